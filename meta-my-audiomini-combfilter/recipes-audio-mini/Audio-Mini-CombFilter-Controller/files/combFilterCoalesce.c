@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Register write coalescing for the combFilterProcessor
+ *              controller
+ *
+ * Every front end (OSC, MIDI, --batch) hands register updates to this
+ * layer instead of writing them. Updates to the same register are
+ * last-value-wins, and the dirty registers are flushed at most once per
+ * control period, all of them in one step that the driver applies under one
+ * lock hold. The driver load is therefore bounded by the control rate, no
+ * matter how fast the inputs send, which keeps the HPS-to-FPGA bridge free
+ * for other peripherals.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "combFilterController.h"
+
+/* Control rate, how many times per second the registers may be written */
+#ifndef COALESCE_DEFAULT_RATE_HZ
+    #define COALESCE_DEFAULT_RATE_HZ 200
+#endif
+
+static struct {
+    unsigned int values[COMBFILTER_NUM_REGS];
+    unsigned int dirty;
+    int64_t period_us;
+    int64_t last_flush_us;
+    int64_t dirty_since_us;
+    struct coalesce_stats stats;
+} coalesce = {
+    .period_us = 1000000 / COALESCE_DEFAULT_RATE_HZ,
+};
+
+/* Function to return a monotonic timestamp in microseconds */
+static int64_t coalesce_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function to set the control rate in Hz, 0 writes every update as soon as it is flushed */
+int coalesce_set_rate(int rate_hz) {
+    if (rate_hz < 0 || rate_hz > 1000000) {
+        return -1;
+    }
+    coalesce.period_us = rate_hz ? 1000000 / rate_hz : 0;
+    return 0;
+}
+
+/* Function to return the control rate in Hz, 0 when unlimited */
+int coalesce_rate() {
+    return coalesce.period_us ? (int)(1000000 / coalesce.period_us) : 0;
+}
+
+/* Function to record a register update, the last value before a flush wins */
+void coalesce_set(int index, unsigned int value) {
+    unsigned int bit = 1u << index;
+    if (coalesce.dirty & bit) {
+        coalesce.stats.merged++;
+    } else if (!coalesce.dirty) {
+        coalesce.dirty_since_us = coalesce_now_us();
+    }
+    coalesce.values[index] = value;
+    coalesce.dirty |= bit;
+    coalesce.stats.updates++;
+}
+
+/* Function to return the mask of registers waiting to be written */
+unsigned int coalesce_pending() {
+    return coalesce.dirty;
+}
+
+/* Function to return how long until the pending registers may be flushed
+ * in ms, 0 if they may be flushed now, -1 if nothing is pending */
+int coalesce_timeout_ms() {
+    if (!coalesce.dirty) {
+        return -1;
+    }
+    int64_t wait_us = coalesce.last_flush_us + coalesce.period_us - coalesce_now_us();
+    return wait_us > 0 ? (int)((wait_us + 999) / 1000) : 0;
+}
+
+/* Function to write the pending registers in one step, so they change
+ * together and registers nobody set are never written. Unless force is
+ * set, nothing is written before the control period is up. A failed write
+ * changes nothing and stays pending, except when the driver rejects a
+ * value as out of range, which would only fail again on every tick; the
+ * whole update is then dropped. Returns the number of registers written,
+ * or -1 on error. */
+int coalesce_flush(struct combfilter *cf, int force) {
+    unsigned int dirty = coalesce.dirty;
+
+    if (!dirty || (!force && coalesce_timeout_ms() > 0)) {
+        return 0;
+    }
+
+    /* Due one period after the last flush, or as soon as it became dirty if that is later */
+    int64_t start_us = coalesce_now_us();
+    int64_t due_us = coalesce.last_flush_us + coalesce.period_us;
+    if (due_us < coalesce.dirty_since_us) {
+        due_us = coalesce.dirty_since_us;
+    }
+    if (!force && coalesce.period_us && start_us - due_us > coalesce.period_us) {
+        coalesce.stats.missed_ticks++;
+    }
+    coalesce.last_flush_us = start_us;
+
+    if (combfilter_write_span(cf, coalesce.values, dirty) != 0) {
+        int error = errno;
+        if (error == ERANGE) {
+            coalesce.dirty = 0;
+        }
+        /* What is left waits for the next period, not for when it first became dirty */
+        coalesce.dirty_since_us = start_us;
+        coalesce.stats.errors++;
+        errno = error;
+        return -1;
+    }
+    coalesce.dirty = 0;
+
+    static const unsigned int bounds[COALESCE_LATENCY_BUCKETS] = COALESCE_LATENCY_BOUNDS_US;
+    int64_t latency_us = coalesce_now_us() - start_us;
+    int bucket = 0;
+    while (bucket < COALESCE_LATENCY_BUCKETS && latency_us > bounds[bucket]) {
+        bucket++;
+    }
+    coalesce.stats.latency[bucket]++;
+    coalesce.stats.latency_sum_us += latency_us;
+    coalesce.stats.flushes++;
+    coalesce.stats.written += __builtin_popcount(dirty);
+    return __builtin_popcount(dirty);
+}
+
+/* Function to wait out the control period if needed, then flush */
+int coalesce_flush_wait(struct combfilter *cf) {
+    int timeout_ms = coalesce_timeout_ms();
+    if (timeout_ms > 0) {
+        struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+    return coalesce_flush(cf, 1);
+}
+
+/* Function to return the coalescing counters */
+const struct coalesce_stats *coalesce_get_stats() {
+    return &coalesce.stats;
+}
+
+/* Function to print the coalescing counters */
+void coalesce_print_stats() {
+    printf("Register updates: %lu received, %lu merged, %lu written in %lu writes, %lu errors (control rate %d Hz)\n",
+           coalesce.stats.updates, coalesce.stats.merged, coalesce.stats.written, coalesce.stats.flushes,
+           coalesce.stats.errors, coalesce_rate());
+}
@@ -12,32 +12,54 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <limits.h>
+#include "combFilterController.h"
 
-/* Define the module name as seen in /proc/modules */
-#ifndef MODULE_NAME
-    #define MODULE_NAME "combFilter"
+/* Device-tree overlay configfs directory used to load effects at runtime */
+#ifndef OVERLAY_CONFIGFS_PATH
+    #define OVERLAY_CONFIGFS_PATH "/sys/kernel/config/device-tree/overlays"
 #endif
 
-/* Define the device name for the character device and sysfs */
-#ifndef DEVICE_NAME
-    #define DEVICE_NAME "combFilterProcessor"
+/* Name of the overlay slot holding the currently loaded effect */
+#ifndef OVERLAY_NAME
+    #define OVERLAY_NAME "combFilterEffect"
 #endif
 
-#ifndef DEVICE_PATH
-    #define DEVICE_PATH "/dev/" DEVICE_NAME
+/* Directory the effect overlays (.dtbo) are installed to */
+#ifndef EFFECT_DIR
+    #define EFFECT_DIR "/boot/devicetree"
 #endif
 
-#ifndef SYSFS_PATH
-    #define SYSFS_PATH "/sys/class/misc/" DEVICE_NAME
+#ifndef DEFAULT_EFFECT
+    #define DEFAULT_EFFECT "de10nano-audiomini-combfilter-overlay"
 #endif
 
-#ifndef MODULE_PATH
-    #define MODULE_PATH "/lib/modules/combFilter.ko"
+/* How long to wait for the driver to bind after an effect is applied */
+#ifndef EFFECT_BIND_TIMEOUT_MS
+    #define EFFECT_BIND_TIMEOUT_MS 1000
 #endif
 
+/* Grid points of --response when none are given */
+#ifndef RESPONSE_DEFAULT_POINTS
+    #define RESPONSE_DEFAULT_POINTS 512
+#endif
+
+/* Longest line accepted in --batch input */
+#ifndef BATCH_LINE_MAX
+    #define BATCH_LINE_MAX 256
+#endif
+
+/* The driver, or with --engine a software combFilterEngine, opened once by main() */
+static struct combfilter *cf;
+
+/* Set by SIGINT/SIGTERM to stop --watch */
+static volatile sig_atomic_t watch_stop;
+
 /* Function to print usage instructions */
 void print_usage(const char *program_name) {
     printf("Usage: %s [options]\n", program_name);
@@ -45,248 +67,736 @@ void print_usage(const char *program_name) {
     printf("  --read <offset>      Read from device at specific offset\n");
     printf("  --write <offset> <value>  Write value to device at specific offset\n");
     printf("  --show-regs          Show all register values via sysfs\n");
+    printf("  --json               Print --show-regs as a JSON object, --dump-history and --watch as JSON lines\n");
+    printf("  --response [points]  Print the frequency response of the current registers (default 512 points)\n");
+    printf("  --dump-history       Print the register changes the driver has recorded, oldest first\n");
+    printf("  --follow-history     Like --dump-history, then keep printing changes as they happen\n");
+    printf("  --watch              Print register changes from now on, also for --engine\n");
     printf("  --set-delaym <value> Set delaym register via sysfs\n");
+    printf("  --set-delay-ms <ms>  Set the delay in milliseconds, converted to delaym samples\n");
     printf("  --set-b0 <value>     Set b0 register via sysfs\n");
     printf("  --set-bm <value>     Set bm register via sysfs\n");
     printf("  --set-wetdrymix <value> Set wetdrymix register via sysfs\n");
+    printf("  --engine <name>      Control the software combFilterEngine <name> instead of the FPGA\n");
     printf("  --load-module        Load the kernel module if not already loaded\n");
     printf("  --unload-module      Unload the kernel module if currently loaded\n");
+    printf("  --load-effect [name] Program an effect overlay through the FPGA Manager and bind the driver\n");
+    printf("  --unload-effect      Remove the currently loaded effect overlay\n");
+    printf("  --batch [file]       Run commands from file (or stdin) against one open device\n");
+    printf("  --rate <hz>          Control rate for --batch, --osc and --midi register writes (default 200, 0 = unlimited)\n");
+    printf("  --metrics <listen>   Serve Prometheus metrics on [addr:]port or unix:path, alone or with --osc/--midi\n");
+    printf("  --osc [port]         Serve OSC over UDP (default port 9000), /comb/0/<register>\n");
+    printf("  --midi [device]      Map MIDI CCs to registers (default first /dev/snd/midiC*D*)\n");
+    printf("  --midi-map <file>    CC map for --midi, lines of <cc> <register> <min> <max> [lin|log|exp] [channel]\n");
+    printf("  --tempo-sync <div>   Set delaym as a note division (1/4, 1/8d, 1/16t) following MIDI clock or --tempo\n");
+    printf("  --tempo <bpm>        Tempo for --tempo-sync until MIDI clock, batch or OSC set another\n");
     printf("  -h, --help           Show this help message\n");
 }
 
 /* Function to read from the device at a specific offset */
-int read_device_at_offset(int fd, off_t offset) {
-    char buffer[4];
-    ssize_t bytes_read;
-    
-    lseek(fd, offset, SEEK_SET);
-    bytes_read = read(fd, buffer, sizeof(buffer));
-    
-    if (bytes_read < 0) {
+int read_device_at_offset(off_t offset) {
+    unsigned int value;
+
+    if (combfilter_read(cf, offset, &value) != 0) {
+        if (errno == EFAULT) {
+            printf("No data read from offset %ld\n", offset);
+            return 0;
+        }
         perror("read");
         return -1;
     }
-    
-    if (bytes_read == 0) {
-        printf("No data read from offset %ld\n", offset);
-        return 0;
-    }
-    
-    unsigned int value = *(unsigned int*)buffer;
+
     printf("Read from offset %ld: 0x%08x (%u)\n", offset, value, value);
     return 0;
 }
 
 /* Function to write a value to the device at a specific offset */
-int write_device_at_offset(int fd, off_t offset, unsigned int value) {
-    ssize_t bytes_written;
-    char buffer[4];
-    
-    *(unsigned int*)buffer = value;
-    lseek(fd, offset, SEEK_SET);
-    bytes_written = write(fd, buffer, sizeof(buffer));
-    
-    if (bytes_written < 0) {
+int write_device_at_offset(off_t offset, unsigned int value) {
+    if (combfilter_write(cf, offset, value) != 0) {
         perror("write");
         return -1;
     }
-    
+
     printf("Wrote 0x%08x (%u) to offset %ld\n", value, value, offset);
     return 0;
 }
 
+/* Function to convert a delay in milliseconds to delaym samples, rounded to the nearest sample */
+unsigned int delay_ms_to_samples(double ms) {
+    return (unsigned int)(ms * combfilter_sample_rate(cf) / 1000.0 + 0.5);
+}
+
+/* Function to convert delaym samples to milliseconds */
+double delay_samples_to_ms(unsigned int samples) {
+    return samples * 1000.0 / combfilter_sample_rate(cf);
+}
+
 /* Function to read and display all register values from sysfs */
-int show_registers() {
-    struct stat st;
-    if (stat(SYSFS_PATH, &st) != 0 || !S_ISDIR(st.st_mode)) {
-        printf("Sysfs path %s not found or not a directory\n", SYSFS_PATH);
+int show_registers(int json) {
+    struct combFilter_regs regs;
+    if (combfilter_get(cf, &regs) != 0) {
+        perror("read registers");
+        printf("Failed to read %s/regs\n", COMBFILTER_SYSFS_PATH);
         return -1;
     }
 
-    char path[256];
-    FILE *file;
-    char buffer[32];
-    int value;
+    if (json) {
+        printf("{\"delaym\": %u, \"b0\": %u, \"bm\": %u, \"wetDryMix\": %u, \"generation\": %u, \"delayMs\": %.3f}\n",
+               regs.delaym, regs.b0, regs.bm, regs.wetDryMix, regs.generation, delay_samples_to_ms(regs.delaym));
+        return 0;
+    }
 
-    printf("Reading register values from sysfs:\n");
+    unsigned int max_delaym;
+    printf("Reading register values from %s:\n", combfilter_is_engine(cf) ? "the engine" : "sysfs");
+    printf("delaym: %u (%.3f ms)\n", regs.delaym, delay_samples_to_ms(regs.delaym));
+    if (combfilter_max_delaym(cf, &max_delaym) == 0 && max_delaym != UINT_MAX) {
+        printf("max_delaym: %u (%.3f ms)\n", max_delaym, delay_samples_to_ms(max_delaym));
+    }
+    printf("b0: %u\n", regs.b0);
+    printf("bm: %u\n", regs.bm);
+    printf("wetDryMix: %u\n", regs.wetDryMix);
+    printf("generation: %u\n", regs.generation);
 
-    /* Read delaym */
-    snprintf(path, sizeof(path), "%s/delaym", SYSFS_PATH);
-    file = fopen(path, "r");
-    if (file) {
-        if (fgets(buffer, sizeof(buffer), file)) {
-            value = atoi(buffer);
-            printf("delaym: %d\n", value);
+    return 0;
+}
+
+/* Function to print the magnitude and phase response of the current registers,
+ * with the notch and peak frequencies */
+int show_response(unsigned int points, int json) {
+    struct combFilter_regs regs;
+    if (combfilter_get(cf, &regs) != 0) {
+        perror("read registers");
+        return -1;
+    }
+    const struct combfilter_response *curve = combfilter_response(cf, &regs, points);
+    if (!curve) {
+        if (errno == EINVAL) {
+            printf("Invalid number of response points %u (2 to %d)\n", points, COMBFILTER_RESPONSE_MAX_POINTS);
         } else {
-            printf("Failed to read %s\n", path);
+            perror("response");
         }
-        fclose(file);
-    } else {
-        perror("fopen delaym");
+        return -1;
     }
+    unsigned int num_notches = curve->num_notches < COMBFILTER_RESPONSE_MAX_EXTREMA ?
+                               curve->num_notches : COMBFILTER_RESPONSE_MAX_EXTREMA;
+    unsigned int num_peaks = curve->num_peaks < COMBFILTER_RESPONSE_MAX_EXTREMA ?
+                             curve->num_peaks : COMBFILTER_RESPONSE_MAX_EXTREMA;
 
-    /* Read b0 */
-    snprintf(path, sizeof(path), "%s/b0", SYSFS_PATH);
-    file = fopen(path, "r");
-    if (file) {
-        if (fgets(buffer, sizeof(buffer), file)) {
-            value = atoi(buffer);
-            printf("b0: %d\n", value);
-        } else {
-            printf("Failed to read %s\n", path);
+    if (json) {
+        printf("{\"sampleRate\": %u, \"delaym\": %u, \"b0\": %u, \"bm\": %u, \"wetDryMix\": %u, "
+               "\"notchDb\": %.2f, \"peakDb\": %.2f, \"numNotches\": %u, \"numPeaks\": %u, \"notchesHz\": [",
+               curve->sample_rate, regs.delaym, regs.b0, regs.bm, regs.wetDryMix,
+               curve->notch_db, curve->peak_db, curve->num_notches, curve->num_peaks);
+        for (unsigned int i = 0; i < num_notches; i++) {
+            printf("%s%.2f", i ? ", " : "", curve->notch_hz[i]);
         }
-        fclose(file);
-    } else {
-        perror("fopen b0");
+        printf("], \"peaksHz\": [");
+        for (unsigned int i = 0; i < num_peaks; i++) {
+            printf("%s%.2f", i ? ", " : "", curve->peak_hz[i]);
+        }
+        printf("], \"response\": [");
+        for (unsigned int k = 0; k < curve->points; k++) {
+            printf("%s[%.2f, %.3f, %.2f]", k ? ", " : "", curve->freq_hz[k], curve->mag_db[k],
+                   curve->phase_rad[k] * (180.0 / 3.14159265358979));
+        }
+        printf("]}\n");
+        return 0;
     }
 
-    /* Read bm */
-    snprintf(path, sizeof(path), "%s/bm", SYSFS_PATH);
-    file = fopen(path, "r");
-    if (file) {
-        if (fgets(buffer, sizeof(buffer), file)) {
-            value = atoi(buffer);
-            printf("bm: %d\n", value);
-        } else {
-            printf("Failed to read %s\n", path);
-        }
-        fclose(file);
+    printf("Response of delaym %u, b0 %u, bm %u, wetDryMix %u at %u Hz:\n",
+           regs.delaym, regs.b0, regs.bm, regs.wetDryMix, curve->sample_rate);
+    if (curve->num_notches == 0) {
+        printf("flat, %.2f dB\n", curve->peak_db);
     } else {
-        perror("fopen bm");
+        printf("%u notches at %.2f dB, %u peaks at %.2f dB, every %.2f Hz\n", curve->num_notches,
+               curve->notch_db, curve->num_peaks, curve->peak_db, (double)curve->sample_rate / regs.delaym);
+        printf("notches (Hz):");
+        for (unsigned int i = 0; i < num_notches; i++) {
+            printf(" %.2f", curve->notch_hz[i]);
+        }
+        printf("%s\npeaks (Hz):", curve->num_notches > num_notches ? " ..." : "");
+        for (unsigned int i = 0; i < num_peaks; i++) {
+            printf(" %.2f", curve->peak_hz[i]);
+        }
+        printf("%s\n", curve->num_peaks > num_peaks ? " ..." : "");
+    }
+    printf("%10s %10s %10s\n", "freq_hz", "mag_db", "phase_deg");
+    for (unsigned int k = 0; k < curve->points; k++) {
+        printf("%10.2f %10.3f %10.2f\n", curve->freq_hz[k], curve->mag_db[k],
+               curve->phase_rad[k] * (180.0 / 3.14159265358979));
+    }
+    return 0;
+}
+
+/* Function to print one history entry */
+void print_history_entry(const struct combFilter_history_entry *entry, int json) {
+    time_t seconds = entry->timestamp_ns / 1000000000ULL;
+    unsigned long nanoseconds = entry->timestamp_ns % 1000000000ULL;
+    const char *name = combfilter_register_name(entry->offset / sizeof(unsigned int));
+    char when[32];
+
+    if (json) {
+        printf("{\"seq\": %llu, \"timestampNs\": %llu, \"pid\": %d, \"register\": \"%s\", "
+               "\"old\": %u, \"new\": %u, \"requested\": %u}\n",
+               (unsigned long long)entry->seq, (unsigned long long)entry->timestamp_ns, entry->pid,
+               name ? name : "unknown", entry->old_value, entry->new_value, entry->requested);
+        return;
     }
 
-    /* Read wetDryMix */
-    snprintf(path, sizeof(path), "%s/wetDryMix", SYSFS_PATH);
-    file = fopen(path, "r");
-    if (file) {
-        if (fgets(buffer, sizeof(buffer), file)) {
-            value = atoi(buffer);
-            printf("wetDryMix: %d\n", value);
-        } else {
-            printf("Failed to read %s\n", path);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+    printf("%s.%06lu #%llu pid %d %s %u -> %u", when, nanoseconds / 1000, (unsigned long long)entry->seq,
+           entry->pid, name ? name : "unknown", entry->old_value, entry->new_value);
+    if (entry->requested != entry->new_value) {
+        printf(" (requested %u, clamped)", entry->requested);
+    }
+    printf("\n");
+}
+
+/* Function to print the driver's register history, with follow keep waiting for new changes */
+int dump_history(int follow, int json) {
+    struct combFilter_history_entry entries[64];
+    unsigned long long next_seq = 0;
+    int first = 1;
+
+    if (combfilter_history_fd(cf) < 0) {
+        perror("open");
+        printf("Failed to open %s\n", combfilter_is_engine(cf) ? "the history, an engine keeps none" : COMBFILTER_HISTORY_PATH);
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t count = combfilter_read_history(cf, entries, sizeof(entries) / sizeof(entries[0]));
+        if (count < 0) {
+            if (errno == EAGAIN && follow) {
+                struct pollfd pfd = { .fd = combfilter_history_fd(cf), .events = POLLIN };
+                if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+                    perror("poll");
+                    return -1;
+                }
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            perror("read");
+            return -1;
         }
-        fclose(file);
-    } else {
-        perror("fopen wetDryMix");
+        for (ssize_t i = 0; i < count; i++) {
+            /* A gap in seq means the ring wrapped before these entries were read */
+            if (!first && entries[i].seq != next_seq && !json) {
+                printf("... %llu entries overwritten\n", (unsigned long long)(entries[i].seq - next_seq));
+            }
+            print_history_entry(&entries[i], json);
+            next_seq = entries[i].seq + 1;
+            first = 0;
+        }
+        fflush(stdout);
+    }
+
+    if (first && !json) {
+        printf("No register changes recorded\n");
+    }
+    return 0;
+}
+
+/* Function to stop --watch on SIGINT/SIGTERM */
+static void watch_signal_handler(int sig) {
+    (void)sig;
+    watch_stop = 1;
+}
+
+/* Function to print one change reported by combfilter_dispatch() */
+static void watch_notify(const struct combFilter_history_entry *entry, void *context) {
+    print_history_entry(entry, *(const int *)context);
+}
+
+/* Function to print register changes as they happen until interrupted,
+ * through the library's change notification so it works for an engine too */
+int watch_registers(int json) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int notify_fd = combfilter_set_notify(cf, watch_notify, &json);
+    if (notify_fd < 0) {
+        perror("watch");
+        return -1;
     }
 
+    while (!watch_stop) {
+        struct pollfd pfd = { .fd = notify_fd, .events = POLLIN };
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+        if (combfilter_dispatch(cf) < 0) {
+            perror("read changes");
+            return -1;
+        }
+        fflush(stdout);
+    }
     return 0;
 }
 
 /* Function to set a sysfs register value */
 int set_register(const char *reg_name, int value) {
-    char path[256];
-    FILE *file;
-    
-    snprintf(path, sizeof(path), "%s/%s", SYSFS_PATH, reg_name);
-    file = fopen(path, "w");
-    if (!file) {
-        perror("fopen");
-        printf("Failed to open sysfs attribute %s\n", path);
+    int index = combfilter_register_index(reg_name);
+    if (index < 0) {
+        printf("Unknown register %s\n", reg_name);
+        return -1;
+    }
+    if (value < 0) {
+        printf("Invalid value %d for %s, registers are unsigned\n", value, reg_name);
+        return -1;
+    }
+
+    if (combfilter_set(cf, index, value) != 0) {
+        perror("write");
+        printf("Failed to write %s %s%s%s\n", combfilter_is_engine(cf) ? "engine register" : "sysfs attribute",
+               combfilter_is_engine(cf) ? "" : COMBFILTER_SYSFS_PATH, combfilter_is_engine(cf) ? "" : "/",
+               combfilter_register_name(index));
         return -1;
     }
-    
-    fprintf(file, "%d", value);
-    fclose(file);
     printf("Set %s to %d\n", reg_name, value);
-    
+
     return 0;
 }
 
-/* Function to check if the kernel module is loaded */
-int is_module_loaded(const char *module_name) {
-    /* Check /proc/modules for the module */
-    FILE *fp = fopen("/proc/modules", "r");
-    if (!fp) {
-        perror("fopen /proc/modules");
+
+/* Function to set the delay in milliseconds, checked against the delay line depth */
+int set_delay_ms(double ms) {
+    unsigned int max_delaym;
+
+    if (!(ms >= 0.0) || ms > delay_samples_to_ms(UINT_MAX)) {
+        printf("Invalid delay %.3f ms\n", ms);
+        return -1;
+    }
+
+    unsigned int samples = delay_ms_to_samples(ms);
+    if (combfilter_max_delaym(cf, &max_delaym) == 0 && samples > max_delaym) {
+        printf("Delay %.3f ms (%u samples) is longer than the delay line, at most %.3f ms (%u samples)\n",
+               ms, samples, delay_samples_to_ms(max_delaym), max_delaym);
+        return -1;
+    }
+
+    if (combfilter_set(cf, COMBFILTER_DELAYM, samples) != 0) {
+        perror("write");
+        printf("Failed to write %s %s%sdelaym\n", combfilter_is_engine(cf) ? "engine register" : "sysfs attribute",
+               combfilter_is_engine(cf) ? "" : COMBFILTER_SYSFS_PATH, combfilter_is_engine(cf) ? "" : "/");
         return -1;
     }
+    printf("Set delay to %.3f ms (%u samples at %u Hz)\n", ms, samples, combfilter_sample_rate(cf));
 
-    char line[256];
-    int module_found = 0;
-    while (fgets(line, sizeof(line), fp)) {
-        char *name = strtok(line, " \t\n");
-        if (name && strcmp(name, module_name) == 0) {
-            module_found = 1;
-            break;
+    return 0;
+}
+
+/* Function to check a char device offset before it is accessed, returns
+ * why it is invalid or NULL. The driver reports most of these as EFAULT or
+ * a short transfer, which cannot be told apart from a bad buffer. */
+const char *batch_check_offset(off_t offset) {
+    if (offset < 0) {
+        return "negative offset";
+    }
+    if (offset % 4 != 0) {
+        return "offset is not a multiple of 4";
+    }
+    if (offset > COMBFILTER_REG_WETDRYMIX) {
+        return "past end of device";
+    }
+    return NULL;
+}
+
+/* Function to describe a failed register access in a batch result line
+ * The one value the driver (or engine) rejects after checking it gets the
+ * reason, anything else is a failed syscall and gets its strerror. */
+const char *batch_error(int err) {
+    if (err == ERANGE) {
+        return "delaym is past the end of the delay line";
+    }
+    return strerror(err);
+}
+
+/* Function to run batch commands from a file (or stdin) against the open device
+ *
+ * One command per line, '#' starts a comment:
+ *   set <reg> <value>       stage a register write (delaym, b0, bm, wetDryMix)
+ *   commit                  write all staged registers in one step, at most
+ *                           once per control period (--rate)
+ *   write <offset> <value>  write the char device immediately
+ *   read <offset>           read the char device
+ *   show                    read a snapshot of all registers
+ *   sleep <ms>              pause before the next command
+ *   tempo <bpm>             set the tempo delaym follows with --tempo-sync
+ *   division <n/d[d|t]>     follow the tempo with delaym as this note division
+ * Staged registers are committed at end of input. Every command prints one
+ * "ok <command> ..." line, failures print "err <line> <message>" and the batch
+ * carries on. Returns the number of failed commands. */
+int run_batch(const char *batch_path) {
+    char line[BATCH_LINE_MAX];
+    int line_number = 0;
+    int errors = 0;
+    int at_eof = 0;
+    unsigned int max_delaym = UINT_MAX;
+    FILE *input = stdin;
+
+    /* Read once, a sweep sets delaym on every other line */
+    combfilter_max_delaym(cf, &max_delaym);
+
+    if (batch_path && strcmp(batch_path, "-") != 0) {
+        input = fopen(batch_path, "r");
+        if (!input) {
+            perror("fopen batch");
+            printf("Failed to open batch file %s\n", batch_path);
+            return -1;
         }
     }
-    fclose(fp);
 
-    if (!module_found) {
-        printf("Module %s not found in /proc/modules\n", module_name);
-        return 0;
+    /* Results are read line by line by whatever drives the batch */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while (!at_eof) {
+        char *cmd;
+        char *arg1;
+        char *arg2;
+
+        if (fgets(line, sizeof(line), input)) {
+            line_number++;
+            char *comment = strchr(line, '#');
+            if (comment) {
+                *comment = '\0';
+            }
+            cmd = strtok(line, " \t\r\n");
+            if (!cmd) {
+                continue;
+            }
+        } else {
+            /* Flush whatever is still staged */
+            at_eof = 1;
+            cmd = "commit";
+        }
+        arg1 = at_eof ? NULL : strtok(NULL, " \t\r\n");
+        arg2 = arg1 ? strtok(NULL, " \t\r\n") : NULL;
+
+        if (strcmp(cmd, "set") == 0) {
+            int index = arg1 ? combfilter_register_index(arg1) : -1;
+            if (index < 0 || !arg2) {
+                printf("err %d usage: set <delaym|b0|bm|wetDryMix> <value>\n", line_number);
+                errors++;
+                continue;
+            }
+            if (index == COMBFILTER_DELAYM && tempo_enabled()) {
+                printf("err %d set delaym: delaym follows the tempo, use division\n", line_number);
+                errors++;
+                continue;
+            }
+            unsigned int value = strtoul(arg2, NULL, 0);
+            if (index == COMBFILTER_DELAYM && value > max_delaym) {
+                printf("err %d set delaym: %u is past the end of the delay line, at most %u\n",
+                       line_number, value, max_delaym);
+                errors++;
+                continue;
+            }
+            coalesce_set(index, value);
+            metrics_count_message(METRICS_SOURCE_BATCH);
+            printf("ok set %s %u\n", combfilter_register_name(index), value);
+        }
+        else if (strcmp(cmd, "commit") == 0) {
+            int written = coalesce_flush_wait(cf);
+            if (written < 0) {
+                printf("err %d commit: %s\n", line_number, batch_error(errno));
+                errors++;
+                continue;
+            }
+            if (!at_eof || written > 0) {
+                printf("ok commit %d\n", written);
+            }
+        }
+        else if (strcmp(cmd, "write") == 0) {
+            if (!arg1 || !arg2) {
+                printf("err %d usage: write <offset> <value>\n", line_number);
+                errors++;
+                continue;
+            }
+            off_t offset = strtol(arg1, NULL, 0);
+            unsigned int value = strtoul(arg2, NULL, 0);
+            const char *invalid = batch_check_offset(offset);
+            if (invalid) {
+                printf("err %d write %ld: %s\n", line_number, (long)offset, invalid);
+                errors++;
+                continue;
+            }
+            if (offset == COMBFILTER_REG_DELAYM && value > max_delaym) {
+                printf("err %d write %ld: %u is past the end of the delay line, at most %u\n",
+                       line_number, (long)offset, value, max_delaym);
+                errors++;
+                continue;
+            }
+            if (combfilter_write(cf, offset, value) != 0) {
+                printf("err %d write %ld: %s\n", line_number, (long)offset, batch_error(errno));
+                errors++;
+                continue;
+            }
+            printf("ok write %ld %u\n", (long)offset, value);
+        }
+        else if (strcmp(cmd, "read") == 0) {
+            if (!arg1) {
+                printf("err %d usage: read <offset>\n", line_number);
+                errors++;
+                continue;
+            }
+            off_t offset = strtol(arg1, NULL, 0);
+            unsigned int value;
+            const char *invalid = batch_check_offset(offset);
+            if (invalid) {
+                printf("err %d read %ld: %s\n", line_number, (long)offset, invalid);
+                errors++;
+                continue;
+            }
+            if (combfilter_read(cf, offset, &value) != 0) {
+                printf("err %d read %ld: %s\n", line_number, (long)offset, batch_error(errno));
+                errors++;
+                continue;
+            }
+            printf("ok read %ld %u\n", (long)offset, value);
+        }
+        else if (strcmp(cmd, "show") == 0) {
+            struct combFilter_regs regs;
+            if (combfilter_get(cf, &regs) != 0) {
+                printf("err %d show: %s\n", line_number, strerror(errno));
+                errors++;
+                continue;
+            }
+            printf("ok show delaym=%u b0=%u bm=%u wetDryMix=%u generation=%u\n",
+                   regs.delaym, regs.b0, regs.bm, regs.wetDryMix, regs.generation);
+        }
+        else if (strcmp(cmd, "sleep") == 0) {
+            long ms = arg1 ? strtol(arg1, NULL, 0) : -1;
+            if (ms < 0) {
+                printf("err %d usage: sleep <ms>\n", line_number);
+                errors++;
+                continue;
+            }
+            struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+            nanosleep(&ts, NULL);
+            printf("ok sleep %ld\n", ms);
+        }
+        else if (strcmp(cmd, "tempo") == 0) {
+            if (!arg1 || tempo_set_bpm(atof(arg1)) != 0) {
+                printf("err %d usage: tempo <%.0f-%.0f bpm>\n", line_number, TEMPO_MIN_BPM, TEMPO_MAX_BPM);
+                errors++;
+                continue;
+            }
+            metrics_count_message(METRICS_SOURCE_BATCH);
+            printf("ok tempo %.2f delaym %ld\n", tempo_bpm(), tempo_delaym());
+        }
+        else if (strcmp(cmd, "division") == 0) {
+            if (!arg1 || tempo_set_division(arg1) != 0) {
+                printf("err %d usage: division <n/d[d|t]>\n", line_number);
+                errors++;
+                continue;
+            }
+            metrics_count_message(METRICS_SOURCE_BATCH);
+            printf("ok division %s delaym %ld\n", arg1, tempo_delaym());
+        }
+        else {
+            printf("err %d unknown command %s\n", line_number, cmd);
+            errors++;
+        }
     }
 
-    /* Check device file existence */
-    struct stat st;
-    if (stat(DEVICE_PATH, &st) == 0 && S_ISCHR(st.st_mode)) {
-        return 1; /* Module loaded and device file exists */
+    if (input != stdin) {
+        fclose(input);
     }
+    return errors;
+}
 
-    printf("Warning: Module %s is loaded, but device file %s not found\n", module_name, DEVICE_PATH);
-    return 0;
+/* Function to check if the kernel module is loaded and its device file exists */
+int is_module_loaded() {
+    int state = combfilter_module_state();
+    if (state < 0) {
+        perror("fopen /proc/modules");
+        return -1;
+    }
+    if (state == COMBFILTER_MODULE_UNLOADED) {
+        printf("Module %s not found in /proc/modules\n", COMBFILTER_MODULE_NAME);
+        return 0;
+    }
+    if (state == COMBFILTER_MODULE_NO_DEVICE) {
+        printf("Warning: Module %s is loaded, but device file %s not found\n",
+               COMBFILTER_MODULE_NAME, COMBFILTER_DEVICE_PATH);
+        return 0;
+    }
+    return 1;
 }
 
 /* Function to load the kernel module */
-int load_module(const char *module_name) {
-    if (is_module_loaded(module_name) == 1) {
-        printf("Module %s is already loaded\n", module_name);
+int load_module() {
+    if (combfilter_module_state() == COMBFILTER_MODULE_READY) {
+        printf("Module %s is already loaded\n", COMBFILTER_MODULE_NAME);
         return 0;
     }
 
-    /* Verify module file exists */
-    struct stat st;
-    if (stat(MODULE_PATH, &st) != 0) {
-        printf("Module file %s does not exist\n", MODULE_PATH);
+    if (combfilter_load_module() != 0) {
+        perror("finit_module");
+        printf("Failed to load module %s from %s\n", COMBFILTER_MODULE_NAME, COMBFILTER_MODULE_PATH);
         return -1;
     }
 
-    char command[256];
-    snprintf(command, sizeof(command), "insmod %s", MODULE_PATH);
-    int result = system(command);
-    if (result == 0) {
-        /* Verify module loaded successfully */
-        if (is_module_loaded(module_name) == 1) {
-            printf("Module %s loaded successfully\n", module_name);
-            return 0;
-        } else {
-            printf("Module %s failed to load (insmod succeeded but module not found)\n", module_name);
-            return -1;
-        }
-    } else {
-        /* Check if failure was due to module already loaded */
-        if (is_module_loaded(module_name) == 1) {
-            printf("Module %s is already loaded (insmod failed: File exists)\n", module_name);
-            return 0;
-        }
-        printf("Failed to load module %s (insmod error)\n", module_name);
-        return -1;
+    /* Verify module loaded successfully */
+    if (is_module_loaded() == 1) {
+        printf("Module %s loaded successfully\n", COMBFILTER_MODULE_NAME);
+        return 0;
     }
+    printf("Module %s failed to load (loaded but no device)\n", COMBFILTER_MODULE_NAME);
+    return -1;
 }
 
 /* Function to unload the kernel module */
-int unload_module(const char *module_name) {
-    if (is_module_loaded(module_name) != 1) {
-        printf("Module %s is not loaded\n", module_name);
-        return 0;
+int unload_module() {
+    if (combfilter_unload_module() != 0) {
+        perror("delete_module");
+        printf("Failed to unload module %s\n", COMBFILTER_MODULE_NAME);
+        return -1;
     }
+    printf("Module %s unloaded successfully\n", COMBFILTER_MODULE_NAME);
+    return 0;
+}
 
-    char command[256];
-    snprintf(command, sizeof(command), "rmmod %s", module_name);
-    int result = system(command);
-    if (result == 0) {
-        printf("Module %s unloaded successfully\n", module_name);
+/* Function to return a monotonic timestamp in milliseconds */
+long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Function to remove the currently applied effect overlay, if any */
+int unload_effect() {
+    char path[256];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/%s", OVERLAY_CONFIGFS_PATH, OVERLAY_NAME);
+    if (stat(path, &st) != 0) {
+        printf("No effect overlay loaded\n");
         return 0;
+    }
+
+    /* Removing the overlay removes the device, which unbinds the driver */
+    if (rmdir(path) != 0) {
+        perror("rmdir overlay");
+        printf("Failed to remove effect overlay %s\n", path);
+        return -1;
+    }
+
+    printf("Effect overlay removed\n");
+    return 0;
+}
+
+/* Function to program an effect through the FPGA Manager and bind the driver to it */
+int load_effect(const char *effect) {
+    char dtbo_path[256];
+    char path[256];
+    char status[32];
+    struct stat st;
+    long start = monotonic_ms();
+
+    /* Effects are looked up by name in EFFECT_DIR unless a path is given */
+    if (strchr(effect, '/')) {
+        snprintf(dtbo_path, sizeof(dtbo_path), "%s", effect);
     } else {
-        printf("Failed to unload module %s\n", module_name);
+        snprintf(dtbo_path, sizeof(dtbo_path), "%s/%s.dtbo", EFFECT_DIR, effect);
+    }
+
+    /* Read the overlay blob */
+    FILE *file = fopen(dtbo_path, "rb");
+    if (!file) {
+        perror("fopen overlay");
+        printf("Effect overlay %s not found\n", dtbo_path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *blob = malloc(size);
+    if (!blob || fread(blob, 1, size, file) != (size_t)size) {
+        printf("Failed to read effect overlay %s\n", dtbo_path);
+        free(blob);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    /* Only one effect can own the FPGA region, drop the previous one first */
+    snprintf(path, sizeof(path), "%s/%s", OVERLAY_CONFIGFS_PATH, OVERLAY_NAME);
+    if (stat(path, &st) == 0 && unload_effect() != 0) {
+        free(blob);
+        return -1;
+    }
+
+    if (mkdir(path, 0755) != 0) {
+        perror("mkdir overlay");
+        printf("Failed to create overlay %s (is configfs mounted?)\n", path);
+        free(blob);
+        return -1;
+    }
+
+    /* Writing the blob applies the overlay: the region programs the bitstream named by
+     * firmware-name, re-enables the bridges and then adds the effect's device nodes */
+    snprintf(path, sizeof(path), "%s/%s/dtbo", OVERLAY_CONFIGFS_PATH, OVERLAY_NAME);
+    int fd = open(path, O_WRONLY);
+    if (fd < 0 || write(fd, blob, size) != size) {
+        perror("write overlay");
+        printf("Failed to apply effect overlay %s\n", dtbo_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(blob);
+        unload_effect();
+        return -1;
+    }
+    close(fd);
+    free(blob);
+
+    snprintf(path, sizeof(path), "%s/%s/status", OVERLAY_CONFIGFS_PATH, OVERLAY_NAME);
+    file = fopen(path, "r");
+    if (!file || !fgets(status, sizeof(status), file) || strncmp(status, "applied", 7) != 0) {
+        printf("Effect overlay %s was not applied\n", dtbo_path);
+        if (file) {
+            fclose(file);
+        }
+        unload_effect();
         return -1;
     }
+    fclose(file);
+
+    /* Bind the driver; if it is already loaded it probes the new node on its own */
+    if (combfilter_module_state() == COMBFILTER_MODULE_UNLOADED && load_module() != 0) {
+        return -1;
+    }
+
+    /* Wait for the char device to show up */
+    while (stat(COMBFILTER_DEVICE_PATH, &st) != 0) {
+        if (monotonic_ms() - start > EFFECT_BIND_TIMEOUT_MS) {
+            printf("Timed out waiting for %s after applying %s\n", COMBFILTER_DEVICE_PATH, dtbo_path);
+            return -1;
+        }
+        usleep(1000);
+    }
+
+    printf("Effect %s loaded in %ld ms\n", effect, monotonic_ms() - start);
+    return 0;
 }
 
 /* Main function */
 int main(int argc, char *argv[]) {
-    int fd = -1;
+    int json = 0;
+    const char *midi_map_path = NULL;
+    const char *metrics_spec = NULL;
+    const char *engine_name = NULL;
     int i;
 
     if (argc < 2) {
@@ -297,95 +807,183 @@ int main(int argc, char *argv[]) {
     /* Handle load/unload module commands first */
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--load-module") == 0) {
-            int module_loaded = is_module_loaded(MODULE_NAME);
+            int module_loaded = is_module_loaded();
             if (module_loaded == -1) {
                 printf("Error checking module status\n");
                 return 1;
             }
             if (module_loaded == 0) {
-                if (load_module(MODULE_NAME) != 0) {
+                if (load_module() != 0) {
                     return 1;
                 }
             } else {
-                printf("Module %s is already loaded\n", MODULE_NAME);
+                printf("Module %s is already loaded\n", COMBFILTER_MODULE_NAME);
             }
             return 0;
         }
         else if (strcmp(argv[i], "--unload-module") == 0) {
-            int module_loaded = is_module_loaded(MODULE_NAME);
-            if (module_loaded == -1) {
+            int module_state = combfilter_module_state();
+            if (module_state == -1) {
                 printf("Error checking module status\n");
                 return 1;
             }
-            if (module_loaded == 1) {
-                if (unload_module(MODULE_NAME) != 0) {
+            if (module_state != COMBFILTER_MODULE_UNLOADED) {
+                if (unload_module() != 0) {
                     return 1;
                 }
             } else {
-                printf("Module %s is not loaded\n", MODULE_NAME);
+                printf("Module %s is not loaded\n", COMBFILTER_MODULE_NAME);
             }
             return 0;
         }
+        else if (strcmp(argv[i], "--load-effect") == 0) {
+            const char *effect = DEFAULT_EFFECT;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                effect = argv[++i];
+            }
+            return load_effect(effect) == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--unload-effect") == 0) {
+            return unload_effect() == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        }
+        else if (strcmp(argv[i], "--midi-map") == 0) {
+            if (i + 1 >= argc) {
+                printf("Missing file argument for --midi-map\n");
+                return 1;
+            }
+            midi_map_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--rate") == 0) {
+            if (i + 1 >= argc || coalesce_set_rate(atoi(argv[++i])) != 0) {
+                printf("Missing or invalid rate for --rate\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--metrics") == 0) {
+            if (i + 1 >= argc) {
+                printf("Missing listen address for --metrics\n");
+                return 1;
+            }
+            metrics_spec = argv[++i];
+        }
+        else if (strcmp(argv[i], "--engine") == 0) {
+            if (i + 1 >= argc) {
+                printf("Missing name argument for --engine\n");
+                return 1;
+            }
+            engine_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--tempo-sync") == 0) {
+            if (i + 1 >= argc || tempo_set_division(argv[++i]) != 0) {
+                printf("Missing or invalid note division for --tempo-sync\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--tempo") == 0) {
+            if (i + 1 >= argc || tempo_set_bpm(atof(argv[++i])) != 0) {
+                printf("Missing or invalid tempo for --tempo (%.0f to %.0f BPM)\n", TEMPO_MIN_BPM, TEMPO_MAX_BPM);
+                return 1;
+            }
+        }
     }
 
-    /* Check if module is loaded */
-    int module_loaded = is_module_loaded(MODULE_NAME);
-    if (module_loaded == -1) {
-        printf("Error checking module status\n");
-        return 1;
-    }
-    if (module_loaded == 0) {
-        printf("Module %s is not loaded. Attempting to load...\n", MODULE_NAME);
-        if (load_module(MODULE_NAME) != 0) {
+    if (engine_name) {
+        /* A software engine needs neither the module nor the device */
+        cf = combfilter_open(engine_name, 0);
+        if (!cf) {
+            return 1;
+        }
+    } else {
+        /* Check if module is loaded */
+        int module_loaded = is_module_loaded();
+        if (module_loaded == -1) {
+            printf("Error checking module status\n");
+            return 1;
+        }
+        if (module_loaded == 0) {
+            printf("Module %s is not loaded. Attempting to load...\n", COMBFILTER_MODULE_NAME);
+            if (load_module() != 0) {
+                return 1;
+            }
+        }
+
+        /* Open the device */
+        cf = combfilter_open(NULL, 0);
+        if (!cf) {
+            perror("open");
+            printf("Failed to open device %s. Ensure the kernel module is loaded and device file exists.\n",
+                   COMBFILTER_DEVICE_PATH);
             return 1;
         }
     }
 
-    /* Open the device */
-    fd = open(DEVICE_PATH, O_RDWR);
-    if (fd < 0) {
-        perror("open");
-        printf("Failed to open device %s. Ensure the kernel module is loaded and device file exists.\n", DEVICE_PATH);
+    if (metrics_spec && metrics_open(cf, metrics_spec) != 0) {
+        combfilter_close(cf);
         return 1;
     }
 
+    /* Write the delay for the division right away, front ends keep it following the tempo */
+    tempo_open(cf);
+    if (tempo_enabled() && coalesce_flush_wait(cf) < 0) {
+        perror("write delaym");
+    }
+
     /* Process other commands */
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--read") == 0) {
             if (i + 1 >= argc) {
                 printf("Missing offset argument for --read\n");
-                close(fd);
+                combfilter_close(cf);
                 return 1;
             }
             off_t offset = atoi(argv[++i]);
-            read_device_at_offset(fd, offset);
+            read_device_at_offset(offset);
         }
         else if (strcmp(argv[i], "--write") == 0) {
             if (i + 2 >= argc) {
                 printf("Missing offset and value arguments for --write\n");
-                close(fd);
+                combfilter_close(cf);
                 return 1;
             }
             off_t offset = atoi(argv[++i]);
             unsigned int value = atoi(argv[++i]);
-            write_device_at_offset(fd, offset, value);
+            write_device_at_offset(offset, value);
         }
         else if (strcmp(argv[i], "--show-regs") == 0) {
-            show_registers();
+            show_registers(json);
+        }
+        else if (strcmp(argv[i], "--response") == 0) {
+            unsigned int points = RESPONSE_DEFAULT_POINTS;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                points = atoi(argv[++i]);
+            }
+            show_response(points, json);
         }
         else if (strcmp(argv[i], "--set-delaym") == 0) {
             if (i + 1 >= argc) {
                 printf("Missing value argument for --set-delaym\n");
-                close(fd);
+                combfilter_close(cf);
                 return 1;
             }
             int value = atoi(argv[++i]);
             set_register("delaym", value);
         }
+        else if (strcmp(argv[i], "--set-delay-ms") == 0) {
+            if (i + 1 >= argc) {
+                printf("Missing value argument for --set-delay-ms\n");
+                combfilter_close(cf);
+                return 1;
+            }
+            double ms = atof(argv[++i]);
+            set_delay_ms(ms);
+        }
         else if (strcmp(argv[i], "--set-b0") == 0) {
             if (i + 1 >= argc) {
                 printf("Missing value argument for --set-b0\n");
-                close(fd);
+                combfilter_close(cf);
                 return 1;
             }
             int value = atoi(argv[++i]);
@@ -394,7 +992,7 @@ int main(int argc, char *argv[]) {
         else if (strcmp(argv[i], "--set-bm") == 0) {
             if (i + 1 >= argc) {
                 printf("Missing value argument for --set-bm\n");
-                close(fd);
+                combfilter_close(cf);
                 return 1;
             }
             int value = atoi(argv[++i]);
@@ -403,25 +1001,84 @@ int main(int argc, char *argv[]) {
         else if (strcmp(argv[i], "--set-wetdrymix") == 0) {
             if (i + 1 >= argc) {
                 printf("Missing value argument for --set-wetdrymix\n");
-                close(fd);
+                combfilter_close(cf);
                 return 1;
             }
             int value = atoi(argv[++i]);
             set_register("wetDryMix", value);
         }
+        else if (strcmp(argv[i], "--dump-history") == 0) {
+            dump_history(0, json);
+        }
+        else if (strcmp(argv[i], "--follow-history") == 0) {
+            int result = dump_history(1, json);
+            combfilter_close(cf);
+            return result == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            int result = watch_registers(json);
+            combfilter_close(cf);
+            return result == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--json") == 0) {
+            /* Already handled above */
+        }
+        else if (strcmp(argv[i], "--midi-map") == 0 || strcmp(argv[i], "--rate") == 0 ||
+                 strcmp(argv[i], "--metrics") == 0 || strcmp(argv[i], "--engine") == 0 ||
+                 strcmp(argv[i], "--tempo-sync") == 0 || strcmp(argv[i], "--tempo") == 0) {
+            /* Already handled above */
+            i++;
+        }
+        else if (strcmp(argv[i], "--batch") == 0) {
+            const char *batch_path = NULL;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                batch_path = argv[++i];
+            }
+            int errors = run_batch(batch_path);
+            metrics_close();
+            combfilter_close(cf);
+            return errors == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--osc") == 0) {
+            int port = 0;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                port = atoi(argv[++i]);
+            }
+            int result = osc_serve(cf, port);
+            metrics_close();
+            combfilter_close(cf);
+            return result == 0 ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--midi") == 0) {
+            const char *device = NULL;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                device = argv[++i];
+            }
+            int result = midi_serve(cf, device, midi_map_path);
+            metrics_close();
+            combfilter_close(cf);
+            return result == 0 ? 0 : 1;
+        }
         else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
-            close(fd);
+            combfilter_close(cf);
             return 0;
         }
         else {
             printf("Unknown option: %s\n", argv[i]);
             print_usage(argv[0]);
-            close(fd);
+            combfilter_close(cf);
             return 1;
         }
     }
 
-    close(fd);
-    return 0;
+    /* --metrics without --osc or --midi keeps serving scrapes on its own */
+    int result = 0;
+    if (metrics_fd() >= 0) {
+        result = metrics_serve();
+        metrics_close();
+    }
+
+    combfilter_close(cf);
+    return result == 0 ? 0 : 1;
 }
\ No newline at end of file
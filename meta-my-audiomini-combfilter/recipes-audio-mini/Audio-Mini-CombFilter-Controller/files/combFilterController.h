@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Functions shared between combFilterController and its
+ *              network/control front ends
+ *-------------------------------------------------------------------------*/
+
+#ifndef COMBFILTERCONTROLLER_H
+#define COMBFILTERCONTROLLER_H
+
+#include <stddef.h>
+#include <combFilter.h>
+
+/* Register access goes through the handle of libcombfilter.h, opened once by main() */
+#include "libcombfilter.h"
+
+/* Register write coalescing (combFilterCoalesce.c), shared by all front ends */
+
+/* Upper bounds of the write latency histogram buckets in microseconds,
+ * a last bucket beyond them catches everything slower */
+#define COALESCE_LATENCY_BOUNDS_US { 10, 25, 50, 100, 250, 500, 1000, 5000 }
+#define COALESCE_LATENCY_BUCKETS 8
+
+struct coalesce_stats {
+    unsigned long updates;      /* coalesce_set() calls */
+    unsigned long merged;       /* updates overwritten before they were written */
+    unsigned long written;      /* registers written */
+    unsigned long flushes;      /* write() calls on the char device */
+    unsigned long errors;
+    unsigned long missed_ticks; /* flushes more than one control period after they were due */
+    unsigned long latency[COALESCE_LATENCY_BUCKETS + 1];
+    unsigned long long latency_sum_us;
+};
+
+int coalesce_set_rate(int rate_hz);
+int coalesce_rate(void);
+void coalesce_set(int index, unsigned int value);
+unsigned int coalesce_pending(void);
+int coalesce_timeout_ms(void);
+int coalesce_flush(struct combfilter *cf, int force);
+int coalesce_flush_wait(struct combfilter *cf);
+const struct coalesce_stats *coalesce_get_stats(void);
+void coalesce_print_stats(void);
+
+/* Prometheus text metrics over HTTP (combFilterMetrics.c) */
+enum metrics_source {
+    METRICS_SOURCE_BATCH,
+    METRICS_SOURCE_OSC,
+    METRICS_SOURCE_MIDI,
+    METRICS_NUM_SOURCES
+};
+
+int metrics_open(struct combfilter *cf, const char *listen_spec);
+int metrics_fd(void);
+void metrics_handle(void);
+void metrics_count_message(enum metrics_source source);
+void metrics_count_missed_deadline(enum metrics_source source);
+int metrics_serve(void);
+void metrics_close(void);
+
+/* Tempo-synced delay (combFilterTempo.c) */
+#define TEMPO_MIN_BPM 20.0
+#define TEMPO_MAX_BPM 400.0
+
+enum tempo_source {
+    TEMPO_SOURCE_NONE,
+    TEMPO_SOURCE_LOCAL,     /* --tempo, batch "tempo", OSC /comb/tempo */
+    TEMPO_SOURCE_MIDI       /* MIDI clock */
+};
+
+struct tempo_stats {
+    unsigned long clock_ticks;      /* MIDI clock ticks received */
+    unsigned long clock_jumps;      /* tempo changes that restarted the clock fit */
+    unsigned long local_updates;    /* tempos set through the local tempo API */
+    unsigned long recomputes;       /* delays recomputed in samples */
+    unsigned long writes;           /* of which moved delaym and were written */
+};
+
+struct timespec;
+
+int tempo_set_division(const char *division);
+int tempo_enabled(void);
+void tempo_open(struct combfilter *cf);
+int tempo_set_bpm(double bpm);
+double tempo_bpm(void);
+long tempo_delaym(void);
+void tempo_midi_realtime(unsigned char byte, const struct timespec *now);
+const struct tempo_stats *tempo_get_stats(void);
+void tempo_print_stats(void);
+
+/* OSC over UDP front end (combFilterOsc.c) */
+int osc_serve(struct combfilter *cf, int port);
+
+/* Raw MIDI control change input (combFilterMidi.c) */
+int midi_serve(struct combfilter *cf, const char *device, const char *map_path);
+
+#endif /* COMBFILTERCONTROLLER_H */
@@ -0,0 +1,404 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Software comb filter engine for the Audio Mini
+ *
+ * Runs the combFilterProcessor's filter on the HPS for channels that no
+ * longer fit in the FPGA fabric: reads an ALSA capture device, filters
+ * every channel and writes an ALSA playback device, one period at a time.
+ * The registers have the same meaning as the FPGA's (see combFilter.h) and
+ * live in a shared memory control block, so combFilterController
+ * --engine <name> drives an engine with the same commands as the hardware.
+ * The audio thread picks up new values once per period without taking a
+ * lock, and ramps the gains across the period so changes do not click.
+ *
+ * The inner loops use NEON on ARM and plain C elsewhere (auto-vectorized
+ * on x86), so the engine also runs on a PC against snd-aloop.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <alsa/asoundlib.h>
+
+#include "combFilterEngine.h"
+#include "combFilterPool.h"
+
+#ifndef ENGINE_DEFAULT_RATE
+    #define ENGINE_DEFAULT_RATE 48000
+#endif
+
+/* Frames per period, the engine adds up to periods + 1 of these in latency */
+#ifndef ENGINE_DEFAULT_PERIOD
+    #define ENGINE_DEFAULT_PERIOD 128
+#endif
+
+#ifndef ENGINE_DEFAULT_PERIODS
+    #define ENGINE_DEFAULT_PERIODS 2
+#endif
+
+/* Same depth as the FPGA delay line (max-delaym in the device tree) */
+#ifndef ENGINE_DEFAULT_MAX_DELAYM
+    #define ENGINE_DEFAULT_MAX_DELAYM 48000
+#endif
+
+struct engine_config {
+    const char *name;
+    const char *capture_device;
+    const char *playback_device;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int period;
+    unsigned int periods;
+    unsigned int max_delaym;
+    int rt_priority;
+    int stats_interval;
+};
+
+static volatile sig_atomic_t engine_stop;
+
+/* Function to stop the engine on SIGINT/SIGTERM */
+static void engine_signal_handler(int sig) {
+    (void)sig;
+    engine_stop = 1;
+}
+
+/* Function to return a monotonic timestamp in microseconds */
+static int64_t engine_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function to print usage instructions */
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n", program_name);
+    printf("       %s --render <grid> [--out <dir>] [--threads <n>] [--summary-only] <input.wav>...\n", program_name);
+    printf("Options:\n");
+    printf("  --name <name>        Engine name for combFilterController --engine (default 0)\n");
+    printf("  --capture <pcm>      ALSA capture device (default \"default\")\n");
+    printf("  --playback <pcm>     ALSA playback device (default \"default\")\n");
+    printf("  --channels <n>       Channels, each filtered with the same registers (default 2)\n");
+    printf("  --rate <hz>          Sample rate (default %d)\n", ENGINE_DEFAULT_RATE);
+    printf("  --period <frames>    Frames per period (default %d)\n", ENGINE_DEFAULT_PERIOD);
+    printf("  --periods <n>        Periods in the ALSA buffers (default %d)\n", ENGINE_DEFAULT_PERIODS);
+    printf("  --max-delaym <n>     Delay line depth in samples (default %d)\n", ENGINE_DEFAULT_MAX_DELAYM);
+    printf("  --rt <priority>      Run the audio loop SCHED_FIFO at this priority, memory locked\n");
+    printf("  --stats <seconds>    Print the CPU load this often, 0 = never (default 10)\n");
+    printf("  --render <grid>      Render the input files offline through every parameter set in grid\n");
+    printf("  --out <dir>          Directory for the renders and summary.csv (default renders)\n");
+    printf("  --threads <n>        Render threads (default one per online CPU)\n");
+    printf("  --summary-only       Measure the renders without writing them\n");
+    printf("  -h, --help           Show this help message\n");
+}
+
+/*-------------------------------------------------------------------------
+ * ALSA
+ *-------------------------------------------------------------------------*/
+
+/* Function to open and configure a PCM for interleaved S32 at the engine's rate and period */
+static snd_pcm_t *engine_open_pcm(const char *device, snd_pcm_stream_t stream,
+                                  const struct engine_config *config) {
+    snd_pcm_t *pcm;
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_sw_params_t *sw;
+    snd_pcm_uframes_t period = config->period;
+    snd_pcm_uframes_t buffer = config->period * config->periods;
+    snd_pcm_uframes_t boundary;
+    const char *what = stream == SND_PCM_STREAM_CAPTURE ? "capture" : "playback";
+    int err;
+
+    err = snd_pcm_open(&pcm, device, stream, 0);
+    if (err < 0) {
+        printf("Failed to open %s device %s: %s\n", what, device, snd_strerror(err));
+        return NULL;
+    }
+
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_hw_params_any(pcm, hw);
+    if ((err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S32_LE)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(pcm, hw, config->channels)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate(pcm, hw, config->rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, NULL)) < 0 ||
+        (err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer)) < 0 ||
+        (err = snd_pcm_hw_params(pcm, hw)) < 0) {
+        printf("%s device %s does not support S32_LE, %u channels, %u Hz: %s\n",
+               what, device, config->channels, config->rate, snd_strerror(err));
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+    if (period != config->period) {
+        printf("%s device %s uses %lu frame periods, not %u, pick a --period it supports\n",
+               what, device, (unsigned long)period, config->period);
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+
+    /* The engine starts the streams itself once playback is prefilled */
+    snd_pcm_sw_params_alloca(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    snd_pcm_sw_params_get_boundary(sw, &boundary);
+    snd_pcm_sw_params_set_start_threshold(pcm, sw, boundary);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, period);
+    if ((err = snd_pcm_sw_params(pcm, sw)) < 0) {
+        printf("Failed to set up %s device %s: %s\n", what, device, snd_strerror(err));
+        snd_pcm_close(pcm);
+        return NULL;
+    }
+    return pcm;
+}
+
+/* Function to (re)start both streams with the playback buffer full of silence */
+static int engine_start(snd_pcm_t *capture, snd_pcm_t *playback, int linked,
+                        struct engine_state *st, unsigned int periods) {
+    int err;
+
+    snd_pcm_drop(capture);
+    snd_pcm_drop(playback);
+    if ((err = snd_pcm_prepare(capture)) < 0 || (err = snd_pcm_prepare(playback)) < 0) {
+        printf("Failed to prepare the streams: %s\n", snd_strerror(err));
+        return -1;
+    }
+
+    memset(st->frames, 0, st->period * st->channels * sizeof(int32_t));
+    for (unsigned int i = 0; i < periods; i++) {
+        if ((err = snd_pcm_writei(playback, st->frames, st->period)) < 0) {
+            printf("Failed to prefill playback: %s\n", snd_strerror(err));
+            return -1;
+        }
+    }
+
+    /* Linked streams start together, otherwise as close together as we can */
+    if ((err = snd_pcm_start(capture)) < 0 || (!linked && (err = snd_pcm_start(playback)) < 0)) {
+        printf("Failed to start the streams: %s\n", snd_strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+/* Main function */
+int main(int argc, char *argv[]) {
+    struct engine_config config = {
+        .name = "0",
+        .capture_device = "default",
+        .playback_device = "default",
+        .channels = 2,
+        .rate = ENGINE_DEFAULT_RATE,
+        .period = ENGINE_DEFAULT_PERIOD,
+        .periods = ENGINE_DEFAULT_PERIODS,
+        .max_delaym = ENGINE_DEFAULT_MAX_DELAYM,
+        .rt_priority = 0,
+        .stats_interval = 10,
+    };
+    struct render_options render = {
+        .out_dir = "renders",
+        .threads = pool_default_threads(),
+    };
+    char **inputs = calloc(argc, sizeof(char *));
+    int num_inputs = 0;
+    struct engine_state st;
+    struct sigaction sa;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "--summary-only") == 0) {
+            render.summary_only = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "--", 2) != 0 && inputs) {
+            inputs[num_inputs++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf("Missing argument for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--name") == 0) {
+            config.name = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0) {
+            config.capture_device = argv[++i];
+        } else if (strcmp(argv[i], "--playback") == 0) {
+            config.playback_device = argv[++i];
+        } else if (strcmp(argv[i], "--channels") == 0) {
+            config.channels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            config.rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--period") == 0) {
+            config.period = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--periods") == 0) {
+            config.periods = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-delaym") == 0) {
+            config.max_delaym = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--rt") == 0) {
+            config.rt_priority = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            config.stats_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--render") == 0) {
+            render.grid_path = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0) {
+            render.out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            render.threads = atoi(argv[++i]);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.channels < 1 || config.channels > ENGINE_MAX_CHANNELS ||
+        config.period < 1 || config.period > ENGINE_MAX_PERIOD || config.periods < 2 ||
+        config.rate < 1 || config.max_delaym > 16 * 1024 * 1024) {
+        printf("Invalid configuration: 1-%d channels, 1-%d frame periods, at least 2 periods, "
+               "a delay line of at most %d samples\n", ENGINE_MAX_CHANNELS, ENGINE_MAX_PERIOD, 16 * 1024 * 1024);
+        return 1;
+    }
+
+    if (render.grid_path) {
+        render.max_delaym = config.max_delaym;
+        int result = engine_render(&render, inputs, num_inputs);
+        free(inputs);
+        return result;
+    }
+    if (num_inputs > 0) {
+        printf("Unknown option: %s\n", inputs[0]);
+        print_usage(argv[0]);
+        return 1;
+    }
+    free(inputs);
+
+    if (engine_state_init(&st, config.channels, config.period, config.max_delaym) != 0) {
+        printf("Failed to allocate the delay lines\n");
+        return 1;
+    }
+
+    snd_pcm_t *capture = engine_open_pcm(config.capture_device, SND_PCM_STREAM_CAPTURE, &config);
+    if (!capture) {
+        return 1;
+    }
+    snd_pcm_t *playback = engine_open_pcm(config.playback_device, SND_PCM_STREAM_PLAYBACK, &config);
+    if (!playback) {
+        snd_pcm_close(capture);
+        return 1;
+    }
+    int linked = snd_pcm_link(capture, playback) == 0;
+
+    struct engine_shm *shm = engine_shm_create(config.name, config.rate, config.max_delaym);
+    if (!shm) {
+        printf("Failed to create the control block for engine %s\n", config.name);
+        snd_pcm_close(playback);
+        snd_pcm_close(capture);
+        return 1;
+    }
+
+    if (config.rt_priority > 0) {
+        struct sched_param param = { .sched_priority = config.rt_priority };
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            perror("mlockall");
+        }
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            perror("sched_setscheduler");
+        }
+    }
+
+    /* No SA_RESTART, the signal has to interrupt the blocking read */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = engine_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("combFilterEngine %s: %s -> %s, %u channels, %u Hz, %u x %u frame periods%s\n",
+           config.name, config.capture_device, config.playback_device, config.channels, config.rate,
+           config.periods, config.period,
+#ifdef ENGINE_NEON
+           ", NEON"
+#else
+           ""
+#endif
+           );
+    fflush(stdout);
+
+    int result = 0;
+    if (engine_start(capture, playback, linked, &st, config.periods) != 0) {
+        result = 1;
+        engine_stop = 1;
+    }
+
+    /* Load is the time spent filtering as a fraction of the period's duration */
+    double period_us = 1e6 * config.period / config.rate;
+    int64_t next_stats_us = engine_now_us() + config.stats_interval * 1000000LL;
+    uint64_t interval_periods = 0;
+    int64_t interval_busy_us = 0;
+    unsigned int interval_max_permille = 0;
+
+    while (!engine_stop) {
+        snd_pcm_sframes_t frames = snd_pcm_readi(capture, st.frames, st.period);
+        if (frames == -EINTR) {
+            continue;
+        }
+        if (frames >= 0) {
+            int64_t start_us = engine_now_us();
+            /* A write in progress keeps the current values for one more period */
+            struct combFilter_regs regs;
+            engine_process(&st, engine_shm_try_read(shm, &regs) == 0 ? &regs : NULL, frames);
+            int64_t busy_us = engine_now_us() - start_us;
+
+            unsigned int permille = (unsigned int)(busy_us * 1000 / period_us);
+            atomic_store_explicit(&shm->load_permille, permille, memory_order_relaxed);
+            if (permille > atomic_load_explicit(&shm->load_max_permille, memory_order_relaxed)) {
+                atomic_store_explicit(&shm->load_max_permille, permille, memory_order_relaxed);
+            }
+            atomic_fetch_add_explicit(&shm->busy_us, busy_us, memory_order_relaxed);
+            atomic_fetch_add_explicit(&shm->periods, 1, memory_order_relaxed);
+            interval_periods++;
+            interval_busy_us += busy_us;
+            if (permille > interval_max_permille) {
+                interval_max_permille = permille;
+            }
+
+            frames = snd_pcm_writei(playback, st.frames, frames);
+            if (frames == -EINTR) {
+                continue;
+            }
+        }
+        if (frames < 0) {
+            /* Overrun or underrun, start over with a fresh playback buffer */
+            atomic_fetch_add_explicit(&shm->xruns, 1, memory_order_relaxed);
+            if (engine_start(capture, playback, linked, &st, config.periods) != 0) {
+                result = 1;
+                break;
+            }
+        }
+
+        if (config.stats_interval > 0 && engine_now_us() >= next_stats_us) {
+            printf("periods %llu, xruns %llu, load avg %.1f%% max %.1f%%\n",
+                   (unsigned long long)atomic_load(&shm->periods), (unsigned long long)atomic_load(&shm->xruns),
+                   interval_periods ? 100.0 * interval_busy_us / (interval_periods * period_us) : 0.0,
+                   interval_max_permille / 10.0);
+            fflush(stdout);
+            next_stats_us += config.stats_interval * 1000000LL;
+            interval_periods = 0;
+            interval_busy_us = 0;
+            interval_max_permille = 0;
+        }
+    }
+
+    printf("combFilterEngine %s stopped: %llu periods, %llu xruns, peak load %.1f%%\n", config.name,
+           (unsigned long long)atomic_load(&shm->periods), (unsigned long long)atomic_load(&shm->xruns),
+           atomic_load(&shm->load_max_permille) / 10.0);
+    snd_pcm_drop(capture);
+    snd_pcm_drop(playback);
+    snd_pcm_close(playback);
+    snd_pcm_close(capture);
+    engine_shm_close(shm, config.name, 1);
+    return result;
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Control block shared between a combFilterEngine and
+ *              combFilterController --engine
+ *
+ * Each engine publishes its registers in a POSIX shared memory object,
+ * /dev/shm/combFilterEngine.<name>, laid out as struct engine_shm. The
+ * registers are guarded by a sequence counter: writers (the controller)
+ * make it odd while they update, the engine's audio thread reads without
+ * ever blocking and keeps the previous values if a write is in progress.
+ * A writer that dies with the counter odd is found by its pid once the
+ * write takes longer than any live one could, and the next writer takes
+ * the write over from it.
+ *
+ * Also declares the signal path (combFilterEngineDsp.c), shared by the
+ * live engine and its --render batch mode.
+ *-------------------------------------------------------------------------*/
+
+#ifndef COMBFILTERENGINE_H
+#define COMBFILTERENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <combFilter.h>
+
+#define ENGINE_SHM_PREFIX "/combFilterEngine."
+#define ENGINE_SHM_MAGIC 0x46424d43u    /* "CMBF" */
+#define ENGINE_SHM_VERSION 2
+
+struct engine_shm {
+    /* Set once by the engine */
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t max_delaym;
+    int32_t pid;
+
+    /* Registers, written by controllers, read by the audio thread */
+    atomic_uint seq;
+    atomic_int writer;                  /* pid of the writer holding seq odd, 0 while it is even */
+    atomic_uint regs[COMBFILTER_NUM_REGS];
+    atomic_uint generation;
+
+    /* Counters, written by the audio thread */
+    _Atomic uint64_t periods;
+    _Atomic uint64_t xruns;
+    _Atomic uint64_t busy_us;           /* time spent processing, rate() of it is the CPU load */
+    atomic_uint load_permille;          /* load of the last period */
+    atomic_uint load_max_permille;      /* highest load of any period */
+};
+
+struct engine_shm *engine_shm_create(const char *name, unsigned int sample_rate, unsigned int max_delaym);
+struct engine_shm *engine_shm_open(const char *name);
+void engine_shm_close(struct engine_shm *shm, const char *name, int unlink_shm);
+int engine_shm_try_read(struct engine_shm *shm, struct combFilter_regs *regs);
+void engine_shm_read(struct engine_shm *shm, struct combFilter_regs *regs);
+int engine_shm_write(struct engine_shm *shm, const unsigned int *values, unsigned int dirty_mask);
+int engine_shm_format_stats(struct engine_shm *shm, char *buffer, size_t size);
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define ENGINE_NEON 1
+#endif
+
+#define ENGINE_MAX_CHANNELS 8
+#define ENGINE_MAX_PERIOD 4096
+
+/* Filter state of one engine, touched only by the thread running it */
+struct engine_state {
+    unsigned int channels;
+    unsigned int period;
+    unsigned int max_delaym;
+    unsigned int delay_mask;                /* delay line length - 1, a power of two */
+    unsigned int write_pos;
+    float *delay[ENGINE_MAX_CHANNELS];      /* length + period floats, the tail mirrors the head */
+    float *samples[ENGINE_MAX_CHANNELS];    /* one period of one channel, filtered in place */
+    int32_t *frames;                        /* one period as ALSA sees it, interleaved S32 */
+    unsigned int delaym;
+    float g_dry;                            /* gain of x[n] */
+    float g_del;                            /* gain of x[n - delaym] */
+    unsigned int generation;
+    int have_registers;
+};
+
+int engine_state_init(struct engine_state *st, unsigned int channels, unsigned int period,
+                      unsigned int max_delaym);
+void engine_state_free(struct engine_state *st);
+void engine_set_registers(struct engine_state *st, const struct combFilter_regs *regs);
+void engine_process(struct engine_state *st, const struct combFilter_regs *regs, unsigned int n);
+
+/* Offline rendering of WAV files over a parameter grid (combFilterRender.c) */
+struct render_options {
+    const char *grid_path;
+    const char *out_dir;
+    unsigned int max_delaym;
+    int threads;
+    int summary_only;           /* measure only, write no WAV files */
+};
+
+int engine_render(const struct render_options *options, char **inputs, int num_inputs);
+
+#endif /* COMBFILTERENGINE_H */
@@ -0,0 +1,204 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Signal path of the combFilterEngine
+ *
+ * Filters interleaved S32 frames one period at a time, the same way for
+ * the live ALSA loop and for --render. Gain changes ramp across the
+ * period so they do not click. The inner loops use NEON on ARM and plain
+ * C elsewhere (auto-vectorized on x86).
+ *-------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+#endif
+
+#include "combFilterEngine.h"
+
+/* Function to compute x = g_dry * x + g_del * d in place over n samples,
+ * the gains ramping linearly from their old to their new values */
+static void engine_comb(float *x, const float *d, unsigned int n,
+                        float g_dry0, float g_dry1, float g_del0, float g_del1) {
+    float step_dry = (g_dry1 - g_dry0) / n;
+    float step_del = (g_del1 - g_del0) / n;
+    unsigned int i = 0;
+
+#ifdef ENGINE_NEON
+    static const float lanes[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t lane = vld1q_f32(lanes);
+    float32x4_t dry = vmlaq_n_f32(vdupq_n_f32(g_dry0), lane, step_dry);
+    float32x4_t del = vmlaq_n_f32(vdupq_n_f32(g_del0), lane, step_del);
+    float32x4_t dry_step = vdupq_n_f32(4.0f * step_dry);
+    float32x4_t del_step = vdupq_n_f32(4.0f * step_del);
+
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t y = vmulq_f32(vld1q_f32(x + i), dry);
+        y = vmlaq_f32(y, vld1q_f32(d + i), del);
+        vst1q_f32(x + i, y);
+        dry = vaddq_f32(dry, dry_step);
+        del = vaddq_f32(del, del_step);
+    }
+#endif
+    for (; i < n; i++) {
+        x[i] = (g_dry0 + step_dry * i) * x[i] + (g_del0 + step_del * i) * d[i];
+    }
+}
+
+/* Function to split the interleaved S32 frames into one float buffer per channel */
+static void engine_deinterleave(struct engine_state *st, unsigned int n) {
+    const int32_t *src = st->frames;
+    unsigned int i = 0;
+
+#ifdef ENGINE_NEON
+    if (st->channels == 2) {
+        for (; i + 4 <= n; i += 4) {
+            int32x4x2_t v = vld2q_s32(src + 2 * i);
+            vst1q_f32(st->samples[0] + i, vcvtq_n_f32_s32(v.val[0], 31));
+            vst1q_f32(st->samples[1] + i, vcvtq_n_f32_s32(v.val[1], 31));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (unsigned int ch = 0; ch < st->channels; ch++) {
+            st->samples[ch][i] = src[i * st->channels + ch] * (1.0f / 2147483648.0f);
+        }
+    }
+}
+
+/* Function to convert a float sample back to S32, saturating like vcvtq_n_s32_f32 */
+static int32_t engine_to_s32(float value) {
+    float scaled = value * 2147483648.0f;
+    if (scaled >= 2147483647.0f) {
+        return INT32_MAX;
+    }
+    if (scaled <= -2147483648.0f) {
+        return INT32_MIN;
+    }
+    return (int32_t)scaled;
+}
+
+/* Function to merge the channel buffers back into interleaved S32 frames */
+static void engine_interleave(struct engine_state *st, unsigned int n) {
+    int32_t *dst = st->frames;
+    unsigned int i = 0;
+
+#ifdef ENGINE_NEON
+    if (st->channels == 2) {
+        for (; i + 4 <= n; i += 4) {
+            int32x4x2_t v;
+            v.val[0] = vcvtq_n_s32_f32(vld1q_f32(st->samples[0] + i), 31);
+            v.val[1] = vcvtq_n_s32_f32(vld1q_f32(st->samples[1] + i), 31);
+            vst2q_s32(dst + 2 * i, v);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (unsigned int ch = 0; ch < st->channels; ch++) {
+            dst[i * st->channels + ch] = engine_to_s32(st->samples[ch][i]);
+        }
+    }
+}
+
+/* Function to append a period of one channel to its delay line */
+static void engine_delay_write(struct engine_state *st, unsigned int ch, unsigned int n) {
+    float *d = st->delay[ch];
+    unsigned int length = st->delay_mask + 1;
+    unsigned int first = length - st->write_pos < n ? length - st->write_pos : n;
+
+    memcpy(d + st->write_pos, st->samples[ch], first * sizeof(float));
+    memcpy(d, st->samples[ch] + first, (n - first) * sizeof(float));
+    /* The head is repeated past the end, so any run of up to a period reads without wrapping */
+    memcpy(d + length, d, st->period * sizeof(float));
+}
+
+/* Function to convert new register values from the FPGA's fixed point,
+ * returns 0 if they are the ones already in use */
+static int engine_update_registers(struct engine_state *st, const struct combFilter_regs *regs,
+                                   float *g_dry, float *g_del) {
+    if (st->have_registers && regs->generation == st->generation) {
+        return 0;
+    }
+    st->generation = regs->generation;
+    st->have_registers = 1;
+
+    float b0 = (float)regs->b0 / COMBFILTER_GAIN_ONE;
+    float bm = (float)regs->bm / COMBFILTER_GAIN_ONE;
+    float mix = (float)regs->wetDryMix / COMBFILTER_GAIN_ONE;
+    *g_dry = (1.0f - mix) + mix * b0;
+    *g_del = mix * bm;
+    st->delaym = regs->delaym <= st->max_delaym ? regs->delaym : st->max_delaym;
+    return 1;
+}
+
+/* Function to start from a register set without ramping to it */
+void engine_set_registers(struct engine_state *st, const struct combFilter_regs *regs) {
+    engine_update_registers(st, regs, &st->g_dry, &st->g_del);
+}
+
+/* Function to filter one period held in st->frames. regs are the values
+ * for this period, NULL keeps the current ones. */
+void engine_process(struct engine_state *st, const struct combFilter_regs *regs, unsigned int n) {
+    float g_dry = st->g_dry;
+    float g_del = st->g_del;
+
+    if (regs) {
+        engine_update_registers(st, regs, &g_dry, &g_del);
+    }
+    engine_deinterleave(st, n);
+
+    unsigned int read_pos = (st->write_pos - st->delaym) & st->delay_mask;
+    for (unsigned int ch = 0; ch < st->channels; ch++) {
+        engine_delay_write(st, ch, n);
+        engine_comb(st->samples[ch], st->delay[ch] + read_pos, n, st->g_dry, g_dry, st->g_del, g_del);
+    }
+    st->g_dry = g_dry;
+    st->g_del = g_del;
+    st->write_pos = (st->write_pos + n) & st->delay_mask;
+
+    engine_interleave(st, n);
+}
+
+/* Function to allocate the filter state, a dry signal until the registers are read */
+int engine_state_init(struct engine_state *st, unsigned int channels, unsigned int period,
+                      unsigned int max_delaym) {
+    unsigned int length = 1;
+
+    memset(st, 0, sizeof(*st));
+    st->channels = channels;
+    st->period = period;
+    st->max_delaym = max_delaym;
+    st->g_dry = 1.0f;
+
+    /* x[n - max_delaym] must survive the period written after it */
+    while (length < max_delaym + period) {
+        length <<= 1;
+    }
+    st->delay_mask = length - 1;
+
+    st->frames = calloc(period * channels, sizeof(int32_t));
+    if (!st->frames) {
+        return -1;
+    }
+    for (unsigned int ch = 0; ch < st->channels; ch++) {
+        st->delay[ch] = calloc(length + period, sizeof(float));
+        st->samples[ch] = calloc(period, sizeof(float));
+        if (!st->delay[ch] || !st->samples[ch]) {
+            engine_state_free(st);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Function to free the filter state */
+void engine_state_free(struct engine_state *st) {
+    for (unsigned int ch = 0; ch < st->channels; ch++) {
+        free(st->delay[ch]);
+        free(st->samples[ch]);
+    }
+    free(st->frames);
+    memset(st, 0, sizeof(*st));
+}
@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Shared memory control block of the combFilterEngine
+ *
+ * Used on both sides: the engine creates the block and reads the
+ * registers once per period, the controller opens it and writes them.
+ * See combFilterEngine.h for the layout and the locking rules.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "combFilterEngine.h"
+
+/* How often the audio thread retries a read that raced with a write before
+ * it keeps the previous values for this period */
+#ifndef ENGINE_SHM_READ_TRIES
+    #define ENGINE_SHM_READ_TRIES 4
+#endif
+
+/* How long the sequence may stay odd before its writer is checked for
+ * being dead, far longer than the few stores of a write take */
+#ifndef ENGINE_SHM_WRITE_TIMEOUT_MS
+    #define ENGINE_SHM_WRITE_TIMEOUT_MS 100
+#endif
+
+/* Function to build the shared memory object name of an engine */
+static void engine_shm_path(char *buffer, size_t size, const char *name) {
+    snprintf(buffer, size, "%s%s", ENGINE_SHM_PREFIX, name);
+}
+
+/* Function to create and map an engine's control block, registers start at 0 (dry signal) */
+struct engine_shm *engine_shm_create(const char *name, unsigned int sample_rate, unsigned int max_delaym) {
+    char path[128];
+    engine_shm_path(path, sizeof(path), name);
+
+    int shm_fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0660);
+    if (shm_fd < 0) {
+        perror("shm_open");
+        return NULL;
+    }
+    if (ftruncate(shm_fd, sizeof(struct engine_shm)) != 0) {
+        perror("ftruncate");
+        close(shm_fd);
+        shm_unlink(path);
+        return NULL;
+    }
+    struct engine_shm *shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(path);
+        return NULL;
+    }
+
+    shm->sample_rate = sample_rate;
+    shm->max_delaym = max_delaym;
+    shm->pid = getpid();
+    shm->version = ENGINE_SHM_VERSION;
+    /* Controllers check the magic last, so they never see a half-built block */
+    atomic_thread_fence(memory_order_release);
+    shm->magic = ENGINE_SHM_MAGIC;
+    return shm;
+}
+
+/* Function to map a running engine's control block */
+struct engine_shm *engine_shm_open(const char *name) {
+    char path[128];
+    engine_shm_path(path, sizeof(path), name);
+
+    int shm_fd = shm_open(path, O_RDWR, 0);
+    if (shm_fd < 0) {
+        perror("shm_open");
+        printf("No combFilterEngine named %s (%s)\n", name, path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(shm_fd, &st) != 0 || st.st_size < (off_t)sizeof(struct engine_shm)) {
+        printf("%s is not a combFilterEngine control block\n", path);
+        close(shm_fd);
+        return NULL;
+    }
+    struct engine_shm *shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (shm->magic != ENGINE_SHM_MAGIC || shm->version != ENGINE_SHM_VERSION) {
+        printf("%s is not a version %d combFilterEngine control block\n", path, ENGINE_SHM_VERSION);
+        munmap(shm, sizeof(*shm));
+        return NULL;
+    }
+    if (kill(shm->pid, 0) != 0 && errno == ESRCH) {
+        printf("combFilterEngine %s (pid %d) is not running\n", name, shm->pid);
+        munmap(shm, sizeof(*shm));
+        return NULL;
+    }
+    return shm;
+}
+
+/* Function to unmap a control block, the engine also removes it */
+void engine_shm_close(struct engine_shm *shm, const char *name, int unlink_shm) {
+    if (!shm) {
+        return;
+    }
+    munmap(shm, sizeof(*shm));
+    if (unlink_shm) {
+        char path[128];
+        engine_shm_path(path, sizeof(path), name);
+        shm_unlink(path);
+    }
+}
+
+/* Function to read the registers without waiting, returns -1 if every try
+ * raced with a write (the audio thread then keeps what it had) */
+int engine_shm_try_read(struct engine_shm *shm, struct combFilter_regs *regs) {
+    for (int i = 0; i < ENGINE_SHM_READ_TRIES; i++) {
+        unsigned int seq = atomic_load_explicit(&shm->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        regs->delaym = atomic_load_explicit(&shm->regs[0], memory_order_relaxed);
+        regs->b0 = atomic_load_explicit(&shm->regs[1], memory_order_relaxed);
+        regs->bm = atomic_load_explicit(&shm->regs[2], memory_order_relaxed);
+        regs->wetDryMix = atomic_load_explicit(&shm->regs[3], memory_order_relaxed);
+        regs->generation = atomic_load_explicit(&shm->generation, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == seq) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Function to check whether the odd sequence seq was left by a writer that died
+ * mid-write. stuck and since keep how long seq has been odd between calls;
+ * a writer is only given up on once that exceeds ENGINE_SHM_WRITE_TIMEOUT_MS
+ * and its pid is gone, or it died before it could store its pid. */
+static int engine_shm_abandoned(struct engine_shm *shm, unsigned int seq, unsigned int *stuck,
+                                struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (seq != *stuck) {
+        *stuck = seq;
+        *since = now;
+        return 0;
+    }
+    long elapsed_ms = (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+    if (elapsed_ms < ENGINE_SHM_WRITE_TIMEOUT_MS) {
+        return 0;
+    }
+    int writer = atomic_load_explicit(&shm->writer, memory_order_relaxed);
+    return writer == 0 || (kill(writer, 0) != 0 && errno == ESRCH);
+}
+
+/* Function to read the registers, retrying until no write is in progress
+ * The write of a dead writer is ended as it stands, so the read goes through. */
+void engine_shm_read(struct engine_shm *shm, struct combFilter_regs *regs) {
+    unsigned int stuck = 0;
+    struct timespec since;
+
+    while (engine_shm_try_read(shm, regs) != 0) {
+        unsigned int seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+        if ((seq & 1) && engine_shm_abandoned(shm, seq, &stuck, &since)) {
+            atomic_compare_exchange_strong_explicit(&shm->seq, &seq, seq + 1,
+                                                    memory_order_release, memory_order_relaxed);
+            continue;
+        }
+        sched_yield();
+    }
+}
+
+/* Function to write the dirty registers as one update, same rules as the
+ * driver: delaym past the delay line fails with ERANGE and writes nothing */
+int engine_shm_write(struct engine_shm *shm, const unsigned int *values, unsigned int dirty_mask) {
+    if ((dirty_mask & 1) && values[0] > shm->max_delaym) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    /* Writers take the sequence from even to odd, which also excludes other writers */
+    unsigned int seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+    unsigned int stuck = 0;
+    struct timespec since;
+    for (;;) {
+        if (!(seq & 1) &&
+            atomic_compare_exchange_weak_explicit(&shm->seq, &seq, seq + 1,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        /* A dead writer's write is taken over: odd to the next odd, as if it were a new write */
+        if ((seq & 1) && engine_shm_abandoned(shm, seq, &stuck, &since) &&
+            atomic_compare_exchange_strong_explicit(&shm->seq, &seq, seq + 2,
+                                                    memory_order_acquire, memory_order_relaxed)) {
+            seq++;
+            break;
+        }
+        if (seq & 1) {
+            sched_yield();
+            seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+        }
+    }
+    atomic_store_explicit(&shm->writer, getpid(), memory_order_relaxed);
+    /* The odd sequence must be visible before any register changes */
+    atomic_thread_fence(memory_order_release);
+
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        if (dirty_mask & (1u << i)) {
+            atomic_store_explicit(&shm->regs[i], values[i], memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add_explicit(&shm->generation, 1, memory_order_relaxed);
+    atomic_store_explicit(&shm->writer, 0, memory_order_relaxed);
+    atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+    return 0;
+}
+
+/* Function to format the engine counters as "<name> <value>" lines, like the driver's stats */
+int engine_shm_format_stats(struct engine_shm *shm, char *buffer, size_t size) {
+    int len = snprintf(buffer, size, "periods %llu\nxruns %llu\nbusy_us %llu\n",
+                       (unsigned long long)atomic_load(&shm->periods),
+                       (unsigned long long)atomic_load(&shm->xruns),
+                       (unsigned long long)atomic_load(&shm->busy_us));
+    return len > 0 && (size_t)len < size ? 0 : -1;
+}
@@ -0,0 +1,377 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Fits the comb filter registers to a set of notch
+ *              frequencies, for feedback suppression presets
+ *
+ * For every delaym in range the search looks for the b0 and bm (fixed
+ * point, see combFilter.h) that pull each target frequency at least
+ * --depth dB below the filter's average level while keeping that level
+ * at unity. Candidates are scored with the closed-form response
+ *   |H(f)|^2 = g_dry^2 + g_del^2 + 2 * g_dry * g_del * cos(2 * pi * f * delaym / fs)
+ * on a coarse gain grid, refined down to single steps around the best.
+ *
+ * The delaym range is searched on one thread per core by the work-stealing
+ * pool (combFilterPool.c). The result does not depend on the number of
+ * threads.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <combFilter.h>
+
+#include "combFilterPool.h"
+
+#ifndef FIT_DEFAULT_RATE
+    #define FIT_DEFAULT_RATE 48000
+#endif
+
+/* Longest delay searched unless --max-delaym says otherwise */
+#ifndef FIT_DEFAULT_MAX_DELAYM
+    #define FIT_DEFAULT_MAX_DELAYM 48000
+#endif
+
+#define FIT_MAX_NOTCHES 16
+
+/* delaym values a thread takes from its share at a time */
+#ifndef FIT_CHUNK
+    #define FIT_CHUNK 32
+#endif
+
+/* Gain grid spacing of the first pass, halved down to 1 while refining */
+#ifndef FIT_COARSE_STEP
+    #define FIT_COARSE_STEP 2048
+#endif
+
+/* Largest --max-gain accepted, keeps the coarse grid finite and its counters from wrapping */
+#ifndef FIT_MAX_GAIN
+    #define FIT_MAX_GAIN (4 * COMBFILTER_GAIN_ONE)
+#endif
+
+/* Weight of the average level's distance from 0 dB against the notch depths */
+#ifndef FIT_LEVEL_WEIGHT
+    #define FIT_LEVEL_WEIGHT 4.0
+#endif
+
+struct fit_config {
+    double notch_hz[FIT_MAX_NOTCHES];
+    int num_notches;
+    double depth_db;
+    unsigned int sample_rate;
+    unsigned int min_delaym;
+    unsigned int max_delaym;
+    unsigned int max_gain;
+    unsigned int mix;
+};
+
+struct fit_result {
+    double cost;
+    unsigned int delaym;
+    unsigned int b0;
+    unsigned int bm;
+};
+
+/* Best candidate found by one search thread */
+struct fit_worker {
+    struct fit_result best;
+    unsigned long evaluations;
+};
+
+static struct fit_config config;
+static struct fit_worker *workers;
+static int num_workers;
+
+/* Function to print usage instructions */
+void print_usage(const char *program_name) {
+    printf("Usage: %s --notch <hz> [--notch <hz> ...] [options]\n", program_name);
+    printf("Options:\n");
+    printf("  --notch <hz>         Frequency to suppress, up to %d\n", FIT_MAX_NOTCHES);
+    printf("  --depth <db>         Required level at each notch, relative to the average (default -30)\n");
+    printf("  --rate <hz>          Sample rate (default %d)\n", FIT_DEFAULT_RATE);
+    printf("  --min-delaym <n>     Shortest delay searched in samples (default 1)\n");
+    printf("  --max-delaym <n>     Longest delay searched in samples (default %d)\n", FIT_DEFAULT_MAX_DELAYM);
+    printf("  --max-gain <value>   Largest b0 and bm searched, at most %u (default %u = 1.0)\n",
+           FIT_MAX_GAIN, COMBFILTER_GAIN_ONE);
+    printf("  --mix <value>        wetDryMix the fit is made for (default %u = wet only)\n", COMBFILTER_GAIN_ONE);
+    printf("  --threads <n>        Search threads (default one per online CPU)\n");
+    printf("  --batch              Print only combFilterController --batch commands\n");
+    printf("  --json               Print the result as a JSON object\n");
+    printf("  -h, --help           Show this help message\n");
+}
+
+/* Function to return a monotonic timestamp in microseconds */
+static int64_t fit_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function to convert b0, bm and wetDryMix to the direct and delayed path gains */
+static void fit_gains(unsigned int b0, unsigned int bm, double *g_dry, double *g_del) {
+    double mix = (double)config.mix / COMBFILTER_GAIN_ONE;
+    *g_dry = (1.0 - mix) + mix * b0 / COMBFILTER_GAIN_ONE;
+    *g_del = mix * bm / COMBFILTER_GAIN_ONE;
+}
+
+/* Function to score one candidate, lower is better. cosines holds
+ * cos(2 * pi * f * delaym / fs) of each target. Each dB a target sits
+ * above the required depth, and each dB the average level is off unity,
+ * cost their square. */
+static double fit_cost(const double *cosines, unsigned int b0, unsigned int bm) {
+    double g_dry, g_del;
+    fit_gains(b0, bm, &g_dry, &g_del);
+
+    /* |H|^2 averaged over frequency */
+    double average = g_dry * g_dry + g_del * g_del;
+    if (average <= 0.0) {
+        return HUGE_VAL;
+    }
+    double level_db = 10.0 * log10(average);
+    double cost = FIT_LEVEL_WEIGHT * level_db * level_db;
+
+    double limit = average * pow(10.0, config.depth_db / 10.0);
+    for (int i = 0; i < config.num_notches; i++) {
+        double power = average + 2.0 * g_dry * g_del * cosines[i];
+        if (power > limit) {
+            double excess_db = 10.0 * log10(power / limit);
+            cost += excess_db * excess_db;
+        }
+    }
+    return cost;
+}
+
+/* Function to order results, ties go to the shorter delay and then the
+ * smaller gains so the result is the same however the work was split */
+static int fit_better(const struct fit_result *a, const struct fit_result *b) {
+    if (a->cost != b->cost) {
+        return a->cost < b->cost;
+    }
+    if (a->delaym != b->delaym) {
+        return a->delaym < b->delaym;
+    }
+    if (a->b0 != b->b0) {
+        return a->b0 < b->b0;
+    }
+    return a->bm < b->bm;
+}
+
+/* Function to find the best gains for one delaym: a coarse grid, then a
+ * pattern search that halves its step down to one register step. Runs
+ * on the pool, index counts from --min-delaym. */
+static void fit_delaym(void *context, int worker_id, unsigned int index) {
+    struct fit_worker *worker = &((struct fit_worker *)context)[worker_id];
+    unsigned int delaym = config.min_delaym + index;
+    double cosines[FIT_MAX_NOTCHES];
+    for (int i = 0; i < config.num_notches; i++) {
+        cosines[i] = cos(2.0 * M_PI * config.notch_hz[i] * delaym / config.sample_rate);
+    }
+
+    struct fit_result best = { HUGE_VAL, delaym, 0, 0 };
+    unsigned long evaluations = 0;
+    for (unsigned int b0 = 0; b0 <= config.max_gain; b0 += FIT_COARSE_STEP) {
+        for (unsigned int bm = 0; bm <= config.max_gain; bm += FIT_COARSE_STEP) {
+            struct fit_result candidate = { fit_cost(cosines, b0, bm), delaym, b0, bm };
+            evaluations++;
+            if (fit_better(&candidate, &best)) {
+                best = candidate;
+            }
+        }
+    }
+
+    for (unsigned int step = FIT_COARSE_STEP / 2; step >= 1; step /= 2) {
+        int moved = 1;
+        while (moved) {
+            moved = 0;
+            struct fit_result centre = best;
+            for (int db0 = -1; db0 <= 1; db0++) {
+                for (int dbm = -1; dbm <= 1; dbm++) {
+                    int64_t b0 = (int64_t)centre.b0 + db0 * (int64_t)step;
+                    int64_t bm = (int64_t)centre.bm + dbm * (int64_t)step;
+                    if ((db0 == 0 && dbm == 0) || b0 < 0 || bm < 0 ||
+                        b0 > config.max_gain || bm > config.max_gain) {
+                        continue;
+                    }
+                    struct fit_result candidate = { fit_cost(cosines, b0, bm), delaym, b0, bm };
+                    evaluations++;
+                    if (fit_better(&candidate, &best)) {
+                        best = candidate;
+                        moved = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    worker->evaluations += evaluations;
+    if (fit_better(&best, &worker->best)) {
+        worker->best = best;
+    }
+}
+
+/* Function to run the search on num_workers threads */
+static int fit_search(struct fit_result *best, unsigned long *evaluations, struct pool_stats *stats) {
+    workers = calloc(num_workers, sizeof(*workers));
+    if (!workers) {
+        perror("calloc");
+        return -1;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].best.cost = HUGE_VAL;
+    }
+
+    if (pool_run(config.max_delaym - config.min_delaym + 1, num_workers, FIT_CHUNK,
+                 fit_delaym, workers, stats) != 0) {
+        free(workers);
+        return -1;
+    }
+
+    *evaluations = 0;
+    for (int i = 0; i < num_workers; i++) {
+        if (fit_better(&workers[i].best, best)) {
+            *best = workers[i].best;
+        }
+        *evaluations += workers[i].evaluations;
+    }
+    free(workers);
+    return 0;
+}
+
+/* Function to compute the level of a frequency relative to the average and
+ * the comb notch nearest to it */
+static void fit_evaluate(const struct fit_result *result, double freq_hz, double *level_db, double *nearest_hz) {
+    double g_dry, g_del;
+    fit_gains(result->b0, result->bm, &g_dry, &g_del);
+    double average = g_dry * g_dry + g_del * g_del;
+    double power = average + 2.0 * g_dry * g_del * cos(2.0 * M_PI * freq_hz * result->delaym / config.sample_rate);
+    *level_db = power > 0.0 ? 10.0 * log10(power / average) : -INFINITY;
+
+    /* Both gains are positive, so the notches sit at odd multiples of fs / (2 * delaym) */
+    double spacing = (double)config.sample_rate / result->delaym;
+    *nearest_hz = (floor(freq_hz / spacing) + 0.5) * spacing;
+}
+
+int main(int argc, char *argv[]) {
+    int batch = 0;
+    int json = 0;
+
+    config.depth_db = -30.0;
+    config.sample_rate = FIT_DEFAULT_RATE;
+    config.min_delaym = 1;
+    config.max_delaym = FIT_DEFAULT_MAX_DELAYM;
+    config.max_gain = COMBFILTER_GAIN_ONE;
+    config.mix = COMBFILTER_GAIN_ONE;
+    num_workers = pool_default_threads();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf("Missing argument for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--notch") == 0) {
+            if (config.num_notches == FIT_MAX_NOTCHES) {
+                printf("At most %d notches\n", FIT_MAX_NOTCHES);
+                return 1;
+            }
+            config.notch_hz[config.num_notches++] = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            config.depth_db = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            config.sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-delaym") == 0) {
+            config.min_delaym = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-delaym") == 0) {
+            config.max_delaym = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-gain") == 0) {
+            unsigned long max_gain = strtoul(argv[++i], NULL, 0);
+            if (max_gain > FIT_MAX_GAIN) {
+                printf("--max-gain is at most %u\n", FIT_MAX_GAIN);
+                return 1;
+            }
+            config.max_gain = max_gain;
+        } else if (strcmp(argv[i], "--mix") == 0) {
+            config.mix = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            num_workers = atoi(argv[++i]);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.num_notches == 0) {
+        printf("Give at least one --notch frequency\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (config.sample_rate == 0 || config.min_delaym == 0 || config.min_delaym > config.max_delaym) {
+        printf("Invalid sample rate or delaym range\n");
+        return 1;
+    }
+    for (int i = 0; i < config.num_notches; i++) {
+        if (config.notch_hz[i] <= 0.0 || config.notch_hz[i] >= config.sample_rate / 2.0) {
+            printf("Notch %.2f Hz is outside 0 to %u Hz\n", config.notch_hz[i], config.sample_rate / 2);
+            return 1;
+        }
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    struct fit_result best = { HUGE_VAL, 0, 0, 0 };
+    unsigned long evaluations;
+    struct pool_stats stats;
+    int64_t start_us = fit_now_us();
+    if (fit_search(&best, &evaluations, &stats) != 0) {
+        return 1;
+    }
+    int64_t elapsed_us = fit_now_us() - start_us;
+
+    if (batch) {
+        printf("set delaym %u\nset b0 %u\nset bm %u\nset wetDryMix %u\ncommit\n",
+               best.delaym, best.b0, best.bm, config.mix);
+        return 0;
+    }
+
+    if (json) {
+        printf("{\"delaym\": %u, \"b0\": %u, \"bm\": %u, \"wetDryMix\": %u, \"cost\": %.6f, \"notches\": [",
+               best.delaym, best.b0, best.bm, config.mix, best.cost);
+        for (int i = 0; i < config.num_notches; i++) {
+            double level_db, nearest_hz;
+            fit_evaluate(&best, config.notch_hz[i], &level_db, &nearest_hz);
+            printf("%s{\"targetHz\": %.2f, \"levelDb\": %.2f, \"nearestNotchHz\": %.2f}",
+                   i ? ", " : "", config.notch_hz[i], level_db, nearest_hz);
+        }
+        printf("], \"candidates\": %lu, \"threads\": %d, \"steals\": %lu, \"elapsedMs\": %.1f}\n",
+               evaluations, stats.threads, stats.steals, elapsed_us / 1000.0);
+        return 0;
+    }
+
+    printf("Best fit: delaym %u (%.3f ms), b0 %u, bm %u, wetDryMix %u, cost %.4f\n",
+           best.delaym, best.delaym * 1000.0 / config.sample_rate, best.b0, best.bm, config.mix, best.cost);
+    printf("%12s %12s %16s\n", "target_hz", "level_db", "nearest_notch_hz");
+    for (int i = 0; i < config.num_notches; i++) {
+        double level_db, nearest_hz;
+        fit_evaluate(&best, config.notch_hz[i], &level_db, &nearest_hz);
+        printf("%12.2f %12.2f %16.2f%s\n", config.notch_hz[i], level_db, nearest_hz,
+               level_db > config.depth_db + 0.05 ? "  (short of --depth)" : "");
+    }
+    printf("Searched %lu candidates over delaym %u to %u in %.1f ms on %d threads (%lu steals)\n",
+           evaluations, config.min_delaym, config.max_delaym, elapsed_us / 1000.0, stats.threads, stats.steals);
+    return 0;
+}
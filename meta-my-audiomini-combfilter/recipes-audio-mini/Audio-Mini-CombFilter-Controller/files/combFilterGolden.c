@@ -0,0 +1,571 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Golden vector comparator for the comb filter bitstream
+ *
+ * Takes a capture of the comb filter's input (pre tap, hw:CombFilter,0)
+ * and of its output (post tap, hw:CombFilter,1), runs the input through
+ * the bit-exact fixed-point model below with the registers the hardware
+ * had, and compares the result with the output sample by sample.
+ *
+ * The model is the reference every bitstream is held to. Samples are the
+ * 24 bits of the left-justified S32 words, the gains are UQ16 (see
+ * combFilter.h), every product is exact and each stage is truncated
+ * towards minus infinity and saturated to 24 bits:
+ *   wet[n] = sat24((b0 * x[n] + bm * x[n - delaym]) >> 16)
+ *   y[n]   = sat24(((65536 - wetDryMix) * x[n] + wetDryMix * wet[n]) >> 16)
+ *
+ * The two captures are started separately, so the post tap is found at
+ * whatever lag matches the model best, within --max-lag frames. The
+ * captures are memory mapped and compared in one pass with integer
+ * arithmetic only, so minutes of audio are checked in seconds.
+ *
+ * --stimulus writes the white noise the runner (combFilterGoldenRun)
+ * plays into the filter while it captures.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <combFilter.h>
+
+/* Frames compared at every candidate lag while aligning the captures */
+#ifndef GOLDEN_SEARCH_FRAMES
+    #define GOLDEN_SEARCH_FRAMES 4096
+#endif
+
+/* Largest lag between the captures searched unless --max-lag says otherwise, 100 ms */
+#ifndef GOLDEN_DEFAULT_MAX_LAG
+    #define GOLDEN_DEFAULT_MAX_LAG 4800
+#endif
+
+#ifndef GOLDEN_STIMULUS_RATE
+    #define GOLDEN_STIMULUS_RATE 48000
+#endif
+
+#define GOLDEN_MAX_CHANNELS 8
+#define GOLDEN_SAMPLE_MAX ((1 << 23) - 1)
+#define GOLDEN_SAMPLE_MIN (-(1 << 23))
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_EXTENSIBLE 0xfffe
+
+/* Error histogram buckets, upper bounds in LSB, the last bucket catches the rest */
+#define GOLDEN_NUM_BUCKETS 6
+static const unsigned int golden_bucket_max[GOLDEN_NUM_BUCKETS - 1] = { 0, 1, 3, 15, 255 };
+static const char *golden_bucket_name[GOLDEN_NUM_BUCKETS] = { "0", "1", "2-3", "4-15", "16-255", "256+" };
+
+struct golden_capture {
+    const char *path;
+    void *map;
+    size_t map_size;
+    const int32_t *samples;     /* interleaved S32 frames */
+    unsigned long frames;
+    unsigned int channels;
+    unsigned int rate;
+};
+
+struct golden_report {
+    long lag;                   /* post tap frame = pre tap frame + lag */
+    unsigned long first_frame;  /* first pre tap frame compared */
+    unsigned long frames;
+    uint64_t histogram[GOLDEN_NUM_BUCKETS];
+    uint64_t over_tolerance;
+    unsigned int max_error;
+    unsigned long max_error_frame;
+    double sum_squares;
+    long first_mismatch_frame;  /* -1 when every sample is within tolerance */
+    unsigned int first_mismatch_channel;
+    int32_t first_mismatch_expected;
+    int32_t first_mismatch_actual;
+    int pre_silent;
+};
+
+/* Function to print usage instructions */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] <pre.wav> <post.wav>\n", program_name);
+    printf("       %s --stimulus <out.wav> [--seconds <n>]\n", program_name);
+    printf("Compares a capture of the comb filter output with the fixed-point model of its input\n");
+    printf("Options:\n");
+    printf("  --delaym <n>         Registers the hardware had during the capture (default 0)\n");
+    printf("  --b0 <n>\n");
+    printf("  --bm <n>\n");
+    printf("  --wetdrymix <n>\n");
+    printf("  --tolerance <lsb>    Largest error that still passes, in 24-bit LSB (default 0, bit-exact)\n");
+    printf("  --max-lag <frames>   Largest offset between the captures searched (default %d)\n", GOLDEN_DEFAULT_MAX_LAG);
+    printf("  --skip <frames>      Leave out the start of the captures, e.g. while a change settles\n");
+    printf("  --json               Print the report as one JSON object\n");
+    printf("  --stimulus <file>    Write S32_LE stereo white noise at -12 dBFS for the filter input\n");
+    printf("  --seconds <n>        Length of the stimulus (default 10)\n");
+    printf("Exits with 0 if every sample is within tolerance, 1 otherwise\n");
+}
+
+/* Function to get a monotonic timestamp in microseconds */
+static int64_t golden_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*-------------------------------------------------------------------------
+ * Captures
+ *-------------------------------------------------------------------------*/
+
+static uint16_t golden_le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t golden_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Function to map a capture made with arecord -f S32_LE */
+static int golden_open(const char *path, struct golden_capture *capture) {
+    struct stat st;
+    memset(capture, 0, sizeof(*capture));
+    capture->path = path;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+        printf("%s: not a WAV file\n", path);
+        close(fd);
+        return -1;
+    }
+    capture->map_size = st.st_size;
+    capture->map = mmap(NULL, capture->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (capture->map == MAP_FAILED) {
+        perror("mmap");
+        capture->map = NULL;
+        return -1;
+    }
+    madvise(capture->map, capture->map_size, MADV_SEQUENTIAL);
+
+    const uint8_t *p = capture->map;
+    const uint8_t *end = p + capture->map_size;
+    if (memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+        printf("%s: not a WAV file\n", path);
+        return -1;
+    }
+
+    unsigned int format = 0;
+    unsigned int bits = 0;
+    for (p += 12; p + 8 <= end; ) {
+        uint32_t size = golden_le32(p + 4);
+        const uint8_t *body = p + 8;
+        if (memcmp(p, "fmt ", 4) == 0 && size >= 16 && body + 16 <= end) {
+            format = golden_le16(body);
+            capture->channels = golden_le16(body + 2);
+            capture->rate = golden_le32(body + 4);
+            bits = golden_le16(body + 14);
+            if (format == WAV_FORMAT_EXTENSIBLE && size >= 26 && body + 26 <= end) {
+                format = golden_le16(body + 24);
+            }
+        } else if (memcmp(p, "data", 4) == 0 && format) {
+            /* arecord stopped by a signal leaves the size unset */
+            if (size > (uint64_t)(end - body)) {
+                size = end - body;
+            }
+            if (((uintptr_t)body & 3) != 0) {
+                printf("%s: sample data is not 32-bit aligned\n", path);
+                return -1;
+            }
+            capture->samples = (const int32_t *)body;
+            if (capture->channels) {
+                capture->frames = size / (4 * capture->channels);
+            }
+            break;
+        }
+        p = body + size + (size & 1);
+    }
+
+    if (!capture->samples) {
+        printf("%s: no fmt and data chunks\n", path);
+        return -1;
+    }
+    if (format != WAV_FORMAT_PCM || bits != 32) {
+        printf("%s: format %u with %u bits, capture with -f S32_LE\n", path, format, bits);
+        return -1;
+    }
+    if (capture->channels < 1 || capture->channels > GOLDEN_MAX_CHANNELS) {
+        printf("%s: %u channels, at most %d\n", path, capture->channels, GOLDEN_MAX_CHANNELS);
+        return -1;
+    }
+    return 0;
+}
+
+static void golden_close(struct golden_capture *capture) {
+    if (capture->map) {
+        munmap(capture->map, capture->map_size);
+        capture->map = NULL;
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * Model
+ *-------------------------------------------------------------------------*/
+
+static int32_t golden_sat24(int64_t value) {
+    if (value > GOLDEN_SAMPLE_MAX) {
+        return GOLDEN_SAMPLE_MAX;
+    }
+    if (value < GOLDEN_SAMPLE_MIN) {
+        return GOLDEN_SAMPLE_MIN;
+    }
+    return (int32_t)value;
+}
+
+/* Function to compute one output sample of the fixed-point model from
+ * 24-bit x[n] and x[n - delaym]. The operands of each product fit in 33
+ * and 24 bits, so every sum fits in int64 whatever the registers hold. */
+static int32_t golden_model(const struct combFilter_regs *regs, int32_t x, int32_t delayed) {
+    int32_t wet = golden_sat24(((int64_t)regs->b0 * x + (int64_t)regs->bm * delayed) >> COMBFILTER_GAIN_FRAC_BITS);
+    int64_t dry_gain = (int64_t)COMBFILTER_GAIN_ONE - regs->wetDryMix;
+    return golden_sat24((dry_gain * x + (int64_t)regs->wetDryMix * wet) >> COMBFILTER_GAIN_FRAC_BITS);
+}
+
+/* Function to get the 24-bit sample of a left-justified S32 word */
+static inline int32_t golden_sample(const struct golden_capture *capture, unsigned long frame, unsigned int ch) {
+    return capture->samples[frame * capture->channels + ch] >> 8;
+}
+
+/*-------------------------------------------------------------------------
+ * Comparison
+ *-------------------------------------------------------------------------*/
+
+/* Function to find the lag of the post tap that matches the model best,
+ * over GOLDEN_SEARCH_FRAMES frames starting at pre tap frame start. Lags are
+ * tried nearest first, so the smallest one wins a tie (e.g. silence). */
+static int golden_find_lag(const struct combFilter_regs *regs, const struct golden_capture *pre,
+                           const struct golden_capture *post, unsigned long start,
+                           long max_lag, long *lag) {
+    unsigned int channels = pre->channels;
+    unsigned long count = GOLDEN_SEARCH_FRAMES;
+
+    if (start + count > pre->frames) {
+        count = pre->frames > start ? pre->frames - start : 0;
+    }
+    if (count == 0) {
+        return -1;
+    }
+
+    int32_t *expected = malloc(sizeof(*expected) * count * channels);
+    if (!expected) {
+        perror("malloc");
+        return -1;
+    }
+    for (unsigned long i = 0; i < count; i++) {
+        unsigned long n = start + i;
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            expected[i * channels + ch] = golden_model(regs, golden_sample(pre, n, ch),
+                                                       golden_sample(pre, n - regs->delaym, ch));
+        }
+    }
+
+    uint64_t best_cost = UINT64_MAX;
+    int found = 0;
+    for (long step = 0; step <= 2 * max_lag; step++) {
+        long candidate = (step & 1) ? (step + 1) / 2 : -step / 2;
+        if ((long)start + candidate < 0 || start + candidate + count > post->frames) {
+            continue;
+        }
+        const int32_t *actual = post->samples + (start + candidate) * channels;
+        uint64_t cost = 0;
+        for (unsigned long i = 0; i < count * channels && cost < best_cost; i++) {
+            int32_t error = (actual[i] >> 8) - expected[i];
+            cost += error < 0 ? -(int64_t)error : error;
+        }
+        if (cost < best_cost) {
+            best_cost = cost;
+            *lag = candidate;
+            found = 1;
+            if (cost == 0) {
+                break;
+            }
+        }
+    }
+
+    free(expected);
+    return found ? 0 : -1;
+}
+
+/* Function to compare every frame both captures hold, from pre tap frame start */
+static void golden_compare(const struct combFilter_regs *regs, const struct golden_capture *pre,
+                           const struct golden_capture *post, unsigned long start,
+                           unsigned int tolerance, struct golden_report *report) {
+    unsigned int channels = pre->channels;
+    unsigned long end = pre->frames;
+    int32_t pre_or = 0;
+
+    if (report->lag < 0 && (unsigned long)-report->lag > start) {
+        start = -report->lag;
+    }
+    if ((long)end + report->lag > (long)post->frames) {
+        end = post->frames - report->lag;
+    }
+    report->first_frame = start;
+    report->first_mismatch_frame = -1;
+
+    for (unsigned long n = start; n < end; n++) {
+        const int32_t *actual = post->samples + (n + report->lag) * channels;
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            int32_t x = golden_sample(pre, n, ch);
+            int32_t y = golden_model(regs, x, golden_sample(pre, n - regs->delaym, ch));
+            int32_t got = actual[ch] >> 8;
+            int32_t error = got - y;
+            unsigned int magnitude = error < 0 ? -error : error;
+            unsigned int bucket = 0;
+
+            pre_or |= x;
+            while (bucket < GOLDEN_NUM_BUCKETS - 1 && magnitude > golden_bucket_max[bucket]) {
+                bucket++;
+            }
+            report->histogram[bucket]++;
+            if (magnitude == 0) {
+                continue;
+            }
+            report->sum_squares += (double)error * error;
+            if (magnitude > report->max_error) {
+                report->max_error = magnitude;
+                report->max_error_frame = n;
+            }
+            if (magnitude > tolerance) {
+                if (report->over_tolerance++ == 0) {
+                    report->first_mismatch_frame = n;
+                    report->first_mismatch_channel = ch;
+                    report->first_mismatch_expected = y;
+                    report->first_mismatch_actual = got;
+                }
+            }
+        }
+    }
+    report->frames = end > start ? end - start : 0;
+    report->pre_silent = pre_or == 0;
+}
+
+/* Function to print the report, returns the exit status */
+static int golden_print_report(const struct combFilter_regs *regs, const struct golden_capture *pre,
+                               const struct golden_report *report, unsigned int tolerance,
+                               int json, double elapsed_ms) {
+    uint64_t samples = (uint64_t)report->frames * pre->channels;
+    double rms = samples ? sqrt(report->sum_squares / samples) : 0.0;
+    double rms_db = rms > 0.0 ? 20.0 * log10(rms / (GOLDEN_SAMPLE_MAX + 1.0)) : -INFINITY;
+    int pass = samples > 0 && report->over_tolerance == 0 && !report->pre_silent;
+
+    if (json) {
+        printf("{\"pass\": %s, \"delaym\": %u, \"b0\": %u, \"bm\": %u, \"wetDryMix\": %u, "
+               "\"lag\": %ld, \"firstFrame\": %lu, \"frames\": %lu, \"channels\": %u, "
+               "\"tolerance\": %u, \"maxError\": %u, \"maxErrorFrame\": %lu, \"rmsError\": %.6f, "
+               "\"overTolerance\": %llu, \"firstMismatchFrame\": %ld, \"preSilent\": %s, \"histogram\": {",
+               pass ? "true" : "false", regs->delaym, regs->b0, regs->bm, regs->wetDryMix,
+               report->lag, report->first_frame, report->frames, pre->channels,
+               tolerance, report->max_error, report->max_error_frame, rms,
+               (unsigned long long)report->over_tolerance, report->first_mismatch_frame,
+               report->pre_silent ? "true" : "false");
+        for (int i = 0; i < GOLDEN_NUM_BUCKETS; i++) {
+            printf("%s\"%s\": %llu", i ? ", " : "", golden_bucket_name[i],
+                   (unsigned long long)report->histogram[i]);
+        }
+        printf("}, \"elapsedMs\": %.1f}\n", elapsed_ms);
+        return pass ? 0 : 1;
+    }
+
+    printf("Model: delaym %u, b0 %u, bm %u, wetDryMix %u\n", regs->delaym, regs->b0, regs->bm, regs->wetDryMix);
+    printf("Post tap lags the pre tap capture by %ld frames\n", report->lag);
+    printf("Compared %lu frames x %u channels (%.1f s) from frame %lu in %.1f ms\n",
+           report->frames, pre->channels, pre->rate ? (double)report->frames / pre->rate : 0.0,
+           report->first_frame, elapsed_ms);
+    printf("Max error %u LSB at frame %lu, RMS error %.4f LSB (%.1f dBFS)\n",
+           report->max_error, report->max_error_frame, rms, rms_db);
+    printf("|error| LSB:");
+    for (int i = 0; i < GOLDEN_NUM_BUCKETS; i++) {
+        printf(" %s=%llu", golden_bucket_name[i], (unsigned long long)report->histogram[i]);
+    }
+    printf("\n");
+    if (report->over_tolerance) {
+        printf("%llu samples over the %u LSB tolerance, first at frame %ld channel %u: expected %d, got %d\n",
+               (unsigned long long)report->over_tolerance, tolerance, report->first_mismatch_frame,
+               report->first_mismatch_channel, report->first_mismatch_expected, report->first_mismatch_actual);
+    }
+    if (report->pre_silent) {
+        printf("The pre tap capture is silent, nothing was tested\n");
+    }
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
+
+/*-------------------------------------------------------------------------
+ * Stimulus
+ *-------------------------------------------------------------------------*/
+
+static void golden_put_le16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void golden_put_le32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* Function to write stereo S32_LE white noise at -12 dBFS, the same hash
+ * as the simulated pre tap of combFilterPcm, 24 significant bits */
+static int golden_write_stimulus(const char *path, unsigned int seconds) {
+    const unsigned int channels = 2;
+    uint32_t frames = seconds * GOLDEN_STIMULUS_RATE;
+    uint32_t data_size = frames * channels * 4;
+    uint8_t header[44];
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        perror(path);
+        return -1;
+    }
+
+    memcpy(header, "RIFF", 4);
+    golden_put_le32(header + 4, 36 + data_size);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    golden_put_le32(header + 16, 16);
+    golden_put_le16(header + 20, WAV_FORMAT_PCM);
+    golden_put_le16(header + 22, channels);
+    golden_put_le32(header + 24, GOLDEN_STIMULUS_RATE);
+    golden_put_le32(header + 28, GOLDEN_STIMULUS_RATE * channels * 4);
+    golden_put_le16(header + 32, channels * 4);
+    golden_put_le16(header + 34, 32);
+    memcpy(header + 36, "data", 4);
+    golden_put_le32(header + 40, data_size);
+    fwrite(header, 1, sizeof(header), out);
+
+    for (uint32_t i = 0; i < frames * channels; i++) {
+        uint32_t x = i;
+        uint8_t sample[4];
+
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+        golden_put_le32(sample, (uint32_t)(((int32_t)x >> 2) & ~0xff));
+        fwrite(sample, 1, sizeof(sample), out);
+    }
+
+    if (fclose(out) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct combFilter_regs regs = { 0 };
+    const char *paths[2];
+    int num_paths = 0;
+    const char *stimulus_path = NULL;
+    unsigned int seconds = 10;
+    unsigned int tolerance = 0;
+    long max_lag = GOLDEN_DEFAULT_MAX_LAG;
+    unsigned long skip = 0;
+    int json = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "--", 2) != 0) {
+            if (num_paths == 2) {
+                printf("Give one pre tap and one post tap capture\n");
+                return 1;
+            }
+            paths[num_paths++] = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf("Missing argument for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--delaym") == 0) {
+            regs.delaym = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--b0") == 0) {
+            regs.b0 = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--bm") == 0) {
+            regs.bm = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--wetdrymix") == 0) {
+            regs.wetDryMix = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-lag") == 0) {
+            max_lag = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--skip") == 0) {
+            skip = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--stimulus") == 0) {
+            stimulus_path = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0) {
+            seconds = strtoul(argv[++i], NULL, 0);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (stimulus_path) {
+        if (seconds == 0 || seconds > 3600) {
+            printf("--seconds must be 1 to 3600\n");
+            return 1;
+        }
+        return golden_write_stimulus(stimulus_path, seconds) == 0 ? 0 : 1;
+    }
+    if (num_paths != 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (max_lag < 0) {
+        max_lag = 0;
+    }
+
+    struct golden_capture pre, post;
+    if (golden_open(paths[0], &pre) != 0 || golden_open(paths[1], &post) != 0) {
+        return 1;
+    }
+    if (pre.channels != post.channels || pre.rate != post.rate) {
+        printf("The captures differ: %u channels at %u Hz against %u channels at %u Hz\n",
+               pre.channels, pre.rate, post.channels, post.rate);
+        return 1;
+    }
+
+    /* x[n - delaym] has to be in the capture too */
+    unsigned long start = skip + regs.delaym;
+    struct golden_report report;
+    memset(&report, 0, sizeof(report));
+
+    int64_t start_us = golden_now_us();
+    if (golden_find_lag(&regs, &pre, &post, start + max_lag, max_lag, &report.lag) != 0) {
+        printf("The captures are too short for delaym %u and a lag of up to %ld frames\n",
+               regs.delaym, max_lag);
+        return 1;
+    }
+    golden_compare(&regs, &pre, &post, start, tolerance, &report);
+    double elapsed_ms = (golden_now_us() - start_us) / 1000.0;
+
+    int status = golden_print_report(&regs, &pre, &report, tolerance, json, elapsed_ms);
+    golden_close(&pre);
+    golden_close(&post);
+    return status;
+}
@@ -0,0 +1,474 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Prometheus text metrics for the combFilterProcessor
+ *              controller
+ *
+ * --metrics <[addr:]port|unix:path> opens a listening socket that answers
+ * GET /metrics with the Prometheus text exposition format: current
+ * register values, input and update counters, the write latency histogram
+ * of the coalescing layer, missed deadlines and the driver debug counters.
+ * The OSC and MIDI loops poll the socket next to their input, otherwise
+ * metrics_serve() runs a loop of its own. metrics_fd() is an epoll
+ * descriptor over the listening socket and the scrapers still sending
+ * their request, so a slow scraper is read a piece at a time and never
+ * blocks the loop.
+ *-------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "combFilterController.h"
+
+/* Largest response body, the exposition is well under this */
+#ifndef METRICS_MAX_BODY
+    #define METRICS_MAX_BODY 8192
+#endif
+
+/* How long a scraper may take to send its request */
+#ifndef METRICS_REQUEST_TIMEOUT_MS
+    #define METRICS_REQUEST_TIMEOUT_MS 100
+#endif
+
+/* Scrapers whose request is read at the same time */
+#ifndef METRICS_MAX_CLIENTS
+    #define METRICS_MAX_CLIENTS 4
+#endif
+
+/* Longest request line read, the rest of the request is ignored */
+#define METRICS_MAX_REQUEST 1024
+
+/* A scraper whose request is still being read */
+struct metrics_client {
+    int fd;                                 /* -1 for a free slot */
+    int64_t deadline_us;
+    int len;
+    char request[METRICS_MAX_REQUEST];
+};
+
+static const char *metrics_source_names[METRICS_NUM_SOURCES] = { "batch", "osc", "midi" };
+
+static int metrics_listen_fd = -1;
+static int metrics_epoll_fd = -1;
+static struct metrics_client metrics_clients[METRICS_MAX_CLIENTS];
+static struct combfilter *metrics_cf;
+static char metrics_unix_path[108];
+static unsigned long metrics_messages[METRICS_NUM_SOURCES];
+static unsigned long metrics_missed[METRICS_NUM_SOURCES];
+static unsigned long metrics_scrapes;
+static volatile sig_atomic_t metrics_stop;
+
+/* Response body being built, how much of it is used, and whether it overflowed */
+static char metrics_body[METRICS_MAX_BODY];
+static int metrics_len;
+static int metrics_truncated;
+
+/* Function to stop metrics_serve() on SIGINT/SIGTERM */
+static void metrics_signal_handler(int sig) {
+    (void)sig;
+    metrics_stop = 1;
+}
+
+/* Function to return a monotonic timestamp in microseconds */
+static int64_t metrics_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function to append formatted text to the response body. Text that does
+ * not fit is dropped whole and marks the body truncated, metrics_len never
+ * goes past what was written. */
+static void metrics_printf(const char *format, ...) {
+    va_list args;
+
+    if (metrics_truncated) {
+        return;
+    }
+    va_start(args, format);
+    int n = vsnprintf(metrics_body + metrics_len, METRICS_MAX_BODY - metrics_len, format, args);
+    va_end(args);
+    if (n < 0 || n >= METRICS_MAX_BODY - metrics_len) {
+        metrics_truncated = 1;
+        metrics_body[metrics_len] = '\0';
+        return;
+    }
+    metrics_len += n;
+}
+
+/* Function to append the HELP and TYPE lines of a metric */
+static void metrics_header(const char *name, const char *type, const char *help) {
+    metrics_printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Function to append the driver debug counters, one "<name> <value>" per line in sysfs */
+static void metrics_driver_stats() {
+    char buffer[512];
+    char name[64];
+    unsigned long value;
+
+    if (combfilter_read_stats(metrics_cf, buffer, sizeof(buffer)) != 0) {
+        return;
+    }
+
+    for (char *line = strtok(buffer, "\n"); line; line = strtok(NULL, "\n")) {
+        if (sscanf(line, "%63s %lu", name, &value) == 2) {
+            metrics_printf("# TYPE combfilter_driver_%s_total counter\ncombfilter_driver_%s_total %lu\n",
+                           name, name, value);
+        }
+    }
+}
+
+/* Function to build the exposition into metrics_body, -1 if it did not fit */
+static int metrics_build() {
+    struct combFilter_regs regs;
+    const struct coalesce_stats *stats = coalesce_get_stats();
+    static const unsigned int bounds[COALESCE_LATENCY_BUCKETS] = COALESCE_LATENCY_BOUNDS_US;
+
+    metrics_len = 0;
+    metrics_truncated = 0;
+
+    int up = combfilter_get(metrics_cf, &regs) == 0;
+    metrics_header("combfilter_up", "gauge", "Whether the driver register snapshot could be read.");
+    metrics_printf("combfilter_up %d\n", up);
+    if (up) {
+        unsigned int values[COMBFILTER_NUM_REGS] = { regs.delaym, regs.b0, regs.bm, regs.wetDryMix };
+        metrics_header("combfilter_register", "gauge", "Current register value.");
+        for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+            metrics_printf("combfilter_register{name=\"%s\"} %u\n", combfilter_register_name(i), values[i]);
+        }
+    }
+
+    metrics_header("combfilter_input_messages_total", "counter", "Register updates received per input.");
+    for (int i = 0; i < METRICS_NUM_SOURCES; i++) {
+        metrics_printf("combfilter_input_messages_total{source=\"%s\"} %lu\n", metrics_source_names[i], metrics_messages[i]);
+    }
+
+    metrics_header("combfilter_control_rate_hz", "gauge", "Control rate of the coalescing layer, 0 when unlimited.");
+    metrics_printf("combfilter_control_rate_hz %d\n", coalesce_rate());
+    metrics_header("combfilter_updates_total", "counter", "Register updates handed to the coalescing layer.");
+    metrics_printf("combfilter_updates_total %lu\n", stats->updates);
+    metrics_header("combfilter_updates_merged_total", "counter", "Updates overwritten before they were written.");
+    metrics_printf("combfilter_updates_merged_total %lu\n", stats->merged);
+    metrics_header("combfilter_registers_written_total", "counter", "Registers written to the driver.");
+    metrics_printf("combfilter_registers_written_total %lu\n", stats->written);
+    metrics_header("combfilter_write_errors_total", "counter", "Failed register writes.");
+    metrics_printf("combfilter_write_errors_total %lu\n", stats->errors);
+
+    metrics_header("combfilter_write_latency_seconds", "histogram", "Duration of one coalesced register write.");
+    unsigned long cumulative = 0;
+    for (int i = 0; i < COALESCE_LATENCY_BUCKETS; i++) {
+        cumulative += stats->latency[i];
+        metrics_printf("combfilter_write_latency_seconds_bucket{le=\"%g\"} %lu\n", bounds[i] / 1e6, cumulative);
+    }
+    cumulative += stats->latency[COALESCE_LATENCY_BUCKETS];
+    metrics_printf("combfilter_write_latency_seconds_bucket{le=\"+Inf\"} %lu\n", cumulative);
+    metrics_printf("combfilter_write_latency_seconds_sum %.6f\n", stats->latency_sum_us / 1e6);
+    metrics_printf("combfilter_write_latency_seconds_count %lu\n", stats->flushes);
+
+    metrics_header("combfilter_missed_deadlines_total", "counter",
+                   "Automation applied more than its tolerance after it was due.");
+    metrics_printf("combfilter_missed_deadlines_total{source=\"control_tick\"} %lu\n", stats->missed_ticks);
+    for (int i = 0; i < METRICS_NUM_SOURCES; i++) {
+        metrics_printf("combfilter_missed_deadlines_total{source=\"%s\"} %lu\n", metrics_source_names[i], metrics_missed[i]);
+    }
+
+    if (tempo_enabled()) {
+        const struct tempo_stats *tempo = tempo_get_stats();
+        metrics_header("combfilter_tempo_bpm", "gauge", "Tempo delaym follows, 0 until one is known.");
+        metrics_printf("combfilter_tempo_bpm %.3f\n", tempo_bpm());
+        metrics_header("combfilter_tempo_clock_ticks_total", "counter", "MIDI clock ticks received.");
+        metrics_printf("combfilter_tempo_clock_ticks_total %lu\n", tempo->clock_ticks);
+        metrics_header("combfilter_tempo_recomputes_total", "counter", "Delays recomputed for a new tempo or division.");
+        metrics_printf("combfilter_tempo_recomputes_total %lu\n", tempo->recomputes);
+        metrics_header("combfilter_tempo_delay_writes_total", "counter", "Recomputed delays that moved delaym and were written.");
+        metrics_printf("combfilter_tempo_delay_writes_total %lu\n", tempo->writes);
+    }
+
+    metrics_header("combfilter_scrapes_total", "counter", "Metrics requests answered.");
+    metrics_printf("combfilter_scrapes_total %lu\n", metrics_scrapes);
+
+    metrics_driver_stats();
+    return metrics_truncated ? -1 : 0;
+}
+
+/* Function to open the metrics socket, listen_spec is "[addr:]port" or "unix:path" */
+int metrics_open(struct combfilter *cf, const char *listen_spec) {
+    int sock;
+
+    metrics_cf = cf;
+
+    if (strncmp(listen_spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(listen_spec + 5) >= sizeof(addr.sun_path)) {
+            printf("Metrics socket path too long: %s\n", listen_spec + 5);
+            return -1;
+        }
+        strcpy(addr.sun_path, listen_spec + 5);
+        strcpy(metrics_unix_path, addr.sun_path);
+
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(addr.sun_path);
+        if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            perror("metrics socket");
+            printf("Failed to bind metrics socket %s\n", addr.sun_path);
+            if (sock >= 0) {
+                close(sock);
+            }
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        const char *port = strrchr(listen_spec, ':');
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (port) {
+            char host[64];
+            snprintf(host, sizeof(host), "%.*s", (int)(port - listen_spec), listen_spec);
+            if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+                printf("Invalid metrics address %s\n", host);
+                return -1;
+            }
+            port++;
+        } else {
+            port = listen_spec;
+        }
+        addr.sin_port = htons(atoi(port));
+
+        sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        if (sock >= 0) {
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        }
+        if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            perror("metrics socket");
+            printf("Failed to bind metrics socket to %s\n", listen_spec);
+            if (sock >= 0) {
+                close(sock);
+            }
+            return -1;
+        }
+    }
+
+    if (listen(sock, 4) != 0) {
+        perror("listen");
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = sock };
+    metrics_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (metrics_epoll_fd < 0 || epoll_ctl(metrics_epoll_fd, EPOLL_CTL_ADD, sock, &event) != 0) {
+        perror("epoll");
+        if (metrics_epoll_fd >= 0) {
+            close(metrics_epoll_fd);
+            metrics_epoll_fd = -1;
+        }
+        close(sock);
+        return -1;
+    }
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        metrics_clients[i].fd = -1;
+    }
+    metrics_listen_fd = sock;
+    printf("Metrics available on %s\n", listen_spec);
+    return 0;
+}
+
+/* Function to return the descriptor to poll() for POLLIN, -1 when metrics are off */
+int metrics_fd() {
+    return metrics_epoll_fd;
+}
+
+/* Function to count a register update received from an input */
+void metrics_count_message(enum metrics_source source) {
+    metrics_messages[source]++;
+}
+
+/* Function to count automation from an input applied later than its tolerance */
+void metrics_count_missed_deadline(enum metrics_source source) {
+    metrics_missed[source]++;
+}
+
+/* Function to stop reading a scraper's request and close its socket */
+static void metrics_drop(struct metrics_client *client) {
+    epoll_ctl(metrics_epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+}
+
+/* Function to answer a request. The response is far smaller than the
+ * socket send buffer, so the non-blocking sends do not come up short. */
+static void metrics_respond(struct metrics_client *client) {
+    static const char *not_found = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    static const char *too_large = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    char header[160];
+
+    if (strncmp(client->request, "GET /metrics", 12) != 0 && strncmp(client->request, "GET / ", 6) != 0) {
+        send(client->fd, not_found, strlen(not_found), MSG_NOSIGNAL);
+        return;
+    }
+
+    metrics_scrapes++;
+    if (metrics_build() != 0) {
+        /* A partial exposition would read as counters going missing */
+        send(client->fd, too_large, strlen(too_large), MSG_NOSIGNAL);
+        return;
+    }
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %d\r\n"
+                              "Connection: close\r\n\r\n", metrics_len);
+    send(client->fd, header, header_len, MSG_NOSIGNAL | MSG_MORE);
+    send(client->fd, metrics_body, metrics_len, MSG_NOSIGNAL);
+}
+
+/* Function to accept new scrapers. When every slot is taken, the one
+ * that has waited longest for its request is dropped. */
+static void metrics_accept() {
+    int fd;
+
+    while ((fd = accept4(metrics_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct metrics_client *client = &metrics_clients[0];
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (metrics_clients[i].fd < 0) {
+                client = &metrics_clients[i];
+                break;
+            }
+            if (metrics_clients[i].deadline_us < client->deadline_us) {
+                client = &metrics_clients[i];
+            }
+        }
+        if (client->fd >= 0) {
+            metrics_drop(client);
+        }
+
+        struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+        if (epoll_ctl(metrics_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->len = 0;
+        client->deadline_us = metrics_now_us() + METRICS_REQUEST_TIMEOUT_MS * 1000;
+    }
+}
+
+/* Function to read what a scraper has sent so far, answering once the
+ * request line is complete */
+static void metrics_read(struct metrics_client *client) {
+    ssize_t len = recv(client->fd, client->request + client->len,
+                       sizeof(client->request) - 1 - client->len, 0);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (len <= 0) {
+        metrics_drop(client);
+        return;
+    }
+    client->len += len;
+    client->request[client->len] = '\0';
+    if (strchr(client->request, '\n') || client->len == (int)sizeof(client->request) - 1) {
+        metrics_respond(client);
+        metrics_drop(client);
+    }
+}
+
+/* Function to accept pending scrapes and answer those whose request has
+ * arrived; never waits for a scraper */
+void metrics_handle() {
+    struct epoll_event events[METRICS_MAX_CLIENTS + 1];
+
+    int n = epoll_wait(metrics_epoll_fd, events, METRICS_MAX_CLIENTS + 1, 0);
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == metrics_listen_fd) {
+            metrics_accept();
+            continue;
+        }
+        for (int j = 0; j < METRICS_MAX_CLIENTS; j++) {
+            if (metrics_clients[j].fd == events[i].data.fd) {
+                metrics_read(&metrics_clients[j]);
+                break;
+            }
+        }
+    }
+
+    /* A scraper that is too slow loses its connection */
+    int64_t now = metrics_now_us();
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (metrics_clients[i].fd >= 0 && now > metrics_clients[i].deadline_us) {
+            metrics_drop(&metrics_clients[i]);
+        }
+    }
+}
+
+/* Function to answer scrapes until SIGINT/SIGTERM, for when no other input runs */
+int metrics_serve() {
+    struct sigaction sa;
+
+    /* No SA_RESTART, the signal has to interrupt poll() */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = metrics_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    fflush(stdout);
+
+    while (!metrics_stop) {
+        struct pollfd pfd = { .fd = metrics_epoll_fd, .events = POLLIN };
+        int timeout_ms = -1;
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (metrics_clients[i].fd >= 0) {
+                /* Wake up to drop a scraper that never finishes its request */
+                timeout_ms = METRICS_REQUEST_TIMEOUT_MS;
+            }
+        }
+        if (poll(&pfd, 1, timeout_ms) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+        metrics_handle();
+    }
+    return 0;
+}
+
+/* Function to close the metrics socket */
+void metrics_close() {
+    if (metrics_epoll_fd >= 0) {
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (metrics_clients[i].fd >= 0) {
+                metrics_drop(&metrics_clients[i]);
+            }
+        }
+        close(metrics_epoll_fd);
+        metrics_epoll_fd = -1;
+    }
+    if (metrics_listen_fd >= 0) {
+        close(metrics_listen_fd);
+        metrics_listen_fd = -1;
+    }
+    if (metrics_unix_path[0]) {
+        unlink(metrics_unix_path);
+        metrics_unix_path[0] = '\0';
+    }
+}
@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: MIDI control change input for the combFilterProcessor
+ *              controller
+ *
+ * Reads a raw MIDI device (/dev/snd/midiC<card>D<device>) and maps control
+ * change messages onto delaym, b0, bm and wetDryMix. Each mapping scales
+ * the 0-127 CC value into a register range along a lin, log or exp curve.
+ * A knob sweep sends hundreds of CCs per second, so values go through the
+ * coalescing layer: only the latest value of each register is written,
+ * once per control tick, and only the registers that changed. They go out
+ * together in one combfilter_write_span() call, which the driver applies
+ * under one lock hold.
+ * With --tempo-sync the MIDI clock drives delaym instead of a CC
+ * (combFilterTempo.c), and CC mappings onto delaym are ignored.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <math.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "combFilterController.h"
+
+#define MIDI_DEVICE_DIR "/dev/snd"
+#define MIDI_MAX_MAPPINGS 32
+#define MIDI_MAP_LINE_MAX 256
+
+/* Response curves, applied to the CC value scaled to 0..1 */
+enum midi_curve {
+    MIDI_CURVE_LIN,     /* straight line from min to max */
+    MIDI_CURVE_LOG,     /* audio taper, fine steps near min, 40 dB over the travel */
+    MIDI_CURVE_EXP      /* inverse of log, fine steps near max */
+};
+
+/* One CC to register mapping, table holds the register value for every CC value */
+struct midi_mapping {
+    int cc;
+    int channel;        /* 0-15, or -1 for any channel */
+    int reg;
+    unsigned int table[128];
+};
+
+struct midi_stats {
+    unsigned long bytes;
+    unsigned long ccs;
+    unsigned long mapped;
+    unsigned long errors;
+};
+
+static struct midi_mapping midi_map[MIDI_MAX_MAPPINGS];
+static int midi_num_mappings;
+static struct midi_stats midi_stats;
+static volatile sig_atomic_t midi_stop;
+
+/* Used when no map file is given, gains are 16-bit fractions */
+static const char *midi_default_map[] = {
+    "20 delaym 1 4800 log",
+    "21 b0 0 65535 lin",
+    "22 bm 0 65535 lin",
+    "23 wetDryMix 0 65535 lin",
+};
+
+/* Function to stop the MIDI loop on SIGINT/SIGTERM */
+static void midi_signal_handler(int sig) {
+    (void)sig;
+    midi_stop = 1;
+}
+
+/* Function to fill a mapping's table from its range and curve */
+static void midi_build_table(struct midi_mapping *mapping, unsigned int min, unsigned int max,
+                             enum midi_curve curve) {
+    for (int i = 0; i < 128; i++) {
+        double x = i / 127.0;
+        if (curve == MIDI_CURVE_LOG) {
+            x = (pow(10.0, 2.0 * x) - 1.0) / 99.0;
+        } else if (curve == MIDI_CURVE_EXP) {
+            x = log10(1.0 + 99.0 * x) / 2.0;
+        }
+        /* min may be above max to reverse the knob */
+        mapping->table[i] = (unsigned int)llround(min + ((double)max - (double)min) * x);
+    }
+}
+
+/* Function to parse one map line "<cc> <register> <min> <max> [curve] [channel]"
+ * Returns 1 for a mapping, 0 for a blank or comment line, -1 on error */
+static int midi_parse_mapping(const char *line, struct midi_mapping *mapping) {
+    char reg_name[32];
+    char curve_name[8] = "lin";
+    char channel_name[8] = "any";
+    unsigned int min;
+    unsigned int max;
+    int cc;
+
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '#' || *line == '\n' || *line == '\0') {
+        return 0;
+    }
+
+    int fields = sscanf(line, "%d %31s %u %u %7s %7s", &cc, reg_name, &min, &max, curve_name, channel_name);
+    if (fields < 4 || cc < 0 || cc > 127) {
+        return -1;
+    }
+
+    mapping->cc = cc;
+    mapping->reg = combfilter_register_index(reg_name);
+    if (mapping->reg < 0) {
+        return -1;
+    }
+
+    enum midi_curve curve;
+    if (strcmp(curve_name, "lin") == 0) {
+        curve = MIDI_CURVE_LIN;
+    } else if (strcmp(curve_name, "log") == 0) {
+        curve = MIDI_CURVE_LOG;
+    } else if (strcmp(curve_name, "exp") == 0) {
+        curve = MIDI_CURVE_EXP;
+    } else {
+        return -1;
+    }
+
+    if (strcmp(channel_name, "any") == 0) {
+        mapping->channel = -1;
+    } else {
+        mapping->channel = atoi(channel_name) - 1;
+        if (mapping->channel < 0 || mapping->channel > 15) {
+            return -1;
+        }
+    }
+
+    midi_build_table(mapping, min, max, curve);
+    return 1;
+}
+
+/* Function to load the CC map from a file, or the default map when path is NULL */
+static int midi_load_map(const char *map_path) {
+    char line[MIDI_MAP_LINE_MAX];
+    int line_number = 0;
+
+    midi_num_mappings = 0;
+    if (!map_path) {
+        for (size_t i = 0; i < sizeof(midi_default_map) / sizeof(midi_default_map[0]); i++) {
+            midi_parse_mapping(midi_default_map[i], &midi_map[midi_num_mappings++]);
+        }
+        return 0;
+    }
+
+    FILE *file = fopen(map_path, "r");
+    if (!file) {
+        perror("fopen");
+        printf("Failed to open MIDI map %s\n", map_path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        if (midi_num_mappings == MIDI_MAX_MAPPINGS) {
+            printf("%s:%d: more than %d mappings\n", map_path, line_number, MIDI_MAX_MAPPINGS);
+            fclose(file);
+            return -1;
+        }
+        int result = midi_parse_mapping(line, &midi_map[midi_num_mappings]);
+        if (result < 0) {
+            printf("%s:%d: expected <cc> <register> <min> <max> [lin|log|exp] [channel|any]\n",
+                   map_path, line_number);
+            fclose(file);
+            return -1;
+        }
+        midi_num_mappings += result;
+    }
+    fclose(file);
+    return 0;
+}
+
+/* Function to find the first raw MIDI device, returns 0 and its path in buffer */
+static int midi_find_device(char *buffer, size_t size) {
+    DIR *dir = opendir(MIDI_DEVICE_DIR);
+    struct dirent *entry;
+    int found = -1;
+
+    if (!dir) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "midiC", 5) == 0 &&
+            (found < 0 || strcmp(entry->d_name, buffer + strlen(MIDI_DEVICE_DIR) + 1) < 0)) {
+            snprintf(buffer, size, "%s/%s", MIDI_DEVICE_DIR, entry->d_name);
+            found = 0;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+/* Function to apply a control change to the registers pending for this tick */
+static void midi_control_change(int channel, int cc, int value) {
+    midi_stats.ccs++;
+    for (int i = 0; i < midi_num_mappings; i++) {
+        const struct midi_mapping *mapping = &midi_map[i];
+        if (mapping->cc == cc && (mapping->channel < 0 || mapping->channel == channel)) {
+            if (mapping->reg == COMBFILTER_DELAYM && tempo_enabled()) {
+                continue;
+            }
+            /* Last value wins, earlier CCs in the same tick are never written */
+            coalesce_set(mapping->reg, mapping->table[value]);
+            midi_stats.mapped++;
+            metrics_count_message(METRICS_SOURCE_MIDI);
+        }
+    }
+}
+
+/* Function to read MIDI control changes from device and drive the registers until SIGINT/SIGTERM */
+int midi_serve(struct combfilter *cf, const char *device, const char *map_path) {
+    char device_path[280];
+    unsigned char input[256];
+    struct sigaction sa;
+
+    /* Running status: the last status byte and the data bytes seen since */
+    unsigned char status = 0;
+    unsigned char data[2];
+    int data_count = 0;
+
+    if (midi_load_map(map_path) != 0) {
+        return -1;
+    }
+
+    if (!device) {
+        if (midi_find_device(device_path, sizeof(device_path)) != 0) {
+            printf("No raw MIDI device found in %s\n", MIDI_DEVICE_DIR);
+            return -1;
+        }
+        device = device_path;
+    }
+
+    int midi_fd = open(device, O_RDONLY | O_NONBLOCK);
+    if (midi_fd < 0) {
+        perror("open");
+        printf("Failed to open MIDI device %s\n", device);
+        return -1;
+    }
+
+    /* No SA_RESTART, the signal has to interrupt poll() */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = midi_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Reading MIDI from %s, %d mappings, control rate %d Hz\n", device, midi_num_mappings, coalesce_rate());
+    for (int i = 0; i < midi_num_mappings; i++) {
+        printf("  CC %d -> %s (%u..%u)\n", midi_map[i].cc, combfilter_register_name(midi_map[i].reg),
+               midi_map[i].table[0], midi_map[i].table[127]);
+    }
+    if (tempo_enabled()) {
+        printf("  MIDI clock -> delaym (tempo sync), delaym mappings ignored\n");
+    }
+    fflush(stdout);
+
+    while (!midi_stop) {
+        struct pollfd pfd[2] = {
+            { .fd = midi_fd, .events = POLLIN },
+            { .fd = metrics_fd(), .events = POLLIN },
+        };
+
+        /* With registers pending, wake up in time for the next tick */
+        int ready = poll(pfd, 2, coalesce_timeout_ms());
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            ssize_t len;
+            while ((len = read(midi_fd, input, sizeof(input))) > 0) {
+                /* Bytes of one read arrived together, one timestamp for their clock ticks */
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                midi_stats.bytes += len;
+                for (ssize_t i = 0; i < len; i++) {
+                    unsigned char byte = input[i];
+                    if (byte >= 0xF8) {
+                        /* Real-time messages (clock, start, stop) may appear anywhere */
+                        tempo_midi_realtime(byte, &now);
+                        continue;
+                    }
+                    if (byte & 0x80) {
+                        /* System common and SysEx cancel running status */
+                        status = byte < 0xF0 ? byte : 0;
+                        data_count = 0;
+                        continue;
+                    }
+                    if (!status) {
+                        continue;
+                    }
+                    data[data_count++] = byte;
+                    int needed = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+                    if (data_count < needed) {
+                        continue;
+                    }
+                    data_count = 0;
+                    if ((status & 0xF0) == 0xB0) {
+                        midi_control_change(status & 0x0F, data[0], data[1]);
+                    }
+                }
+            }
+            if (len == 0) {
+                printf("MIDI device %s closed\n", device);
+                break;
+            }
+        } else if (pfd[0].revents & (POLLERR | POLLHUP)) {
+            printf("MIDI device %s went away\n", device);
+            break;
+        }
+
+        if (coalesce_flush(cf, 0) < 0) {
+            perror("write registers");
+            midi_stats.errors++;
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            metrics_handle();
+        }
+    }
+    coalesce_flush(cf, 1);
+
+    printf("MIDI input stopped: %lu bytes, %lu control changes, %lu mapped, %lu errors\n",
+           midi_stats.bytes, midi_stats.ccs, midi_stats.mapped, midi_stats.errors);
+    coalesce_print_stats();
+    tempo_print_stats();
+    close(midi_fd);
+    return 0;
+}
@@ -0,0 +1,489 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: OSC (Open Sound Control) over UDP front end for the
+ *              combFilterProcessor controller
+ *
+ * Maps messages addressed to /comb/0/<register> (delaym, b0, bm, wetDryMix)
+ * with one int or float argument onto the driver. Single messages go
+ * through the coalescing layer and are written at the control rate.
+ * Bundles are held until their timetag and then applied as one ordered
+ * batch the driver writes under one lock hold, so every register a bundle
+ * sets changes at once and the ones it does not set are left alone.
+ * /comb/ping <int> is answered with /comb/pong <int> <messages
+ * applied>, which is what the combFilterOscTest client uses to measure
+ * latency and throughput. With --tempo-sync, /comb/tempo <bpm> and
+ * /comb/division <string> drive delaym as a note division (combFilterTempo.c)
+ * and /comb/0/delaym is ignored; inside a bundle they too wait for its
+ * timetag.
+ *-------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "combFilterController.h"
+
+#ifndef OSC_DEFAULT_PORT
+    #define OSC_DEFAULT_PORT 9000
+#endif
+
+/* Largest OSC packet accepted, desks send far smaller ones */
+#ifndef OSC_MAX_PACKET
+    #define OSC_MAX_PACKET 4096
+#endif
+
+/* Bundles waiting for their timetag */
+#ifndef OSC_MAX_PENDING
+    #define OSC_MAX_PENDING 64
+#endif
+
+/* A bundle applied later than this after its timetag counts as late */
+#ifndef OSC_LATE_US
+    #define OSC_LATE_US 1000
+#endif
+
+#define OSC_REGISTER_PREFIX "/comb/0/"
+#define OSC_PING_ADDRESS "/comb/ping"
+#define OSC_TEMPO_ADDRESS "/comb/tempo"
+#define OSC_DIVISION_ADDRESS "/comb/division"
+#define OSC_MAX_PINGS 8
+#define OSC_MAX_DEPTH 4
+
+/* Seconds between the NTP epoch (1900) used by timetags and the Unix epoch */
+#define NTP_UNIX_OFFSET 2208988800LL
+
+/* A bundle waiting for its timetag, nested bundles get their own entry */
+struct osc_pending {
+    int in_use;
+    int64_t due_us;
+    unsigned long sequence;
+    struct sockaddr_in from;
+    int len;
+    char data[OSC_MAX_PACKET];
+};
+
+/* Register values and pings collected from one bundle (or single message) */
+struct osc_update {
+    unsigned int values[COMBFILTER_NUM_REGS];
+    unsigned int dirty;
+    int32_t pings[OSC_MAX_PINGS];
+    int num_pings;
+    double bpm;                 /* 0 if the bundle sets no tempo */
+    char division[16];          /* empty if it sets no division */
+};
+
+struct osc_stats {
+    unsigned long packets;
+    unsigned long messages;
+    unsigned long bundles;
+    unsigned long late;
+    unsigned long dropped;
+    unsigned long errors;
+};
+
+static struct osc_pending osc_queue[OSC_MAX_PENDING];
+static unsigned long osc_sequence;
+static struct osc_stats osc_stats;
+static volatile sig_atomic_t osc_stop;
+
+/* Function to stop the server loop on SIGINT/SIGTERM */
+static void osc_signal_handler(int sig) {
+    (void)sig;
+    osc_stop = 1;
+}
+
+/* Function to return the wall clock in microseconds, timetags are wall clock */
+static int64_t osc_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function to read a big-endian 32-bit OSC value */
+static uint32_t osc_be32(const char *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return ntohl(value);
+}
+
+/* Function to convert an NTP timetag to microseconds, 0 means immediately */
+static int64_t osc_timetag_us(const char *data) {
+    uint64_t seconds = osc_be32(data);
+    uint64_t fraction = osc_be32(data + 4);
+
+    if (seconds == 0 && fraction == 1) {
+        return 0;
+    }
+    return ((int64_t)seconds - NTP_UNIX_OFFSET) * 1000000 + (int64_t)((fraction * 1000000) >> 32);
+}
+
+/* Function to return the padded length of the OSC string at data, or -1 */
+static int osc_string_len(const char *data, int len) {
+    int n = strnlen(data, len);
+    if (n >= len) {
+        return -1;
+    }
+    n = (n + 4) & ~3;
+    return n <= len ? n : -1;
+}
+
+/* Function to check whether an element is a bundle */
+static int osc_is_bundle(const char *data, int len) {
+    return len >= 16 && memcmp(data, "#bundle", 8) == 0;
+}
+
+/* Function to parse one OSC message into a register value, a tempo or a ping */
+static int osc_parse_message(const char *data, int len, struct osc_update *update) {
+    int address_len = osc_string_len(data, len);
+    if (address_len < 0 || data[0] != '/') {
+        return -1;
+    }
+    const char *types = data + address_len;
+    int types_len = osc_string_len(types, len - address_len);
+    if (types_len < 0 || types[0] != ',') {
+        return -1;
+    }
+    const char *args = types + types_len;
+    int args_len = len - address_len - types_len;
+
+    /* The first argument, int32 or float32, is the value */
+    int has_value = 0;
+    int32_t value = 0;
+    double number = 0.0;
+    if ((types[1] == 'i' || types[1] == 'f') && args_len >= 4) {
+        uint32_t raw = osc_be32(args);
+        if (types[1] == 'i') {
+            value = (int32_t)raw;
+            number = value;
+        } else {
+            float f;
+            memcpy(&f, &raw, sizeof(f));
+            if (f < 0.0f || f > 4294967295.0f) {
+                return -1;
+            }
+            value = (int32_t)(uint32_t)(f + 0.5f);
+            number = f;
+        }
+        has_value = 1;
+    }
+
+    if (strcmp(data, OSC_PING_ADDRESS) == 0) {
+        if (update->num_pings < OSC_MAX_PINGS) {
+            update->pings[update->num_pings++] = value;
+        }
+        return 0;
+    }
+
+    if (strcmp(data, OSC_TEMPO_ADDRESS) == 0) {
+        if (!has_value || !(number >= TEMPO_MIN_BPM && number <= TEMPO_MAX_BPM)) {
+            return -1;
+        }
+        update->bpm = number;
+        osc_stats.messages++;
+        metrics_count_message(METRICS_SOURCE_OSC);
+        return 0;
+    }
+
+    if (strcmp(data, OSC_DIVISION_ADDRESS) == 0) {
+        if (types[1] != 's' || osc_string_len(args, args_len) < 0 ||
+            strlen(args) >= sizeof(update->division)) {
+            return -1;
+        }
+        strcpy(update->division, args);
+        osc_stats.messages++;
+        metrics_count_message(METRICS_SOURCE_OSC);
+        return 0;
+    }
+
+    if (strncmp(data, OSC_REGISTER_PREFIX, strlen(OSC_REGISTER_PREFIX)) != 0 || !has_value) {
+        return -1;
+    }
+    int index = combfilter_register_index(data + strlen(OSC_REGISTER_PREFIX));
+    if (index < 0) {
+        return -1;
+    }
+
+    /* Last value wins when a bundle sets a register more than once */
+    update->values[index] = (uint32_t)value;
+    update->dirty |= 1u << index;
+    osc_stats.messages++;
+    metrics_count_message(METRICS_SOURCE_OSC);
+    return 0;
+}
+
+/* Function to collect the messages of a bundle, or a single message, into one update
+ * Nested bundles are skipped, they were queued for their own timetag on arrival */
+static void osc_collect(const char *data, int len, struct osc_update *update) {
+    if (!osc_is_bundle(data, len)) {
+        if (osc_parse_message(data, len, update) != 0) {
+            osc_stats.errors++;
+        }
+        return;
+    }
+
+    int pos = 16;
+    while (pos + 4 <= len) {
+        int size = (int32_t)osc_be32(data + pos);
+        pos += 4;
+        if (size <= 0 || size > len - pos || size % 4 != 0) {
+            osc_stats.errors++;
+            return;
+        }
+        if (!osc_is_bundle(data + pos, size) && osc_parse_message(data + pos, size, update) != 0) {
+            osc_stats.errors++;
+        }
+        pos += size;
+    }
+}
+
+/* Function to answer pings with /comb/pong <int> <messages applied> */
+static void osc_send_pongs(int sock, const struct sockaddr_in *to, const struct osc_update *update) {
+    char reply[24];
+
+    memset(reply, 0, sizeof(reply));
+    memcpy(reply, "/comb/pong", 10);
+    memcpy(reply + 12, ",ii", 3);
+    for (int i = 0; i < update->num_pings; i++) {
+        uint32_t value = htonl((uint32_t)update->pings[i]);
+        memcpy(reply + 16, &value, sizeof(value));
+        value = htonl((uint32_t)osc_stats.messages);
+        memcpy(reply + 20, &value, sizeof(value));
+        sendto(sock, reply, sizeof(reply), 0, (const struct sockaddr *)to, sizeof(*to));
+    }
+}
+
+/* Function to apply a bundle (or single message)
+ * Single messages are coalesced and written at the control rate. A bundle is
+ * written at once, so it lands at its timetag; the registers it sets go out
+ * in one batch the driver applies atomically, and the ones it does not set
+ * are left alone. A ping also flushes, so the pong reports
+ * what was applied. */
+static void osc_apply(struct combfilter *cf, int sock, const struct sockaddr_in *from, const char *data, int len) {
+    struct osc_update update;
+
+    memset(&update, 0, sizeof(update));
+    osc_collect(data, len, &update);
+
+    /* Tempo first, the delaym it yields goes out with the other registers */
+    if (update.division[0] && tempo_set_division(update.division) != 0) {
+        osc_stats.errors++;
+    }
+    if (update.bpm > 0.0) {
+        tempo_set_bpm(update.bpm);
+    }
+    if (tempo_enabled()) {
+        update.dirty &= ~(1u << COMBFILTER_DELAYM);
+    }
+
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        if (update.dirty & (1u << i)) {
+            coalesce_set(i, update.values[i]);
+        }
+    }
+    if ((osc_is_bundle(data, len) || update.num_pings) && coalesce_flush(cf, 1) < 0) {
+        perror("write registers");
+        osc_stats.errors++;
+    }
+
+    osc_send_pongs(sock, from, &update);
+}
+
+/* Function to queue a bundle for its timetag, nested bundles are queued separately */
+static int osc_queue_bundle(const char *data, int len, const struct sockaddr_in *from, int depth) {
+    if (depth > OSC_MAX_DEPTH) {
+        return -1;
+    }
+
+    int slot;
+    for (slot = 0; slot < OSC_MAX_PENDING; slot++) {
+        if (!osc_queue[slot].in_use) {
+            break;
+        }
+    }
+    if (slot == OSC_MAX_PENDING) {
+        osc_stats.dropped++;
+        return -1;
+    }
+
+    struct osc_pending *pending = &osc_queue[slot];
+    pending->in_use = 1;
+    pending->due_us = osc_timetag_us(data + 8);
+    pending->sequence = osc_sequence++;
+    pending->from = *from;
+    pending->len = len;
+    memcpy(pending->data, data, len);
+
+    int pos = 16;
+    while (pos + 4 <= len) {
+        int size = (int32_t)osc_be32(data + pos);
+        pos += 4;
+        if (size <= 0 || size > len - pos) {
+            break;
+        }
+        if (osc_is_bundle(data + pos, size)) {
+            osc_queue_bundle(data + pos, size, from, depth + 1);
+        }
+        pos += size;
+    }
+    return 0;
+}
+
+/* Function to find the pending bundle that is due first, returns its slot or -1 */
+static int osc_next_pending() {
+    int next = -1;
+    for (int i = 0; i < OSC_MAX_PENDING; i++) {
+        if (!osc_queue[i].in_use) {
+            continue;
+        }
+        if (next < 0 || osc_queue[i].due_us < osc_queue[next].due_us ||
+            (osc_queue[i].due_us == osc_queue[next].due_us && osc_queue[i].sequence < osc_queue[next].sequence)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+/* Function to apply every pending bundle whose timetag has passed, in timetag order */
+static void osc_apply_due(struct combfilter *cf, int sock) {
+    int next;
+    while ((next = osc_next_pending()) >= 0) {
+        struct osc_pending *pending = &osc_queue[next];
+        int64_t now = osc_now_us();
+        if (pending->due_us > now) {
+            break;
+        }
+        if (pending->due_us != 0 && now - pending->due_us > OSC_LATE_US) {
+            osc_stats.late++;
+            metrics_count_missed_deadline(METRICS_SOURCE_OSC);
+        }
+        osc_apply(cf, sock, &pending->from, pending->data, pending->len);
+        osc_stats.bundles++;
+        pending->in_use = 0;
+    }
+}
+
+/* Function to run the OSC server until SIGINT/SIGTERM */
+int osc_serve(struct combfilter *cf, int port) {
+    static char packet[OSC_MAX_PACKET];
+    struct sockaddr_in addr;
+    struct sigaction sa;
+
+    if (port <= 0) {
+        port = OSC_DEFAULT_PORT;
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    /* Give knob sweeps and test bursts room to queue while a write is in progress */
+    int rcvbuf = 256 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        printf("Failed to bind OSC server to UDP port %d\n", port);
+        close(sock);
+        return -1;
+    }
+
+    /* No SA_RESTART, the signal has to interrupt ppoll() */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = osc_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("OSC server listening on UDP port %d\n", port);
+    fflush(stdout);
+
+    while (!osc_stop) {
+        struct pollfd pfd[2] = {
+            { .fd = sock, .events = POLLIN },
+            { .fd = metrics_fd(), .events = POLLIN },
+        };
+        struct timespec timeout;
+        struct timespec *timeout_ptr = NULL;
+
+        /* Sleep until the next packet, bundle timetag or control tick, whichever is first */
+        int64_t wait_us = -1;
+        int next = osc_next_pending();
+        if (next >= 0) {
+            wait_us = osc_queue[next].due_us - osc_now_us();
+            if (wait_us < 0) {
+                wait_us = 0;
+            }
+        }
+        int flush_ms = coalesce_timeout_ms();
+        if (flush_ms >= 0 && (wait_us < 0 || flush_ms * 1000LL < wait_us)) {
+            wait_us = flush_ms * 1000LL;
+        }
+        if (wait_us >= 0) {
+            timeout.tv_sec = wait_us / 1000000;
+            timeout.tv_nsec = (wait_us % 1000000) * 1000;
+            timeout_ptr = &timeout;
+        }
+
+        if (ppoll(pfd, 2, timeout_ptr, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ppoll");
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            for (;;) {
+                struct sockaddr_in from;
+                socklen_t from_len = sizeof(from);
+                ssize_t len = recvfrom(sock, packet, sizeof(packet), MSG_DONTWAIT,
+                                       (struct sockaddr *)&from, &from_len);
+                if (len <= 0) {
+                    break;
+                }
+                osc_stats.packets++;
+                if (len % 4 != 0) {
+                    osc_stats.errors++;
+                } else if (osc_is_bundle(packet, len)) {
+                    osc_queue_bundle(packet, len, &from, 0);
+                } else {
+                    osc_apply(cf, sock, &from, packet, len);
+                }
+            }
+        }
+
+        osc_apply_due(cf, sock);
+        if (coalesce_flush(cf, 0) < 0) {
+            perror("write registers");
+            osc_stats.errors++;
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            metrics_handle();
+        }
+    }
+    coalesce_flush(cf, 1);
+
+    printf("OSC server stopped: %lu packets, %lu register messages, %lu bundles (%lu late), %lu dropped, %lu errors\n",
+           osc_stats.packets, osc_stats.messages, osc_stats.bundles, osc_stats.late,
+           osc_stats.dropped, osc_stats.errors);
+    coalesce_print_stats();
+    tempo_print_stats();
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Throughput and latency test client for the
+ *              combFilterController OSC server (--osc)
+ *
+ * Runs three tests against a server, normally over loopback on the board:
+ *   latency    /comb/ping round trips, one at a time
+ *   throughput a burst of register messages followed by a ping, the pong
+ *              reports how many of them the server applied
+ *   timetag    bundles scheduled --delay-ms ahead holding a register write
+ *              and a ping, reports how far after its timetag each applied
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* How long to wait for a pong before giving up */
+#ifndef PONG_TIMEOUT_MS
+    #define PONG_TIMEOUT_MS 2000
+#endif
+
+/* Seconds between the NTP epoch (1900) used by timetags and the Unix epoch */
+#define NTP_UNIX_OFFSET 2208988800LL
+
+/* Function to print usage instructions */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n", program_name);
+    printf("Options:\n");
+    printf("  --host <ip>          Server address (default 127.0.0.1)\n");
+    printf("  --port <port>        Server UDP port (default 9000)\n");
+    printf("  --pings <n>          Round trips for the latency and timetag tests (default 1000)\n");
+    printf("  --count <n>          Messages in the throughput burst (default 10000)\n");
+    printf("  --register <name>    Register written by the tests (default delaym)\n");
+    printf("  --value <value>      Value written, the same every time so the audio does not change (default 2400)\n");
+    printf("  --delay-ms <ms>      How far ahead timetag bundles are scheduled (default 20)\n");
+    printf("  -h, --help           Show this help message\n");
+}
+
+/* Function to return a timestamp in microseconds */
+int64_t now_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Function to append a padded OSC string, returns the new length */
+int osc_put_string(char *buffer, int len, const char *string) {
+    int n = strlen(string);
+    memset(buffer + len, 0, (n + 4) & ~3);
+    memcpy(buffer + len, string, n);
+    return len + ((n + 4) & ~3);
+}
+
+/* Function to append a big-endian 32-bit value, returns the new length */
+int osc_put_int(char *buffer, int len, uint32_t value) {
+    value = htonl(value);
+    memcpy(buffer + len, &value, sizeof(value));
+    return len + 4;
+}
+
+/* Function to build a message with one int argument, returns its length */
+int osc_message(char *buffer, const char *address, int32_t value) {
+    int len = osc_put_string(buffer, 0, address);
+    len = osc_put_string(buffer, len, ",i");
+    return osc_put_int(buffer, len, (uint32_t)value);
+}
+
+/* Function to wait for the pong answering ping seq, returns 0 and the server's message count */
+int wait_pong(int sock, int32_t seq, uint32_t *messages) {
+    char reply[64];
+    int64_t deadline = now_us(CLOCK_MONOTONIC) + PONG_TIMEOUT_MS * 1000LL;
+
+    for (;;) {
+        int64_t remaining = deadline - now_us(CLOCK_MONOTONIC);
+        if (remaining <= 0) {
+            return -1;
+        }
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        if (poll(&pfd, 1, (int)((remaining + 999) / 1000)) <= 0) {
+            return -1;
+        }
+        ssize_t len = recv(sock, reply, sizeof(reply), 0);
+        if (len != 24 || strcmp(reply, "/comb/pong") != 0) {
+            continue;
+        }
+        uint32_t value;
+        memcpy(&value, reply + 16, sizeof(value));
+        if ((int32_t)ntohl(value) != seq) {
+            continue;
+        }
+        memcpy(&value, reply + 20, sizeof(value));
+        *messages = ntohl(value);
+        return 0;
+    }
+}
+
+/* Function to compare two int64_t for qsort */
+int compare_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Function to print min/avg/p50/p99/max of a set of samples in microseconds */
+void print_stats(const char *name, int64_t *samples, int count) {
+    int64_t sum = 0;
+
+    if (count == 0) {
+        printf("%-10s no samples\n", name);
+        return;
+    }
+    qsort(samples, count, sizeof(samples[0]), compare_int64);
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    printf("%-10s n=%d min=%lld avg=%lld p50=%lld p99=%lld max=%lld us\n", name, count,
+           (long long)samples[0], (long long)(sum / count), (long long)samples[count / 2],
+           (long long)samples[(count * 99) / 100], (long long)samples[count - 1]);
+}
+
+/* Main function */
+int main(int argc, char *argv[]) {
+    const char *host = "127.0.0.1";
+    const char *reg = "delaym";
+    int port = 9000;
+    int pings = 1000;
+    int count = 10000;
+    int value = 2400;
+    int delay_ms = 20;
+    char address[64];
+    char buffer[256];
+    uint32_t messages_before;
+    uint32_t messages_after;
+    int32_t seq = 0;
+    int failed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            printf("Missing argument for %s\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--host") == 0) {
+            host = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pings") == 0) {
+            pings = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--count") == 0) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--register") == 0) {
+            reg = argv[++i];
+        } else if (strcmp(argv[i], "--value") == 0) {
+            value = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--delay-ms") == 0) {
+            delay_ms = atoi(argv[++i]);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (pings <= 0 || count <= 0) {
+        printf("--pings and --count must be positive\n");
+        return 1;
+    }
+    snprintf(address, sizeof(address), "/comb/0/%s", reg);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    if (sock < 0 || inet_pton(AF_INET, host, &server.sin_addr) != 1 ||
+        connect(sock, (struct sockaddr *)&server, sizeof(server)) != 0) {
+        perror("socket");
+        printf("Failed to set up a socket for %s:%d\n", host, port);
+        return 1;
+    }
+
+    int64_t *samples = malloc(pings * sizeof(int64_t));
+    if (!samples) {
+        printf("Failed to allocate %d samples\n", pings);
+        return 1;
+    }
+
+    /* Latency: one ping in flight at a time */
+    int received = 0;
+    for (int i = 0; i < pings; i++) {
+        int len = osc_message(buffer, "/comb/ping", ++seq);
+        int64_t start = now_us(CLOCK_MONOTONIC);
+        send(sock, buffer, len, 0);
+        if (wait_pong(sock, seq, &messages_before) == 0) {
+            samples[received++] = now_us(CLOCK_MONOTONIC) - start;
+        }
+    }
+    if (received == 0) {
+        printf("No answer from the OSC server at %s:%d\n", host, port);
+        return 1;
+    }
+    print_stats("latency", samples, received);
+    if (received != pings) {
+        printf("latency    %d of %d pings lost\n", pings - received, pings);
+        failed = 1;
+    }
+
+    /* Throughput: a burst of register writes, the trailing pong counts what arrived */
+    int len = osc_message(buffer, address, value);
+    int64_t start = now_us(CLOCK_MONOTONIC);
+    for (int i = 0; i < count; i++) {
+        while (send(sock, buffer, len, 0) < 0 && errno == ENOBUFS) {
+            usleep(100);
+        }
+    }
+    len = osc_message(buffer, "/comb/ping", ++seq);
+    send(sock, buffer, len, 0);
+    if (wait_pong(sock, seq, &messages_after) != 0) {
+        printf("throughput no pong after the burst\n");
+        failed = 1;
+    } else {
+        int64_t elapsed = now_us(CLOCK_MONOTONIC) - start;
+        uint32_t applied = messages_after - messages_before;
+        printf("throughput %d sent, %u applied in %lld us, %.0f messages/s\n", count, applied,
+               (long long)elapsed, applied * 1e6 / (elapsed > 0 ? elapsed : 1));
+        if (applied != (uint32_t)count) {
+            failed = 1;
+        }
+    }
+
+    /* Timetag: bundles due delay_ms ahead, lateness is pong arrival minus timetag */
+    received = 0;
+    for (int i = 0; i < pings; i++) {
+        char message[64];
+        int64_t due = now_us(CLOCK_REALTIME) + delay_ms * 1000LL;
+        uint64_t seconds = due / 1000000 + NTP_UNIX_OFFSET;
+        uint64_t fraction = ((uint64_t)(due % 1000000) << 32) / 1000000;
+
+        len = osc_put_string(buffer, 0, "#bundle");
+        len = osc_put_int(buffer, len, (uint32_t)seconds);
+        len = osc_put_int(buffer, len, (uint32_t)fraction);
+        int message_len = osc_message(message, address, value);
+        len = osc_put_int(buffer, len, message_len);
+        memcpy(buffer + len, message, message_len);
+        len += message_len;
+        message_len = osc_message(message, "/comb/ping", ++seq);
+        len = osc_put_int(buffer, len, message_len);
+        memcpy(buffer + len, message, message_len);
+        len += message_len;
+
+        send(sock, buffer, len, 0);
+        if (wait_pong(sock, seq, &messages_after) == 0) {
+            samples[received++] = now_us(CLOCK_REALTIME) - due;
+        }
+    }
+    print_stats("timetag", samples, received);
+    if (received != pings) {
+        printf("timetag    %d of %d bundles unanswered\n", pings - received, pings);
+        failed = 1;
+    }
+
+    free(samples);
+    close(sock);
+    return failed;
+}
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Work-stealing thread pool for the offline tools
+ *
+ * See combFilterPool.h. Shares are [next, end) ranges guarded by a mutex
+ * per thread; they only ever shrink or move to another thread, so once
+ * every share is empty all the work has been handed out.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "combFilterPool.h"
+
+struct pool_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;       /* guards next and end, the share not yet taken */
+    unsigned int next;
+    unsigned int end;
+    unsigned long steals;
+    int id;
+    struct pool *pool;
+};
+
+struct pool {
+    struct pool_worker *workers;
+    int num_workers;
+    unsigned int chunk;
+    pool_work_fn work;
+    void *context;
+};
+
+/* Function to return the number of online CPUs, the default thread count */
+int pool_default_threads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+/* Function to take the next chunk of a worker's own share, returns 0 when it is empty */
+static int pool_take(struct pool_worker *worker, unsigned int *first, unsigned int *end) {
+    pthread_mutex_lock(&worker->lock);
+    *first = worker->next;
+    *end = worker->end - worker->next > worker->pool->chunk ? worker->next + worker->pool->chunk : worker->end;
+    worker->next = *end;
+    pthread_mutex_unlock(&worker->lock);
+    return *first < *end;
+}
+
+/* Function to move the back half of the largest remaining share to an idle
+ * worker, returns 0 when no work is left anywhere */
+static int pool_steal(struct pool_worker *thief) {
+    struct pool *pool = thief->pool;
+    for (;;) {
+        struct pool_worker *victim = NULL;
+        unsigned int largest = 0;
+        for (int i = 0; i < pool->num_workers; i++) {
+            struct pool_worker *worker = &pool->workers[i];
+            if (worker == thief) {
+                continue;
+            }
+            pthread_mutex_lock(&worker->lock);
+            unsigned int remaining = worker->end - worker->next;
+            pthread_mutex_unlock(&worker->lock);
+            if (remaining > largest) {
+                largest = remaining;
+                victim = worker;
+            }
+        }
+        if (!victim) {
+            return 0;
+        }
+
+        /* The victim may have moved on since it was measured */
+        pthread_mutex_lock(&victim->lock);
+        unsigned int remaining = victim->end - victim->next;
+        unsigned int first = victim->end - (remaining + 1) / 2;
+        unsigned int end = victim->end;
+        victim->end = first;
+        pthread_mutex_unlock(&victim->lock);
+        if (first == end) {
+            continue;
+        }
+
+        pthread_mutex_lock(&thief->lock);
+        thief->next = first;
+        thief->end = end;
+        pthread_mutex_unlock(&thief->lock);
+        thief->steals++;
+        return 1;
+    }
+}
+
+/* Function run by each pool thread */
+static void *pool_worker_main(void *arg) {
+    struct pool_worker *worker = arg;
+    struct pool *pool = worker->pool;
+    unsigned int first, end;
+    do {
+        while (pool_take(worker, &first, &end)) {
+            for (unsigned int index = first; index < end; index++) {
+                pool->work(pool->context, worker->id, index);
+            }
+        }
+    } while (pool_steal(worker));
+    return NULL;
+}
+
+/* Function to run work() for every index on up to threads threads, returns
+ * once all of them are done */
+int pool_run(unsigned int count, int threads, unsigned int chunk,
+             pool_work_fn work, void *context, struct pool_stats *stats) {
+    struct pool pool = {
+        .num_workers = threads > 0 ? threads : 1,
+        .chunk = chunk > 0 ? chunk : 1,
+        .work = work,
+        .context = context,
+    };
+    pool.workers = calloc(pool.num_workers, sizeof(*pool.workers));
+    if (!pool.workers) {
+        perror("calloc");
+        return -1;
+    }
+
+    /* Equal contiguous shares to start with */
+    for (int i = 0; i < pool.num_workers; i++) {
+        struct pool_worker *worker = &pool.workers[i];
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->next = (unsigned int)((uint64_t)count * i / pool.num_workers);
+        worker->end = (unsigned int)((uint64_t)count * (i + 1) / pool.num_workers);
+        worker->id = i;
+        worker->pool = &pool;
+    }
+
+    int started = 0;
+    for (; started < pool.num_workers; started++) {
+        if (pthread_create(&pool.workers[started].thread, NULL, pool_worker_main, &pool.workers[started]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    /* Shares of threads that failed to start are stolen by the others */
+    for (int i = 0; i < started; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    if (stats) {
+        stats->threads = started;
+        stats->steals = 0;
+        for (int i = 0; i < pool.num_workers; i++) {
+            stats->steals += pool.workers[i].steals;
+        }
+    }
+    for (int i = 0; i < pool.num_workers; i++) {
+        pthread_mutex_destroy(&pool.workers[i].lock);
+    }
+    free(pool.workers);
+    return started > 0 ? 0 : -1;
+}
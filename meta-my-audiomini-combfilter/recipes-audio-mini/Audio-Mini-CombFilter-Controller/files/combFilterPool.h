@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Work-stealing thread pool for the offline tools
+ *              (combFilterFit, combFilterEngine --render)
+ *
+ * pool_run() calls work() once for every index in [0, count). Each thread
+ * starts with an equal contiguous share of the indexes and takes them in
+ * chunks; a thread whose share is empty steals the back half of the
+ * largest share left, so uneven items do not leave cores idle.
+ *-------------------------------------------------------------------------*/
+
+#ifndef COMBFILTERPOOL_H
+#define COMBFILTERPOOL_H
+
+/* worker is the calling thread's number, 0 to threads - 1 */
+typedef void (*pool_work_fn)(void *context, int worker, unsigned int index);
+
+struct pool_stats {
+    int threads;                /* threads that ran */
+    unsigned long steals;
+};
+
+int pool_default_threads(void);
+int pool_run(unsigned int count, int threads, unsigned int chunk,
+             pool_work_fn work, void *context, struct pool_stats *stats);
+
+#endif /* COMBFILTERPOOL_H */
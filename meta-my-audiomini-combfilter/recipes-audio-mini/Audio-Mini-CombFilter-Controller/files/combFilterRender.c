@@ -0,0 +1,764 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Offline batch rendering for the combFilterEngine
+ *              (combFilterEngine --render)
+ *
+ * Renders every input WAV file through every parameter set of a grid
+ * file with the engine's own signal path, so a render sounds exactly like
+ * the engine running live with those registers. Renders are independent
+ * and run on the work-stealing pool (combFilterPool.c), one per thread at
+ * a time. Inputs are memory mapped once and shared by all threads, and
+ * each output is written as it is filtered, so memory use does not grow
+ * with the length of the material.
+ *
+ * Every render is summarized in <out>/summary.csv: integrated loudness
+ * (ITU-R BS.1770 K-weighting and gating), peak, RMS, and the level in
+ * each octave band, so candidates can be ranked before listening.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "combFilterEngine.h"
+#include "combFilterPool.h"
+
+/* Frames filtered per engine call, larger than a live period since latency does not matter */
+#ifndef RENDER_PERIOD
+    #define RENDER_PERIOD 1024
+#endif
+
+/* Most parameter sets one grid file may expand to */
+#ifndef RENDER_MAX_SETS
+    #define RENDER_MAX_SETS 100000
+#endif
+
+/* stdio buffer of each output file */
+#ifndef RENDER_OUTPUT_BUFFER
+    #define RENDER_OUTPUT_BUFFER (256 * 1024)
+#endif
+
+/* Octave bands of the summary, centre frequencies in Hz */
+#define RENDER_NUM_BANDS 8
+static const double render_band_hz[RENDER_NUM_BANDS] = { 63, 125, 250, 500, 1000, 2000, 4000, 8000 };
+
+/* Levels below this are reported as this, in dB */
+#define RENDER_FLOOR_DB -120.0
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xfffe
+
+struct render_input {
+    const char *path;
+    void *map;
+    size_t map_size;
+    const uint8_t *data;        /* first sample frame */
+    unsigned long frames;
+    unsigned int format;        /* WAV_FORMAT_PCM or WAV_FORMAT_FLOAT */
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int bits;
+    unsigned int frame_bytes;
+};
+
+struct render_job_context {
+    const struct render_options *options;
+    struct render_input *inputs;
+    int num_inputs;
+    struct combFilter_regs *sets;
+    unsigned int num_sets;
+    FILE *summary;
+    pthread_mutex_t summary_lock;
+    unsigned long failed;
+};
+
+/* Second-order section, direct form I in double */
+struct render_biquad {
+    double b0, b1, b2, a1, a2;
+};
+
+struct render_biquad_state {
+    double x1, x2, y1, y2;
+};
+
+/* Loudness and spectrum of one render */
+struct render_meter {
+    unsigned int channels;
+    unsigned int block_frames;  /* 100 ms */
+    unsigned int block_fill;
+    struct render_biquad shelf, highpass, bands[RENDER_NUM_BANDS];
+    int num_bands;
+    struct render_biquad_state k_state[ENGINE_MAX_CHANNELS][2];
+    struct render_biquad_state band_state[ENGINE_MAX_CHANNELS][RENDER_NUM_BANDS];
+    double block_energy;        /* K-weighted energy of the current 100 ms block */
+    double *blocks;             /* mean square of every finished 100 ms block */
+    unsigned long num_blocks;
+    unsigned long max_blocks;
+    double sum_squares;
+    double band_squares[RENDER_NUM_BANDS];
+    int32_t peak;
+    unsigned long frames;
+};
+
+/*-------------------------------------------------------------------------
+ * Input files
+ *-------------------------------------------------------------------------*/
+
+static uint16_t render_le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t render_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Function to map a WAV file and find its format and sample data */
+static int render_open_input(const char *path, struct render_input *input) {
+    struct stat st;
+    memset(input, 0, sizeof(*input));
+    input->path = path;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+        printf("%s: not a WAV file\n", path);
+        close(fd);
+        return -1;
+    }
+    input->map_size = st.st_size;
+    input->map = mmap(NULL, input->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (input->map == MAP_FAILED) {
+        perror("mmap");
+        input->map = NULL;
+        return -1;
+    }
+    /* Every render reads the file front to back */
+    madvise(input->map, input->map_size, MADV_SEQUENTIAL);
+
+    const uint8_t *p = input->map;
+    const uint8_t *end = p + input->map_size;
+    if (memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+        printf("%s: not a WAV file\n", path);
+        return -1;
+    }
+
+    int have_format = 0;
+    for (p += 12; p + 8 <= end; ) {
+        uint32_t size = render_le32(p + 4);
+        const uint8_t *body = p + 8;
+        if (memcmp(p, "fmt ", 4) == 0 && size >= 16 && body + 16 <= end) {
+            input->format = render_le16(body);
+            input->channels = render_le16(body + 2);
+            input->rate = render_le32(body + 4);
+            input->bits = render_le16(body + 14);
+            if (input->format == WAV_FORMAT_EXTENSIBLE && size >= 26 && body + 26 <= end) {
+                input->format = render_le16(body + 24);     /* first two bytes of the sub-format GUID */
+            }
+            have_format = 1;
+        } else if (memcmp(p, "data", 4) == 0 && have_format) {
+            input->data = body;
+            /* Streamed WAVs may leave the size unset, the file then ends at the data */
+            if (size > (uint64_t)(end - body)) {
+                size = end - body;
+            }
+            input->frame_bytes = input->channels * (input->bits / 8);
+            input->frames = input->frame_bytes ? size / input->frame_bytes : 0;
+            break;
+        }
+        p = body + size + (size & 1);
+    }
+
+    if (!input->data) {
+        printf("%s: no fmt and data chunks\n", path);
+        return -1;
+    }
+    if (!((input->format == WAV_FORMAT_PCM && (input->bits == 16 || input->bits == 24 || input->bits == 32)) ||
+          (input->format == WAV_FORMAT_FLOAT && input->bits == 32))) {
+        printf("%s: unsupported format %u with %u bits, use 16/24/32-bit PCM or 32-bit float\n",
+               path, input->format, input->bits);
+        return -1;
+    }
+    if (input->channels < 1 || input->channels > ENGINE_MAX_CHANNELS || input->rate == 0) {
+        printf("%s: %u channels at %u Hz, the engine takes 1 to %d\n",
+               path, input->channels, input->rate, ENGINE_MAX_CHANNELS);
+        return -1;
+    }
+    return 0;
+}
+
+static void render_close_input(struct render_input *input) {
+    if (input->map) {
+        munmap(input->map, input->map_size);
+    }
+}
+
+/* Function to convert frames of an input to the engine's interleaved S32 */
+static void render_read_frames(const struct render_input *input, unsigned long first,
+                               unsigned int n, int32_t *frames) {
+    const uint8_t *p = input->data + first * input->frame_bytes;
+    unsigned int samples = n * input->channels;
+
+    switch (input->bits) {
+    case 16:
+        for (unsigned int i = 0; i < samples; i++, p += 2) {
+            frames[i] = (int32_t)((uint32_t)render_le16(p) << 16);
+        }
+        break;
+    case 24:
+        for (unsigned int i = 0; i < samples; i++, p += 3) {
+            frames[i] = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+        }
+        break;
+    default:
+        for (unsigned int i = 0; i < samples; i++, p += 4) {
+            uint32_t word = render_le32(p);
+            if (input->format == WAV_FORMAT_PCM) {
+                frames[i] = (int32_t)word;
+            } else {
+                float value;
+                memcpy(&value, &word, sizeof(value));
+                double scaled = value * 2147483648.0;
+                frames[i] = scaled >= 2147483647.0 ? INT32_MAX : scaled <= -2147483648.0 ? INT32_MIN : (int32_t)scaled;
+            }
+        }
+        break;
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * Output files
+ *-------------------------------------------------------------------------*/
+
+static void render_put16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void render_put32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/* Function to write a 44-byte WAV header in the input's format */
+static int render_write_header(FILE *out, const struct render_input *input, unsigned long frames) {
+    uint8_t header[44];
+    uint32_t data_bytes = frames * input->frame_bytes;
+
+    memcpy(header, "RIFF", 4);
+    render_put32(header + 4, 36 + data_bytes);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    render_put32(header + 16, 16);
+    render_put16(header + 20, input->format);
+    render_put16(header + 22, input->channels);
+    render_put32(header + 24, input->rate);
+    render_put32(header + 28, input->rate * input->frame_bytes);
+    render_put16(header + 32, input->frame_bytes);
+    render_put16(header + 34, input->bits);
+    memcpy(header + 36, "data", 4);
+    render_put32(header + 40, data_bytes);
+    return fwrite(header, sizeof(header), 1, out) == 1 ? 0 : -1;
+}
+
+/* Function to append frames to an output in the input's sample format */
+static int render_write_frames(FILE *out, const struct render_input *input,
+                               const int32_t *frames, unsigned int n, uint8_t *buffer) {
+    unsigned int samples = n * input->channels;
+    uint8_t *p = buffer;
+
+    switch (input->bits) {
+    case 16:
+        for (unsigned int i = 0; i < samples; i++, p += 2) {
+            render_put16(p, (uint32_t)frames[i] >> 16);
+        }
+        break;
+    case 24:
+        for (unsigned int i = 0; i < samples; i++, p += 3) {
+            uint32_t word = frames[i];
+            p[0] = word >> 8;
+            p[1] = word >> 16;
+            p[2] = word >> 24;
+        }
+        break;
+    default:
+        for (unsigned int i = 0; i < samples; i++, p += 4) {
+            uint32_t word = frames[i];
+            if (input->format == WAV_FORMAT_FLOAT) {
+                float value = frames[i] * (1.0f / 2147483648.0f);
+                memcpy(&word, &value, sizeof(word));
+            }
+            render_put32(p, word);
+        }
+        break;
+    }
+    return fwrite(buffer, p - buffer, 1, out) == 1 ? 0 : -1;
+}
+
+/*-------------------------------------------------------------------------
+ * Loudness and spectrum
+ *-------------------------------------------------------------------------*/
+
+/* Function to design the two BS.1770 K-weighting stages for any sample rate,
+ * these give the coefficients tabulated in the standard at 48 kHz */
+static void render_k_weighting(struct render_meter *meter, unsigned int rate) {
+    /* High shelf, +4 dB above about 1.7 kHz */
+    double q = 0.7071752369554196, fc = 1681.974450955533;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double k = tan(M_PI * fc / rate);
+    double a0 = 1.0 + k / q + k * k;
+    meter->shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    meter->shelf.b1 = 2.0 * (k * k - vh) / a0;
+    meter->shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    meter->shelf.a1 = 2.0 * (k * k - 1.0) / a0;
+    meter->shelf.a2 = (1.0 - k / q + k * k) / a0;
+
+    /* High pass at about 38 Hz, numerator 1, -2, 1 as in the standard */
+    q = 0.5003270373238773;
+    fc = 38.13547087602444;
+    k = tan(M_PI * fc / rate);
+    a0 = 1.0 + k / q + k * k;
+    meter->highpass.b0 = 1.0;
+    meter->highpass.b1 = -2.0;
+    meter->highpass.b2 = 1.0;
+    meter->highpass.a1 = 2.0 * (k * k - 1.0) / a0;
+    meter->highpass.a2 = (1.0 - k / q + k * k) / a0;
+}
+
+/* Function to design one octave wide band pass with 0 dB at its centre */
+static void render_band_pass(struct render_biquad *bq, double fc, unsigned int rate) {
+    double w0 = 2.0 * M_PI * fc / rate;
+    double alpha = sin(w0) / (2.0 * M_SQRT2);
+    double a0 = 1 + alpha;
+    bq->b0 = alpha / a0;
+    bq->b1 = 0.0;
+    bq->b2 = -alpha / a0;
+    bq->a1 = -2 * cos(w0) / a0;
+    bq->a2 = (1 - alpha) / a0;
+}
+
+static inline double render_biquad_run(const struct render_biquad *bq, struct render_biquad_state *s, double x) {
+    double y = bq->b0 * x + bq->b1 * s->x1 + bq->b2 * s->x2 - bq->a1 * s->y1 - bq->a2 * s->y2;
+    s->x2 = s->x1;
+    s->x1 = x;
+    s->y2 = s->y1;
+    s->y1 = y;
+    return y;
+}
+
+static int render_meter_init(struct render_meter *meter, const struct render_input *input) {
+    memset(meter, 0, sizeof(*meter));
+    meter->channels = input->channels;
+    meter->block_frames = input->rate / 10 > 0 ? input->rate / 10 : 1;
+    render_k_weighting(meter, input->rate);
+    /* Bands whose upper edge passes Nyquist are left out */
+    for (int b = 0; b < RENDER_NUM_BANDS && render_band_hz[b] * M_SQRT2 < input->rate / 2.0; b++) {
+        render_band_pass(&meter->bands[b], render_band_hz[b], input->rate);
+        meter->num_bands = b + 1;
+    }
+    meter->max_blocks = input->frames / meter->block_frames + 1;
+    meter->blocks = malloc(meter->max_blocks * sizeof(double));
+    return meter->blocks ? 0 : -1;
+}
+
+/* Function to measure n output frames */
+static void render_meter_add(struct render_meter *meter, const int32_t *frames, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        for (unsigned int ch = 0; ch < meter->channels; ch++) {
+            int32_t sample = frames[i * meter->channels + ch];
+            int32_t magnitude = sample == INT32_MIN ? INT32_MAX : (sample < 0 ? -sample : sample);
+            if (magnitude > meter->peak) {
+                meter->peak = magnitude;
+            }
+            double x = sample * (1.0 / 2147483648.0);
+            meter->sum_squares += x * x;
+
+            double k = render_biquad_run(&meter->highpass, &meter->k_state[ch][1],
+                                         render_biquad_run(&meter->shelf, &meter->k_state[ch][0], x));
+            meter->block_energy += k * k;
+
+            for (int b = 0; b < meter->num_bands; b++) {
+                double y = render_biquad_run(&meter->bands[b], &meter->band_state[ch][b], x);
+                meter->band_squares[b] += y * y;
+            }
+        }
+        if (++meter->block_fill == meter->block_frames) {
+            if (meter->num_blocks < meter->max_blocks) {
+                meter->blocks[meter->num_blocks++] = meter->block_energy / meter->block_frames;
+            }
+            meter->block_energy = 0.0;
+            meter->block_fill = 0;
+        }
+    }
+    meter->frames += n;
+}
+
+/* Function to compute the gated integrated loudness in LUFS: 400 ms blocks
+ * overlapping by 75 %, an absolute gate at -70 LUFS and a relative gate
+ * 10 LU below the loudness of the blocks that passed it */
+static double render_meter_loudness(const struct render_meter *meter) {
+    double threshold = pow(10.0, (-70.0 + 0.691) / 10.0);
+    double sum = 0.0;
+    unsigned long count = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        double gated_sum = 0.0;
+        unsigned long gated_count = 0;
+        for (unsigned long i = 3; i < meter->num_blocks; i++) {
+            double z = (meter->blocks[i - 3] + meter->blocks[i - 2] + meter->blocks[i - 1] + meter->blocks[i]) / 4.0;
+            if (z > threshold) {
+                gated_sum += z;
+                gated_count++;
+            }
+        }
+        if (gated_count == 0) {
+            return RENDER_FLOOR_DB;
+        }
+        sum = gated_sum;
+        count = gated_count;
+        /* Relative gate for the second pass */
+        threshold = sum / count * pow(10.0, -10.0 / 10.0);
+    }
+    return -0.691 + 10.0 * log10(sum / count);
+}
+
+static double render_db(double power) {
+    return power > 0.0 ? fmax(10.0 * log10(power), RENDER_FLOOR_DB) : RENDER_FLOOR_DB;
+}
+
+/*-------------------------------------------------------------------------
+ * Parameter grid
+ *-------------------------------------------------------------------------*/
+
+/* Function to expand one grid field, a value, a list a,b,c or a range
+ * start:stop:step, returns the number of values or -1 */
+static int render_parse_field(const char *field, unsigned int *values, int max_values) {
+    char *end;
+    int count = 0;
+
+    if (strchr(field, ':')) {
+        unsigned long start = strtoul(field, &end, 0);
+        if (*end != ':') {
+            return -1;
+        }
+        unsigned long stop = strtoul(end + 1, &end, 0);
+        unsigned long step = 1;
+        if (*end == ':') {
+            step = strtoul(end + 1, &end, 0);
+        }
+        if (*end != '\0' || step == 0 || stop < start) {
+            return -1;
+        }
+        for (unsigned long value = start; value <= stop; value += step) {
+            if (count == max_values) {
+                return -1;
+            }
+            values[count++] = value;
+        }
+        return count;
+    }
+
+    const char *p = field;
+    for (;;) {
+        if (count == max_values) {
+            return -1;
+        }
+        values[count++] = strtoul(p, &end, 0);
+        if (end == p || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        if (*end == '\0') {
+            return count;
+        }
+        p = end + 1;
+    }
+}
+
+/* Function to read a grid file, every line gives delaym b0 bm wetDryMix
+ * and stands for all combinations of its values */
+static struct combFilter_regs *render_parse_grid(const char *path, unsigned int max_delaym, unsigned int *num_sets) {
+    FILE *file = fopen(path, "r");
+    char line[512];
+    int line_number = 0;
+    unsigned int count = 0;
+    struct combFilter_regs *sets = NULL;
+    unsigned int (*values)[RENDER_MAX_SETS] = NULL;
+
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    sets = malloc(RENDER_MAX_SETS * sizeof(*sets));
+    values = malloc(COMBFILTER_NUM_REGS * sizeof(*values));
+    if (!sets || !values) {
+        goto fail;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        int lengths[COMBFILTER_NUM_REGS];
+        char *fields[COMBFILTER_NUM_REGS + 1];
+        int num_fields = 0;
+
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        for (char *token = strtok(line, " \t\r\n"); token && num_fields <= COMBFILTER_NUM_REGS;
+             token = strtok(NULL, " \t\r\n")) {
+            fields[num_fields++] = token;
+        }
+        if (num_fields == 0) {
+            continue;
+        }
+        if (num_fields != COMBFILTER_NUM_REGS) {
+            printf("%s:%d: expected <delaym> <b0> <bm> <wetDryMix>\n", path, line_number);
+            goto fail;
+        }
+
+        unsigned long combinations = 1;
+        for (int r = 0; r < COMBFILTER_NUM_REGS; r++) {
+            lengths[r] = render_parse_field(fields[r], values[r], RENDER_MAX_SETS);
+            if (lengths[r] < 0) {
+                printf("%s:%d: bad value, list or range \"%s\"\n", path, line_number, fields[r]);
+                goto fail;
+            }
+            combinations *= lengths[r];
+            if (combinations > RENDER_MAX_SETS - count) {
+                printf("%s:%d: more than %d parameter sets\n", path, line_number, RENDER_MAX_SETS);
+                goto fail;
+            }
+        }
+        for (int i = 0; i < lengths[0]; i++) {
+            if (values[0][i] > max_delaym) {
+                printf("%s:%d: delaym %u is longer than the delay line (--max-delaym %u)\n",
+                       path, line_number, values[0][i], max_delaym);
+                goto fail;
+            }
+        }
+
+        for (unsigned long c = 0; c < combinations; c++) {
+            unsigned long rest = c;
+            unsigned int regs[COMBFILTER_NUM_REGS];
+            for (int r = COMBFILTER_NUM_REGS - 1; r >= 0; r--) {
+                regs[r] = values[r][rest % lengths[r]];
+                rest /= lengths[r];
+            }
+            sets[count] = (struct combFilter_regs){ regs[0], regs[1], regs[2], regs[3], count };
+            count++;
+        }
+    }
+    fclose(file);
+    free(values);
+
+    if (count == 0) {
+        printf("%s: no parameter sets\n", path);
+        free(sets);
+        return NULL;
+    }
+    *num_sets = count;
+    return sets;
+
+fail:
+    fclose(file);
+    free(values);
+    free(sets);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------
+ * Rendering
+ *-------------------------------------------------------------------------*/
+
+/* Function to build the output path <out>/<input name without .wav>.<set>.wav */
+static void render_output_path(char *buffer, size_t size, const char *out_dir, const char *input, unsigned int set) {
+    const char *name = strrchr(input, '/');
+    name = name ? name + 1 : input;
+    int length = strlen(name);
+    if (length > 4 && strcasecmp(name + length - 4, ".wav") == 0) {
+        length -= 4;
+    }
+    snprintf(buffer, size, "%s/%.*s.%04u.wav", out_dir, length, name, set);
+}
+
+/* Function to render one input through one parameter set, run on the pool */
+static void render_job(void *arg, int worker, unsigned int index) {
+    struct render_job_context *ctx = arg;
+    const struct render_options *options = ctx->options;
+    const struct render_input *input = &ctx->inputs[index / ctx->num_sets];
+    const struct combFilter_regs *regs = &ctx->sets[index % ctx->num_sets];
+    struct engine_state st;
+    struct render_meter meter;
+    char path[PATH_MAX];
+    FILE *out = NULL;
+    uint8_t *buffer = NULL;
+    char *out_buffer = NULL;
+    int failed = 0;
+    (void)worker;
+
+    if (engine_state_init(&st, input->channels, RENDER_PERIOD, options->max_delaym) != 0) {
+        printf("%s: failed to allocate the delay lines\n", input->path);
+        pthread_mutex_lock(&ctx->summary_lock);
+        ctx->failed++;
+        pthread_mutex_unlock(&ctx->summary_lock);
+        return;
+    }
+    /* The whole render uses one register set, no ramp from the dry signal */
+    engine_set_registers(&st, regs);
+
+    if (render_meter_init(&meter, input) != 0) {
+        failed = 1;
+    }
+    render_output_path(path, sizeof(path), options->out_dir, input->path, regs->generation);
+    if (!failed && !options->summary_only) {
+        buffer = malloc(RENDER_PERIOD * input->frame_bytes);
+        out_buffer = malloc(RENDER_OUTPUT_BUFFER);
+        out = fopen(path, "wb");
+        if (!buffer || !out_buffer || !out) {
+            perror(path);
+            failed = 1;
+        } else {
+            setvbuf(out, out_buffer, _IOFBF, RENDER_OUTPUT_BUFFER);
+            failed = render_write_header(out, input, input->frames) != 0;
+        }
+    }
+
+    for (unsigned long frame = 0; !failed && frame < input->frames; frame += RENDER_PERIOD) {
+        unsigned int n = input->frames - frame < RENDER_PERIOD ? input->frames - frame : RENDER_PERIOD;
+        render_read_frames(input, frame, n, st.frames);
+        engine_process(&st, NULL, n);
+        render_meter_add(&meter, st.frames, n);
+        if (out && render_write_frames(out, input, st.frames, n, buffer) != 0) {
+            perror(path);
+            failed = 1;
+        }
+    }
+    if (out && fclose(out) != 0 && !failed) {
+        perror(path);
+        failed = 1;
+    }
+
+    pthread_mutex_lock(&ctx->summary_lock);
+    if (failed) {
+        ctx->failed++;
+    } else {
+        double samples = (double)meter.frames * meter.channels;
+        fprintf(ctx->summary, "%s,%u,%u,%u,%u,%u,%.2f,%.2f,%.2f", input->path, regs->generation,
+                regs->delaym, regs->b0, regs->bm, regs->wetDryMix, render_meter_loudness(&meter),
+                render_db((double)meter.peak * meter.peak / (2147483648.0 * 2147483648.0)),
+                render_db(samples > 0 ? meter.sum_squares / samples : 0.0));
+        for (int b = 0; b < RENDER_NUM_BANDS; b++) {
+            fprintf(ctx->summary, ",%.2f",
+                    render_db(b < meter.num_bands && samples > 0 ? meter.band_squares[b] / samples : 0.0));
+        }
+        fprintf(ctx->summary, "\n");
+        fflush(ctx->summary);
+    }
+    pthread_mutex_unlock(&ctx->summary_lock);
+
+    free(meter.blocks);
+    free(buffer);
+    free(out_buffer);
+    engine_state_free(&st);
+}
+
+/* Function to render every input through every parameter set of the grid */
+int engine_render(const struct render_options *options, char **inputs, int num_inputs) {
+    struct render_job_context ctx = { .options = options, .num_inputs = num_inputs };
+    char path[PATH_MAX];
+    int result = 1;
+
+    if (num_inputs == 0) {
+        printf("--render needs at least one input WAV file\n");
+        return 1;
+    }
+    ctx.sets = render_parse_grid(options->grid_path, options->max_delaym, &ctx.num_sets);
+    if (!ctx.sets) {
+        return 1;
+    }
+    if ((uint64_t)ctx.num_sets * num_inputs > UINT32_MAX) {
+        printf("Too many renders\n");
+        free(ctx.sets);
+        return 1;
+    }
+
+    ctx.inputs = calloc(num_inputs, sizeof(*ctx.inputs));
+    if (!ctx.inputs) {
+        free(ctx.sets);
+        return 1;
+    }
+    for (int i = 0; i < num_inputs; i++) {
+        if (render_open_input(inputs[i], &ctx.inputs[i]) != 0) {
+            goto out;
+        }
+    }
+
+    if (mkdir(options->out_dir, 0755) != 0 && errno != EEXIST) {
+        perror(options->out_dir);
+        goto out;
+    }
+    snprintf(path, sizeof(path), "%s/summary.csv", options->out_dir);
+    ctx.summary = fopen(path, "w");
+    if (!ctx.summary) {
+        perror(path);
+        goto out;
+    }
+    fprintf(ctx.summary, "input,set,delaym,b0,bm,wetDryMix,loudness_lufs,peak_dbfs,rms_dbfs");
+    for (int b = 0; b < RENDER_NUM_BANDS; b++) {
+        fprintf(ctx.summary, ",band_%.0fhz_db", render_band_hz[b]);
+    }
+    fprintf(ctx.summary, "\n");
+    pthread_mutex_init(&ctx.summary_lock, NULL);
+
+    printf("Rendering %d files x %u parameter sets on %d threads into %s\n",
+           num_inputs, ctx.num_sets, options->threads, options->out_dir);
+    fflush(stdout);
+
+    struct timespec start, stop;
+    struct pool_stats stats;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* One render is a long item, hand them out one at a time */
+    if (pool_run(num_inputs * ctx.num_sets, options->threads, 1, render_job, &ctx, &stats) != 0) {
+        fclose(ctx.summary);
+        pthread_mutex_destroy(&ctx.summary_lock);
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    double audio_seconds = 0.0;
+    for (int i = 0; i < num_inputs; i++) {
+        audio_seconds += (double)ctx.inputs[i].frames / ctx.inputs[i].rate;
+    }
+
+    printf("Rendered %lu of %u in %.2f s, %.0fx real time, %lu steals, summary in %s\n",
+           (unsigned long)num_inputs * ctx.num_sets - ctx.failed, num_inputs * ctx.num_sets, seconds,
+           seconds > 0 ? audio_seconds * ctx.num_sets / seconds : 0.0, stats.steals, path);
+    fclose(ctx.summary);
+    pthread_mutex_destroy(&ctx.summary_lock);
+    result = ctx.failed ? 1 : 0;
+
+out:
+    for (int i = 0; i < num_inputs; i++) {
+        render_close_input(&ctx.inputs[i]);
+    }
+    free(ctx.inputs);
+    free(ctx.sets);
+    return result;
+}
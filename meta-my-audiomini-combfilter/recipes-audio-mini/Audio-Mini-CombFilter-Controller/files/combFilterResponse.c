@@ -0,0 +1,290 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Frequency response of the programmed comb filter, part of
+ *              libcombfilter (combfilter_response())
+ *
+ * With the register formats from combFilter.h the filter is
+ *   H(f) = g_dry + g_del * exp(-j * 2 * pi * f * delaym / fs)
+ *   g_dry = (1 - wetDryMix) + wetDryMix * b0,  g_del = wetDryMix * bm
+ * response_get() evaluates it on a linear grid from 0 Hz to fs / 2 and
+ * keeps the result in the handle's response_state. It is only recomputed
+ * when the registers, the sample rate or the grid change, so a UI may
+ * call it on every redraw. The exp() term depends on delaym alone and is
+ * kept separately, a gain or mix change only redoes the cheap part.
+ *
+ * The grid is processed four points at a time with GCC vector types,
+ * which become NEON on the Cortex-A9. sin, atan2 and log10 are
+ * polynomial approximations, accurate to better than 1e-5 (about
+ * -100 dB), far below what a plot shows.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "libcombfilter.h"
+#include "combFilterResponse.h"
+
+/* Lowest magnitude reported, an exact notch would be -inf dB */
+#ifndef RESPONSE_FLOOR_DB
+    #define RESPONSE_FLOOR_DB -120.0f
+#endif
+
+typedef float response_v4f __attribute__((vector_size(16)));
+typedef int32_t response_v4i __attribute__((vector_size(16)));
+
+#define RESPONSE_LANES 4
+#define RESPONSE_PI 3.14159265358979f
+
+struct response_state {
+    struct combfilter_response result;
+    unsigned int capacity;      /* grid points the arrays hold, a multiple of RESPONSE_LANES */
+    float *arrays;              /* one allocation for all the per-point arrays below */
+    float *cos_delay;           /* cos and sin of 2 * pi * f * delaym / fs, */
+    float *sin_delay;           /* valid while basis_valid is set */
+    float *freq_hz;
+    float *mag_db;
+    float *phase_rad;
+    int basis_valid;
+    int result_valid;
+};
+
+/*-------------------------------------------------------------------------
+ * Vector helpers, 4 grid points per call
+ *-------------------------------------------------------------------------*/
+
+/* Function to pick a where mask is set, b elsewhere */
+static inline response_v4f response_select(response_v4i mask, response_v4f a, response_v4f b) {
+    return (response_v4f)((mask & (response_v4i)a) | (~mask & (response_v4i)b));
+}
+
+static inline response_v4f response_splat(float value) {
+    return (response_v4f){ value, value, value, value };
+}
+
+static inline response_v4f response_abs(response_v4f x) {
+    return (response_v4f)((response_v4i)x & 0x7fffffff);
+}
+
+/* Function to compute sin(2 * pi * t) for t in [-0.5, 0.5) */
+static inline response_v4f response_sin_turns(response_v4f t) {
+    /* sin(pi - x) = sin(x) folds t into [-0.25, 0.25] */
+    t = response_select(t > 0.25f, 0.5f - t, t);
+    t = response_select(t < -0.25f, -0.5f - t, t);
+
+    response_v4f x = t * (2.0f * RESPONSE_PI);
+    response_v4f x2 = x * x;
+    response_v4f p = response_splat(1.0f / 362880.0f);
+    p = p * x2 - 1.0f / 5040.0f;
+    p = p * x2 + 1.0f / 120.0f;
+    p = p * x2 - 1.0f / 6.0f;
+    p = p * x2 + 1.0f;
+    return p * x;
+}
+
+/* Function to compute atan2(y, x) */
+static inline response_v4f response_atan2(response_v4f y, response_v4f x) {
+    response_v4f ax = response_abs(x);
+    response_v4f ay = response_abs(y);
+    response_v4i y_larger = ay > ax;
+    response_v4f num = response_select(y_larger, ax, ay);
+    response_v4f den = response_select(y_larger, ay, ax);
+    den = response_select(den == 0.0f, response_splat(1.0f), den);
+
+    /* atan(a) for a in [0, 1] */
+    response_v4f a = num / den;
+    response_v4f a2 = a * a;
+    response_v4f p = response_splat(-0.0117212f);
+    p = p * a2 + 0.05265332f;
+    p = p * a2 - 0.11643287f;
+    p = p * a2 + 0.19354346f;
+    p = p * a2 - 0.33262347f;
+    p = p * a2 + 0.99997726f;
+    p = p * a;
+
+    p = response_select(y_larger, 0.5f * RESPONSE_PI - p, p);
+    p = response_select(x < 0.0f, RESPONSE_PI - p, p);
+    return (response_v4f)((response_v4i)p | ((y != 0.0f) & (response_v4i)y & (int32_t)0x80000000));
+}
+
+/* Function to compute 10 * log10(power) in dB, floored at RESPONSE_FLOOR_DB */
+static inline response_v4f response_power_db(response_v4f power) {
+    static const float floor_power = 1e-12f;   /* RESPONSE_FLOOR_DB */
+    response_v4i low = power < floor_power;
+    power = response_select(low, response_splat(floor_power), power);
+
+    /* power = m * 2^e with m in [1, 2), ln(m) = 2 * atanh((m - 1) / (m + 1)) */
+    response_v4i bits = (response_v4i)power;
+    response_v4f e = __builtin_convertvector(((bits >> 23) & 0xff) - 127, response_v4f);
+    response_v4f m = (response_v4f)((bits & 0x007fffff) | 0x3f800000);
+    response_v4f z = (m - 1.0f) / (m + 1.0f);
+    response_v4f z2 = z * z;
+    response_v4f p = response_splat(1.0f / 9.0f);
+    p = p * z2 + 1.0f / 7.0f;
+    p = p * z2 + 1.0f / 5.0f;
+    p = p * z2 + 1.0f / 3.0f;
+    p = p * z2 + 1.0f;
+    response_v4f ln = 2.0f * z * p + e * 0.69314718f;
+
+    return response_select(low, response_splat(RESPONSE_FLOOR_DB), ln * (10.0f / 2.30258509f));
+}
+
+/*-------------------------------------------------------------------------
+ * Response computation
+ *-------------------------------------------------------------------------*/
+
+/* Function to size the per-point arrays for a grid, keeping them if they are large enough */
+static int response_reserve(struct response_state *response, unsigned int points) {
+    unsigned int capacity = (points + RESPONSE_LANES - 1) & ~(RESPONSE_LANES - 1);
+    if (capacity <= response->capacity) {
+        return 0;
+    }
+
+    void *arrays;
+    if (posix_memalign(&arrays, sizeof(response_v4f), 5 * capacity * sizeof(float)) != 0) {
+        return -1;
+    }
+    free(response->arrays);
+    response->arrays = arrays;
+    response->capacity = capacity;
+    response->cos_delay = response->arrays;
+    response->sin_delay = response->cos_delay + capacity;
+    response->freq_hz = response->sin_delay + capacity;
+    response->mag_db = response->freq_hz + capacity;
+    response->phase_rad = response->mag_db + capacity;
+    response->basis_valid = 0;
+    return 0;
+}
+
+/* Function to compute the delay term of every grid point, f * delaym / fs in turns */
+static void response_compute_basis(struct response_state *response, unsigned int points, unsigned int padded,
+                                   unsigned int delaym) {
+    /* Point k is at k / (2 * (points - 1)) of fs, so its phase in turns is
+     * k * delaym / span. It is kept exact as an integer remainder, a float
+     * product would lose precision for long delays. */
+    uint32_t span = 2 * (points - 1);
+    uint32_t step = delaym % span;
+    uint32_t remainder = 0;
+    for (unsigned int k = 0; k < padded; k++) {
+        float turns = (float)remainder / span;
+        response->sin_delay[k] = turns >= 0.5f ? turns - 1.0f : turns;
+        remainder += step;
+        if (remainder >= span) {
+            remainder -= span;
+        }
+    }
+
+    /* cos(2 * pi * t) = sin(2 * pi * (t + 0.25)) */
+    for (unsigned int k = 0; k < padded; k += RESPONSE_LANES) {
+        response_v4f t = *(response_v4f *)&response->sin_delay[k];
+        response_v4f c = t + 0.25f;
+        c = response_select(c >= 0.5f, c - 1.0f, c);
+        *(response_v4f *)&response->sin_delay[k] = response_sin_turns(t);
+        *(response_v4f *)&response->cos_delay[k] = response_sin_turns(c);
+    }
+}
+
+/* Function to list the notch and peak frequencies, which follow from the
+ * gains without searching the grid: |H| swings between |g_dry| + |g_del|
+ * and ||g_dry| - |g_del|| once every fs / delaym */
+static void response_compute_extrema(struct combfilter_response *r, float g_dry, float g_del) {
+    float peak = fabsf(g_dry) + fabsf(g_del);
+    float notch = fabsf(fabsf(g_dry) - fabsf(g_del));
+    r->peak_db = peak > 0.0f ? 20.0f * log10f(peak) : RESPONSE_FLOOR_DB;
+    r->notch_db = notch > 0.0f ? fmaxf(20.0f * log10f(notch), RESPONSE_FLOOR_DB) : RESPONSE_FLOOR_DB;
+    r->num_notches = 0;
+    r->num_peaks = 0;
+    if (r->regs.delaym == 0 || g_dry == 0.0f || g_del == 0.0f) {
+        return;     /* flat response */
+    }
+
+    /* With both gains of the same sign the delayed path adds at multiples
+     * of fs / delaym and cancels halfway between them */
+    double spacing = (double)r->sample_rate / r->regs.delaym;
+    double nyquist = r->sample_rate / 2.0;
+    double first_notch = (g_dry > 0.0f) == (g_del > 0.0f) ? spacing / 2.0 : 0.0;
+    double first_peak = first_notch == 0.0 ? spacing / 2.0 : 0.0;
+    r->num_notches = (unsigned int)((nyquist - first_notch) / spacing + 1e-9) + 1;
+    r->num_peaks = (unsigned int)((nyquist - first_peak) / spacing + 1e-9) + 1;
+    for (unsigned int i = 0; i < r->num_notches && i < COMBFILTER_RESPONSE_MAX_EXTREMA; i++) {
+        r->notch_hz[i] = first_notch + i * spacing;
+    }
+    for (unsigned int i = 0; i < r->num_peaks && i < COMBFILTER_RESPONSE_MAX_EXTREMA; i++) {
+        r->peak_hz[i] = first_peak + i * spacing;
+    }
+}
+
+/* Function to allocate the cached response of one handle, nothing computed yet */
+struct response_state *response_create() {
+    return calloc(1, sizeof(struct response_state));
+}
+
+/* Function to return the response of a register set on a grid of points
+ * from 0 Hz to sample_rate / 2, recomputed only if anything changed since
+ * the last call. The result stays valid until the next call. */
+const struct combfilter_response *response_get(struct response_state *response, const struct combFilter_regs *regs,
+                                               unsigned int sample_rate, unsigned int points) {
+    struct combfilter_response *r = &response->result;
+    if (points < 2 || points > COMBFILTER_RESPONSE_MAX_POINTS || sample_rate == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int grid_changed = points != r->points || sample_rate != r->sample_rate;
+    int delay_changed = regs->delaym != r->regs.delaym;
+    if (response->result_valid && !grid_changed && !delay_changed && regs->b0 == r->regs.b0 &&
+        regs->bm == r->regs.bm && regs->wetDryMix == r->regs.wetDryMix) {
+        return r;
+    }
+    if (response_reserve(response, points) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    unsigned int padded = (points + RESPONSE_LANES - 1) & ~(RESPONSE_LANES - 1);
+
+    if (grid_changed || !response->basis_valid) {
+        for (unsigned int k = 0; k < points; k++) {
+            response->freq_hz[k] = (float)((double)k * sample_rate / (2 * (points - 1)));
+        }
+    }
+    if (grid_changed || delay_changed || !response->basis_valid) {
+        response_compute_basis(response, points, padded, regs->delaym);
+        response->basis_valid = 1;
+        r->basis_updates++;
+    }
+
+    float mix = (float)regs->wetDryMix / COMBFILTER_GAIN_ONE;
+    float g_dry = (1.0f - mix) + mix * ((float)regs->b0 / COMBFILTER_GAIN_ONE);
+    float g_del = mix * ((float)regs->bm / COMBFILTER_GAIN_ONE);
+    for (unsigned int k = 0; k < padded; k += RESPONSE_LANES) {
+        response_v4f c = *(response_v4f *)&response->cos_delay[k];
+        response_v4f s = *(response_v4f *)&response->sin_delay[k];
+        response_v4f re = g_dry + g_del * c;
+        response_v4f im = -g_del * s;
+        *(response_v4f *)&response->mag_db[k] = response_power_db(re * re + im * im);
+        *(response_v4f *)&response->phase_rad[k] = response_atan2(im, re);
+    }
+
+    r->regs = *regs;
+    r->sample_rate = sample_rate;
+    r->points = points;
+    r->freq_hz = response->freq_hz;
+    r->mag_db = response->mag_db;
+    r->phase_rad = response->phase_rad;
+    response_compute_extrema(r, g_dry, g_del);
+    r->updates++;
+    response->result_valid = 1;
+    return r;
+}
+
+/* Function to release a handle's cached response */
+void response_destroy(struct response_state *response) {
+    if (!response) {
+        return;
+    }
+    free(response->arrays);
+    free(response);
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Frequency response computation inside libcombfilter
+ *
+ * Private to the library; callers use combfilter_response() from
+ * libcombfilter.h, which keeps one response_state per handle.
+ *-------------------------------------------------------------------------*/
+
+#ifndef COMBFILTERRESPONSE_H
+#define COMBFILTERRESPONSE_H
+
+#include "libcombfilter.h"
+
+struct response_state;
+
+struct response_state *response_create(void);
+const struct combfilter_response *response_get(struct response_state *response, const struct combFilter_regs *regs,
+                                               unsigned int sample_rate, unsigned int points);
+void response_destroy(struct response_state *response);
+
+#endif /* COMBFILTERRESPONSE_H */
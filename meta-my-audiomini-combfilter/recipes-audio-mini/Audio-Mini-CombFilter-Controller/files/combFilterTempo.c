@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: Tempo-synced delay for the combFilterProcessor controller
+ *
+ * With --tempo-sync <division> delaym is given as a note division (1/4,
+ * 1/8d, 1/16t, ...) instead of samples, and follows a tempo. The tempo
+ * comes from the MIDI clock read by --midi, or from the local tempo API
+ * (--tempo, the batch "tempo" command, OSC /comb/tempo); whichever set it
+ * last wins. The MIDI clock is tracked with a least-squares fit over the
+ * last few beats of clock ticks, so the jitter of single ticks averages
+ * out, and a new tempo is only taken once it stands out from the error of
+ * that fit. The delay is recomputed in samples on
+ * every tempo change but handed to the coalescing layer only when the
+ * rounded value moves by more than a small deadband, so a steady clock
+ * causes no register writes at all.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#include "combFilterController.h"
+
+/* MIDI clock ticks per quarter note */
+#define TEMPO_MIDI_PPQN 24
+
+/* Clock ticks the tempo is fitted over, four beats */
+#ifndef TEMPO_CLOCK_WINDOW
+    #define TEMPO_CLOCK_WINDOW (4 * TEMPO_MIDI_PPQN)
+#endif
+
+/* A gap between ticks longer than this means the clock stopped (below 10 BPM) */
+#ifndef TEMPO_CLOCK_TIMEOUT_S
+    #define TEMPO_CLOCK_TIMEOUT_S 0.25
+#endif
+
+/* The last beat deviating from the fit by more than this is a tempo change,
+ * the fit then starts over from that beat instead of lagging behind */
+#ifndef TEMPO_CLOCK_JUMP
+    #define TEMPO_CLOCK_JUMP 0.02
+#endif
+
+/* Standard errors of the fitted tick period a new MIDI tempo has to be away
+ * from the current one, below that the difference is clock jitter */
+#ifndef TEMPO_CLOCK_SIGMAS
+    #define TEMPO_CLOCK_SIGMAS 3.0
+#endif
+
+/* How far past the half-sample rounding point the exact delay must move
+ * before a new delaym is written, keeps jitter around .5 from toggling */
+#ifndef TEMPO_DEADBAND_SAMPLES
+    #define TEMPO_DEADBAND_SAMPLES 0.1
+#endif
+
+static struct {
+    double division_beats;      /* delay in quarter notes, 0 while tempo sync is off */
+    char division[16];
+    double bpm;                 /* 0 until a tempo is known */
+    enum tempo_source source;
+    unsigned int sample_rate;   /* 0 until tempo_open() */
+    unsigned int max_delaym;
+    long pushed;                /* last delaym handed to the coalescing layer, -1 for none */
+    int folded;                 /* octaves the division was shortened to fit the delay line */
+    double ticks[TEMPO_CLOCK_WINDOW];
+    unsigned int first;         /* ring of the last clock tick times */
+    unsigned int count;
+    struct tempo_stats stats;
+} tempo = {
+    .pushed = -1,
+    .max_delaym = UINT_MAX,
+};
+
+static const char *tempo_source_names[] = { "none", "local", "midi" };
+
+/* Function to hand the delay for the current tempo to the coalescing layer if it moved */
+static void tempo_push() {
+    if (tempo.division_beats <= 0.0 || tempo.bpm <= 0.0 || tempo.sample_rate == 0) {
+        return;
+    }
+    tempo.stats.recomputes++;
+
+    /* A division longer than the delay line is halved until it fits, the pulse stays on the beat */
+    double exact = tempo.division_beats * 60.0 / tempo.bpm * tempo.sample_rate;
+    int folded = 0;
+    while (exact > tempo.max_delaym) {
+        exact /= 2.0;
+        folded++;
+    }
+    if (folded != tempo.folded) {
+        if (folded) {
+            printf("Tempo sync: %s at %.2f BPM is longer than the delay line, using %d octave(s) shorter\n",
+                   tempo.division, tempo.bpm, folded);
+        }
+        tempo.folded = folded;
+    }
+
+    long rounded = lround(exact);
+    if (tempo.pushed >= 0 &&
+        (rounded == tempo.pushed || fabs(exact - tempo.pushed) < 0.5 + TEMPO_DEADBAND_SAMPLES)) {
+        return;
+    }
+    coalesce_set(COMBFILTER_DELAYM, (unsigned int)rounded);
+    tempo.pushed = rounded;
+    tempo.stats.writes++;
+}
+
+/* Function to parse a note division "<n>/<d>[d|t]" into quarter notes, -1 if invalid
+ * d is dotted (x1.5), t is triplet (x2/3) */
+static double tempo_parse_division(const char *division) {
+    unsigned int numerator;
+    unsigned int denominator;
+    char modifier = '\0';
+    char extra;
+
+    int fields = sscanf(division, "%u/%u%c%c", &numerator, &denominator, &modifier, &extra);
+    if (fields < 2 || fields > 3 || numerator == 0 || numerator > 64 ||
+        denominator == 0 || denominator > 128) {
+        return -1.0;
+    }
+
+    double beats = 4.0 * numerator / denominator;
+    if (modifier == 'd') {
+        beats *= 1.5;
+    } else if (modifier == 't') {
+        beats *= 2.0 / 3.0;
+    } else if (modifier != '\0') {
+        return -1.0;
+    }
+    return beats;
+}
+
+/* Function to turn tempo sync on with delaym as the given note division */
+int tempo_set_division(const char *division) {
+    double beats = tempo_parse_division(division);
+    if (beats <= 0.0) {
+        return -1;
+    }
+    tempo.division_beats = beats;
+    snprintf(tempo.division, sizeof(tempo.division), "%s", division);
+
+    /* Always write the delay for a new division, even if it rounds the same */
+    tempo.pushed = -1;
+    tempo_push();
+    return 0;
+}
+
+/* Function to check whether delaym follows the tempo */
+int tempo_enabled() {
+    return tempo.division_beats > 0.0;
+}
+
+/* Function to bind tempo sync to the open device, for its sample rate and delay line depth */
+void tempo_open(struct combfilter *cf) {
+    unsigned int max_delaym;
+
+    tempo.sample_rate = combfilter_sample_rate(cf);
+    if (combfilter_max_delaym(cf, &max_delaym) == 0) {
+        tempo.max_delaym = max_delaym;
+    }
+
+    if (tempo_enabled()) {
+        printf("Tempo sync: delaym follows %s", tempo.division);
+        if (tempo.bpm > 0.0) {
+            printf(" at %.2f BPM", tempo.bpm);
+        }
+        printf("\n");
+        tempo.pushed = -1;
+        tempo_push();
+    }
+}
+
+/* Function to set the tempo from the local tempo API, returns -1 if out of range */
+int tempo_set_bpm(double bpm) {
+    if (!(bpm >= TEMPO_MIN_BPM && bpm <= TEMPO_MAX_BPM)) {
+        return -1;
+    }
+    tempo.bpm = bpm;
+    tempo.source = TEMPO_SOURCE_LOCAL;
+    tempo.stats.local_updates++;
+    tempo_push();
+    return 0;
+}
+
+/* Function to return the current tempo in BPM, 0 while none is known */
+double tempo_bpm() {
+    return tempo.bpm;
+}
+
+/* Function to return the delaym last handed to the coalescing layer, -1 for none */
+long tempo_delaym() {
+    return tempo.pushed;
+}
+
+/* Function to fit the tick times in the ring, returns seconds per tick
+ * and its standard error in stderr_out */
+static double tempo_fit_period(double *stderr_out) {
+    /* Least squares over (tick number, time), times relative to the first
+     * tick so the doubles keep their precision on a long uptime */
+    double t0 = tempo.ticks[tempo.first];
+    double n = tempo.count;
+    double sum_x = 0.0, sum_y = 0.0, sum_xy = 0.0, sum_xx = 0.0, sum_yy = 0.0;
+
+    for (unsigned int i = 0; i < tempo.count; i++) {
+        double y = tempo.ticks[(tempo.first + i) % TEMPO_CLOCK_WINDOW] - t0;
+        sum_x += i;
+        sum_y += y;
+        sum_xy += i * y;
+        sum_xx += (double)i * i;
+        sum_yy += y * y;
+    }
+    double sxx = sum_xx - sum_x * sum_x / n;
+    double sxy = sum_xy - sum_x * sum_y / n;
+    double syy = sum_yy - sum_y * sum_y / n;
+    double slope = sxy / sxx;
+
+    /* Residual variance of the ticks around the line, gives the slope's error */
+    double residual = (syy - slope * sxy) / (n - 2);
+    *stderr_out = residual > 0.0 ? sqrt(residual / sxx) : 0.0;
+    return slope;
+}
+
+/* Function to drop all but the last keep ticks from the ring */
+static void tempo_clock_trim(unsigned int keep) {
+    if (tempo.count > keep) {
+        tempo.first = (tempo.first + tempo.count - keep) % TEMPO_CLOCK_WINDOW;
+        tempo.count = keep;
+    }
+}
+
+/* Function to handle a MIDI real-time byte (0xF8 clock, 0xFA start, 0xFB continue, 0xFC stop)
+ * received at now, a CLOCK_MONOTONIC time */
+void tempo_midi_realtime(unsigned char byte, const struct timespec *now) {
+    if (!tempo_enabled()) {
+        return;
+    }
+
+    if (byte == 0xFA || byte == 0xFB) {
+        /* Start and continue restart the tick phase, the tempo stays until ticks say otherwise */
+        tempo.count = 0;
+        return;
+    }
+    if (byte != 0xF8) {
+        return;
+    }
+
+    double t = now->tv_sec + now->tv_nsec / 1e9;
+    tempo.stats.clock_ticks++;
+
+    if (tempo.count > 0) {
+        double last = tempo.ticks[(tempo.first + tempo.count - 1) % TEMPO_CLOCK_WINDOW];
+        if (t - last > TEMPO_CLOCK_TIMEOUT_S) {
+            tempo.count = 0;
+        }
+    }
+    if (tempo.count == TEMPO_CLOCK_WINDOW) {
+        tempo.first = (tempo.first + 1) % TEMPO_CLOCK_WINDOW;
+        tempo.count--;
+    }
+    tempo.ticks[(tempo.first + tempo.count) % TEMPO_CLOCK_WINDOW] = t;
+    tempo.count++;
+
+    /* One beat of ticks before the first estimate */
+    if (tempo.count <= TEMPO_MIDI_PPQN) {
+        return;
+    }
+
+    double period_error;
+    double period = tempo_fit_period(&period_error);
+
+    /* Compare the last beat alone with the fit; a tempo change shows there
+     * first, and restarting the fit from it follows the change within a beat */
+    if (tempo.count > 2 * TEMPO_MIDI_PPQN) {
+        double beat_start = tempo.ticks[(tempo.first + tempo.count - 1 - TEMPO_MIDI_PPQN) % TEMPO_CLOCK_WINDOW];
+        double beat_period = (t - beat_start) / TEMPO_MIDI_PPQN;
+        if (fabs(beat_period - period) > period * TEMPO_CLOCK_JUMP) {
+            tempo_clock_trim(TEMPO_MIDI_PPQN + 1);
+            tempo.stats.clock_jumps++;
+            period = tempo_fit_period(&period_error);
+        }
+    }
+
+    double bpm = 60.0 / (period * TEMPO_MIDI_PPQN);
+    if (!(bpm >= TEMPO_MIN_BPM && bpm <= TEMPO_MAX_BPM)) {
+        return;
+    }
+
+    /* Keep the tempo while the fit cannot tell it apart from the last one,
+     * a jittery clock then moves delaym only when the tempo really changed */
+    if (tempo.source == TEMPO_SOURCE_MIDI && tempo.bpm > 0.0) {
+        double current = 60.0 / (tempo.bpm * TEMPO_MIDI_PPQN);
+        if (fabs(period - current) <= TEMPO_CLOCK_SIGMAS * period_error) {
+            return;
+        }
+    }
+    tempo.bpm = bpm;
+    tempo.source = TEMPO_SOURCE_MIDI;
+    tempo_push();
+}
+
+/* Function to return the tempo sync counters */
+const struct tempo_stats *tempo_get_stats() {
+    return &tempo.stats;
+}
+
+/* Function to print the tempo sync state and counters */
+void tempo_print_stats() {
+    if (!tempo_enabled()) {
+        return;
+    }
+    printf("Tempo sync: %s at %.2f BPM from %s, delaym %ld; %lu clock ticks, %lu tempo jumps, "
+           "%lu recomputes, %lu delaym writes\n",
+           tempo.division, tempo.bpm, tempo_source_names[tempo.source], tempo.pushed,
+           tempo.stats.clock_ticks, tempo.stats.clock_jumps, tempo.stats.recomputes, tempo.stats.writes);
+}
@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: io_uring command test client for the combFilterProcessor
+ *              kernel module
+ *
+ * Submits COMBFILTER_URING_CMD_BATCH commands to /dev/combFilterProcessor
+ * with liburing and checks what the driver promises:
+ *   mixed      a batch of interleaved writes and reads completes with its
+ *              op count, every op reads back the register as it stands
+ *              after that op, and a read after a write sees the new value
+ *   rejected   a batch with one bad op fails with EINVAL and leaves the
+ *              registers its valid ops would have written alone
+ *   read-only  through an fd opened O_RDONLY, reads work and any write
+ *              fails the batch with EBADF
+ * delaym is written with --value and restored afterwards, so the test is
+ * safe to run on a live board. Values written must be inside the limits
+ * sysfs attribute, or the driver clamps them and the read-back differs.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <liburing.h>
+#include <combFilter.h>
+
+#define DEVICE_PATH "/dev/combFilterProcessor"
+
+static int failed;
+
+/* Function to print usage instructions */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n", program_name);
+    printf("Options:\n");
+    printf("  --device <path>      Device to test (default %s)\n", DEVICE_PATH);
+    printf("  --value <value>      delaym written by the mixed batch, restored afterwards (default 2400)\n");
+    printf("  -h, --help           Show this help message\n");
+}
+
+/* Function to record one check, printing it either way */
+void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) {
+        failed++;
+    }
+}
+
+/* Function to fill in one op */
+void set_op(struct combFilter_op *op, unsigned int offset, unsigned int flags, unsigned int value) {
+    memset(op, 0, sizeof(*op));
+    op->offset = offset;
+    op->flags = flags;
+    op->value = value;
+}
+
+/* Function to submit one batch on fd and wait for it, returns the CQE result */
+int submit_batch(struct io_uring *ring, int fd, struct combFilter_op *ops, unsigned int count) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    struct io_uring_cqe *cqe;
+    struct combFilter_uring_batch *batch;
+
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+    // cmd_op shares its space with the offset prep_rw just cleared
+    sqe->cmd_op = COMBFILTER_URING_CMD_BATCH;
+    batch = (struct combFilter_uring_batch *)sqe->cmd;
+    memset(batch, 0, sizeof(*batch));
+    batch->ops = (uintptr_t)ops;
+    batch->count = count;
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = io_uring_wait_cqe(ring, &cqe);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    return ret;
+}
+
+/* Function to read all registers with one batch, returns the CQE result */
+int read_all(struct io_uring *ring, int fd, unsigned int values[COMBFILTER_NUM_REGS]) {
+    struct combFilter_op ops[COMBFILTER_NUM_REGS];
+
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        set_op(&ops[i], i * sizeof(uint32_t), COMBFILTER_OP_READ, 0);
+    }
+    int ret = submit_batch(ring, fd, ops, COMBFILTER_NUM_REGS);
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        values[i] = ops[i].value;
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = DEVICE_PATH;
+    unsigned int value = 2400;
+    unsigned int before[COMBFILTER_NUM_REGS];
+    unsigned int after[COMBFILTER_NUM_REGS];
+    struct combFilter_op ops[COMBFILTER_URING_BATCH_MAX];
+    struct io_uring ring;
+    char what[128];
+    int ret;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            device = argv[++i];
+        } else if (strcmp(argv[i], "--value") == 0 && i + 1 < argc) {
+            value = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = open(device, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        printf("Failed to open %s\n", device);
+        return 1;
+    }
+    ret = io_uring_queue_init(4, &ring, 0);
+    if (ret < 0) {
+        printf("io_uring_queue_init: %s\n", strerror(-ret));
+        close(fd);
+        return 1;
+    }
+
+    ret = read_all(&ring, fd, before);
+    if (ret == -EOPNOTSUPP || ret == -ENOTTY) {
+        printf("%s does not support io_uring commands: %s\n", device, strerror(-ret));
+        io_uring_queue_exit(&ring);
+        close(fd);
+        return 1;
+    }
+    check(ret == COMBFILTER_NUM_REGS, "read batch completes with its op count");
+
+    /* mixed: write delaym, read it, read b0, write b0 back unchanged, read delaym again */
+    set_op(&ops[0], COMBFILTER_REG_DELAYM, COMBFILTER_OP_WRITE, value);
+    set_op(&ops[1], COMBFILTER_REG_DELAYM, COMBFILTER_OP_READ, 0);
+    set_op(&ops[2], COMBFILTER_REG_B0, COMBFILTER_OP_READ, 0);
+    set_op(&ops[3], COMBFILTER_REG_B0, COMBFILTER_OP_WRITE, before[COMBFILTER_REG_B0 / 4]);
+    set_op(&ops[4], COMBFILTER_REG_DELAYM, COMBFILTER_OP_READ, 0);
+    ret = submit_batch(&ring, fd, ops, 5);
+    snprintf(what, sizeof(what), "mixed batch completes with 5 ops (got %d)", ret);
+    check(ret == 5, what);
+    snprintf(what, sizeof(what), "write op reads back delaym %u (got %u)", value, ops[0].value);
+    check(ops[0].value == value, what);
+    snprintf(what, sizeof(what), "read after write sees delaym %u (got %u, %u)", value, ops[1].value, ops[4].value);
+    check(ops[1].value == value && ops[4].value == value, what);
+    snprintf(what, sizeof(what), "b0 reads back unchanged %u (got %u, %u)",
+             before[COMBFILTER_REG_B0 / 4], ops[2].value, ops[3].value);
+    check(ops[2].value == before[COMBFILTER_REG_B0 / 4] && ops[3].value == before[COMBFILTER_REG_B0 / 4], what);
+
+    /* rejected: a valid write followed by an unaligned op writes nothing */
+    set_op(&ops[0], COMBFILTER_REG_DELAYM, COMBFILTER_OP_WRITE, before[0]);
+    set_op(&ops[1], COMBFILTER_REG_B0 + 1, COMBFILTER_OP_READ, 0);
+    ret = submit_batch(&ring, fd, ops, 2);
+    snprintf(what, sizeof(what), "batch with an unaligned op fails with EINVAL (got %d)", ret);
+    check(ret == -EINVAL, what);
+    read_all(&ring, fd, after);
+    snprintf(what, sizeof(what), "rejected batch leaves delaym at %u (got %u)", value, after[0]);
+    check(after[0] == value, what);
+
+    /* read-only: reads go through, writes are refused */
+    int ro_fd = open(device, O_RDONLY);
+    if (ro_fd < 0) {
+        perror("open O_RDONLY");
+        failed++;
+    } else {
+        ret = read_all(&ring, ro_fd, after);
+        snprintf(what, sizeof(what), "read batch on an O_RDONLY fd completes (got %d)", ret);
+        check(ret == COMBFILTER_NUM_REGS, what);
+
+        set_op(&ops[0], COMBFILTER_REG_DELAYM, COMBFILTER_OP_READ, 0);
+        set_op(&ops[1], COMBFILTER_REG_DELAYM, COMBFILTER_OP_WRITE, before[0]);
+        ret = submit_batch(&ring, ro_fd, ops, 2);
+        snprintf(what, sizeof(what), "write batch on an O_RDONLY fd fails with EBADF (got %d)", ret);
+        check(ret == -EBADF, what);
+        read_all(&ring, fd, after);
+        snprintf(what, sizeof(what), "refused write leaves delaym at %u (got %u)", value, after[0]);
+        check(after[0] == value, what);
+        close(ro_fd);
+    }
+
+    /* Put delaym back where it was */
+    set_op(&ops[0], COMBFILTER_REG_DELAYM, COMBFILTER_OP_WRITE, before[0]);
+    ret = submit_batch(&ring, fd, ops, 1);
+    snprintf(what, sizeof(what), "delaym restored to %u (got %u)", before[0], ops[0].value);
+    check(ret == 1 && ops[0].value == before[0], what);
+
+    io_uring_queue_exit(&ring);
+    close(fd);
+
+    printf("%d check(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
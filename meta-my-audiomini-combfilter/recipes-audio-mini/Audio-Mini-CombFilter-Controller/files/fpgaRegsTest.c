@@ -0,0 +1,258 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: ioctl test client for the fpgaRegs generic register driver
+ *
+ * Runs the FPGA_REGS_IOC_* ioctls against /dev/<name> and checks what
+ * fpgaRegs.h promises:
+ *   info       FPGA_REGS_IOC_INFO and FPGA_REGS_IOC_REG_INFO describe every
+ *              register, and an index past the last one fails with EINVAL
+ *   batch      writes and reads run in order, a read after a write returns
+ *              the value written, and the generation moves on
+ *   rejected   an unknown index, a write to a read-only register and a
+ *              value outside [min, max] each fail the whole batch, and the
+ *              valid write in front of them is not applied
+ *   read-only  through an fd opened O_RDONLY, reads work and any write
+ *              fails the batch with EBADF
+ * The batch test writes the first writable register and restores it right
+ * after. Checks the layout has nothing for (no read-only register, or no
+ * value outside a register's range) are skipped.
+ *-------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <fpgaRegs.h>
+
+#define DEVICE_PATH "/dev/combFilterRegs"
+
+static int failed;
+static int skipped;
+
+/* Function to print usage instructions */
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n", program_name);
+    printf("Options:\n");
+    printf("  --device <path>      fpgaRegs device to test (default %s)\n", DEVICE_PATH);
+    printf("  -h, --help           Show this help message\n");
+}
+
+/* Function to record one check, printing it either way */
+void check(int ok, const char *what) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) {
+        failed++;
+    }
+}
+
+/* Function to record a check the layout cannot run */
+void skip(const char *what) {
+    printf("skip %s\n", what);
+    skipped++;
+}
+
+/* Function to fill in one op */
+void set_op(struct fpga_regs_op *op, unsigned int index, unsigned int flags, unsigned int value) {
+    memset(op, 0, sizeof(*op));
+    op->index = index;
+    op->flags = flags;
+    op->value = value;
+}
+
+/* Function to run one batch, returns 0 or -errno */
+int run_batch(int fd, struct fpga_regs_op *ops, unsigned int count, unsigned int *generation) {
+    struct fpga_regs_batch batch = { .ops = (uintptr_t)ops, .count = count };
+
+    if (ioctl(fd, FPGA_REGS_IOC_BATCH, &batch) != 0) {
+        return -errno;
+    }
+    if (generation) {
+        *generation = batch.generation;
+    }
+    return 0;
+}
+
+/* Function to read one register with a batch, returns 0 or -errno */
+int read_reg(int fd, unsigned int index, unsigned int *value) {
+    struct fpga_regs_op op;
+
+    set_op(&op, index, FPGA_REGS_OP_READ, 0);
+    int ret = run_batch(fd, &op, 1, NULL);
+    *value = op.value;
+    return ret;
+}
+
+/* Function to check that a batch of a valid write to index followed by bad is rejected with
+ * the expected error and leaves the register at its value */
+void check_rejected(int fd, unsigned int index, unsigned int value, unsigned int other,
+                    const struct fpga_regs_op *bad, int expected, const char *what) {
+    struct fpga_regs_op ops[2];
+    unsigned int now;
+    char line[160];
+
+    set_op(&ops[0], index, FPGA_REGS_OP_WRITE, other);
+    ops[1] = *bad;
+    int ret = run_batch(fd, ops, 2, NULL);
+    snprintf(line, sizeof(line), "%s fails the batch with %s (got %s)", what,
+             strerror(-expected), ret ? strerror(-ret) : "success");
+    check(ret == expected, line);
+
+    read_reg(fd, index, &now);
+    snprintf(line, sizeof(line), "%s: valid write in front of it not applied (%u, got %u)", what, value, now);
+    check(now == value, line);
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = DEVICE_PATH;
+    struct fpga_regs_info info;
+    struct fpga_regs_reg_info regs[FPGA_REGS_MAX_REGS];
+    struct fpga_regs_op ops[4];
+    char what[160];
+    int ret;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+            device = argv[++i];
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = open(device, O_RDWR);
+    if (fd < 0) {
+        perror("open");
+        printf("Failed to open %s\n", device);
+        return 1;
+    }
+
+    /* info */
+    memset(&info, 0, sizeof(info));
+    ret = ioctl(fd, FPGA_REGS_IOC_INFO, &info) == 0 ? 0 : -errno;
+    snprintf(what, sizeof(what), "FPGA_REGS_IOC_INFO: %s, %u registers, span %u, generation %u",
+             info.name, info.num_regs, info.span, info.generation);
+    check(ret == 0 && info.num_regs >= 1 && info.num_regs <= FPGA_REGS_MAX_REGS, what);
+    if (ret != 0 || info.num_regs < 1 || info.num_regs > FPGA_REGS_MAX_REGS) {
+        close(fd);
+        return 1;
+    }
+
+    int writable = -1;
+    int read_only = -1;
+    for (unsigned int i = 0; i < info.num_regs; i++) {
+        memset(&regs[i], 0, sizeof(regs[i]));
+        regs[i].index = i;
+        ret = ioctl(fd, FPGA_REGS_IOC_REG_INFO, &regs[i]) == 0 ? 0 : -errno;
+        snprintf(what, sizeof(what), "FPGA_REGS_IOC_REG_INFO %u: %s at 0x%02x, %u bits, [%lld, %lld]%s%s",
+                 i, regs[i].name, regs[i].offset, regs[i].width, (long long)regs[i].min, (long long)regs[i].max,
+                 regs[i].flags & FPGA_REGS_REG_SIGNED ? " signed" : "",
+                 regs[i].flags & FPGA_REGS_REG_READONLY ? " read-only" : "");
+        check(ret == 0 && regs[i].index == i && regs[i].offset < info.span && regs[i].min <= regs[i].max, what);
+        if (regs[i].flags & FPGA_REGS_REG_READONLY) {
+            if (read_only < 0) {
+                read_only = i;
+            }
+        } else if (writable < 0 && regs[i].min < regs[i].max) {
+            writable = i;
+        }
+    }
+    struct fpga_regs_reg_info past = { .index = info.num_regs };
+    ret = ioctl(fd, FPGA_REGS_IOC_REG_INFO, &past) == 0 ? 0 : -errno;
+    snprintf(what, sizeof(what), "FPGA_REGS_IOC_REG_INFO past the last register fails with EINVAL (got %s)",
+             ret ? strerror(-ret) : "success");
+    check(ret == -EINVAL, what);
+
+    if (writable < 0) {
+        skip("batch tests: no writable register with more than one value");
+        close(fd);
+        printf("%d check(s) failed, %d skipped\n", failed, skipped);
+        return failed ? 1 : 0;
+    }
+
+    /* batch: write another in-range value, read it back, restore */
+    const struct fpga_regs_reg_info *reg = &regs[writable];
+    unsigned int value;
+    unsigned int generation;
+    read_reg(fd, writable, &value);
+    unsigned int other = (unsigned int)(value == (unsigned int)reg->min ? reg->max : reg->min);
+
+    set_op(&ops[0], writable, FPGA_REGS_OP_WRITE, other);
+    set_op(&ops[1], writable, FPGA_REGS_OP_READ, 0);
+    set_op(&ops[2], writable, FPGA_REGS_OP_WRITE, value);
+    set_op(&ops[3], writable, FPGA_REGS_OP_READ, 0);
+    ret = run_batch(fd, ops, 4, &generation);
+    snprintf(what, sizeof(what), "batch write/read/write/read on %s succeeds (got %s)", reg->name,
+             ret ? strerror(-ret) : "success");
+    check(ret == 0, what);
+    snprintf(what, sizeof(what), "read after write returns %d, then %d after the restore (got %d, %d)",
+             (int)other, (int)value, (int)ops[1].value, (int)ops[3].value);
+    check(ops[1].value == other && ops[3].value == value, what);
+    snprintf(what, sizeof(what), "generation moved from %u to %u", info.generation, generation);
+    check(generation >= info.generation + 2, what);
+
+    /* rejected: each bad op takes the valid write in front of it down too */
+    struct fpga_regs_op bad;
+    set_op(&bad, info.num_regs, FPGA_REGS_OP_READ, 0);
+    check_rejected(fd, writable, value, other, &bad, -EINVAL, "unknown index");
+
+    if (read_only >= 0) {
+        set_op(&bad, read_only, FPGA_REGS_OP_WRITE, 0);
+        check_rejected(fd, writable, value, other, &bad, -EPERM, "write to read-only register");
+    } else {
+        skip("write to read-only register: the layout has none");
+    }
+
+    int out_of_range = -1;
+    unsigned int beyond = 0;
+    for (unsigned int i = 0; i < info.num_regs && out_of_range < 0; i++) {
+        if (regs[i].flags & FPGA_REGS_REG_READONLY) {
+            continue;
+        }
+        long long limit = regs[i].flags & FPGA_REGS_REG_SIGNED ? INT32_MAX : UINT32_MAX;
+        if (regs[i].max < limit) {
+            out_of_range = i;
+            beyond = (unsigned int)(regs[i].max + 1);
+        }
+    }
+    if (out_of_range >= 0) {
+        set_op(&bad, out_of_range, FPGA_REGS_OP_WRITE, beyond);
+        snprintf(what, sizeof(what), "%s = %lld, above its range", regs[out_of_range].name,
+                 regs[out_of_range].max + 1);
+        check_rejected(fd, writable, value, other, &bad, -ERANGE, what);
+    } else {
+        skip("value out of range: every register takes its whole width");
+    }
+
+    /* read-only: reads go through, writes are refused */
+    int ro_fd = open(device, O_RDONLY);
+    if (ro_fd < 0) {
+        perror("open O_RDONLY");
+        failed++;
+    } else {
+        unsigned int read_back;
+        ret = read_reg(ro_fd, writable, &read_back);
+        snprintf(what, sizeof(what), "read batch on an O_RDONLY fd succeeds (got %s)", ret ? strerror(-ret) : "success");
+        check(ret == 0 && read_back == value, what);
+
+        set_op(&bad, writable, FPGA_REGS_OP_WRITE, other);
+        ret = run_batch(ro_fd, &bad, 1, NULL);
+        snprintf(what, sizeof(what), "write batch on an O_RDONLY fd fails with EBADF (got %s)",
+                 ret ? strerror(-ret) : "success");
+        check(ret == -EBADF, what);
+        read_reg(fd, writable, &read_back);
+        snprintf(what, sizeof(what), "refused write leaves %s at %u (got %u)", reg->name, value, read_back);
+        check(read_back == value, what);
+        close(ro_fd);
+    }
+
+    close(fd);
+    printf("%d check(s) failed, %d skipped\n", failed, skipped);
+    return failed ? 1 : 0;
+}
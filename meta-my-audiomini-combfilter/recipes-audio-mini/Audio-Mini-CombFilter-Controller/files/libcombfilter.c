@@ -0,0 +1,618 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: libcombfilter, register access to the combFilterProcessor
+ *              driver or a software combFilterEngine
+ *
+ * Everything combFilterController used to do in-process, as a shared
+ * library for the other services on the board. See libcombfilter.h for
+ * the API. Built with -fvisibility=hidden, so only the calls marked
+ * COMBFILTER_API are exported; the engine control block code
+ * (combFilterEngineShm.c) and the response computation
+ * (combFilterResponse.c) are linked in privately.
+ *-------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "libcombfilter.h"
+#include "combFilterEngine.h"
+#include "combFilterResponse.h"
+
+/* How often an engine handle compares snapshots for combfilter_dispatch() */
+#ifndef COMBFILTER_ENGINE_NOTIFY_MS
+    #define COMBFILTER_ENGINE_NOTIFY_MS 10
+#endif
+
+/* History entries read per read() by combfilter_dispatch() */
+#define COMBFILTER_DISPATCH_BATCH 64
+
+static const char *combfilter_register_names[COMBFILTER_NUM_REGS] = {
+    "delaym", "b0", "bm", "wetDryMix",
+};
+
+struct combfilter {
+    int fd;                                     /* char device, -1 for an engine */
+    int attr_fds[COMBFILTER_NUM_REGS];          /* sysfs attributes, opened on first use */
+    int regs_fd;                                /* binary sysfs attribute "regs" */
+    int history_fd;
+    struct engine_shm *engine;
+
+    unsigned int staged_values[COMBFILTER_NUM_REGS];
+    unsigned int staged;
+
+    combfilter_notify_fn notify;
+    void *notify_context;
+    int notify_fd;                              /* history_fd, or a timer for an engine */
+    struct combFilter_regs notify_last;         /* engine: snapshot of the last dispatch */
+
+    struct response_state *response;            /* allocated on first combfilter_response() */
+};
+
+/*-------------------------------------------------------------------------
+ * Kernel module
+ *-------------------------------------------------------------------------*/
+
+/* Function to check the module in /proc/modules and its device node */
+int combfilter_module_state(void) {
+    FILE *fp = fopen("/proc/modules", "r");
+    if (!fp) {
+        return -1;
+    }
+
+    char line[256];
+    int module_found = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        char *name = strtok(line, " \t\n");
+        if (name && strcmp(name, COMBFILTER_MODULE_NAME) == 0) {
+            module_found = 1;
+            break;
+        }
+    }
+    fclose(fp);
+
+    if (!module_found) {
+        return COMBFILTER_MODULE_UNLOADED;
+    }
+
+    struct stat st;
+    if (stat(COMBFILTER_DEVICE_PATH, &st) == 0 && S_ISCHR(st.st_mode)) {
+        return COMBFILTER_MODULE_READY;
+    }
+    return COMBFILTER_MODULE_NO_DEVICE;
+}
+
+/* Function to load the module with finit_module(), already loaded counts as success */
+int combfilter_load_module(void) {
+    int module_fd = open(COMBFILTER_MODULE_PATH, O_RDONLY | O_CLOEXEC);
+    if (module_fd < 0) {
+        return -1;
+    }
+    long result = syscall(SYS_finit_module, module_fd, "", 0);
+    int saved_errno = errno;
+    close(module_fd);
+    if (result != 0 && saved_errno != EEXIST) {
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to unload the module, fails with EWOULDBLOCK while it is in use */
+int combfilter_unload_module(void) {
+    if (syscall(SYS_delete_module, COMBFILTER_MODULE_NAME, O_NONBLOCK) != 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+ * Handles
+ *-------------------------------------------------------------------------*/
+
+/* Function to open the driver's char device, or attach to a running engine */
+struct combfilter *combfilter_open(const char *engine_name, unsigned int flags) {
+    struct combfilter *cf = calloc(1, sizeof(*cf));
+    if (!cf) {
+        return NULL;
+    }
+    cf->fd = -1;
+    cf->regs_fd = -1;
+    cf->history_fd = -1;
+    cf->notify_fd = -1;
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        cf->attr_fds[i] = -1;
+    }
+
+    if (engine_name) {
+        /* A software engine needs neither the module nor the device */
+        cf->engine = engine_shm_open(engine_name);
+        if (!cf->engine) {
+            free(cf);
+            errno = ENOENT;
+            return NULL;
+        }
+        return cf;
+    }
+
+    if ((flags & COMBFILTER_OPEN_LOAD_MODULE) &&
+        combfilter_module_state() == COMBFILTER_MODULE_UNLOADED && combfilter_load_module() != 0) {
+        int saved_errno = errno;
+        free(cf);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    cf->fd = open(COMBFILTER_DEVICE_PATH, O_RDWR | O_CLOEXEC);
+    if (cf->fd < 0) {
+        int saved_errno = errno;
+        free(cf);
+        errno = saved_errno;
+        return NULL;
+    }
+    return cf;
+}
+
+/* Function to close a handle and every descriptor it opened */
+void combfilter_close(struct combfilter *cf) {
+    if (!cf) {
+        return;
+    }
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        if (cf->attr_fds[i] >= 0) {
+            close(cf->attr_fds[i]);
+        }
+    }
+    if (cf->regs_fd >= 0) {
+        close(cf->regs_fd);
+    }
+    if (cf->notify_fd >= 0 && cf->notify_fd != cf->history_fd) {
+        close(cf->notify_fd);
+    }
+    if (cf->history_fd >= 0) {
+        close(cf->history_fd);
+    }
+    if (cf->fd >= 0) {
+        close(cf->fd);
+    }
+    engine_shm_close(cf->engine, NULL, 0);
+    response_destroy(cf->response);
+    free(cf);
+}
+
+int combfilter_is_engine(const struct combfilter *cf) {
+    return cf->engine != NULL;
+}
+
+unsigned int combfilter_sample_rate(const struct combfilter *cf) {
+    return cf->engine ? cf->engine->sample_rate : COMBFILTER_SAMPLE_RATE;
+}
+
+/* Function to read the largest delaym the delay line holds, UINT_MAX if the driver does not check */
+int combfilter_max_delaym(struct combfilter *cf, unsigned int *max_delaym) {
+    char buffer[16];
+    if (cf->engine) {
+        *max_delaym = cf->engine->max_delaym;
+        return 0;
+    }
+    int attr_fd = open(COMBFILTER_SYSFS_PATH "/max_delaym", O_RDONLY | O_CLOEXEC);
+    if (attr_fd < 0) {
+        return -1;
+    }
+    ssize_t len = read(attr_fd, buffer, sizeof(buffer) - 1);
+    close(attr_fd);
+    if (len <= 0) {
+        errno = len == 0 ? EIO : errno;
+        return -1;
+    }
+    buffer[len] = '\0';
+    *max_delaym = strtoul(buffer, NULL, 10);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+ * Registers
+ *-------------------------------------------------------------------------*/
+
+int combfilter_register_index(const char *name) {
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        if (strcasecmp(name, combfilter_register_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *combfilter_register_name(int index) {
+    if (index < 0 || index >= COMBFILTER_NUM_REGS) {
+        return NULL;
+    }
+    return combfilter_register_names[index];
+}
+
+/* Function to read a consistent snapshot of all registers in one read */
+int combfilter_get(struct combfilter *cf, struct combFilter_regs *regs) {
+    if (cf->engine) {
+        engine_shm_read(cf->engine, regs);
+        return 0;
+    }
+    if (cf->regs_fd < 0) {
+        cf->regs_fd = open(COMBFILTER_SYSFS_PATH "/regs", O_RDONLY | O_CLOEXEC);
+        if (cf->regs_fd < 0) {
+            return -1;
+        }
+    }
+
+    /* The driver reads all registers under its lock, so they cannot tear */
+    ssize_t len = pread(cf->regs_fd, regs, sizeof(*regs), 0);
+    if (len != sizeof(*regs)) {
+        errno = len < 0 ? errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to format an unsigned value as decimal text, returns the length
+ * (hand-rolled instead of snprintf, this sits on every register update) */
+static int combfilter_format_uint(char *buffer, unsigned int value) {
+    char digits[10];
+    int count = 0;
+    int len = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (count) {
+        buffer[len++] = digits[--count];
+    }
+    return len;
+}
+
+/* Function to write one register through its sysfs attribute, opened once and kept */
+int combfilter_set(struct combfilter *cf, int index, unsigned int value) {
+    char buffer[16];
+
+    if (index < 0 || index >= COMBFILTER_NUM_REGS) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cf->engine) {
+        unsigned int values[COMBFILTER_NUM_REGS];
+        values[index] = value;
+        return engine_shm_write(cf->engine, values, 1u << index);
+    }
+    if (cf->attr_fds[index] < 0) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", COMBFILTER_SYSFS_PATH, combfilter_register_names[index]);
+        cf->attr_fds[index] = open(path, O_RDWR | O_CLOEXEC);
+        if (cf->attr_fds[index] < 0) {
+            return -1;
+        }
+    }
+
+    /* Every write at offset 0 is handed to the attribute's store() on its own */
+    int len = combfilter_format_uint(buffer, value);
+    ssize_t written = pwrite(cf->attr_fds[index], buffer, len, 0);
+    if (written != len) {
+        errno = written < 0 ? errno : EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to read the char device at a byte offset */
+int combfilter_read(struct combfilter *cf, off_t offset, unsigned int *value) {
+    if (cf->engine) {
+        /* Same register layout as the char device */
+        struct combFilter_regs regs;
+        if (offset < 0 || offset > COMBFILTER_REG_WETDRYMIX || offset % 4 != 0) {
+            errno = EFAULT;
+            return -1;
+        }
+        engine_shm_read(cf->engine, &regs);
+        memcpy(value, (char *)&regs + offset, sizeof(*value));
+        return 0;
+    }
+    ssize_t len = pread(cf->fd, value, sizeof(*value), offset);
+    if (len != sizeof(*value)) {
+        errno = len < 0 ? errno : EFAULT;
+        return -1;
+    }
+    return 0;
+}
+
+/* Function to write the char device at a byte offset */
+int combfilter_write(struct combfilter *cf, off_t offset, unsigned int value) {
+    if (cf->engine) {
+        unsigned int values[COMBFILTER_NUM_REGS];
+        if (offset < 0 || offset > COMBFILTER_REG_WETDRYMIX || offset % 4 != 0) {
+            errno = EFAULT;
+            return -1;
+        }
+        values[offset / 4] = value;
+        return engine_shm_write(cf->engine, values, 1u << (offset / 4));
+    }
+    ssize_t len = pwrite(cf->fd, &value, sizeof(value), offset);
+    if (len != sizeof(value)) {
+        errno = len < 0 ? errno : EFAULT;
+        return -1;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+ * Batched writes
+ *-------------------------------------------------------------------------*/
+
+/* Function to return the lowest contiguous run of set bits in mask, 0b0110 for 0b1110 */
+static unsigned int combfilter_lowest_run(unsigned int mask) {
+    return mask & ~(mask + (mask & -mask));
+}
+
+int combfilter_stage(struct combfilter *cf, int index, unsigned int value) {
+    if (index < 0 || index >= COMBFILTER_NUM_REGS) {
+        errno = EINVAL;
+        return -1;
+    }
+    cf->staged_values[index] = value;
+    cf->staged |= 1u << index;
+    return 0;
+}
+
+unsigned int combfilter_staged(const struct combfilter *cf) {
+    return cf->staged;
+}
+
+/* Function to write the dirty registers in one step. A contiguous run of
+ * them is a single write() on the char device; registers with a clean one
+ * in between go out as one COMBFILTER_IOC_BATCH. Either way the driver
+ * checks every value first and writes them all under one lock hold, so
+ * they change together or not at all. Clean registers are never written,
+ * so a value another client set in between is left alone. */
+int combfilter_write_span(struct combfilter *cf, const unsigned int *values, unsigned int dirty_mask) {
+    dirty_mask &= (1u << COMBFILTER_NUM_REGS) - 1;
+    if (dirty_mask == 0) {
+        return 0;
+    }
+    if (cf->engine) {
+        return engine_shm_write(cf->engine, values, dirty_mask);
+    }
+
+    if (combfilter_lowest_run(dirty_mask) == dirty_mask) {
+        int first = __builtin_ctz(dirty_mask);
+        ssize_t len = __builtin_popcount(dirty_mask) * sizeof(unsigned int);
+        ssize_t written = pwrite(cf->fd, &values[first], len, first * sizeof(unsigned int));
+        if (written != len) {
+            errno = written < 0 ? errno : EIO;
+            return -1;
+        }
+        return 0;
+    }
+
+    struct combFilter_op ops[COMBFILTER_NUM_REGS];
+    struct combFilter_uring_batch batch = { .ops = (uintptr_t)ops };
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        if (dirty_mask & (1u << i)) {
+            ops[batch.count++] = (struct combFilter_op) {
+                .offset = i * sizeof(unsigned int),
+                .flags = COMBFILTER_OP_WRITE,
+                .value = values[i],
+            };
+        }
+    }
+    return ioctl(cf->fd, COMBFILTER_IOC_BATCH, &batch) == 0 ? 0 : -1;
+}
+
+/* Function to write the staged registers in one step, returns how many.
+ * On failure nothing was written and they all stay staged. */
+int combfilter_commit(struct combfilter *cf) {
+    unsigned int dirty = cf->staged;
+    if (!dirty) {
+        return 0;
+    }
+    if (combfilter_write_span(cf, cf->staged_values, dirty) != 0) {
+        return -1;
+    }
+    cf->staged = 0;
+    return __builtin_popcount(dirty);
+}
+
+/*-------------------------------------------------------------------------
+ * Frequency response
+ *-------------------------------------------------------------------------*/
+
+const struct combfilter_response *combfilter_response(struct combfilter *cf, const struct combFilter_regs *regs,
+                                                      unsigned int points) {
+    if (!cf->response) {
+        cf->response = response_create();
+        if (!cf->response) {
+            return NULL;
+        }
+    }
+    return response_get(cf->response, regs, combfilter_sample_rate(cf), points);
+}
+
+/* Function to read the debug counters as a string */
+int combfilter_read_stats(struct combfilter *cf, char *buffer, size_t size) {
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cf->engine) {
+        return engine_shm_format_stats(cf->engine, buffer, size);
+    }
+    int stats_fd = open(COMBFILTER_SYSFS_PATH "/stats", O_RDONLY | O_CLOEXEC);
+    if (stats_fd < 0) {
+        return -1;
+    }
+    ssize_t len = read(stats_fd, buffer, size - 1);
+    close(stats_fd);
+    if (len < 0) {
+        return -1;
+    }
+    buffer[len] = '\0';
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+ * History and change notification
+ *-------------------------------------------------------------------------*/
+
+/* Function to get the non-blocking history descriptor, opening it on first
+ * use; a new reader starts at the oldest entry the driver still holds */
+int combfilter_history_fd(struct combfilter *cf) {
+    if (cf->engine) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (cf->history_fd < 0) {
+        cf->history_fd = open(COMBFILTER_HISTORY_PATH, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+    return cf->history_fd;
+}
+
+ssize_t combfilter_read_history(struct combfilter *cf, struct combFilter_history_entry *entries, size_t max) {
+    int history_fd = combfilter_history_fd(cf);
+    if (history_fd < 0) {
+        return -1;
+    }
+    for (;;) {
+        ssize_t len = read(history_fd, entries, max * sizeof(*entries));
+        if (len >= 0) {
+            return len / sizeof(*entries);
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/* Function to start change notification, returns the descriptor to poll */
+int combfilter_set_notify(struct combfilter *cf, combfilter_notify_fn fn, void *context) {
+    struct combFilter_history_entry entries[COMBFILTER_DISPATCH_BATCH];
+
+    cf->notify = fn;
+    cf->notify_context = context;
+    if (cf->notify_fd >= 0) {
+        return cf->notify_fd;
+    }
+
+    if (cf->engine) {
+        struct itimerspec period = {
+            .it_interval = { 0, COMBFILTER_ENGINE_NOTIFY_MS * 1000000L },
+            .it_value = { 0, COMBFILTER_ENGINE_NOTIFY_MS * 1000000L },
+        };
+        cf->notify_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (cf->notify_fd < 0) {
+            return -1;
+        }
+        if (timerfd_settime(cf->notify_fd, 0, &period, NULL) != 0) {
+            close(cf->notify_fd);
+            cf->notify_fd = -1;
+            return -1;
+        }
+        engine_shm_read(cf->engine, &cf->notify_last);
+        return cf->notify_fd;
+    }
+
+    /* Skip what the ring already holds, only later changes are reported */
+    ssize_t n;
+    while ((n = combfilter_read_history(cf, entries, COMBFILTER_DISPATCH_BATCH)) > 0) {
+    }
+    if (n < 0 && errno != EAGAIN) {
+        return -1;
+    }
+    cf->notify_fd = cf->history_fd;
+    return cf->notify_fd;
+}
+
+/* Function to report the changes of an engine since the last snapshot, one
+ * entry per register that differs */
+static int combfilter_dispatch_engine(struct combfilter *cf) {
+    struct combFilter_regs regs;
+    uint64_t expirations;
+    struct timespec now;
+    int count = 0;
+
+    /* Rearm the timer's POLLIN */
+    if (read(cf->notify_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return -1;
+    }
+
+    engine_shm_read(cf->engine, &regs);
+    if (regs.generation == cf->notify_last.generation) {
+        return 0;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    const struct combFilter_regs *last = &cf->notify_last;
+    unsigned int old_values[COMBFILTER_NUM_REGS] = { last->delaym, last->b0, last->bm, last->wetDryMix };
+    unsigned int new_values[COMBFILTER_NUM_REGS] = { regs.delaym, regs.b0, regs.bm, regs.wetDryMix };
+    for (int i = 0; i < COMBFILTER_NUM_REGS; i++) {
+        if (old_values[i] == new_values[i]) {
+            continue;
+        }
+        struct combFilter_history_entry entry = {
+            .seq = regs.generation,
+            .timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec,
+            .offset = i * sizeof(unsigned int),
+            .old_value = old_values[i],
+            .new_value = new_values[i],
+            .requested = new_values[i],
+        };
+        if (cf->notify) {
+            cf->notify(&entry, cf->notify_context);
+        }
+        count++;
+    }
+    cf->notify_last = regs;
+    return count;
+}
+
+/* Function to call the notify callback for every change not reported yet */
+int combfilter_dispatch(struct combfilter *cf) {
+    struct combFilter_history_entry entries[COMBFILTER_DISPATCH_BATCH];
+    int count = 0;
+
+    if (cf->notify_fd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cf->engine) {
+        return combfilter_dispatch_engine(cf);
+    }
+
+    for (;;) {
+        ssize_t n = combfilter_read_history(cf, entries, COMBFILTER_DISPATCH_BATCH);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            return -1;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (cf->notify) {
+                cf->notify(&entries[i], cf->notify_context);
+            }
+        }
+        count += n;
+        if (n < COMBFILTER_DISPATCH_BATCH) {
+            break;
+        }
+    }
+    return count;
+}
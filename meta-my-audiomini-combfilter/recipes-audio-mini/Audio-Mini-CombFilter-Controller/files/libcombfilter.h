@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: MIT */
+/*-------------------------------------------------------------------------
+ * Description: libcombfilter, C API for the comb filter registers
+ *
+ * A handle is opened once and keeps its descriptors, so no call forks a
+ * process or opens a file again. The same calls drive the kernel driver
+ * (/dev/combFilterProcessor and its sysfs attributes) or a software
+ * combFilterEngine, chosen when the handle is opened.
+ *
+ * Calls return 0 (or a count) on success and -1 with errno set on
+ * failure; the library does not print. A handle must not be used by two
+ * threads at once, give each thread its own.
+ *
+ *   struct combfilter *cf = combfilter_open(NULL, COMBFILTER_OPEN_LOAD_MODULE);
+ *   combfilter_stage(cf, COMBFILTER_DELAYM, 2400);
+ *   combfilter_stage(cf, COMBFILTER_B0, 0x8000);
+ *   combfilter_commit(cf);
+ *   combfilter_close(cf);
+ *
+ * Build with pkg-config --cflags --libs combfilter.
+ *-------------------------------------------------------------------------*/
+
+#ifndef LIBCOMBFILTER_H
+#define LIBCOMBFILTER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <combFilter.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COMBFILTER_API_VERSION 2
+
+#ifndef COMBFILTER_API
+    #define COMBFILTER_API __attribute__((visibility("default")))
+#endif
+
+/* Module name as seen in /proc/modules */
+#ifndef COMBFILTER_MODULE_NAME
+    #define COMBFILTER_MODULE_NAME "combFilter"
+#endif
+
+#ifndef COMBFILTER_MODULE_PATH
+    #define COMBFILTER_MODULE_PATH "/lib/modules/combFilter.ko"
+#endif
+
+#ifndef COMBFILTER_DEVICE_PATH
+    #define COMBFILTER_DEVICE_PATH "/dev/combFilterProcessor"
+#endif
+
+/* Char device streaming the driver's register change history */
+#ifndef COMBFILTER_HISTORY_PATH
+    #define COMBFILTER_HISTORY_PATH "/dev/combFilterProcessor_history"
+#endif
+
+#ifndef COMBFILTER_SYSFS_PATH
+    #define COMBFILTER_SYSFS_PATH "/sys/class/misc/combFilterProcessor"
+#endif
+
+/* Sample rate of the Audio Mini codec, delaym counts samples at this rate */
+#ifndef COMBFILTER_SAMPLE_RATE
+    #define COMBFILTER_SAMPLE_RATE 48000
+#endif
+
+/* Register indexes, the char device offset / 4 */
+enum combfilter_register {
+    COMBFILTER_DELAYM,
+    COMBFILTER_B0,
+    COMBFILTER_BM,
+    COMBFILTER_WETDRYMIX,
+};
+
+/* combfilter_module_state() results */
+enum combfilter_module_state {
+    COMBFILTER_MODULE_UNLOADED,
+    COMBFILTER_MODULE_READY,        /* loaded and the device node exists */
+    COMBFILTER_MODULE_NO_DEVICE,    /* loaded, but no device bound (no effect overlay?) */
+};
+
+/* Largest grid and number of listed notches and peaks of combfilter_response() */
+#define COMBFILTER_RESPONSE_MAX_POINTS 16384
+#define COMBFILTER_RESPONSE_MAX_EXTREMA 64
+
+/* combfilter_open() flags */
+#define COMBFILTER_OPEN_LOAD_MODULE 0x1     /* load the driver first if it is not loaded */
+
+struct combfilter;
+
+struct combfilter_response {
+    struct combFilter_regs regs;        /* registers the curve was computed from */
+    unsigned int sample_rate;
+    unsigned int points;                /* grid points, 0 Hz to sample_rate / 2 inclusive */
+    const float *freq_hz;               /* points entries each */
+    const float *mag_db;
+    const float *phase_rad;
+    float peak_db;                      /* every peak and every notch has the same magnitude */
+    float notch_db;
+    unsigned int num_peaks;             /* count up to sample_rate / 2, the lists */
+    unsigned int num_notches;           /* hold the first COMBFILTER_RESPONSE_MAX_EXTREMA */
+    float peak_hz[COMBFILTER_RESPONSE_MAX_EXTREMA];
+    float notch_hz[COMBFILTER_RESPONSE_MAX_EXTREMA];
+    unsigned long updates;              /* recomputations, unchanged means the curve is too */
+    unsigned long basis_updates;        /* of which delaym or the grid changed */
+};
+
+/* Called by combfilter_dispatch() for every register change */
+typedef void (*combfilter_notify_fn)(const struct combFilter_history_entry *entry, void *context);
+
+/* Kernel module */
+COMBFILTER_API int combfilter_module_state(void);
+COMBFILTER_API int combfilter_load_module(void);
+COMBFILTER_API int combfilter_unload_module(void);
+
+/* Handles, engine_name NULL for the kernel driver */
+COMBFILTER_API struct combfilter *combfilter_open(const char *engine_name, unsigned int flags);
+COMBFILTER_API void combfilter_close(struct combfilter *cf);
+COMBFILTER_API int combfilter_is_engine(const struct combfilter *cf);
+COMBFILTER_API unsigned int combfilter_sample_rate(const struct combfilter *cf);
+COMBFILTER_API int combfilter_max_delaym(struct combfilter *cf, unsigned int *max_delaym);
+
+/* Register names, case-insensitive lookup, -1 for an unknown name */
+COMBFILTER_API int combfilter_register_index(const char *name);
+COMBFILTER_API const char *combfilter_register_name(int index);
+
+/* Registers. get reads all of them in one consistent snapshot, set writes
+ * one through sysfs, read and write go to a char device byte offset. */
+COMBFILTER_API int combfilter_get(struct combfilter *cf, struct combFilter_regs *regs);
+COMBFILTER_API int combfilter_set(struct combfilter *cf, int index, unsigned int value);
+COMBFILTER_API int combfilter_read(struct combfilter *cf, off_t offset, unsigned int *value);
+COMBFILTER_API int combfilter_write(struct combfilter *cf, off_t offset, unsigned int value);
+
+/* Batched writes. commit writes all staged registers in one step: the
+ * driver checks every value first, then writes them under one lock hold,
+ * so they change together or, on failure, not at all and stay staged.
+ * commit returns the number of registers written. write_span does the
+ * same for a caller that keeps its own values, only the registers in
+ * dirty_mask are written. */
+COMBFILTER_API int combfilter_stage(struct combfilter *cf, int index, unsigned int value);
+COMBFILTER_API unsigned int combfilter_staged(const struct combfilter *cf);
+COMBFILTER_API int combfilter_commit(struct combfilter *cf);
+COMBFILTER_API int combfilter_write_span(struct combfilter *cf, const unsigned int *values,
+                                         unsigned int dirty_mask);
+
+/* Frequency response of a register set, from 0 Hz to half the handle's
+ * sample rate on a grid of points (2 to COMBFILTER_RESPONSE_MAX_POINTS).
+ * The curve belongs to the handle and stays valid until the next call or
+ * combfilter_close(). It is only recomputed when the registers or the grid
+ * change, so a UI may call it on every redraw. NULL with errno EINVAL for
+ * a bad number of points. Pure computation, registers are not read. */
+COMBFILTER_API const struct combfilter_response *combfilter_response(struct combfilter *cf,
+                                                                    const struct combFilter_regs *regs,
+                                                                    unsigned int points);
+
+/* Driver (or engine) debug counters, "<name> <value>" lines */
+COMBFILTER_API int combfilter_read_stats(struct combfilter *cf, char *buffer, size_t size);
+
+/* Register change history, oldest entry first. Returns the number of
+ * entries read, -1 with errno EAGAIN when there is nothing new. The driver
+ * only; an engine keeps no history. */
+COMBFILTER_API int combfilter_history_fd(struct combfilter *cf);
+COMBFILTER_API ssize_t combfilter_read_history(struct combfilter *cf,
+                                               struct combFilter_history_entry *entries, size_t max);
+
+/* Change notification. set_notify returns a descriptor to poll for POLLIN
+ * next to the caller's own; when it is readable, dispatch calls fn for
+ * every change since the last call and returns how many there were. Only
+ * changes after set_notify are reported. For an engine the descriptor is
+ * a timer and changes are found by comparing snapshots, seq is then the
+ * engine's generation and pid is 0. */
+COMBFILTER_API int combfilter_set_notify(struct combfilter *cf, combfilter_notify_fn fn, void *context);
+COMBFILTER_API int combfilter_dispatch(struct combfilter *cf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBCOMBFILTER_H */
@@ -20,6 +20,19 @@
 #include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/uaccess.h>
+#include <linux/sysfs.h>
+#include <linux/of.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/timekeeping.h>
+#include <linux/io_uring.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include "combFilter.h"
 /*#include "fp_conversions.h"*/
 
 /*-----------------------------------------------------------------------*/
@@ -35,10 +48,103 @@
 /* component combFilterProcessor                                         */
 #define SPAN 0x10
 
+/* Entries kept in the parameter history ring, must be a power of two    */
+#define HISTORY_LEN 1024
+
+/* The step limit is the largest change per ramp period                  */
+#define COMBFILTER_RAMP_PERIOD_NS   NSEC_PER_MSEC
+/* Jiffies between two runs of ramp_work while a register ramps          */
+#define COMBFILTER_RAMP_INTERVAL    1
+/* Ramp periods one run of ramp_work may catch up on                     */
+#define COMBFILTER_RAMP_MAX_PERIODS \
+	DIV_ROUND_UP(TICK_NSEC * COMBFILTER_RAMP_INTERVAL, COMBFILTER_RAMP_PERIOD_NS)
+
+/* Safety limits at probe, unless the device tree gives others: gains and */
+/* the mix at most unity, crossing their range in 64 ms at the fastest   */
+#define COMBFILTER_DEFAULT_GAIN_MAX  COMBFILTER_GAIN_ONE
+#define COMBFILTER_DEFAULT_GAIN_STEP (COMBFILTER_GAIN_ONE / 64)
+
+/* Register names, indexed by register offset / 4, as used by the limits attribute */
+static const char *const combFilterProcessor_reg_names[COMBFILTER_NUM_REGS] = {
+	"delaym", "b0", "bm", "wetDryMix",
+};
+
+/* Device tree properties overriding the default limits, <min max step> */
+static const char *const combFilterProcessor_limit_props[COMBFILTER_NUM_REGS] = {
+	"delaym-limits", "b0-limits", "bm-limits", "wetdrymix-limits",
+};
+
 
 /*-----------------------------------------------------------------------*/
 /* combFilterProcessor device structure                                  */
 /*-----------------------------------------------------------------------*/
+/*
+ * struct combFilterProcessor_stats - Debug counters of a combFilterProcessor device.
+ * @char_reads: Successful read() calls on the char device
+ * @char_writes: Successful write() calls on the char device
+ * @uring_cmds: Completed io_uring command batches
+ * @ioctl_batches: Completed COMBFILTER_IOC_BATCH batches
+ * @sysfs_writes: Successful register stores through sysfs
+ * @faults: Rejected char device accesses and batches (bad offset, size or
+ *          user buffer)
+ * @clamped: Register writes changed by the min/max limits
+ * @ramped: Register writes the step limit spread over several ramp steps
+ *
+ * All counters are protected by the device lock.
+ */
+struct combFilterProcessor_stats {
+	unsigned long char_reads;
+	unsigned long char_writes;
+	unsigned long uring_cmds;
+	unsigned long ioctl_batches;
+	unsigned long sysfs_writes;
+	unsigned long faults;
+	unsigned long clamped;
+	unsigned long ramped;
+};
+
+/*
+ * struct combFilterProcessor_limit - Safety limits of one register.
+ * @min: Lowest value written to the hardware
+ * @max: Highest value written to the hardware
+ * @step: Largest change per COMBFILTER_RAMP_PERIOD_NS, so gains ramp toward
+ *        a new value instead of jumping; U32_MAX disables the rate-of-change
+ *        limit
+ */
+struct combFilterProcessor_limit {
+	u32 min;
+	u32 max;
+	u32 step;
+};
+
+/*
+ * struct combFilterProcessor_history_slot - One slot of the history ring.
+ * @stamp: Sequence number of the entry plus one, 0 while the slot is being
+ *         rewritten; readers check it before and after copying the entry
+ * @entry: The register change
+ */
+struct combFilterProcessor_history_slot {
+	atomic64_t stamp;
+	struct combFilter_history_entry entry;
+};
+
+/*
+ * struct combFilterProcessor_history - Ring of the last HISTORY_LEN register changes.
+ * @slots: HISTORY_LEN slots, entry seq lives in slot seq % HISTORY_LEN
+ * @head: Sequence number of the next entry
+ * @wait: Readers waiting for the next entry
+ *
+ * There is a single producer, combFilterProcessor_reg_write(), serialized
+ * by the device lock. Readers never take the lock: they copy a slot and
+ * throw it away if its stamp changed meanwhile, so a slow reader can never
+ * hold up a register write, it only loses the entries that were overwritten.
+ */
+struct combFilterProcessor_history {
+	struct combFilterProcessor_history_slot *slots;
+	atomic64_t head;
+	wait_queue_head_t wait;
+};
+
 /*
  * struct  combFilterProcessor_dev - Private combFilterProcessor device struct.
  * @miscdev: miscdevice used to create a char device 
@@ -46,6 +152,20 @@
  * @base_addr: Base address of the combFilterProcessor component
  * @lock: mutex used to prevent concurrent writes 
  *        to the combFilterProcessor component
+ * @generation: Number of register writes so far, reported with the
+ *              regs snapshot so readers can tell whether anything changed
+ * @stats: Debug counters, reported by the stats attribute
+ * @limits: Safety limits per register, from probe defaults or the device
+ *          tree, changed through the limits attribute
+ * @shadow: Last value written to each register, the base of the step limit
+ * @target: Value each register ramps toward, the last write clamped to [min, max]
+ * @ramp_stamp: When each register last moved, the step limit's time base
+ * @ramp_work: Moves registers that are short of their target, one ramp
+ *             interval at a time
+ * @max_delaym: Largest delaym the FPGA delay line can hold, from the
+ *              max-delaym device tree property (U32_MAX if not given)
+ * @history_miscdev: miscdevice for /dev/combFilterProcessor_history
+ * @history: Ring of the recent register changes
  *
  * An combFilterProcessor_dev struct gets created for each combFilterProcessor 
  * component in the system.
@@ -54,8 +174,224 @@ struct combFilterProcessor_dev {
 	struct miscdevice miscdev;
 	void __iomem *base_addr;
 	struct mutex lock;
+	u32 generation;
+	struct combFilterProcessor_stats stats;
+	struct combFilterProcessor_limit limits[COMBFILTER_NUM_REGS];
+	u32 shadow[COMBFILTER_NUM_REGS];
+	u32 target[COMBFILTER_NUM_REGS];
+	ktime_t ramp_stamp[COMBFILTER_NUM_REGS];
+	struct delayed_work ramp_work;
+	u32 max_delaym;
+	struct miscdevice history_miscdev;
+	struct combFilterProcessor_history history;
 };
 
+/*-----------------------------------------------------------------------*/
+/* Parameter history helper                                              */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterProcessor_history_add() - Record a register change.
+ * @priv: Private combFilterProcessor device struct.
+ * @offset: Byte offset of the register.
+ * @old: Value before the write.
+ * @new: Value written to the hardware.
+ * @requested: Value the writer asked for.
+ *
+ * Overwrites the oldest entry once the ring is full. The caller must hold
+ * priv->lock, which makes this the only writer of the ring.
+ */
+static void combFilterProcessor_history_add(struct combFilterProcessor_dev *priv,
+	u32 offset, u32 old, u32 new, u32 requested)
+{
+	struct combFilterProcessor_history *history = &priv->history;
+	u64 seq = atomic64_read(&history->head);
+	struct combFilterProcessor_history_slot *slot =
+		&history->slots[seq & (HISTORY_LEN - 1)];
+
+	// Invalidate the slot first, so a reader copying it sees the change
+	atomic64_set(&slot->stamp, 0);
+	smp_wmb();
+
+	slot->entry.seq = seq;
+	slot->entry.timestamp_ns = ktime_get_real_ns();
+	slot->entry.offset = offset;
+	slot->entry.old_value = old;
+	slot->entry.new_value = new;
+	slot->entry.requested = requested;
+	slot->entry.pid = task_tgid_vnr(current);
+	slot->entry.reserved = 0;
+
+	// Publish the entry, then the new head
+	atomic64_set_release(&slot->stamp, seq + 1);
+	atomic64_set_release(&history->head, seq + 1);
+
+	if (wq_has_sleeper(&history->wait)) {
+		wake_up_interruptible(&history->wait);
+	}
+}
+
+/*-----------------------------------------------------------------------*/
+/* Register write helper                                                 */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterProcessor_ramp_step() - Move one register toward its target.
+ * @priv: Private combFilterProcessor device struct.
+ * @reg: Register index.
+ * @now: Current monotonic time.
+ * @requested: Value the writer asked for, recorded in the history.
+ *
+ * The register moves by at most step for every COMBFILTER_RAMP_PERIOD_NS
+ * since it last moved. The periods count up to one ramp interval at most,
+ * so a register that sat still for a while does not save up for a jump.
+ * The caller must hold priv->lock.
+ *
+ * Return: true while the register is still short of its target.
+ */
+static bool combFilterProcessor_ramp_step(struct combFilterProcessor_dev *priv,
+	unsigned int reg, ktime_t now, u32 requested)
+{
+	const struct combFilterProcessor_limit *limit = &priv->limits[reg];
+	u32 old = priv->shadow[reg];
+	u32 target = priv->target[reg];
+	u64 periods, budget;
+	u32 new;
+
+	if (limit->step == U32_MAX) {
+		budget = U32_MAX;
+	} else {
+		periods = div_u64(ktime_to_ns(ktime_sub(now, priv->ramp_stamp[reg])),
+			COMBFILTER_RAMP_PERIOD_NS);
+		periods = min_t(u64, periods, COMBFILTER_RAMP_MAX_PERIODS);
+		budget = (u64)limit->step * periods;
+		if (budget == 0) {
+			return old != target;
+		}
+	}
+
+	if (target >= old) {
+		new = old + min_t(u64, budget, target - old);
+	} else {
+		new = old - min_t(u64, budget, old - target);
+	}
+
+	iowrite32(new, priv->base_addr + reg * sizeof(u32));
+	priv->shadow[reg] = new;
+	priv->ramp_stamp[reg] = now;
+	priv->generation++;
+	combFilterProcessor_history_add(priv, reg * sizeof(u32), old, new, requested);
+
+	return new != target;
+}
+
+/*
+ * combFilterProcessor_ramp_work() - Ramp registers that are short of their target.
+ * @work: ramp_work of the combFilterProcessor device.
+ *
+ * Runs every COMBFILTER_RAMP_INTERVAL while any register is still ramping.
+ */
+static void combFilterProcessor_ramp_work(struct work_struct *work)
+{
+	struct combFilterProcessor_dev *priv = container_of(to_delayed_work(work),
+	                            struct combFilterProcessor_dev, ramp_work);
+	ktime_t now = ktime_get();
+	bool ramping = false;
+	unsigned int i;
+
+	mutex_lock(&priv->lock);
+	for (i = 0; i < COMBFILTER_NUM_REGS; i++) {
+		if (priv->shadow[i] != priv->target[i]) {
+			ramping |= combFilterProcessor_ramp_step(priv, i, now, priv->target[i]);
+		}
+	}
+	if (ramping) {
+		schedule_delayed_work(&priv->ramp_work, COMBFILTER_RAMP_INTERVAL);
+	}
+	mutex_unlock(&priv->lock);
+}
+
+/*
+ * combFilterProcessor_reg_write() - Write one combFilterProcessor register.
+ * @priv: Private combFilterProcessor device struct.
+ * @offset: Byte offset of the register.
+ * @value: Value to write.
+ *
+ * All register writes (sysfs and char device) go through this function so
+ * the generation counter and the history stay in step with the hardware,
+ * and so no client
+ * can get past the safety limits. @value is clamped to the register's
+ * [min, max] range, which compiles to conditional moves with no branch on
+ * the value, and becomes the register's target. The register moves toward
+ * the target right away as far as the step limit allows; the rest of the
+ * way ramp_work moves it at step per COMBFILTER_RAMP_PERIOD_NS, however
+ * often clients write. A write that changes the target mid-ramp takes over
+ * from the value the hardware holds. The caller must hold priv->lock.
+ */
+static void combFilterProcessor_reg_write(struct combFilterProcessor_dev *priv,
+	u32 offset, u32 value)
+{
+	unsigned int reg = offset / sizeof(u32);
+	const struct combFilterProcessor_limit *limit = &priv->limits[reg];
+	u32 old = priv->shadow[reg];
+	u32 target;
+
+	lockdep_assert_held(&priv->lock);
+
+	target = max(min(value, limit->max), limit->min);
+	priv->target[reg] = target;
+	priv->stats.clamped += target != value;
+
+	if (target == old) {
+		// Nothing to ramp, but the write still counts as one
+		iowrite32(target, priv->base_addr + offset);
+		priv->generation++;
+		combFilterProcessor_history_add(priv, offset, old, target, value);
+		return;
+	}
+
+	if (combFilterProcessor_ramp_step(priv, reg, ktime_get(), value)) {
+		priv->stats.ramped++;
+		schedule_delayed_work(&priv->ramp_work, COMBFILTER_RAMP_INTERVAL);
+	}
+}
+
+/*
+ * combFilterProcessor_reg_check() - Check a value against the hardware's range.
+ * @priv: Private combFilterProcessor device struct.
+ * @offset: Byte offset of the register.
+ * @value: Value about to be written.
+ *
+ * A delaym past the end of the FPGA delay line would wrap around the delay
+ * memory, so it is rejected outright rather than clamped like the limits.
+ *
+ * Return: 0 if @value may be written, -ERANGE if not.
+ */
+static int combFilterProcessor_reg_check(struct combFilterProcessor_dev *priv,
+	u32 offset, u32 value)
+{
+	if (offset == REG0_DELAYM_OFFSET && value > priv->max_delaym) {
+		return -ERANGE;
+	}
+
+	return 0;
+}
+
+/*
+ * combFilterProcessor_fault() - Count a rejected char device access.
+ * @priv: Private combFilterProcessor device struct.
+ * @err: Error code being returned to user-space.
+ *
+ * Return: @err, so error paths can return the result directly.
+ */
+static ssize_t combFilterProcessor_fault(struct combFilterProcessor_dev *priv,
+	ssize_t err)
+{
+	mutex_lock(&priv->lock);
+	priv->stats.faults++;
+	mutex_unlock(&priv->lock);
+
+	return err;
+}
+
 /*-----------------------------------------------------------------------*/
 /* REG0: DELAYM register read function show()                            */
 /*-----------------------------------------------------------------------*/
@@ -94,7 +430,8 @@ static ssize_t delaym_show(struct device *dev,
  * @buf: Buffer that contains the value being written.
  * @size: The number of bytes being written.
  *
- * Return: The number of bytes stored.
+ * Return: The number of bytes stored, or -ERANGE if the value is larger
+ * than max_delaym.
  */
 static ssize_t delaym_store(struct device *dev,
 	struct device_attribute *attr, const char *buf, size_t size)
@@ -111,7 +448,15 @@ static ssize_t delaym_store(struct device *dev,
 		return ret;
 	}
 
-	iowrite32(value, priv->base_addr + REG0_DELAYM_OFFSET);
+	ret = combFilterProcessor_reg_check(priv, REG0_DELAYM_OFFSET, value);
+	if (ret < 0) {
+		return ret;
+	}
+
+	mutex_lock(&priv->lock);
+	combFilterProcessor_reg_write(priv, REG0_DELAYM_OFFSET, value);
+	priv->stats.sysfs_writes++;
+	mutex_unlock(&priv->lock);
 
 	// Write was successful, so we return the number of bytes we wrote.
 	return size;
@@ -172,7 +517,10 @@ static ssize_t b0_store(struct device *dev,
 		return ret;
 	}
 
-	iowrite32(value, priv->base_addr + REG1_B0_OFFSET);
+	mutex_lock(&priv->lock);
+	combFilterProcessor_reg_write(priv, REG1_B0_OFFSET, value);
+	priv->stats.sysfs_writes++;
+	mutex_unlock(&priv->lock);
 
 	// Write was successful, so we return the number of bytes we wrote.
 	return size;
@@ -233,7 +581,10 @@ static ssize_t bm_store(struct device *dev,
 		return ret;
 	}
 
-	iowrite32(value, priv->base_addr + REG2_BM_OFFSET);
+	mutex_lock(&priv->lock);
+	combFilterProcessor_reg_write(priv, REG2_BM_OFFSET, value);
+	priv->stats.sysfs_writes++;
+	mutex_unlock(&priv->lock);
 
 	// Write was successful, so we return the number of bytes we wrote.
 	return size;
@@ -294,12 +645,195 @@ static ssize_t wetDryMix_store(struct device *dev,
 		return ret;
 	}
 
-	iowrite32(value, priv->base_addr + REG3_WETDRYMIX_OFFSET);
+	mutex_lock(&priv->lock);
+	combFilterProcessor_reg_write(priv, REG3_WETDRYMIX_OFFSET, value);
+	priv->stats.sysfs_writes++;
+	mutex_unlock(&priv->lock);
 
 	// Write was successful, so we return the number of bytes we wrote.
 	return size;
 }
 
+/*-----------------------------------------------------------------------*/
+/* REGS: register snapshot binary read function                          */
+/*-----------------------------------------------------------------------*/
+/*
+ * regs_read() - Return all registers and the generation counter
+ *               to user-space as a struct combFilter_regs.
+ * @file: Unused.
+ * @kobj: kobject of the device the attribute belongs to.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ * @off: Byte offset into the snapshot.
+ * @count: The number of bytes being requested.
+ *
+ * The registers are read under priv->lock so a snapshot can never mix
+ * values from before and after a concurrent write.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t regs_read(struct file *file, struct kobject *kobj,
+	struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct combFilter_regs regs;
+	struct combFilterProcessor_dev *priv = dev_get_drvdata(kobj_to_dev(kobj));
+
+	// The sysfs core already limits off + count to the attribute size
+	mutex_lock(&priv->lock);
+	regs.delaym = ioread32(priv->base_addr + REG0_DELAYM_OFFSET);
+	regs.b0 = ioread32(priv->base_addr + REG1_B0_OFFSET);
+	regs.bm = ioread32(priv->base_addr + REG2_BM_OFFSET);
+	regs.wetDryMix = ioread32(priv->base_addr + REG3_WETDRYMIX_OFFSET);
+	regs.generation = priv->generation;
+	mutex_unlock(&priv->lock);
+
+	memcpy(buf, (char *)&regs + off, count);
+
+	return count;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Delay line depth read function show()                                 */
+/*-----------------------------------------------------------------------*/
+/*
+ * max_delaym_show() - Return the largest delaym the FPGA delay line holds
+ *                     to user-space via sysfs.
+ * @dev: Device structure for the combFilterProcessor component.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t max_delaym_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct combFilterProcessor_dev *priv = dev_get_drvdata(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", priv->max_delaym);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Debug counters read function show()                                   */
+/*-----------------------------------------------------------------------*/
+/*
+ * stats_show() - Return the debug counters to user-space via sysfs,
+ *                one "<name> <value>" pair per line.
+ * @dev: Device structure for the combFilterProcessor component.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t stats_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct combFilterProcessor_stats stats;
+	u32 generation;
+	struct combFilterProcessor_dev *priv = dev_get_drvdata(dev);
+
+	mutex_lock(&priv->lock);
+	stats = priv->stats;
+	generation = priv->generation;
+	mutex_unlock(&priv->lock);
+
+	return scnprintf(buf, PAGE_SIZE,
+		"reg_writes %u\n"
+		"char_reads %lu\n"
+		"char_writes %lu\n"
+		"uring_cmds %lu\n"
+		"ioctl_batches %lu\n"
+		"sysfs_writes %lu\n"
+		"faults %lu\n"
+		"clamped %lu\n"
+		"ramped %lu\n",
+		generation, stats.char_reads, stats.char_writes, stats.uring_cmds,
+		stats.ioctl_batches, stats.sysfs_writes, stats.faults, stats.clamped, stats.ramped);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Safety limits read function show()                                   */
+/*-----------------------------------------------------------------------*/
+/*
+ * limits_show() - Return the safety limits to user-space via sysfs,
+ *                 one "<register> <min> <max> <step>" line per register.
+ * @dev: Device structure for the combFilterProcessor component.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t limits_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct combFilterProcessor_limit limits[COMBFILTER_NUM_REGS];
+	ssize_t len = 0;
+	unsigned int i;
+	struct combFilterProcessor_dev *priv = dev_get_drvdata(dev);
+
+	mutex_lock(&priv->lock);
+	memcpy(limits, priv->limits, sizeof(limits));
+	mutex_unlock(&priv->lock);
+
+	for (i = 0; i < COMBFILTER_NUM_REGS; i++) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %u %u %u\n",
+			combFilterProcessor_reg_names[i], limits[i].min,
+			limits[i].max, limits[i].step);
+	}
+
+	return len;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Safety limits write function store()                                  */
+/*-----------------------------------------------------------------------*/
+/**
+ * limits_store() - Set the safety limits of one register.
+ * @dev: Device structure for the combFilterProcessor component.
+ * @attr: Unused.
+ * @buf: "<register> <min> <max> [step]", step defaults to no limit.
+ * @size: The number of bytes being written.
+ *
+ * The new limits apply from the next write; the current register value is
+ * left alone so tightening a limit never causes a jump by itself. A ramp
+ * in progress takes the new limits at once, its target clamped into the
+ * new range.
+ *
+ * Return: The number of bytes stored, or -EINVAL for an unknown register
+ * or a min above max.
+ */
+static ssize_t limits_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	char name[16];
+	struct combFilterProcessor_limit limit = { .step = U32_MAX };
+	unsigned int i;
+	int fields;
+	struct combFilterProcessor_dev *priv = dev_get_drvdata(dev);
+
+	fields = sscanf(buf, "%15s %u %u %u", name, &limit.min, &limit.max, &limit.step);
+	if (fields < 3 || limit.min > limit.max || limit.step == 0) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < COMBFILTER_NUM_REGS; i++) {
+		if (strcmp(name, combFilterProcessor_reg_names[i]) == 0) {
+			break;
+		}
+	}
+	if (i == COMBFILTER_NUM_REGS) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&priv->lock);
+	priv->limits[i] = limit;
+	if (priv->target[i] != priv->shadow[i]) {
+		priv->target[i] = max(min(priv->target[i], limit.max), limit.min);
+	}
+	mutex_unlock(&priv->lock);
+
+	return size;
+}
+
 /*-----------------------------------------------------------------------*/
 /* sysfs Attributes                                                      */
 /*-----------------------------------------------------------------------*/
@@ -308,6 +842,10 @@ static DEVICE_ATTR_RW(delaym);    // Attribute for REG0
 static DEVICE_ATTR_RW(b0);        // Attribute for REG1
 static DEVICE_ATTR_RW(bm);        // Attribute for REG2
 static DEVICE_ATTR_RW(wetDryMix); // Attribute for REG3
+static DEVICE_ATTR_RO(stats);     // Debug counters
+static DEVICE_ATTR_RW(limits);    // Safety limits
+static DEVICE_ATTR_RO(max_delaym); // Delay line depth
+static BIN_ATTR_RO(regs, sizeof(struct combFilter_regs)); // Snapshot of all registers
 
 // Create an atribute group so the device core can 
 // export the attributes for us.
@@ -316,9 +854,26 @@ static struct attribute *combFilterProcessor_attrs[] = {
 	&dev_attr_b0.attr,
 	&dev_attr_bm.attr,
 	&dev_attr_wetDryMix.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_limits.attr,
+	&dev_attr_max_delaym.attr,
+	NULL,
+};
+
+static struct bin_attribute *combFilterProcessor_bin_attrs[] = {
+	&bin_attr_regs,
+	NULL,
+};
+
+static const struct attribute_group combFilterProcessor_group = {
+	.attrs = combFilterProcessor_attrs,
+	.bin_attrs = combFilterProcessor_bin_attrs,
+};
+
+static const struct attribute_group *combFilterProcessor_groups[] = {
+	&combFilterProcessor_group,
 	NULL,
 };
-ATTRIBUTE_GROUPS(combFilterProcessor);
 
 
 /*-----------------------------------------------------------------------*/
@@ -331,6 +886,9 @@ ATTRIBUTE_GROUPS(combFilterProcessor);
  * @count: The number of bytes being requested.
  * @offset: The byte offset in the file being read from.
  *
+ * Reads as many whole registers as fit in @count, starting at @offset, all
+ * under one lock hold so a multi-register read is a consistent snapshot.
+ *
  * Return: On success, the number of bytes written is returned and the
  * offset @offset is advanced by this number. On error, a negative error
  * value is returned.
@@ -339,7 +897,8 @@ static ssize_t combFilterProcessor_read(struct file *file, char __user *buf,
 	size_t count, loff_t *offset)
 {
 	size_t ret;
-	u32 val;
+	u32 vals[SPAN / sizeof(u32)];
+	unsigned int i;
 
 	loff_t pos = *offset;
 
@@ -355,7 +914,7 @@ static ssize_t combFilterProcessor_read(struct file *file, char __user *buf,
 	// Check file offset to make sure we are reading to a valid location.
 	if (pos < 0) {
 		// We can't read from a negative file position.
-		return -EINVAL;
+		return combFilterProcessor_fault(priv, -EINVAL);
 	}
 	if (pos >= SPAN) {
 		// We can't read from a position past the end of our device.
@@ -369,7 +928,7 @@ static ssize_t combFilterProcessor_read(struct file *file, char __user *buf,
 		 * because our registers are 32-bit-aligned.
 		 */
 		pr_warn("combFilterProcessor_read: unaligned access\n");
-		return -EFAULT;
+		return combFilterProcessor_fault(priv, -EFAULT);
 	}
 
 	// If the user didn't request any bytes, don't return any bytes :)
@@ -377,20 +936,32 @@ static ssize_t combFilterProcessor_read(struct file *file, char __user *buf,
 		return 0;
 	}
 
-	// Read the value at offset pos.
-	val = ioread32(priv->base_addr + pos);
+	// Read whole registers only, up to the end of the device.
+	count = min_t(size_t, count, SPAN - pos);
+	count -= count % sizeof(u32);
+	if (count == 0) {
+		return combFilterProcessor_fault(priv, -EINVAL);
+	}
+
+	// Read the values starting at offset pos.
+	mutex_lock(&priv->lock);
+	for (i = 0; i < count / sizeof(u32); i++) {
+		vals[i] = ioread32(priv->base_addr + pos + i * sizeof(u32));
+	}
+	priv->stats.char_reads++;
+	mutex_unlock(&priv->lock);
 
-	ret = copy_to_user(buf, &val, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied to the user.
+	ret = copy_to_user(buf, vals, count);
+	if (ret) {
+		// Not everything was copied to the user.
 		pr_warn("combFilterProcessor_read: nothing copied\n");
-		return -EFAULT;
+		return combFilterProcessor_fault(priv, -EFAULT);
 	}
 
 	// Increment the file offset by the number of bytes we read.
-	*offset = pos + sizeof(val);
+	*offset = pos + count;
 
-	return sizeof(val);
+	return count;
 }
 /*-----------------------------------------------------------------------*/
 /* File Operations write()                                               */
@@ -402,6 +973,11 @@ static ssize_t combFilterProcessor_read(struct file *file, char __user *buf,
  * @count: The number of bytes being written.
  * @offset: The byte offset in the file being written to.
  *
+ * Writes as many whole registers as fit in @count, starting at @offset, all
+ * under one lock hold so a multi-register write is applied atomically with
+ * respect to other writers and the regs snapshot. If any value is out of
+ * range (see combFilterProcessor_reg_check()) nothing is written.
+ *
  * Return: On success, the number of bytes written is returned and the
  * offset @offset is advanced by this number. On error, a negative error
  * value is returned.
@@ -410,7 +986,9 @@ static ssize_t combFilterProcessor_write(struct file *file, const char __user *b
 	size_t count, loff_t *offset)
 {
 	size_t ret;
-	u32 val;
+	u32 vals[SPAN / sizeof(u32)];
+	unsigned int i;
+	int err;
 
 	loff_t pos = *offset;
 
@@ -426,7 +1004,7 @@ static ssize_t combFilterProcessor_write(struct file *file, const char __user *b
 	// Check file offset to make sure we are writing to a valid location.
 	if (pos < 0) {
 		// We can't write to a negative file position.
-		return -EINVAL;
+		return combFilterProcessor_fault(priv, -EINVAL);
 	}
 	if (pos >= SPAN) {
 		// We can't write to a position past the end of our device.
@@ -440,7 +1018,7 @@ static ssize_t combFilterProcessor_write(struct file *file, const char __user *b
 		 * because our registers are 32-bit-aligned.
 		 */
 		pr_warn("combFilterProcessor_write: unaligned access\n");
-		return -EFAULT;
+		return combFilterProcessor_fault(priv, -EFAULT);
 	}
 
 	// If the user didn't request to write anything, return 0.
@@ -448,30 +1026,195 @@ static ssize_t combFilterProcessor_write(struct file *file, const char __user *b
 		return 0;
 	}
 
-	mutex_lock(&priv->lock);
+	// Write whole registers only, up to the end of the device.
+	count = min_t(size_t, count, SPAN - pos);
+	count -= count % sizeof(u32);
+	if (count == 0) {
+		return combFilterProcessor_fault(priv, -EINVAL);
+	}
 
-	ret = copy_from_user(&val, buf, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied from the user.
+	// Copy from user space before taking the lock, copy_from_user can sleep on a fault
+	ret = copy_from_user(vals, buf, count);
+	if (ret) {
+		// Not everything was copied from the user.
 		pr_warn("combFilterProcessor_write: nothing copied from user space\n");
-		ret = -EFAULT;
-		goto unlock;
+		return combFilterProcessor_fault(priv, -EFAULT);
 	}
 
-	// Write the value we were given at the address offset given by pos.
-	iowrite32(val, priv->base_addr + pos);
+	// Check every value first so a rejected write leaves all registers alone.
+	for (i = 0; i < count / sizeof(u32); i++) {
+		err = combFilterProcessor_reg_check(priv, pos + i * sizeof(u32), vals[i]);
+		if (err) {
+			return combFilterProcessor_fault(priv, err);
+		}
+	}
+
+	// Write the values we were given starting at the address offset given by pos.
+	mutex_lock(&priv->lock);
+	for (i = 0; i < count / sizeof(u32); i++) {
+		combFilterProcessor_reg_write(priv, pos + i * sizeof(u32), vals[i]);
+	}
+	priv->stats.char_writes++;
+	mutex_unlock(&priv->lock);
 
 	// Increment the file offset by the number of bytes we wrote.
-	*offset = pos + sizeof(val);
+	*offset = pos + count;
 
 	// Return the number of bytes we wrote.
-	ret = sizeof(val);
+	return count;
+}
 
-unlock:
+
+/*-----------------------------------------------------------------------*/
+/* Register batches, io_uring command and ioctl()                        */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterProcessor_batch() - Run a batch of register reads and writes.
+ * @priv: The device.
+ * @file: File the batch came through; writes need it opened for writing.
+ * @uops: User pointer to @count struct combFilter_op.
+ * @count: Number of operations.
+ * @nonblock: Return -EAGAIN instead of sleeping on the device lock.
+ * @counter: Stats counter to increment when the batch has run.
+ *
+ * Every operation is checked first, so a rejected batch leaves all
+ * registers alone. The operations then run in order under one lock hold,
+ * and every register is read back into the op array.
+ *
+ * Return: @count on success. -EINVAL for a bad batch or op, -ERANGE for a
+ * value out of range, -EBADF for a write through a file not opened for
+ * writing, -EFAULT on a bad user buffer, -EAGAIN if @nonblock and the lock
+ * is held.
+ */
+static int combFilterProcessor_batch(struct combFilterProcessor_dev *priv,
+	struct file *file, void __user *uops, u32 count, bool nonblock,
+	unsigned long *counter)
+{
+	struct combFilter_op ops[COMBFILTER_URING_BATCH_MAX];
+	unsigned int i;
+	int err;
+
+	if (count == 0 || count > COMBFILTER_URING_BATCH_MAX) {
+		return combFilterProcessor_fault(priv, -EINVAL);
+	}
+
+	if (copy_from_user(ops, uops, count * sizeof(ops[0]))) {
+		return combFilterProcessor_fault(priv, -EFAULT);
+	}
+
+	// Check every operation first so a rejected batch leaves all registers alone.
+	for (i = 0; i < count; i++) {
+		if (ops[i].offset >= SPAN || (ops[i].offset % 0x4) != 0 ||
+		    (ops[i].flags & ~COMBFILTER_OP_WRITE) || ops[i].reserved) {
+			return combFilterProcessor_fault(priv, -EINVAL);
+		}
+		if (ops[i].flags & COMBFILTER_OP_WRITE) {
+			// Same rule as write(2): no register writes through a read-only fd
+			if (!(file->f_mode & FMODE_WRITE)) {
+				return -EBADF;
+			}
+			err = combFilterProcessor_reg_check(priv, ops[i].offset, ops[i].value);
+			if (err) {
+				return combFilterProcessor_fault(priv, err);
+			}
+		}
+	}
+
+	if (nonblock) {
+		if (!mutex_trylock(&priv->lock)) {
+			return -EAGAIN;
+		}
+	} else {
+		mutex_lock(&priv->lock);
+	}
+	for (i = 0; i < count; i++) {
+		if (ops[i].flags & COMBFILTER_OP_WRITE) {
+			combFilterProcessor_reg_write(priv, ops[i].offset, ops[i].value);
+		}
+		ops[i].value = ioread32(priv->base_addr + ops[i].offset);
+	}
+	(*counter)++;
 	mutex_unlock(&priv->lock);
-	return ret;
+
+	// The registers are written by now, a fault here only loses the read-back
+	if (copy_to_user(uops, ops, count * sizeof(ops[0]))) {
+		return combFilterProcessor_fault(priv, -EFAULT);
+	}
+
+	return count;
+}
+
+/*
+ * combFilterProcessor_uring_cmd() - io_uring command method for the
+ *                                   combFilterProcessor char device
+ * @ioucmd: The command; its SQE holds a struct combFilter_uring_batch.
+ * @issue_flags: IO_URING_F_* flags of this attempt.
+ *
+ * Runs the batch with combFilterProcessor_batch(). The first attempt comes
+ * from io_uring_enter() with IO_URING_F_NONBLOCK. If another writer holds
+ * the lock then, -EAGAIN makes io_uring retry from its worker thread, where
+ * waiting for the lock is fine. That way the submitting thread never sleeps
+ * on the lock.
+ *
+ * Return: The number of operations, posted as the CQE result. -ENOTTY for
+ * an unknown command, otherwise as combFilterProcessor_batch().
+ */
+static int combFilterProcessor_uring_cmd(struct io_uring_cmd *ioucmd,
+	unsigned int issue_flags)
+{
+	struct combFilterProcessor_dev *priv = container_of(ioucmd->file->private_data,
+	                            struct combFilterProcessor_dev, miscdev);
+	const struct combFilter_uring_batch *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+
+	if (ioucmd->cmd_op != COMBFILTER_URING_CMD_BATCH) {
+		return -ENOTTY;
+	}
+
+	// The SQE lives in memory user-space can still change, read it once
+	if (READ_ONCE(cmd->reserved)) {
+		return combFilterProcessor_fault(priv, -EINVAL);
+	}
+	return combFilterProcessor_batch(priv, ioucmd->file,
+		u64_to_user_ptr(READ_ONCE(cmd->ops)), READ_ONCE(cmd->count),
+		issue_flags & IO_URING_F_NONBLOCK, &priv->stats.uring_cmds);
 }
 
+/*
+ * combFilterProcessor_ioctl() - ioctl method for the combFilterProcessor
+ *                               char device
+ * @file: Pointer to the char device file struct.
+ * @cmd: COMBFILTER_IOC_BATCH.
+ * @arg: User pointer to a struct combFilter_uring_batch.
+ *
+ * The same batch as the io_uring command, for callers without io_uring.
+ * libcombfilter uses it to write registers that are not next to each other
+ * in one step, which write() cannot do.
+ *
+ * Return: 0 on success, -ENOTTY for an unknown command, otherwise as
+ * combFilterProcessor_batch().
+ */
+static long combFilterProcessor_ioctl(struct file *file, unsigned int cmd,
+	unsigned long arg)
+{
+	struct combFilterProcessor_dev *priv = container_of(file->private_data,
+	                            struct combFilterProcessor_dev, miscdev);
+	struct combFilter_uring_batch batch;
+	int ret;
+
+	if (cmd != COMBFILTER_IOC_BATCH) {
+		return -ENOTTY;
+	}
+
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+		return combFilterProcessor_fault(priv, -EFAULT);
+	}
+	if (batch.reserved) {
+		return combFilterProcessor_fault(priv, -EINVAL);
+	}
+	ret = combFilterProcessor_batch(priv, file, u64_to_user_ptr(batch.ops),
+		batch.count, false, &priv->stats.ioctl_batches);
+	return ret < 0 ? ret : 0;
+}
 
 /*-----------------------------------------------------------------------*/
 /* File Operations Supported                                             */
@@ -484,6 +1227,9 @@ unlock:
  *         character device is still in use.
  * @read: The read function.
  * @write: The write function.
+ * @uring_cmd: Batched register access through io_uring (IORING_OP_URING_CMD).
+ * @unlocked_ioctl: The same batches through COMBFILTER_IOC_BATCH.
+ * @compat_ioctl: The batch struct has the same layout for 32-bit callers.
  * @llseek: We use the kernel's default_llseek() function; this allows 
  *          users to change what position they are writing/reading to/from.
  */
@@ -491,10 +1237,184 @@ static const struct file_operations  combFilterProcessor_fops = {
 	.owner = THIS_MODULE,
 	.read = combFilterProcessor_read,
 	.write = combFilterProcessor_write,
+	.uring_cmd = combFilterProcessor_uring_cmd,
+	.unlocked_ioctl = combFilterProcessor_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
 	.llseek = default_llseek,
 };
 
 
+/*-----------------------------------------------------------------------*/
+/* History File Operations read() and poll()                             */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterProcessor_history_read() - Read method for the history char device
+ * @file: Pointer to the char device file struct.
+ * @buf: User-space buffer to read the entries into.
+ * @count: The number of bytes being requested.
+ * @offset: Sequence number of the next entry this reader wants.
+ *
+ * Streams struct combFilter_history_entry records, as many whole entries as
+ * fit in @count. A new reader starts at the oldest entry still in the ring.
+ * If the reader fell more than HISTORY_LEN entries behind, it skips ahead to
+ * the oldest entry left; the gap shows in the seq numbers. Blocks until
+ * there is at least one entry unless the file is O_NONBLOCK.
+ *
+ * Return: On success, the number of bytes read. -EAGAIN if there is
+ * nothing new and the file is non-blocking, -EINVAL if @count is smaller
+ * than one entry, -EFAULT on a bad user buffer.
+ */
+static ssize_t combFilterProcessor_history_read(struct file *file, char __user *buf,
+	size_t count, loff_t *offset)
+{
+	struct combFilterProcessor_dev *priv = container_of(file->private_data,
+	                            struct combFilterProcessor_dev, history_miscdev);
+	struct combFilterProcessor_history *history = &priv->history;
+	struct combFilterProcessor_history_slot *slot;
+	struct combFilter_history_entry entry;
+	u64 seq = *offset;
+	u64 head;
+	s64 stamp;
+	size_t copied = 0;
+	int ret;
+
+	if (count < sizeof(entry)) {
+		return -EINVAL;
+	}
+
+	while (copied + sizeof(entry) <= count) {
+		head = atomic64_read_acquire(&history->head);
+		if (seq >= head) {
+			if (copied) {
+				break;
+			}
+			if (file->f_flags & O_NONBLOCK) {
+				return -EAGAIN;
+			}
+			ret = wait_event_interruptible(history->wait,
+				atomic64_read(&history->head) > seq);
+			if (ret) {
+				return ret;
+			}
+			continue;
+		}
+
+		// Entries older than one ring length are gone
+		if (head - seq > HISTORY_LEN) {
+			seq = head - HISTORY_LEN;
+		}
+
+		slot = &history->slots[seq & (HISTORY_LEN - 1)];
+		stamp = atomic64_read_acquire(&slot->stamp);
+		if (stamp != seq + 1) {
+			// Being overwritten right now, the entry is lost
+			seq++;
+			continue;
+		}
+		entry = slot->entry;
+		smp_rmb();
+		if (atomic64_read(&slot->stamp) != stamp) {
+			// Overwritten while we copied it
+			seq++;
+			continue;
+		}
+
+		if (copy_to_user(buf + copied, &entry, sizeof(entry))) {
+			return -EFAULT;
+		}
+		copied += sizeof(entry);
+		seq++;
+	}
+
+	*offset = seq;
+
+	return copied;
+}
+
+/*
+ * combFilterProcessor_history_poll() - Poll method for the history char device
+ * @file: Pointer to the char device file struct.
+ * @wait: Poll table.
+ *
+ * Return: EPOLLIN when there is an entry this reader has not read yet.
+ */
+static __poll_t combFilterProcessor_history_poll(struct file *file, poll_table *wait)
+{
+	struct combFilterProcessor_dev *priv = container_of(file->private_data,
+	                            struct combFilterProcessor_dev, history_miscdev);
+
+	poll_wait(file, &priv->history.wait, wait);
+
+	if (atomic64_read(&priv->history.head) > (u64)file->f_pos) {
+		return EPOLLIN | EPOLLRDNORM;
+	}
+	return 0;
+}
+
+/*
+ *  combFilterProcessor_history_fops - File operations of the history device
+ * @owner: The combFilterProcessor driver owns the file operations.
+ * @read: Streams the register changes.
+ * @poll: Signals new register changes.
+ * @llseek: The file position is a sequence number, not a byte offset, so
+ *          seeking is not supported.
+ */
+static const struct file_operations  combFilterProcessor_history_fops = {
+	.owner = THIS_MODULE,
+	.read = combFilterProcessor_history_read,
+	.poll = combFilterProcessor_history_poll,
+	.llseek = no_llseek,
+};
+
+
+/*-----------------------------------------------------------------------*/
+/* Safety limit defaults                                                 */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterProcessor_init_limits() - Set the limits a register starts with.
+ * @priv: Private combFilterProcessor device struct; max_delaym must be set.
+ * @np: Device tree node of the device.
+ *
+ * The guard is on from the first write, before user-space configures
+ * anything: delaym within the delay line, b0, bm and wetDryMix at most
+ * unity and ramping at COMBFILTER_DEFAULT_GAIN_STEP per millisecond. A
+ * <name>-limits = <min max step> property replaces a register's defaults,
+ * for a bitstream with another gain format. The limits attribute can
+ * tighten or relax them afterwards.
+ */
+static void combFilterProcessor_init_limits(struct combFilterProcessor_dev *priv,
+	struct device_node *np)
+{
+	struct combFilterProcessor_limit limit;
+	u32 prop[3];
+	unsigned int i;
+
+	for (i = 0; i < COMBFILTER_NUM_REGS; i++) {
+		if (i * sizeof(u32) == REG0_DELAYM_OFFSET) {
+			limit.min = 0;
+			limit.max = priv->max_delaym;
+			limit.step = U32_MAX;
+		} else {
+			limit.min = 0;
+			limit.max = COMBFILTER_DEFAULT_GAIN_MAX;
+			limit.step = COMBFILTER_DEFAULT_GAIN_STEP;
+		}
+
+		if (!of_property_read_u32_array(np, combFilterProcessor_limit_props[i],
+				prop, ARRAY_SIZE(prop))) {
+			if (prop[0] <= prop[1] && prop[2] != 0) {
+				limit.min = prop[0];
+				limit.max = prop[1];
+				limit.step = prop[2];
+			} else {
+				pr_warn("combFilterProcessor: invalid %s, keeping the defaults\n",
+					combFilterProcessor_limit_props[i]);
+			}
+		}
+		priv->limits[i] = limit;
+	}
+}
+
 /*-----------------------------------------------------------------------*/
 /* Platform Driver Probe (Initialization) Function                       */
 /*-----------------------------------------------------------------------*/
@@ -512,6 +1432,7 @@ static const struct file_operations  combFilterProcessor_fops = {
 static int combFilterProcessor_probe(struct platform_device *pdev)
 {
 	struct combFilterProcessor_dev *priv;
+	unsigned int i;
 	int ret;
 
 	/*
@@ -538,6 +1459,34 @@ static int combFilterProcessor_probe(struct platform_device *pdev)
 		return PTR_ERR(priv->base_addr);
 	}
 
+	// Serializes register writes and the regs snapshot
+	mutex_init(&priv->lock);
+
+	// Depth of the FPGA delay line; without it delaym is not range checked
+	if (of_property_read_u32(pdev->dev.of_node, "max-delaym", &priv->max_delaym)) {
+		pr_warn("combFilterProcessor: no max-delaym property, delaym is not range checked\n");
+		priv->max_delaym = U32_MAX;
+	}
+
+	// Safe limits from the start; the step limit starts from whatever the
+	// hardware holds now
+	combFilterProcessor_init_limits(priv, pdev->dev.of_node);
+	for (i = 0; i < COMBFILTER_NUM_REGS; i++) {
+		priv->shadow[i] = ioread32(priv->base_addr + i * sizeof(u32));
+		priv->target[i] = priv->shadow[i];
+		priv->ramp_stamp[i] = ktime_get();
+	}
+	INIT_DELAYED_WORK(&priv->ramp_work, combFilterProcessor_ramp_work);
+
+	// Ring of the recent register changes, allocated apart from priv as it is 48 KiB
+	priv->history.slots = devm_kcalloc(&pdev->dev, HISTORY_LEN,
+		sizeof(*priv->history.slots), GFP_KERNEL);
+	if (!priv->history.slots) {
+		pr_err("Failed to allocate the combFilterProcessor history\n");
+		return -ENOMEM;
+	}
+	init_waitqueue_head(&priv->history.wait);
+
 	// Initialize the misc device parameters
 	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
 	priv->miscdev.name = "combFilterProcessor";
@@ -553,6 +1502,19 @@ static int combFilterProcessor_probe(struct platform_device *pdev)
 		return ret;
 	}
 
+	// The history gets its own device, /dev/combFilterProcessor_history
+	priv->history_miscdev.minor = MISC_DYNAMIC_MINOR;
+	priv->history_miscdev.name = "combFilterProcessor_history";
+	priv->history_miscdev.fops = &combFilterProcessor_history_fops;
+	priv->history_miscdev.parent = &pdev->dev;
+
+	ret = misc_register(&priv->history_miscdev);
+	if (ret) {
+		pr_err("Failed to register history misc device for combFilterProcessor\n");
+		misc_deregister(&priv->miscdev);
+		return ret;
+	}
+
 	// Attach the combFilterProcessor' private data to the 
     // platform device's struct.
 	platform_set_drvdata(pdev, priv);
@@ -578,8 +1540,12 @@ static int combFilterProcessor_remove(struct platform_device *pdev)
 	struct combFilterProcessor_dev *priv = platform_get_drvdata(pdev);
 
 	// Deregister the misc device and remove the /dev/combFilterProcessor file.
+	misc_deregister(&priv->history_miscdev);
 	misc_deregister(&priv->miscdev);
 
+	// No writer is left to restart a ramp, stop the one in progress
+	cancel_delayed_work_sync(&priv->ramp_work);
+
 	pr_info("combFilterProcessor_remove successful\n");
 
 	return 0;
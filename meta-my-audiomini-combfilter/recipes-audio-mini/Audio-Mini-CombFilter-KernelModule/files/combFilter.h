@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  User-space interface of the combFilterProcessor driver
+ * ------------------------------------------------------------------------
+ * Shared by the kernel module and user-space programs (installed to
+ * /usr/include with the driver) so both agree on the binary layouts.
+-------------------------------------------------------------------------*/
+#ifndef _COMBFILTER_H
+#define _COMBFILTER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*-----------------------------------------------------------------------*/
+/* Register Offsets (char device /dev/combFilterProcessor)               */
+/*-----------------------------------------------------------------------*/
+#define COMBFILTER_REG_DELAYM     0x00
+#define COMBFILTER_REG_B0         0x04
+#define COMBFILTER_REG_BM         0x08
+#define COMBFILTER_REG_WETDRYMIX  0x0C
+#define COMBFILTER_NUM_REGS       4
+
+/*
+ * Register formats. delaym is a whole number of samples. b0, bm and
+ * wetDryMix are unsigned fractions, value / COMBFILTER_GAIN_ONE, so 65535
+ * is just below unity. The processor computes
+ *   wet[n] = b0 * x[n] + bm * x[n - delaym]
+ *   y[n]   = (1 - wetDryMix) * x[n] + wetDryMix * wet[n]
+ */
+#define COMBFILTER_GAIN_FRAC_BITS 16
+#define COMBFILTER_GAIN_ONE       (1u << COMBFILTER_GAIN_FRAC_BITS)
+
+/*-----------------------------------------------------------------------*/
+/* Register Snapshot (binary sysfs attribute "regs")                     */
+/*-----------------------------------------------------------------------*/
+/*
+ * struct combFilter_regs - All registers, read in one go under the driver lock.
+ * @delaym: REG0, comb delay in samples
+ * @b0: REG1, direct path gain
+ * @bm: REG2, delayed path gain
+ * @wetDryMix: REG3, wet/dry mix
+ * @generation: Incremented on every register write; two snapshots with the
+ *              same generation saw the same register values
+ *
+ * A single read() of sizeof(struct combFilter_regs) bytes at offset 0 returns
+ * a consistent snapshot, no value can change between the four registers.
+ */
+struct combFilter_regs {
+	__u32 delaym;
+	__u32 b0;
+	__u32 bm;
+	__u32 wetDryMix;
+	__u32 generation;
+};
+
+/*-----------------------------------------------------------------------*/
+/* Parameter History (char device /dev/combFilterProcessor_history)      */
+/*-----------------------------------------------------------------------*/
+/*
+ * struct combFilter_history_entry - One register change, as read from the
+ *                                   history device.
+ * @seq: Sequence number, one per register write since the driver loaded;
+ *       a gap between two entries is the number of entries overwritten
+ *       before the reader got to them
+ * @timestamp_ns: CLOCK_REALTIME time of the write in nanoseconds
+ * @offset: Byte offset of the register (COMBFILTER_REG_*)
+ * @old_value: Register value before the write
+ * @new_value: Register value after the write
+ * @requested: Value the writer asked for; differs from @new_value when the
+ *             safety limits clamped it
+ * @pid: Thread group id of the writing process
+ * @reserved: Zero
+ *
+ * read() returns whole entries only, oldest first, and blocks for the next
+ * change unless the device was opened O_NONBLOCK.
+ */
+struct combFilter_history_entry {
+	__u64 seq;
+	__u64 timestamp_ns;
+	__u32 offset;
+	__u32 old_value;
+	__u32 new_value;
+	__u32 requested;
+	__s32 pid;
+	__u32 reserved;
+};
+
+/*-----------------------------------------------------------------------*/
+/* Register Batches (io_uring commands and ioctl on the char device)     */
+/*-----------------------------------------------------------------------*/
+/* Most operations in one COMBFILTER_URING_CMD_BATCH or COMBFILTER_IOC_BATCH */
+#define COMBFILTER_URING_BATCH_MAX 16
+
+/* struct combFilter_op.flags */
+#define COMBFILTER_OP_READ   0x0
+#define COMBFILTER_OP_WRITE  0x1
+
+/*
+ * struct combFilter_op - One register access of a batch.
+ * @offset: Byte offset of the register (COMBFILTER_REG_*)
+ * @flags: COMBFILTER_OP_READ or COMBFILTER_OP_WRITE
+ * @value: Value to write. On completion, the value read back from the
+ *         register after the operation, so a write shows what the safety
+ *         limits let through
+ * @reserved: Zero
+ */
+struct combFilter_op {
+	__u32 offset;
+	__u32 flags;
+	__u32 value;
+	__u32 reserved;
+};
+
+/*
+ * struct combFilter_uring_batch - COMBFILTER_URING_CMD_BATCH command, in
+ *                                 the cmd area of a normal 64-byte SQE,
+ *                                 or the argument of COMBFILTER_IOC_BATCH.
+ * @ops: User pointer to @count struct combFilter_op, which must stay valid
+ *       until the completion
+ * @count: Number of operations, 1 to COMBFILTER_URING_BATCH_MAX
+ * @reserved: Zero
+ *
+ * The operations run in order under one lock hold, in any mix of offsets
+ * and reads and writes. Every write is checked first, as for write(): one
+ * value out of range fails the batch and nothing is written. The CQE
+ * result is @count on success or a negative error code; the ioctl returns
+ * 0 or -1 with errno set.
+ */
+struct combFilter_uring_batch {
+	__u64 ops;
+	__u32 count;
+	__u32 reserved;
+};
+
+/* sqe->cmd_op of a batch */
+#define COMBFILTER_URING_CMD_BATCH _IOWR(0xCF, 0x00, struct combFilter_uring_batch)
+
+/* The same batch through ioctl(), for callers without io_uring */
+#define COMBFILTER_IOC_BATCH _IOWR(0xCF, 0x01, struct combFilter_uring_batch)
+
+#endif /* _COMBFILTER_H */
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Dummy FPGA Manager used to exercise the combFilterProcessor
+ *               effect overlays without a Cyclone V FPGA (e.g. under QEMU)
+ * ------------------------------------------------------------------------
+ * Accepts any bitstream handed to it by an fpga-region, counts the bytes
+ * and reports success, so the overlay apply/remove path, the region and
+ * the driver binding can be tested on a machine without programmable
+ * fabric. See fpga-mgr-dummy-overlay.dts.
+-------------------------------------------------------------------------*/
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/mod_devicetable.h>
+#include <linux/fpga/fpga-mgr.h>
+#include <linux/kernel.h>
+
+/*-----------------------------------------------------------------------*/
+/* fpgaMgrDummy device structure                                         */
+/*-----------------------------------------------------------------------*/
+/*
+ * struct fpgaMgrDummy_priv - Private fpgaMgrDummy device struct.
+ * @state: FPGA Manager state reported back to the framework
+ * @bytes: Number of bitstream bytes received for the current image
+ */
+struct fpgaMgrDummy_priv {
+	enum fpga_mgr_states state;
+	size_t bytes;
+};
+
+static enum fpga_mgr_states fpgaMgrDummy_state(struct fpga_manager *mgr)
+{
+	struct fpgaMgrDummy_priv *priv = mgr->priv;
+
+	return priv->state;
+}
+
+static int fpgaMgrDummy_write_init(struct fpga_manager *mgr,
+	struct fpga_image_info *info, const char *buf, size_t count)
+{
+	struct fpgaMgrDummy_priv *priv = mgr->priv;
+
+	priv->state = FPGA_MGR_STATE_WRITE_INIT;
+	priv->bytes = 0;
+
+	return 0;
+}
+
+static int fpgaMgrDummy_write(struct fpga_manager *mgr,
+	const char *buf, size_t count)
+{
+	struct fpgaMgrDummy_priv *priv = mgr->priv;
+
+	priv->state = FPGA_MGR_STATE_WRITE;
+	priv->bytes += count;
+
+	return 0;
+}
+
+static int fpgaMgrDummy_write_complete(struct fpga_manager *mgr,
+	struct fpga_image_info *info)
+{
+	struct fpgaMgrDummy_priv *priv = mgr->priv;
+
+	priv->state = FPGA_MGR_STATE_OPERATING;
+	dev_info(&mgr->dev, "fpgaMgrDummy: accepted %zu byte bitstream\n",
+		priv->bytes);
+
+	return 0;
+}
+
+static const struct fpga_manager_ops fpgaMgrDummy_ops = {
+	.state = fpgaMgrDummy_state,
+	.write_init = fpgaMgrDummy_write_init,
+	.write = fpgaMgrDummy_write,
+	.write_complete = fpgaMgrDummy_write_complete,
+};
+
+/*-----------------------------------------------------------------------*/
+/* Platform Driver Probe (Initialization) Function                       */
+/*-----------------------------------------------------------------------*/
+static int fpgaMgrDummy_probe(struct platform_device *pdev)
+{
+	struct fpgaMgrDummy_priv *priv;
+	struct fpga_manager *mgr;
+
+	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv) {
+		pr_err("Failed to allocate kernel memory for fpgaMgrDummy\n");
+		return -ENOMEM;
+	}
+	priv->state = FPGA_MGR_STATE_OPERATING;
+
+	// The FPGA Manager is unregistered automatically when the device goes away
+	mgr = devm_fpga_mgr_register(&pdev->dev, "Dummy FPGA Manager",
+		&fpgaMgrDummy_ops, priv);
+	if (IS_ERR(mgr)) {
+		pr_err("Failed to register fpgaMgrDummy\n");
+		return PTR_ERR(mgr);
+	}
+
+	pr_info("fpgaMgrDummy_probe successful\n");
+
+	return 0;
+}
+
+static const struct of_device_id fpgaMgrDummy_of_match[] = {
+	{ .compatible = "msu,fpga-mgr-dummy", },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, fpgaMgrDummy_of_match);
+
+static struct platform_driver fpgaMgrDummy_driver = {
+	.probe = fpgaMgrDummy_probe,
+	.driver = {
+		.owner = THIS_MODULE,
+		.name = "fpgaMgrDummy",
+		.of_match_table = fpgaMgrDummy_of_match,
+	},
+};
+
+module_platform_driver(fpgaMgrDummy_driver);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("Dummy FPGA Manager for testing effect overlays");
+MODULE_VERSION("1.0");
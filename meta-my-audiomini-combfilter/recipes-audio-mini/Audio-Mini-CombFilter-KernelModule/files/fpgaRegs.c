@@ -0,0 +1,1023 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Generic Linux Platform Device Driver for FPGA cores that
+ *               are a bank of 32-bit registers
+ * ------------------------------------------------------------------------
+ * The register layout (names, offsets, widths, fixed-point formats and
+ * ranges) comes from the device tree node, from a layout compiled into
+ * this file, or from a compiled layout with device tree overrides. From
+ * it the driver builds everything combFilter.c writes by hand:
+ *   - /dev/<name>, whole-register read()/write() at byte offsets, applied
+ *     under one lock hold
+ *   - a sysfs attribute per register, the "regs" snapshot of all of them
+ *     and a "layout" attribute describing the registers
+ *   - the FPGA_REGS_IOC_* ioctls, see fpgaRegs.h
+ * A new effect needs a device tree node (or a table entry below), no new
+ * driver. See fpgaRegs-combfilter-overlay.dts for a complete node.
+-------------------------------------------------------------------------*/
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/mod_devicetable.h>
+#include <linux/types.h>
+#include <linux/io.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/uaccess.h>
+#include <linux/sysfs.h>
+#include <linux/of.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/bits.h>
+#include <linux/sizes.h>
+#include "fpgaRegs.h"
+
+/*-----------------------------------------------------------------------*/
+/* Register layouts                                                      */
+/*-----------------------------------------------------------------------*/
+/*
+ * struct fpgaRegs_reg - Description of one register.
+ * @name: Register name, also its sysfs attribute
+ * @offset: Byte offset from the start of the core
+ * @width: Bits the core implements, 1 to 32; writes are masked to them
+ * @frac_bits: Fractional bits of the fixed-point format, reported to
+ *             user-space, the driver itself works on raw values
+ * @flags: FPGA_REGS_REG_*
+ * @min: Lowest value a write may have
+ * @max: Highest value a write may have; both are clipped to what @width
+ *       holds when the device is probed, so S64_MIN/S64_MAX mean no limit
+ */
+struct fpgaRegs_reg {
+	const char *name;
+	u32 offset;
+	u32 width;
+	u32 frac_bits;
+	u32 flags;
+	s64 min;
+	s64 max;
+};
+
+/*
+ * struct fpgaRegs_layout - A register layout compiled into the driver.
+ * @name: Name the device tree selects it by, with msu,layout
+ * @regs: The registers
+ * @num_regs: Number of entries in @regs
+ */
+struct fpgaRegs_layout {
+	const char *name;
+	const struct fpgaRegs_reg *regs;
+	unsigned int num_regs;
+};
+
+/* The comb filter of combFilter.rbf, in the order of struct combFilter_regs */
+static const struct fpgaRegs_reg fpgaRegs_combFilter_regs[] = {
+	{ "delaym",    0x00, 32, 0,  0, 0, S64_MAX },
+	{ "b0",        0x04, 32, 16, 0, 0, S64_MAX },
+	{ "bm",        0x08, 32, 16, 0, 0, S64_MAX },
+	{ "wetDryMix", 0x0C, 32, 16, 0, 0, S64_MAX },
+};
+
+static const struct fpgaRegs_layout fpgaRegs_layouts[] = {
+	{ "combFilterProcessor", fpgaRegs_combFilter_regs, ARRAY_SIZE(fpgaRegs_combFilter_regs) },
+};
+
+
+/*-----------------------------------------------------------------------*/
+/* fpgaRegs device structure                                             */
+/*-----------------------------------------------------------------------*/
+/*
+ * struct fpgaRegs_attr - sysfs attribute of one register.
+ * @dev_attr: The attribute
+ * @index: Index of the register it shows
+ */
+struct fpgaRegs_attr {
+	struct device_attribute dev_attr;
+	unsigned int index;
+};
+
+/*
+ * struct fpgaRegs_dev - Private fpgaRegs device struct.
+ * @miscdev: miscdevice used to create the char device
+ * @base_addr: Base address of the FPGA core
+ * @span: Bytes of register space, the size of the reg resource
+ * @lock: mutex serializing register writes and multi-register reads
+ * @generation: Number of register writes so far
+ * @regs: The register layout
+ * @num_regs: Number of entries in @regs
+ * @word_reg: Register index at every 32-bit word of @span, -1 for none
+ * @reg_attrs: One sysfs attribute per register
+ * @attrs: @reg_attrs and the layout attribute, NULL terminated
+ * @regs_attr: Binary "regs" snapshot attribute
+ * @bin_attrs: @regs_attr, NULL terminated
+ * @group: Attribute group of the char device
+ * @groups: @group, NULL terminated, handed to misc_register()
+ *
+ * The attributes are built per device at probe because every layout
+ * has its own registers.
+ */
+struct fpgaRegs_dev {
+	struct miscdevice miscdev;
+	void __iomem *base_addr;
+	u32 span;
+	struct mutex lock;
+	u32 generation;
+	struct fpgaRegs_reg *regs;
+	unsigned int num_regs;
+	s8 *word_reg;
+	struct fpgaRegs_attr *reg_attrs;
+	struct attribute **attrs;
+	struct bin_attribute regs_attr;
+	struct bin_attribute *bin_attrs[2];
+	struct attribute_group group;
+	const struct attribute_group *groups[2];
+};
+
+/* The miscdevice is the drvdata of its device, and the first member of priv */
+static struct fpgaRegs_dev *fpgaRegs_from_dev(struct device *dev)
+{
+	return container_of((struct miscdevice *)dev_get_drvdata(dev),
+		struct fpgaRegs_dev, miscdev);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Register access helpers                                               */
+/*-----------------------------------------------------------------------*/
+/*
+ * fpgaRegs_reg_read() - Read one register.
+ * @priv: Private fpgaRegs device struct.
+ * @index: Register index.
+ *
+ * Return: The register's bits, sign-extended to 32 bits for a signed register.
+ */
+static u32 fpgaRegs_reg_read(struct fpgaRegs_dev *priv, unsigned int index)
+{
+	const struct fpgaRegs_reg *reg = &priv->regs[index];
+	u32 value = ioread32(priv->base_addr + reg->offset) & GENMASK(reg->width - 1, 0);
+
+	if (reg->flags & FPGA_REGS_REG_SIGNED) {
+		value = (u32)sign_extend32(value, reg->width - 1);
+	}
+
+	return value;
+}
+
+/*
+ * fpgaRegs_reg_check() - Check a value against a register's description.
+ * @priv: Private fpgaRegs device struct.
+ * @index: Register index.
+ * @value: Value about to be written, a two's complement number for a
+ *         signed register.
+ *
+ * Return: 0 if @value may be written, -EPERM for a read-only register,
+ * -ERANGE for a value outside [min, max].
+ */
+static int fpgaRegs_reg_check(struct fpgaRegs_dev *priv, unsigned int index,
+	u32 value)
+{
+	const struct fpgaRegs_reg *reg = &priv->regs[index];
+	s64 v = (reg->flags & FPGA_REGS_REG_SIGNED) ? (s64)(s32)value : (s64)value;
+
+	if (reg->flags & FPGA_REGS_REG_READONLY) {
+		return -EPERM;
+	}
+	if (v < reg->min || v > reg->max) {
+		return -ERANGE;
+	}
+
+	return 0;
+}
+
+/*
+ * fpgaRegs_reg_write() - Write one register.
+ * @priv: Private fpgaRegs device struct.
+ * @index: Register index.
+ * @value: Value to write, already passed fpgaRegs_reg_check().
+ *
+ * The caller must hold priv->lock.
+ */
+static void fpgaRegs_reg_write(struct fpgaRegs_dev *priv, unsigned int index,
+	u32 value)
+{
+	const struct fpgaRegs_reg *reg = &priv->regs[index];
+
+	lockdep_assert_held(&priv->lock);
+
+	iowrite32(value & GENMASK(reg->width - 1, 0), priv->base_addr + reg->offset);
+	priv->generation++;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Register attributes show() and store()                                */
+/*-----------------------------------------------------------------------*/
+/*
+ * fpgaRegs_attr_show() - Return a register value to user-space via sysfs.
+ * @dev: Device structure of the char device.
+ * @attr: The register's attribute, embedded in a struct fpgaRegs_attr.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t fpgaRegs_attr_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct fpgaRegs_dev *priv = fpgaRegs_from_dev(dev);
+	unsigned int index = container_of(attr, struct fpgaRegs_attr, dev_attr)->index;
+	u32 value = fpgaRegs_reg_read(priv, index);
+
+	if (priv->regs[index].flags & FPGA_REGS_REG_SIGNED) {
+		return scnprintf(buf, PAGE_SIZE, "%d\n", (s32)value);
+	}
+	return scnprintf(buf, PAGE_SIZE, "%u\n", value);
+}
+
+/*
+ * fpgaRegs_attr_store() - Store a register value.
+ * @dev: Device structure of the char device.
+ * @attr: The register's attribute, embedded in a struct fpgaRegs_attr.
+ * @buf: Buffer that contains the value being written.
+ * @size: The number of bytes being written.
+ *
+ * Return: The number of bytes stored, or -ERANGE if the value is outside
+ * the register's range.
+ */
+static ssize_t fpgaRegs_attr_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct fpgaRegs_dev *priv = fpgaRegs_from_dev(dev);
+	unsigned int index = container_of(attr, struct fpgaRegs_attr, dev_attr)->index;
+	u32 value;
+	s32 svalue;
+	int ret;
+
+	if (priv->regs[index].flags & FPGA_REGS_REG_SIGNED) {
+		ret = kstrtos32(buf, 0, &svalue);
+		value = (u32)svalue;
+	} else {
+		ret = kstrtou32(buf, 0, &value);
+	}
+	if (ret < 0) {
+		return ret;
+	}
+
+	ret = fpgaRegs_reg_check(priv, index, value);
+	if (ret < 0) {
+		return ret;
+	}
+
+	mutex_lock(&priv->lock);
+	fpgaRegs_reg_write(priv, index, value);
+	mutex_unlock(&priv->lock);
+
+	return size;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Layout read function show()                                           */
+/*-----------------------------------------------------------------------*/
+/*
+ * layout_show() - Describe the registers to user-space via sysfs, one
+ *                 "<name> <offset> <width> <frac_bits> signed|unsigned
+ *                 <min> <max> rw|ro" line per register.
+ * @dev: Device structure of the char device.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t layout_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct fpgaRegs_dev *priv = fpgaRegs_from_dev(dev);
+	ssize_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < priv->num_regs; i++) {
+		const struct fpgaRegs_reg *reg = &priv->regs[i];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s 0x%02x %u %u %s %lld %lld %s\n",
+			reg->name, reg->offset, reg->width, reg->frac_bits,
+			(reg->flags & FPGA_REGS_REG_SIGNED) ? "signed" : "unsigned",
+			reg->min, reg->max,
+			(reg->flags & FPGA_REGS_REG_READONLY) ? "ro" : "rw");
+	}
+
+	return len;
+}
+
+static DEVICE_ATTR_RO(layout);
+
+/*-----------------------------------------------------------------------*/
+/* REGS: register snapshot binary read function                          */
+/*-----------------------------------------------------------------------*/
+/*
+ * regs_read() - Return all registers in layout order, then the generation
+ *               counter, as u32s.
+ * @file: Unused.
+ * @kobj: kobject of the device the attribute belongs to.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ * @off: Byte offset into the snapshot.
+ * @count: The number of bytes being requested.
+ *
+ * Read under priv->lock, so a snapshot never mixes values from before and
+ * after a write. For the combFilterProcessor layout this is a
+ * struct combFilter_regs.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t regs_read(struct file *file, struct kobject *kobj,
+	struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+	struct fpgaRegs_dev *priv = fpgaRegs_from_dev(kobj_to_dev(kobj));
+	u32 vals[FPGA_REGS_MAX_REGS + 1];
+	unsigned int i;
+
+	// The sysfs core already limits off + count to the attribute size
+	mutex_lock(&priv->lock);
+	for (i = 0; i < priv->num_regs; i++) {
+		vals[i] = fpgaRegs_reg_read(priv, i);
+	}
+	vals[i] = priv->generation;
+	mutex_unlock(&priv->lock);
+
+	memcpy(buf, (char *)vals + off, count);
+
+	return count;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* File Operations read() and write()                                    */
+/*-----------------------------------------------------------------------*/
+/*
+ * fpgaRegs_span_check() - Check a char device access and trim it to whole
+ *                         registers.
+ * @priv: Private fpgaRegs device struct.
+ * @pos: Byte offset of the access.
+ * @count: Bytes requested, trimmed to whole words inside the span and to
+ *         FPGA_REGS_MAX_REGS words.
+ *
+ * Return: 0 if the access can go ahead, 1 at or past the end of the
+ * span, or a negative error code.
+ */
+static int fpgaRegs_span_check(struct fpgaRegs_dev *priv, loff_t pos, size_t *count)
+{
+	if (pos < 0) {
+		return -EINVAL;
+	}
+	if (pos >= priv->span) {
+		return 1;
+	}
+	if ((pos % sizeof(u32)) != 0) {
+		// Registers are 32-bit aligned, so only aligned accesses are allowed
+		return -EFAULT;
+	}
+
+	*count = min_t(size_t, *count, priv->span - pos);
+	*count = min_t(size_t, *count, FPGA_REGS_MAX_REGS * sizeof(u32));
+	*count -= *count % sizeof(u32);
+	if (*count == 0) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * fpgaRegs_read() - Read method for the fpgaRegs char device
+ * @file: Pointer to the char device file struct.
+ * @buf: User-space buffer to read the values into.
+ * @count: The number of bytes being requested.
+ * @offset: The byte offset in the file being read from.
+ *
+ * Reads as many whole registers as fit in @count, starting at @offset, all
+ * under one lock hold. Words of the span without a register read as 0.
+ *
+ * Return: On success, the number of bytes read and @offset is advanced by
+ * it. On error, a negative error value.
+ */
+static ssize_t fpgaRegs_read(struct file *file, char __user *buf,
+	size_t count, loff_t *offset)
+{
+	struct fpgaRegs_dev *priv = container_of(file->private_data,
+	                            struct fpgaRegs_dev, miscdev);
+	u32 vals[FPGA_REGS_MAX_REGS];
+	loff_t pos = *offset;
+	unsigned int i;
+	int ret;
+
+	if (count == 0) {
+		return 0;
+	}
+	ret = fpgaRegs_span_check(priv, pos, &count);
+	if (ret) {
+		return ret < 0 ? ret : 0;
+	}
+
+	mutex_lock(&priv->lock);
+	for (i = 0; i < count / sizeof(u32); i++) {
+		int index = priv->word_reg[pos / sizeof(u32) + i];
+
+		vals[i] = index < 0 ? 0 : fpgaRegs_reg_read(priv, index);
+	}
+	mutex_unlock(&priv->lock);
+
+	if (copy_to_user(buf, vals, count)) {
+		return -EFAULT;
+	}
+
+	*offset = pos + count;
+
+	return count;
+}
+
+/*
+ * fpgaRegs_write() - Write method for the fpgaRegs char device
+ * @file: Pointer to the char device file struct.
+ * @buf: User-space buffer to read the values from.
+ * @count: The number of bytes being written.
+ * @offset: The byte offset in the file being written to.
+ *
+ * Writes as many whole registers as fit in @count, starting at @offset, all
+ * under one lock hold. Every word is checked first; a word without a
+ * register (-EINVAL), a read-only register (-EPERM) or a value out of
+ * range (-ERANGE) fails the write and nothing is written.
+ *
+ * Return: On success, the number of bytes written and @offset is advanced
+ * by it. On error, a negative error value.
+ */
+static ssize_t fpgaRegs_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *offset)
+{
+	struct fpgaRegs_dev *priv = container_of(file->private_data,
+	                            struct fpgaRegs_dev, miscdev);
+	u32 vals[FPGA_REGS_MAX_REGS];
+	loff_t pos = *offset;
+	unsigned int i;
+	int ret;
+
+	if (count == 0) {
+		return 0;
+	}
+	ret = fpgaRegs_span_check(priv, pos, &count);
+	if (ret) {
+		return ret < 0 ? ret : 0;
+	}
+
+	// Copy from user space before taking the lock, copy_from_user can sleep on a fault
+	if (copy_from_user(vals, buf, count)) {
+		return -EFAULT;
+	}
+
+	for (i = 0; i < count / sizeof(u32); i++) {
+		int index = priv->word_reg[pos / sizeof(u32) + i];
+
+		if (index < 0) {
+			return -EINVAL;
+		}
+		ret = fpgaRegs_reg_check(priv, index, vals[i]);
+		if (ret) {
+			return ret;
+		}
+	}
+
+	mutex_lock(&priv->lock);
+	for (i = 0; i < count / sizeof(u32); i++) {
+		fpgaRegs_reg_write(priv, priv->word_reg[pos / sizeof(u32) + i], vals[i]);
+	}
+	mutex_unlock(&priv->lock);
+
+	*offset = pos + count;
+
+	return count;
+}
+
+/*-----------------------------------------------------------------------*/
+/* File Operations ioctl()                                               */
+/*-----------------------------------------------------------------------*/
+/* FPGA_REGS_IOC_INFO: describe the device */
+static long fpgaRegs_ioctl_info(struct fpgaRegs_dev *priv, void __user *arg)
+{
+	struct fpga_regs_info info;
+
+	memset(&info, 0, sizeof(info));
+	strscpy(info.name, priv->miscdev.name, sizeof(info.name));
+	info.num_regs = priv->num_regs;
+	info.span = priv->span;
+	mutex_lock(&priv->lock);
+	info.generation = priv->generation;
+	mutex_unlock(&priv->lock);
+
+	return copy_to_user(arg, &info, sizeof(info)) ? -EFAULT : 0;
+}
+
+/* FPGA_REGS_IOC_REG_INFO: describe the register at info.index */
+static long fpgaRegs_ioctl_reg_info(struct fpgaRegs_dev *priv, void __user *arg)
+{
+	struct fpga_regs_reg_info info;
+	const struct fpgaRegs_reg *reg;
+	u32 index;
+
+	if (get_user(index, (u32 __user *)arg)) {
+		return -EFAULT;
+	}
+	if (index >= priv->num_regs) {
+		return -EINVAL;
+	}
+	reg = &priv->regs[index];
+
+	memset(&info, 0, sizeof(info));
+	info.index = index;
+	info.offset = reg->offset;
+	info.width = reg->width;
+	info.frac_bits = reg->frac_bits;
+	info.flags = reg->flags;
+	info.min = reg->min;
+	info.max = reg->max;
+	strscpy(info.name, reg->name, sizeof(info.name));
+
+	return copy_to_user(arg, &info, sizeof(info)) ? -EFAULT : 0;
+}
+
+/* FPGA_REGS_IOC_BATCH: run a list of reads and writes under one lock hold,
+ * writes only through a file opened for writing, like write(2) */
+static long fpgaRegs_ioctl_batch(struct fpgaRegs_dev *priv, struct file *file,
+	void __user *arg)
+{
+	struct fpga_regs_batch batch;
+	struct fpga_regs_op *ops;
+	void __user *uops;
+	unsigned int i;
+	long ret = 0;
+
+	if (copy_from_user(&batch, arg, sizeof(batch))) {
+		return -EFAULT;
+	}
+	if (batch.count > FPGA_REGS_BATCH_MAX) {
+		return -EINVAL;
+	}
+	uops = u64_to_user_ptr(batch.ops);
+
+	ops = memdup_user(uops, batch.count * sizeof(*ops));
+	if (IS_ERR(ops)) {
+		return PTR_ERR(ops);
+	}
+
+	// Check every operation first so a rejected batch leaves all registers alone
+	for (i = 0; i < batch.count; i++) {
+		if (ops[i].index >= priv->num_regs ||
+		    (ops[i].flags & ~FPGA_REGS_OP_WRITE) || ops[i].reserved) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (ops[i].flags & FPGA_REGS_OP_WRITE) {
+			if (!(file->f_mode & FMODE_WRITE)) {
+				ret = -EBADF;
+				goto out;
+			}
+			ret = fpgaRegs_reg_check(priv, ops[i].index, ops[i].value);
+			if (ret) {
+				goto out;
+			}
+		}
+	}
+
+	mutex_lock(&priv->lock);
+	for (i = 0; i < batch.count; i++) {
+		if (ops[i].flags & FPGA_REGS_OP_WRITE) {
+			fpgaRegs_reg_write(priv, ops[i].index, ops[i].value);
+		} else {
+			ops[i].value = fpgaRegs_reg_read(priv, ops[i].index);
+		}
+	}
+	batch.generation = priv->generation;
+	mutex_unlock(&priv->lock);
+
+	if (copy_to_user(uops, ops, batch.count * sizeof(*ops)) ||
+	    copy_to_user(arg, &batch, sizeof(batch))) {
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(ops);
+	return ret;
+}
+
+/*
+ * fpgaRegs_ioctl() - ioctl method for the fpgaRegs char device
+ * @file: Pointer to the char device file struct.
+ * @cmd: FPGA_REGS_IOC_*.
+ * @arg: User pointer to the command's struct.
+ *
+ * Return: 0 on success, -ENOTTY for an unknown command, or the command's error.
+ */
+static long fpgaRegs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct fpgaRegs_dev *priv = container_of(file->private_data,
+	                            struct fpgaRegs_dev, miscdev);
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case FPGA_REGS_IOC_INFO:
+		return fpgaRegs_ioctl_info(priv, argp);
+	case FPGA_REGS_IOC_REG_INFO:
+		return fpgaRegs_ioctl_reg_info(priv, argp);
+	case FPGA_REGS_IOC_BATCH:
+		return fpgaRegs_ioctl_batch(priv, file, argp);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/*
+ *  fpgaRegs_fops - File operations supported by the fpgaRegs driver
+ * @owner: The fpgaRegs driver owns the file operations.
+ * @read: Whole-register reads at byte offsets.
+ * @write: Whole-register writes at byte offsets.
+ * @unlocked_ioctl: The FPGA_REGS_IOC_* commands.
+ * @compat_ioctl: The ioctl structs have the same layout for 32-bit callers.
+ * @llseek: The kernel's default_llseek(), to pick the register offset.
+ */
+static const struct file_operations fpgaRegs_fops = {
+	.owner = THIS_MODULE,
+	.read = fpgaRegs_read,
+	.write = fpgaRegs_write,
+	.unlocked_ioctl = fpgaRegs_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = default_llseek,
+};
+
+
+/*-----------------------------------------------------------------------*/
+/* Layout parsing                                                        */
+/*-----------------------------------------------------------------------*/
+/*
+ * fpgaRegs_parse_reg() - Fill in a register from its device tree node.
+ * @np: The register's child node.
+ * @reg: Register to fill in; properties the node does not have keep the
+ *       value @reg already holds.
+ * @required_reg: The node must have a reg property (a new register rather
+ *                than an override of a compiled-in one).
+ *
+ * Return: 0 on success, -EINVAL if a required reg property is missing.
+ */
+static int fpgaRegs_parse_reg(struct device_node *np, struct fpgaRegs_reg *reg,
+	bool required_reg)
+{
+	u32 range[2];
+
+	if (of_property_read_u32(np, "reg", &reg->offset) && required_reg) {
+		pr_err("fpgaRegs: %pOF has no reg property\n", np);
+		return -EINVAL;
+	}
+	of_property_read_u32(np, "msu,width", &reg->width);
+	of_property_read_u32(np, "msu,frac-bits", &reg->frac_bits);
+	if (of_property_read_bool(np, "msu,signed")) {
+		reg->flags |= FPGA_REGS_REG_SIGNED;
+	}
+	if (of_property_read_bool(np, "msu,read-only")) {
+		reg->flags |= FPGA_REGS_REG_READONLY;
+	}
+	if (!of_property_read_u32_array(np, "msu,range", range, 2)) {
+		// Cells are u32, a signed register's range is read as two's complement
+		if (reg->flags & FPGA_REGS_REG_SIGNED) {
+			reg->min = (s32)range[0];
+			reg->max = (s32)range[1];
+		} else {
+			reg->min = range[0];
+			reg->max = range[1];
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * fpgaRegs_check_layout() - Check the registers and build the offset map.
+ * @priv: Private fpgaRegs device struct with regs, num_regs, span and a
+ *        word_reg map set to -1.
+ *
+ * Clips every range to what the register's width holds.
+ *
+ * Return: 0 on success, -EINVAL for a bad register description.
+ */
+static int fpgaRegs_check_layout(struct fpgaRegs_dev *priv)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < priv->num_regs; i++) {
+		struct fpgaRegs_reg *reg = &priv->regs[i];
+		bool is_signed = reg->flags & FPGA_REGS_REG_SIGNED;
+		s64 lo, hi;
+
+		// The name becomes a sysfs attribute next to regs and layout
+		if (!reg->name[0] || strlen(reg->name) >= FPGA_REGS_NAME_LEN ||
+		    strcmp(reg->name, "regs") == 0 || strcmp(reg->name, "layout") == 0) {
+			pr_err("fpgaRegs: bad register name \"%s\"\n", reg->name);
+			return -EINVAL;
+		}
+		for (j = 0; j < i; j++) {
+			if (strcmp(reg->name, priv->regs[j].name) == 0) {
+				pr_err("fpgaRegs: register %s is described twice\n", reg->name);
+				return -EINVAL;
+			}
+		}
+		if (reg->offset % sizeof(u32) || reg->offset > priv->span - sizeof(u32)) {
+			pr_err("fpgaRegs: register %s at 0x%x is unaligned or outside the 0x%x byte span\n",
+				reg->name, reg->offset, priv->span);
+			return -EINVAL;
+		}
+		if (priv->word_reg[reg->offset / sizeof(u32)] >= 0) {
+			pr_err("fpgaRegs: registers %s and %s share offset 0x%x\n",
+				priv->regs[priv->word_reg[reg->offset / sizeof(u32)]].name,
+				reg->name, reg->offset);
+			return -EINVAL;
+		}
+		if (reg->width < 1 || reg->width > 32 || reg->frac_bits > reg->width) {
+			pr_err("fpgaRegs: register %s has width %u and %u fractional bits\n",
+				reg->name, reg->width, reg->frac_bits);
+			return -EINVAL;
+		}
+
+		lo = is_signed ? -(1LL << (reg->width - 1)) : 0;
+		hi = is_signed ? (1LL << (reg->width - 1)) - 1 : (1LL << reg->width) - 1;
+		reg->min = max(reg->min, lo);
+		reg->max = min(reg->max, hi);
+		if (reg->min > reg->max) {
+			pr_err("fpgaRegs: register %s has an empty range\n", reg->name);
+			return -EINVAL;
+		}
+
+		priv->word_reg[reg->offset / sizeof(u32)] = i;
+	}
+
+	return 0;
+}
+
+/*
+ * fpgaRegs_load_layout() - Build the register layout of a device.
+ * @pdev: The platform device.
+ * @priv: Private fpgaRegs device struct with span and word_reg set.
+ * @layout: Filled in with the compiled-in layout the node selects, or NULL.
+ *
+ * An msu,layout property selects a layout compiled into the driver. Every
+ * available child node then describes a register: a child named like a
+ * compiled-in register overrides the properties it has, any other child
+ * adds a register.
+ *
+ * Return: 0 on success, or a negative error code.
+ */
+static int fpgaRegs_load_layout(struct platform_device *pdev,
+	struct fpgaRegs_dev *priv, const struct fpgaRegs_layout **layout)
+{
+	struct device_node *np = pdev->dev.of_node;
+	struct device_node *child;
+	const char *layout_name;
+	unsigned int i, num_regs;
+	int ret;
+
+	*layout = NULL;
+	if (!of_property_read_string(np, "msu,layout", &layout_name)) {
+		for (i = 0; i < ARRAY_SIZE(fpgaRegs_layouts); i++) {
+			if (strcmp(layout_name, fpgaRegs_layouts[i].name) == 0) {
+				*layout = &fpgaRegs_layouts[i];
+				break;
+			}
+		}
+		if (!*layout) {
+			pr_err("fpgaRegs: %pOF: no compiled-in layout %s\n", np, layout_name);
+			return -EINVAL;
+		}
+	}
+
+	// Enough room for every child to add a register
+	num_regs = (*layout ? (*layout)->num_regs : 0) + of_get_available_child_count(np);
+	if (num_regs == 0 || num_regs > FPGA_REGS_MAX_REGS) {
+		pr_err("fpgaRegs: %pOF: %u registers, 1 to %u are supported\n",
+			np, num_regs, FPGA_REGS_MAX_REGS);
+		return -EINVAL;
+	}
+	priv->regs = devm_kcalloc(&pdev->dev, num_regs, sizeof(*priv->regs), GFP_KERNEL);
+	if (!priv->regs) {
+		return -ENOMEM;
+	}
+	if (*layout) {
+		memcpy(priv->regs, (*layout)->regs, (*layout)->num_regs * sizeof(*priv->regs));
+		priv->num_regs = (*layout)->num_regs;
+	}
+
+	for_each_available_child_of_node(np, child) {
+		struct fpgaRegs_reg *reg = NULL;
+
+		for (i = 0; i < priv->num_regs; i++) {
+			if (of_node_name_eq(child, priv->regs[i].name)) {
+				reg = &priv->regs[i];
+				break;
+			}
+		}
+
+		if (reg) {
+			ret = fpgaRegs_parse_reg(child, reg, false);
+		} else {
+			reg = &priv->regs[priv->num_regs++];
+			reg->name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "%pOFn", child);
+			if (!reg->name) {
+				of_node_put(child);
+				return -ENOMEM;
+			}
+			reg->width = 32;
+			reg->min = S64_MIN;
+			reg->max = S64_MAX;
+			ret = fpgaRegs_parse_reg(child, reg, true);
+		}
+		if (ret) {
+			of_node_put(child);
+			return ret;
+		}
+	}
+
+	return fpgaRegs_check_layout(priv);
+}
+
+/*
+ * fpgaRegs_init_attrs() - Build the sysfs attributes of a device.
+ * @dev: Device the allocations belong to.
+ * @priv: Private fpgaRegs device struct with its layout loaded.
+ *
+ * Return: 0 on success, -ENOMEM if an allocation failed.
+ */
+static int fpgaRegs_init_attrs(struct device *dev, struct fpgaRegs_dev *priv)
+{
+	unsigned int i;
+
+	priv->reg_attrs = devm_kcalloc(dev, priv->num_regs, sizeof(*priv->reg_attrs), GFP_KERNEL);
+	// One per register, layout and the NULL terminator
+	priv->attrs = devm_kcalloc(dev, priv->num_regs + 2, sizeof(*priv->attrs), GFP_KERNEL);
+	if (!priv->reg_attrs || !priv->attrs) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < priv->num_regs; i++) {
+		struct fpgaRegs_attr *reg_attr = &priv->reg_attrs[i];
+		bool readonly = priv->regs[i].flags & FPGA_REGS_REG_READONLY;
+
+		sysfs_attr_init(&reg_attr->dev_attr.attr);
+		reg_attr->dev_attr.attr.name = priv->regs[i].name;
+		reg_attr->dev_attr.attr.mode = readonly ? 0444 : 0644;
+		reg_attr->dev_attr.show = fpgaRegs_attr_show;
+		reg_attr->dev_attr.store = readonly ? NULL : fpgaRegs_attr_store;
+		reg_attr->index = i;
+		priv->attrs[i] = &reg_attr->dev_attr.attr;
+	}
+	priv->attrs[i] = &dev_attr_layout.attr;
+
+	sysfs_bin_attr_init(&priv->regs_attr);
+	priv->regs_attr.attr.name = "regs";
+	priv->regs_attr.attr.mode = 0444;
+	priv->regs_attr.size = (priv->num_regs + 1) * sizeof(u32);
+	priv->regs_attr.read = regs_read;
+	priv->bin_attrs[0] = &priv->regs_attr;
+
+	priv->group.attrs = priv->attrs;
+	priv->group.bin_attrs = priv->bin_attrs;
+	priv->groups[0] = &priv->group;
+
+	return 0;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Platform Driver Probe (Initialization) Function                       */
+/*-----------------------------------------------------------------------*/
+/*
+ * fpgaRegs_probe() - Initialize a device when a match is found
+ * @pdev: Platform device created from an msu,fpga-regs device tree node.
+ *
+ * Maps the core, builds its layout and attributes and registers the char
+ * device, named after the node's label, else its compiled-in layout, else
+ * the node name.
+ */
+static int fpgaRegs_probe(struct platform_device *pdev)
+{
+	struct device_node *np = pdev->dev.of_node;
+	const struct fpgaRegs_layout *layout;
+	struct fpgaRegs_dev *priv;
+	struct resource *res;
+	resource_size_t size;
+	const char *name;
+	int ret;
+
+	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv) {
+		pr_err("Failed to allocate kernel memory for fpgaRegs\n");
+		return -ENOMEM;
+	}
+
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	priv->base_addr = devm_ioremap_resource(&pdev->dev, res);
+	if (IS_ERR(priv->base_addr)) {
+		pr_err("fpgaRegs: %pOF: failed to request/remap the register space\n", np);
+		return PTR_ERR(priv->base_addr);
+	}
+	size = resource_size(res);
+	if (size < sizeof(u32) || size > SZ_64K) {
+		pr_err("fpgaRegs: %pOF: register space of %pa bytes, 4 to 64K are supported\n", np, &size);
+		return -EINVAL;
+	}
+	priv->span = size;
+
+	// Register index at each word of the span, -1 where there is none
+	priv->word_reg = devm_kmalloc(&pdev->dev, priv->span / sizeof(u32), GFP_KERNEL);
+	if (!priv->word_reg) {
+		return -ENOMEM;
+	}
+	memset(priv->word_reg, -1, priv->span / sizeof(u32));
+
+	ret = fpgaRegs_load_layout(pdev, priv, &layout);
+	if (ret) {
+		return ret;
+	}
+
+	mutex_init(&priv->lock);
+
+	ret = fpgaRegs_init_attrs(&pdev->dev, priv);
+	if (ret) {
+		return ret;
+	}
+
+	if (of_property_read_string(np, "label", &name)) {
+		name = layout ? layout->name : NULL;
+	}
+	priv->miscdev.name = name ? devm_kstrdup(&pdev->dev, name, GFP_KERNEL)
+	                          : devm_kasprintf(&pdev->dev, GFP_KERNEL, "%pOFn", np);
+	if (!priv->miscdev.name) {
+		return -ENOMEM;
+	}
+	if (strlen(priv->miscdev.name) >= FPGA_REGS_NAME_LEN) {
+		pr_err("fpgaRegs: %pOF: device name %s is too long\n", np, priv->miscdev.name);
+		return -EINVAL;
+	}
+
+	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
+	priv->miscdev.fops = &fpgaRegs_fops;
+	priv->miscdev.parent = &pdev->dev;
+	priv->miscdev.groups = priv->groups;
+
+	// Register the misc device; this creates /dev/<name>
+	ret = misc_register(&priv->miscdev);
+	if (ret) {
+		pr_err("Failed to register misc device %s\n", priv->miscdev.name);
+		return ret;
+	}
+
+	platform_set_drvdata(pdev, priv);
+
+	pr_info("fpgaRegs: %s with %u registers\n", priv->miscdev.name, priv->num_regs);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Platform Driver Remove Function                                       */
+/*-----------------------------------------------------------------------*/
+/*
+ * fpgaRegs_remove() - Remove an fpgaRegs device.
+ * @pdev: Platform device structure associated with the device.
+ */
+static int fpgaRegs_remove(struct platform_device *pdev)
+{
+	struct fpgaRegs_dev *priv = platform_get_drvdata(pdev);
+
+	misc_deregister(&priv->miscdev);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Compatible Match String                                               */
+/*-----------------------------------------------------------------------*/
+static const struct of_device_id fpgaRegs_of_match[] = {
+	{ .compatible = "msu,fpga-regs", },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, fpgaRegs_of_match);
+
+/*-----------------------------------------------------------------------*/
+/* Platform Driver Structure                                             */
+/*-----------------------------------------------------------------------*/
+static struct platform_driver fpgaRegs_driver = {
+	.probe = fpgaRegs_probe,
+	.remove = fpgaRegs_remove,
+	.driver = {
+		.owner = THIS_MODULE,
+		.name = "fpgaRegs",
+		.of_match_table = fpgaRegs_of_match,
+	},
+};
+
+module_platform_driver(fpgaRegs_driver);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("Table-driven driver for FPGA register banks");
+MODULE_VERSION("1.0");
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  User-space interface of the fpgaRegs generic register driver
+ * ------------------------------------------------------------------------
+ * fpgaRegs.ko drives any FPGA core that is a bank of 32-bit registers,
+ * from a register layout given in the device tree or compiled into the
+ * driver. Every device gets /dev/<name> with the same read/write rules as
+ * /dev/combFilterProcessor, one sysfs attribute per register, a "regs"
+ * snapshot, a "layout" description and the ioctls below. Installed to
+ * /usr/include with the driver.
+-------------------------------------------------------------------------*/
+#ifndef _FPGAREGS_H
+#define _FPGAREGS_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Longest register or device name, including the terminating NUL */
+#define FPGA_REGS_NAME_LEN   32
+/* Most registers one device can describe */
+#define FPGA_REGS_MAX_REGS   64
+/* Most operations in one FPGA_REGS_IOC_BATCH */
+#define FPGA_REGS_BATCH_MAX  64
+
+/*-----------------------------------------------------------------------*/
+/* Register Description                                                  */
+/*-----------------------------------------------------------------------*/
+/* fpga_regs_reg_info.flags */
+#define FPGA_REGS_REG_SIGNED    0x1  /* two's complement, read back sign-extended */
+#define FPGA_REGS_REG_READONLY  0x2  /* writes are rejected with EPERM */
+
+/*
+ * struct fpga_regs_info - The device, from FPGA_REGS_IOC_INFO.
+ * @name: Device name, also the name of its char device
+ * @num_regs: Number of registers, valid indexes are 0 to num_regs - 1
+ * @span: Bytes of register space the char device covers
+ * @generation: Number of register writes so far
+ * @reserved: Zero
+ */
+struct fpga_regs_info {
+	char name[FPGA_REGS_NAME_LEN];
+	__u32 num_regs;
+	__u32 span;
+	__u32 generation;
+	__u32 reserved;
+};
+
+/*
+ * struct fpga_regs_reg_info - One register, from FPGA_REGS_IOC_REG_INFO.
+ * @index: Register index, set by the caller
+ * @offset: Byte offset in the char device and the FPGA core
+ * @width: Bits the core implements, 1 to 32
+ * @frac_bits: Fractional bits, the value means raw / 2^frac_bits
+ * @flags: FPGA_REGS_REG_*
+ * @reserved: Zero
+ * @min: Lowest value a write may have, as a signed number for signed registers
+ * @max: Highest value a write may have
+ * @name: Register name, also the name of its sysfs attribute
+ */
+struct fpga_regs_reg_info {
+	__u32 index;
+	__u32 offset;
+	__u32 width;
+	__u32 frac_bits;
+	__u32 flags;
+	__u32 reserved;
+	__s64 min;
+	__s64 max;
+	char name[FPGA_REGS_NAME_LEN];
+};
+
+/*-----------------------------------------------------------------------*/
+/* Batched Access                                                        */
+/*-----------------------------------------------------------------------*/
+/* fpga_regs_op.flags */
+#define FPGA_REGS_OP_READ   0x0
+#define FPGA_REGS_OP_WRITE  0x1
+
+/*
+ * struct fpga_regs_op - One register access of a batch.
+ * @index: Register index
+ * @flags: FPGA_REGS_OP_READ or FPGA_REGS_OP_WRITE
+ * @value: Value to write, or the value read; sign-extended for signed registers
+ * @reserved: Zero
+ */
+struct fpga_regs_op {
+	__u32 index;
+	__u32 flags;
+	__u32 value;
+	__u32 reserved;
+};
+
+/*
+ * struct fpga_regs_batch - Argument of FPGA_REGS_IOC_BATCH.
+ * @ops: User pointer to @count struct fpga_regs_op
+ * @count: Number of operations, at most FPGA_REGS_BATCH_MAX
+ * @generation: Set to the generation after the batch
+ *
+ * The operations run in order under one lock hold, so registers need not
+ * be adjacent to be written together, and a read after a write in the same
+ * batch returns what the hardware took. Every operation is checked before
+ * any runs: an unknown index, a write to a read-only register or a value
+ * outside [min, max] fails the whole batch and writes nothing.
+ */
+struct fpga_regs_batch {
+	__u64 ops;
+	__u32 count;
+	__u32 generation;
+};
+
+/*-----------------------------------------------------------------------*/
+/* ioctls (on /dev/<name>)                                               */
+/*-----------------------------------------------------------------------*/
+#define FPGA_REGS_IOC_MAGIC     0xFA
+#define FPGA_REGS_IOC_INFO      _IOR(FPGA_REGS_IOC_MAGIC, 0, struct fpga_regs_info)
+#define FPGA_REGS_IOC_REG_INFO  _IOWR(FPGA_REGS_IOC_MAGIC, 1, struct fpga_regs_reg_info)
+#define FPGA_REGS_IOC_BATCH     _IOWR(FPGA_REGS_IOC_MAGIC, 2, struct fpga_regs_batch)
+
+#endif /* _FPGAREGS_H */
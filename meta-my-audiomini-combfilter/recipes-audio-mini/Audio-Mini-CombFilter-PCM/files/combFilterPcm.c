@@ -0,0 +1,836 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  ALSA PCM driver for the audio stream of the
+ *               combFilterProcessor component
+ * ------------------------------------------------------------------------
+ * Registers a "CombFilter" sound card with three streams between the FPGA
+ * audio pipeline and HPS memory:
+ *   hw:CombFilter,0 capture   audio entering the comb filter (pre tap)
+ *   hw:CombFilter,0 playback  audio injected at the comb filter input
+ *   hw:CombFilter,1 capture   audio leaving the comb filter (post tap)
+ *
+ * Two backends move the samples:
+ *   dma  Each stream is a DMA channel between an FPGA FIFO and the ALSA
+ *        buffer. The buffer is allocated for the DMA controller and mapped
+ *        straight into user space, so samples are never copied by the CPU.
+ *        With PL330 (CONFIG_PL330_DMA) one cyclic transfer covers the whole
+ *        buffer; engines without cyclic support, such as msgDMA
+ *        (CONFIG_ALTERA_MSGDMA), get one descriptor per period, each
+ *        resubmitted as it completes.
+ *   sim  Software stand-in for exercising the driver without the FPGA
+ *        (e.g. under QEMU). An hrtimer paces each stream at the sample
+ *        rate; the pre tap is white noise, the post tap the same noise
+ *        through a comb filter of sim_delaym samples, and playback is
+ *        consumed and discarded.
+ * The backend is chosen by the compatible string, see
+ * combfilter-pcm-sim-overlay.dts for the stand-in.
+-------------------------------------------------------------------------*/
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/mod_devicetable.h>
+#include <linux/of.h>
+#include <linux/of_device.h>
+#include <linux/dmaengine.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/kernel.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/initval.h>
+
+/*-----------------------------------------------------------------------*/
+/* DEFINE STATEMENTS                                                     */
+/*-----------------------------------------------------------------------*/
+/* The FPGA audio pipeline runs at the AD1939's rate, 24-bit samples left */
+/* justified in 32-bit words, left and right interleaved                 */
+#define COMBFILTER_PCM_RATE        48000
+#define COMBFILTER_PCM_CHANNELS    2
+
+/* ALSA buffer per stream, preallocated so opening a stream cannot fail  */
+/* for lack of contiguous memory                                         */
+#define COMBFILTER_PCM_BUFFER_BYTES (128 * 1024)
+#define COMBFILTER_PCM_PERIOD_MIN   256
+#define COMBFILTER_PCM_PERIOD_MAX   (32 * 1024)
+
+/* Period sizes are a whole number of DMA bursts                         */
+#define COMBFILTER_PCM_DMA_BURST    8
+#define COMBFILTER_PCM_PERIOD_ALIGN (COMBFILTER_PCM_DMA_BURST * sizeof(u32))
+
+/* Streams, also the names of their DMA channels and FIFO registers in   */
+/* the device tree (dma-names, reg-names)                                */
+enum combFilterPcm_stream_id {
+	COMBFILTER_PCM_PRE,
+	COMBFILTER_PCM_POST,
+	COMBFILTER_PCM_PLAYBACK,
+	COMBFILTER_PCM_NUM_STREAMS
+};
+
+static const char *const combFilterPcm_stream_names[COMBFILTER_PCM_NUM_STREAMS] = {
+	"pre", "post", "playback",
+};
+
+static unsigned int sim_delaym = 48;
+module_param(sim_delaym, uint, 0644);
+MODULE_PARM_DESC(sim_delaym, "Comb delay of the sim backend's post tap in samples (default 48)");
+
+
+/*-----------------------------------------------------------------------*/
+/* combFilterPcm device structures                                       */
+/*-----------------------------------------------------------------------*/
+struct combFilterPcm_dev;
+
+/*
+ * struct combFilterPcm_stream - One stream between the FPGA and HPS memory.
+ * @priv: Device the stream belongs to
+ * @name: Stream name, see combFilterPcm_stream_names
+ * @direction: SNDRV_PCM_STREAM_CAPTURE or SNDRV_PCM_STREAM_PLAYBACK
+ * @present: The backend provides this stream
+ * @substream: Open ALSA substream, NULL while closed
+ * @lock: Protects @running and @period against the period interrupt
+ * @running: Between trigger start and stop
+ * @period: Index of the period the hardware is working on
+ * @chan: dma backend: DMA channel of the stream
+ * @fifo_addr: dma backend: Bus address of the FPGA FIFO
+ * @cyclic: dma backend: The channel does cyclic transfers
+ * @cookie: dma backend: Cookie of the cyclic transfer
+ * @timer: sim backend: Fires once per period
+ * @period_time: sim backend: Length of a period
+ * @frame: sim backend: Frame number of the next sample, on a clock shared by
+ *         all streams so the pre and post taps line up
+ */
+struct combFilterPcm_stream {
+	struct combFilterPcm_dev *priv;
+	const char *name;
+	int direction;
+	bool present;
+	struct snd_pcm_substream *substream;
+	spinlock_t lock;
+	bool running;
+	unsigned int period;
+	struct dma_chan *chan;
+	dma_addr_t fifo_addr;
+	bool cyclic;
+	dma_cookie_t cookie;
+	struct hrtimer timer;
+	ktime_t period_time;
+	u64 frame;
+};
+
+/*
+ * struct combFilterPcm_backend - How a backend moves the samples.
+ * @name: Backend name, shown in the card's long name
+ * @buffer_type: SNDRV_DMA_TYPE_* of the ALSA buffers
+ * @init: Claim the resources of a stream at probe; -ENODEV leaves the
+ *        stream out of the card
+ * @prepare: Set up a stream for the hw_params in the runtime
+ * @start: Start moving samples, called from trigger (atomic)
+ * @stop: Stop moving samples, called from trigger (atomic)
+ * @sync_stop: Wait until the period interrupt can no longer run
+ * @pointer: Position in the buffer in frames
+ */
+struct combFilterPcm_backend {
+	const char *name;
+	int buffer_type;
+	int (*init)(struct platform_device *pdev, struct combFilterPcm_stream *stream);
+	int (*prepare)(struct combFilterPcm_stream *stream);
+	int (*start)(struct combFilterPcm_stream *stream);
+	void (*stop)(struct combFilterPcm_stream *stream);
+	void (*sync_stop)(struct combFilterPcm_stream *stream);
+	snd_pcm_uframes_t (*pointer)(struct combFilterPcm_stream *stream);
+};
+
+/*
+ * struct combFilterPcm_dev - Private combFilterPcm device struct.
+ * @card: The ALSA card
+ * @backend: Backend moving the samples, from the compatible string
+ * @streams: The streams, indexed by enum combFilterPcm_stream_id
+ */
+struct combFilterPcm_dev {
+	struct snd_card *card;
+	const struct combFilterPcm_backend *backend;
+	struct combFilterPcm_stream streams[COMBFILTER_PCM_NUM_STREAMS];
+};
+
+/*
+ * combFilterPcm_advance() - Account for one completed period.
+ * @stream: The stream.
+ *
+ * The caller must hold stream->lock.
+ *
+ * Return: Index of the period that completed.
+ */
+static unsigned int combFilterPcm_advance(struct combFilterPcm_stream *stream)
+{
+	unsigned int done = stream->period;
+
+	stream->period = (done + 1) % stream->substream->runtime->periods;
+
+	return done;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* DMA backend                                                           */
+/*-----------------------------------------------------------------------*/
+static void combFilterPcm_dma_release(void *data)
+{
+	dma_release_channel(data);
+}
+
+/*
+ * combFilterPcm_dma_init() - Claim the DMA channel and FIFO of a stream.
+ * @pdev: Platform device of the combFilterPcm node.
+ * @stream: The stream.
+ *
+ * Return: 0 on success, -ENODEV if the node has no DMA channel for the
+ * stream, another negative error value on failure.
+ */
+static int combFilterPcm_dma_init(struct platform_device *pdev,
+	struct combFilterPcm_stream *stream)
+{
+	struct resource *res;
+	int ret;
+
+	stream->chan = dma_request_chan(&pdev->dev, stream->name);
+	if (IS_ERR(stream->chan)) {
+		ret = PTR_ERR(stream->chan);
+		stream->chan = NULL;
+		return ret;
+	}
+
+	ret = devm_add_action_or_reset(&pdev->dev, combFilterPcm_dma_release, stream->chan);
+	if (ret) {
+		return ret;
+	}
+
+	// The DMA engine moves the samples to/from this FIFO data register
+	res = platform_get_resource_byname(pdev, IORESOURCE_MEM, stream->name);
+	if (!res) {
+		pr_err("combFilterPcm: no %s FIFO in reg-names\n", stream->name);
+		return -EINVAL;
+	}
+	stream->fifo_addr = res->start;
+	stream->cyclic = dma_has_cap(DMA_CYCLIC, stream->chan->device->cap_mask);
+
+	pr_info("combFilterPcm: %s stream on %s (%s)\n", stream->name,
+		dma_chan_name(stream->chan), stream->cyclic ? "cyclic" : "per period");
+
+	return 0;
+}
+
+static int combFilterPcm_dma_prepare(struct combFilterPcm_stream *stream)
+{
+	struct dma_slave_config config = {
+		.src_addr = stream->fifo_addr,
+		.dst_addr = stream->fifo_addr,
+		.src_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+		.dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
+		.src_maxburst = COMBFILTER_PCM_DMA_BURST,
+		.dst_maxburst = COMBFILTER_PCM_DMA_BURST,
+	};
+
+	config.direction = stream->direction == SNDRV_PCM_STREAM_CAPTURE ?
+		DMA_DEV_TO_MEM : DMA_MEM_TO_DEV;
+
+	return dmaengine_slave_config(stream->chan, &config);
+}
+
+static void combFilterPcm_dma_period_done(void *data);
+
+/*
+ * combFilterPcm_dma_queue_period() - Queue a transfer of one period.
+ * @stream: The stream, on a channel without cyclic support.
+ * @period: Index of the period in the ALSA buffer.
+ *
+ * Return: 0 on success, -ENOMEM if the engine is out of descriptors.
+ */
+static int combFilterPcm_dma_queue_period(struct combFilterPcm_stream *stream,
+	unsigned int period)
+{
+	struct snd_pcm_runtime *runtime = stream->substream->runtime;
+	size_t period_bytes = frames_to_bytes(runtime, runtime->period_size);
+	struct dma_async_tx_descriptor *desc;
+
+	desc = dmaengine_prep_slave_single(stream->chan,
+		runtime->dma_addr + period * period_bytes, period_bytes,
+		stream->direction == SNDRV_PCM_STREAM_CAPTURE ? DMA_DEV_TO_MEM : DMA_MEM_TO_DEV,
+		DMA_PREP_INTERRUPT);
+	if (!desc) {
+		return -ENOMEM;
+	}
+	desc->callback = combFilterPcm_dma_period_done;
+	desc->callback_param = stream;
+	dmaengine_submit(desc);
+
+	return 0;
+}
+
+/*
+ * combFilterPcm_dma_period_done() - DMA completion callback, once per period.
+ * @data: The stream.
+ *
+ * Without cyclic support the period that just completed is queued again
+ * behind the others, so it is next written one buffer length later, as
+ * with a cyclic transfer.
+ */
+static void combFilterPcm_dma_period_done(void *data)
+{
+	struct combFilterPcm_stream *stream = data;
+	unsigned long flags;
+	unsigned int done;
+
+	spin_lock_irqsave(&stream->lock, flags);
+	if (!stream->running) {
+		spin_unlock_irqrestore(&stream->lock, flags);
+		return;
+	}
+	done = combFilterPcm_advance(stream);
+	if (!stream->cyclic) {
+		if (combFilterPcm_dma_queue_period(stream, done)) {
+			pr_warn_ratelimited("combFilterPcm: %s: failed to requeue a period\n",
+				stream->name);
+		}
+		dma_async_issue_pending(stream->chan);
+	}
+	spin_unlock_irqrestore(&stream->lock, flags);
+
+	snd_pcm_period_elapsed(stream->substream);
+}
+
+static int combFilterPcm_dma_start(struct combFilterPcm_stream *stream)
+{
+	struct snd_pcm_runtime *runtime = stream->substream->runtime;
+	struct dma_async_tx_descriptor *desc;
+	unsigned int i;
+	int ret;
+
+	if (stream->cyclic) {
+		desc = dmaengine_prep_dma_cyclic(stream->chan, runtime->dma_addr,
+			snd_pcm_lib_buffer_bytes(stream->substream),
+			snd_pcm_lib_period_bytes(stream->substream),
+			stream->direction == SNDRV_PCM_STREAM_CAPTURE ? DMA_DEV_TO_MEM : DMA_MEM_TO_DEV,
+			DMA_PREP_INTERRUPT);
+		if (!desc) {
+			return -ENOMEM;
+		}
+		desc->callback = combFilterPcm_dma_period_done;
+		desc->callback_param = stream;
+		stream->cookie = dmaengine_submit(desc);
+	} else {
+		// Queue the whole buffer, one descriptor per period
+		for (i = 0; i < runtime->periods; i++) {
+			ret = combFilterPcm_dma_queue_period(stream, i);
+			if (ret) {
+				dmaengine_terminate_async(stream->chan);
+				return ret;
+			}
+		}
+	}
+	dma_async_issue_pending(stream->chan);
+
+	return 0;
+}
+
+static void combFilterPcm_dma_stop(struct combFilterPcm_stream *stream)
+{
+	dmaengine_terminate_async(stream->chan);
+}
+
+static void combFilterPcm_dma_sync_stop(struct combFilterPcm_stream *stream)
+{
+	dmaengine_synchronize(stream->chan);
+}
+
+/*
+ * combFilterPcm_dma_pointer() - Position of the DMA engine in the buffer.
+ * @stream: The stream.
+ *
+ * A cyclic transfer reports its residue, which is finer than a period on
+ * PL330; otherwise the position is the start of the current period.
+ */
+static snd_pcm_uframes_t combFilterPcm_dma_pointer(struct combFilterPcm_stream *stream)
+{
+	struct snd_pcm_runtime *runtime = stream->substream->runtime;
+	size_t buffer_bytes = snd_pcm_lib_buffer_bytes(stream->substream);
+	struct dma_tx_state state;
+
+	if (stream->cyclic &&
+	    dmaengine_tx_status(stream->chan, stream->cookie, &state) != DMA_ERROR &&
+	    state.residue > 0 && state.residue <= buffer_bytes) {
+		return bytes_to_frames(runtime, buffer_bytes - state.residue);
+	}
+
+	return READ_ONCE(stream->period) * runtime->period_size;
+}
+
+static const struct combFilterPcm_backend combFilterPcm_dma_backend = {
+	.name = "dma",
+	.buffer_type = SNDRV_DMA_TYPE_DEV,
+	.init = combFilterPcm_dma_init,
+	.prepare = combFilterPcm_dma_prepare,
+	.start = combFilterPcm_dma_start,
+	.stop = combFilterPcm_dma_stop,
+	.sync_stop = combFilterPcm_dma_sync_stop,
+	.pointer = combFilterPcm_dma_pointer,
+};
+
+
+/*-----------------------------------------------------------------------*/
+/* Simulated backend                                                     */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterPcm_sim_noise() - White noise sample of the simulated pre tap.
+ * @frame: Frame number.
+ * @channel: Channel number.
+ *
+ * A hash of the frame number rather than a generator with state, so every
+ * stream can compute any sample on its own. Peaks at -12 dBFS, leaving
+ * headroom for the comb filter's sum.
+ */
+static s32 combFilterPcm_sim_noise(u64 frame, unsigned int channel)
+{
+	u32 x = lower_32_bits(frame) * COMBFILTER_PCM_CHANNELS + channel;
+
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+
+	return (s32)x >> 2;
+}
+
+/*
+ * combFilterPcm_sim_fill() - Write one period of simulated capture audio.
+ * @stream: A capture stream.
+ * @period: Index of the period in the ALSA buffer.
+ *
+ * The post tap is y[n] = (x[n] + x[n - sim_delaym]) / 2 of the pre tap's x[n].
+ */
+static void combFilterPcm_sim_fill(struct combFilterPcm_stream *stream, unsigned int period)
+{
+	struct snd_pcm_runtime *runtime = stream->substream->runtime;
+	s32 *samples = (s32 *)(runtime->dma_area +
+		frames_to_bytes(runtime, period * runtime->period_size));
+	unsigned int delaym = READ_ONCE(sim_delaym);
+	snd_pcm_uframes_t i;
+	unsigned int ch;
+	u64 frame;
+
+	for (i = 0; i < runtime->period_size; i++) {
+		frame = stream->frame + i;
+		for (ch = 0; ch < runtime->channels; ch++) {
+			s32 x = combFilterPcm_sim_noise(frame, ch);
+
+			if (stream == &stream->priv->streams[COMBFILTER_PCM_POST]) {
+				x = x / 2 + (frame >= delaym ?
+					combFilterPcm_sim_noise(frame - delaym, ch) / 2 : 0);
+			}
+			*samples++ = x;
+		}
+	}
+}
+
+/*
+ * combFilterPcm_sim_tick() - hrtimer callback, once per period.
+ * @timer: The stream's timer.
+ *
+ * Runs in softirq context (HRTIMER_MODE_REL_SOFT). If the timer fired late
+ * the missed periods are produced too, at most one buffer's worth.
+ */
+static enum hrtimer_restart combFilterPcm_sim_tick(struct hrtimer *timer)
+{
+	struct combFilterPcm_stream *stream = container_of(timer,
+		struct combFilterPcm_stream, timer);
+	struct snd_pcm_runtime *runtime;
+	unsigned long flags;
+	u64 periods;
+	unsigned int done;
+
+	periods = hrtimer_forward_now(timer, stream->period_time);
+
+	spin_lock_irqsave(&stream->lock, flags);
+	if (!stream->running) {
+		spin_unlock_irqrestore(&stream->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+	runtime = stream->substream->runtime;
+	if (periods > runtime->periods) {
+		stream->frame += (periods - runtime->periods) * runtime->period_size;
+		periods = runtime->periods;
+	}
+	while (periods--) {
+		done = combFilterPcm_advance(stream);
+		if (stream->direction == SNDRV_PCM_STREAM_CAPTURE) {
+			combFilterPcm_sim_fill(stream, done);
+		}
+		stream->frame += runtime->period_size;
+	}
+	spin_unlock_irqrestore(&stream->lock, flags);
+
+	snd_pcm_period_elapsed(stream->substream);
+
+	return HRTIMER_RESTART;
+}
+
+static int combFilterPcm_sim_init(struct platform_device *pdev,
+	struct combFilterPcm_stream *stream)
+{
+	hrtimer_init(&stream->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	stream->timer.function = combFilterPcm_sim_tick;
+
+	return 0;
+}
+
+static int combFilterPcm_sim_prepare(struct combFilterPcm_stream *stream)
+{
+	struct snd_pcm_runtime *runtime = stream->substream->runtime;
+
+	stream->period_time = ns_to_ktime(div_u64((u64)runtime->period_size * NSEC_PER_SEC,
+		runtime->rate));
+
+	return 0;
+}
+
+static int combFilterPcm_sim_start(struct combFilterPcm_stream *stream)
+{
+	// Start on the shared sample clock so the pre and post taps line up
+	stream->frame = mul_u64_u32_div(ktime_get_ns(), COMBFILTER_PCM_RATE, NSEC_PER_SEC);
+	hrtimer_start(&stream->timer, stream->period_time, HRTIMER_MODE_REL_SOFT);
+
+	return 0;
+}
+
+static void combFilterPcm_sim_stop(struct combFilterPcm_stream *stream)
+{
+	hrtimer_try_to_cancel(&stream->timer);
+}
+
+static void combFilterPcm_sim_sync_stop(struct combFilterPcm_stream *stream)
+{
+	hrtimer_cancel(&stream->timer);
+}
+
+static snd_pcm_uframes_t combFilterPcm_sim_pointer(struct combFilterPcm_stream *stream)
+{
+	return READ_ONCE(stream->period) * stream->substream->runtime->period_size;
+}
+
+static const struct combFilterPcm_backend combFilterPcm_sim_backend = {
+	.name = "sim",
+	.buffer_type = SNDRV_DMA_TYPE_VMALLOC,
+	.init = combFilterPcm_sim_init,
+	.prepare = combFilterPcm_sim_prepare,
+	.start = combFilterPcm_sim_start,
+	.stop = combFilterPcm_sim_stop,
+	.sync_stop = combFilterPcm_sim_sync_stop,
+	.pointer = combFilterPcm_sim_pointer,
+};
+
+
+/*-----------------------------------------------------------------------*/
+/* PCM Operations                                                        */
+/*-----------------------------------------------------------------------*/
+static const struct snd_pcm_hardware combFilterPcm_hardware = {
+	.info = SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_MMAP_VALID |
+		SNDRV_PCM_INFO_INTERLEAVED | SNDRV_PCM_INFO_BLOCK_TRANSFER,
+	.formats = SNDRV_PCM_FMTBIT_S32_LE,
+	.rates = SNDRV_PCM_RATE_48000,
+	.rate_min = COMBFILTER_PCM_RATE,
+	.rate_max = COMBFILTER_PCM_RATE,
+	.channels_min = COMBFILTER_PCM_CHANNELS,
+	.channels_max = COMBFILTER_PCM_CHANNELS,
+	.buffer_bytes_max = COMBFILTER_PCM_BUFFER_BYTES,
+	.period_bytes_min = COMBFILTER_PCM_PERIOD_MIN,
+	.period_bytes_max = COMBFILTER_PCM_PERIOD_MAX,
+	.periods_min = 2,
+	.periods_max = COMBFILTER_PCM_BUFFER_BYTES / COMBFILTER_PCM_PERIOD_MIN,
+};
+
+/*
+ * combFilterPcm_lookup() - Find the stream behind an ALSA substream.
+ * @priv: Private combFilterPcm device struct.
+ * @substream: The substream.
+ *
+ * PCM device 0 is the comb input (pre tap capture, playback), PCM device 1
+ * the comb output (post tap capture).
+ */
+static struct combFilterPcm_stream *combFilterPcm_lookup(struct combFilterPcm_dev *priv,
+	struct snd_pcm_substream *substream)
+{
+	if (substream->pcm->device == 1) {
+		return &priv->streams[COMBFILTER_PCM_POST];
+	}
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		return &priv->streams[COMBFILTER_PCM_PLAYBACK];
+	}
+	return &priv->streams[COMBFILTER_PCM_PRE];
+}
+
+static int combFilterPcm_open(struct snd_pcm_substream *substream)
+{
+	struct combFilterPcm_dev *priv = snd_pcm_substream_chip(substream);
+	struct combFilterPcm_stream *stream = combFilterPcm_lookup(priv, substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	int ret;
+
+	runtime->hw = combFilterPcm_hardware;
+
+	// Cyclic DMA needs the buffer to be a whole number of periods
+	ret = snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
+	if (ret < 0) {
+		return ret;
+	}
+	ret = snd_pcm_hw_constraint_step(runtime, 0, SNDRV_PCM_HW_PARAM_PERIOD_BYTES,
+		COMBFILTER_PCM_PERIOD_ALIGN);
+	if (ret < 0) {
+		return ret;
+	}
+
+	runtime->private_data = stream;
+	stream->substream = substream;
+
+	return 0;
+}
+
+static int combFilterPcm_close(struct snd_pcm_substream *substream)
+{
+	struct combFilterPcm_stream *stream = substream->runtime->private_data;
+
+	stream->substream = NULL;
+
+	return 0;
+}
+
+static int combFilterPcm_prepare(struct snd_pcm_substream *substream)
+{
+	struct combFilterPcm_stream *stream = substream->runtime->private_data;
+
+	stream->period = 0;
+
+	return stream->priv->backend->prepare(stream);
+}
+
+static int combFilterPcm_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct combFilterPcm_stream *stream = substream->runtime->private_data;
+	const struct combFilterPcm_backend *backend = stream->priv->backend;
+	unsigned long flags;
+	int ret;
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+	case SNDRV_PCM_TRIGGER_RESUME:
+		spin_lock_irqsave(&stream->lock, flags);
+		stream->running = true;
+		spin_unlock_irqrestore(&stream->lock, flags);
+		ret = backend->start(stream);
+		if (ret) {
+			spin_lock_irqsave(&stream->lock, flags);
+			stream->running = false;
+			spin_unlock_irqrestore(&stream->lock, flags);
+		}
+		return ret;
+	case SNDRV_PCM_TRIGGER_STOP:
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+		spin_lock_irqsave(&stream->lock, flags);
+		stream->running = false;
+		spin_unlock_irqrestore(&stream->lock, flags);
+		backend->stop(stream);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int combFilterPcm_sync_stop(struct snd_pcm_substream *substream)
+{
+	struct combFilterPcm_stream *stream = substream->runtime->private_data;
+
+	stream->priv->backend->sync_stop(stream);
+
+	return 0;
+}
+
+static snd_pcm_uframes_t combFilterPcm_pointer(struct snd_pcm_substream *substream)
+{
+	struct combFilterPcm_stream *stream = substream->runtime->private_data;
+
+	return stream->priv->backend->pointer(stream);
+}
+
+static const struct snd_pcm_ops combFilterPcm_ops = {
+	.open = combFilterPcm_open,
+	.close = combFilterPcm_close,
+	.prepare = combFilterPcm_prepare,
+	.trigger = combFilterPcm_trigger,
+	.sync_stop = combFilterPcm_sync_stop,
+	.pointer = combFilterPcm_pointer,
+};
+
+/*
+ * combFilterPcm_new_pcm() - Create one PCM device of the card.
+ * @priv: Private combFilterPcm device struct.
+ * @device: PCM device number.
+ * @name: PCM name.
+ * @playback: Playback stream of the PCM, or NULL.
+ * @capture: Capture stream of the PCM.
+ *
+ * Streams the backend does not provide are left out; a PCM without any
+ * stream is not created.
+ */
+static int combFilterPcm_new_pcm(struct combFilterPcm_dev *priv, int device,
+	const char *name, struct combFilterPcm_stream *playback,
+	struct combFilterPcm_stream *capture)
+{
+	struct combFilterPcm_stream *streams[] = { playback, capture };
+	struct snd_pcm *pcm;
+	unsigned int i;
+	int has_playback = playback && playback->present;
+	int has_capture = capture && capture->present;
+	int ret;
+
+	if (!has_playback && !has_capture) {
+		return 0;
+	}
+
+	ret = snd_pcm_new(priv->card, name, device, has_playback, has_capture, &pcm);
+	if (ret) {
+		return ret;
+	}
+	pcm->private_data = priv;
+	strscpy(pcm->name, name, sizeof(pcm->name));
+
+	// streams[] is indexed like pcm->streams[], playback first
+	for (i = 0; i < ARRAY_SIZE(streams); i++) {
+		struct combFilterPcm_stream *stream = streams[i];
+
+		if (!stream || !stream->present) {
+			continue;
+		}
+		snd_pcm_set_ops(pcm, stream->direction, &combFilterPcm_ops);
+
+		// The DMA backend's buffers belong to the DMA controller, which
+		// writes them directly; they are mmapped to user space as is
+		snd_pcm_set_managed_buffer(pcm->streams[stream->direction].substream,
+			priv->backend->buffer_type,
+			stream->chan ? stream->chan->device->dev : NULL,
+			COMBFILTER_PCM_BUFFER_BYTES, COMBFILTER_PCM_BUFFER_BYTES);
+	}
+
+	return 0;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Platform Driver Probe (Initialization) Function                       */
+/*-----------------------------------------------------------------------*/
+/*
+ * combFilterPcm_probe() - Initialize device when a match is found
+ * @pdev: Platform device structure associated with the combFilterPcm
+ *        device tree node.
+ *
+ * Claims the backend's resources for each stream, then registers the card
+ * with the streams that are present. The card is freed automatically when
+ * the device goes away, before the DMA channels are released.
+ */
+static int combFilterPcm_probe(struct platform_device *pdev)
+{
+	struct combFilterPcm_dev *priv;
+	unsigned int i;
+	int present = 0;
+	int ret;
+
+	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv) {
+		pr_err("Failed to allocate kernel memory for combFilterPcm\n");
+		return -ENOMEM;
+	}
+	priv->backend = of_device_get_match_data(&pdev->dev);
+
+	for (i = 0; i < COMBFILTER_PCM_NUM_STREAMS; i++) {
+		struct combFilterPcm_stream *stream = &priv->streams[i];
+
+		stream->priv = priv;
+		stream->name = combFilterPcm_stream_names[i];
+		stream->direction = i == COMBFILTER_PCM_PLAYBACK ?
+			SNDRV_PCM_STREAM_PLAYBACK : SNDRV_PCM_STREAM_CAPTURE;
+		spin_lock_init(&stream->lock);
+
+		ret = priv->backend->init(pdev, stream);
+		if (ret == -ENODEV) {
+			// Not wired up in this design, leave the stream out
+			continue;
+		}
+		if (ret) {
+			return dev_err_probe(&pdev->dev, ret,
+				"Failed to set up the %s stream\n", stream->name);
+		}
+		stream->present = true;
+		present++;
+	}
+	if (!present) {
+		pr_err("combFilterPcm: no streams, check dmas/dma-names\n");
+		return -ENODEV;
+	}
+
+	ret = snd_devm_card_new(&pdev->dev, SNDRV_DEFAULT_IDX1, "CombFilter",
+		THIS_MODULE, 0, &priv->card);
+	if (ret) {
+		pr_err("Failed to create the combFilterPcm sound card\n");
+		return ret;
+	}
+	strscpy(priv->card->driver, "combFilterPcm", sizeof(priv->card->driver));
+	strscpy(priv->card->shortname, "CombFilter", sizeof(priv->card->shortname));
+	snprintf(priv->card->longname, sizeof(priv->card->longname),
+		"Comb Filter pre/post taps (%s backend)", priv->backend->name);
+
+	ret = combFilterPcm_new_pcm(priv, 0, "Comb Input",
+		&priv->streams[COMBFILTER_PCM_PLAYBACK], &priv->streams[COMBFILTER_PCM_PRE]);
+	if (ret) {
+		return ret;
+	}
+	ret = combFilterPcm_new_pcm(priv, 1, "Comb Output",
+		NULL, &priv->streams[COMBFILTER_PCM_POST]);
+	if (ret) {
+		return ret;
+	}
+
+	ret = snd_card_register(priv->card);
+	if (ret) {
+		pr_err("Failed to register the combFilterPcm sound card\n");
+		return ret;
+	}
+
+	platform_set_drvdata(pdev, priv);
+
+	pr_info("combFilterPcm_probe successful (%s backend)\n", priv->backend->name);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Compatible Match String                                               */
+/*-----------------------------------------------------------------------*/
+static const struct of_device_id combFilterPcm_of_match[] = {
+	{ .compatible = "msu,combFilterPcm", .data = &combFilterPcm_dma_backend },
+	{ .compatible = "msu,combFilterPcm-sim", .data = &combFilterPcm_sim_backend },
+	{ }
+};
+MODULE_DEVICE_TABLE(of, combFilterPcm_of_match);
+
+static struct platform_driver combFilterPcm_driver = {
+	.probe = combFilterPcm_probe,
+	.driver = {
+		.owner = THIS_MODULE,
+		.name = "combFilterPcm",
+		.of_match_table = combFilterPcm_of_match,
+	},
+};
+
+module_platform_driver(combFilterPcm_driver);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("ALSA PCM driver for the combFilterProcessor audio stream");
+MODULE_VERSION("1.0");
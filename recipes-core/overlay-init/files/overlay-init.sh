@@ -0,0 +1,69 @@
+#!/bin/sh
+# overlay-init
+# Runs as PID 1 in place of /sbin/init when the root filesystem is a read-only
+# squashfs. Mounts a writable overlay on top of the root, pivots into it and
+# hands off to the real init.
+#
+# The overlay backing store is taken from the kernel command line:
+#   overlayroot=/dev/mmcblk0p4   ext4 partition, state survives reboots
+#   overlayroot=tmpfs            RAM only, state is lost on every reboot
+# If the partition cannot be mounted we fall back to tmpfs so the board
+# still boots.
+
+PATH=/sbin:/bin:/usr/sbin:/usr/bin
+export PATH
+
+OVERLAY_DIR="/media/overlay"
+NEWROOT_DIR="${OVERLAY_DIR}/newroot"
+LOWER_DIR="/media/rfs/ro"
+REAL_INIT="/sbin/init"
+
+log() {
+    echo "overlay-init: $1" > /dev/kmsg 2>/dev/null || echo "overlay-init: $1"
+}
+
+# Never leave the kernel without an init, whatever goes wrong below
+fallback_init() {
+    log "$1, booting read-only root"
+    umount /proc 2>/dev/null
+    exec "${REAL_INIT}"
+}
+
+mount -t proc proc /proc || fallback_init "Failed to mount /proc"
+
+overlay_dev=$(sed -n 's/.*overlayroot=\([^ ]*\).*/\1/p' /proc/cmdline)
+[ -z "${overlay_dev}" ] && overlay_dev="tmpfs"
+
+if [ "${overlay_dev}" != "tmpfs" ]; then
+    # Wait for the SD card to show up, the same way rootwait does
+    tries=50
+    while [ ! -b "${overlay_dev}" ] && [ ${tries} -gt 0 ]; do
+        sleep 0.1
+        tries=$((tries - 1))
+    done
+
+    if ! mount -t ext4 -o noatime "${overlay_dev}" "${OVERLAY_DIR}"; then
+        log "Could not mount ${overlay_dev}, falling back to tmpfs"
+        overlay_dev="tmpfs"
+    fi
+fi
+
+if [ "${overlay_dev}" = "tmpfs" ]; then
+    mount -t tmpfs -o mode=0755 tmpfs "${OVERLAY_DIR}" || fallback_init "Failed to mount tmpfs overlay"
+fi
+
+mkdir -p "${OVERLAY_DIR}/upper" "${OVERLAY_DIR}/work" "${NEWROOT_DIR}"
+
+mount -t overlay overlay \
+    -o "lowerdir=/,upperdir=${OVERLAY_DIR}/upper,workdir=${OVERLAY_DIR}/work" \
+    "${NEWROOT_DIR}" || fallback_init "Failed to mount overlay"
+
+# Keep the read-only lower root reachable for debugging and upgrades
+mkdir -p "${NEWROOT_DIR}${LOWER_DIR}"
+
+log "Root overlay on ${overlay_dev}"
+
+umount /proc
+cd "${NEWROOT_DIR}" || fallback_init "Failed to enter new root"
+pivot_root . ".${LOWER_DIR}" || fallback_init "pivot_root failed"
+exec chroot . "${REAL_INIT}" "$@" <dev/console >dev/console 2>&1
@@ -0,0 +1,76 @@
+#!/bin/bash
+
+# Scrape the combFilterController metrics endpoint (--metrics) with curl and
+# check that the exposition is well formed and complete.
+#
+# Usage: check_metrics.sh [target]
+#   target  http://<host>:<port>/metrics or unix:<socket path>
+#           (default http://127.0.0.1:9100/metrics)
+
+# Exit on error
+set -e
+
+TARGET="${1:-http://127.0.0.1:9100/metrics}"
+
+# Metric families every scrape must contain
+REQUIRED_METRICS=(
+    combfilter_up
+    combfilter_register
+    combfilter_input_messages_total
+    combfilter_updates_total
+    combfilter_registers_written_total
+    combfilter_write_latency_seconds_bucket
+    combfilter_write_latency_seconds_count
+    combfilter_missed_deadlines_total
+    combfilter_driver_reg_writes_total
+)
+
+# Function for logging
+log() {
+    echo "$(date '+%Y-%m-%d %H:%M:%S') - $1"
+}
+
+# Function for error handling
+error_exit() {
+    echo "ERROR: $1" >&2
+    exit 1
+}
+
+# Function to scrape the target, writes headers and body to the given files
+scrape() {
+    local headers=$1
+    local body=$2
+
+    if [[ $TARGET == unix:* ]]; then
+        curl -sS --max-time 5 -D "$headers" -o "$body" --unix-socket "${TARGET#unix:}" http://localhost/metrics
+    else
+        curl -sS --max-time 5 -D "$headers" -o "$body" "$TARGET"
+    fi
+}
+
+command -v curl >/dev/null || error_exit "curl is not installed"
+
+tmpdir=$(mktemp -d)
+trap 'rm -rf "$tmpdir"' EXIT
+
+log "Scraping $TARGET..."
+scrape "$tmpdir/headers" "$tmpdir/body" || error_exit "Scrape of $TARGET failed"
+
+grep -q '^HTTP/1\.[01] 200' "$tmpdir/headers" || error_exit "Unexpected status: $(head -n1 "$tmpdir/headers")"
+grep -qi '^Content-Type: text/plain; version=0.0.4' "$tmpdir/headers" || error_exit "Not the Prometheus text format"
+
+# Every line is a comment or "<name>[{labels}] <value>"
+bad_lines=$(grep -Ev '^(#.*|[a-zA-Z_:][a-zA-Z0-9_:]*(\{[^}]*\})? [-+]?([0-9.eE+-]+|Inf|NaN))$' "$tmpdir/body" || true)
+if [ -n "$bad_lines" ]; then
+    error_exit "Malformed sample lines:
+$bad_lines"
+fi
+
+for metric in "${REQUIRED_METRICS[@]}"; do
+    grep -Eq "^${metric}(\{| )" "$tmpdir/body" || error_exit "Missing metric $metric"
+done
+
+grep -q '^combfilter_up 1$' "$tmpdir/body" || error_exit "combfilter_up is not 1, the driver snapshot could not be read"
+
+log "$(grep -vc '^#' "$tmpdir/body") samples, all required metrics present"
+grep '^combfilter_register{' "$tmpdir/body"
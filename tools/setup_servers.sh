@@ -3,6 +3,16 @@
 # Exit on error
 set -e
 
+# TFTP server implementation, atftpd supports the RFC 7440 windowsize option U-Boot
+# uses to stream blocks (tftpwindowsize), tftpd-hpa only negotiates blksize
+TFTP_SERVER="${TFTP_SERVER:-atftpd}"
+# TFTP servers this script knows; whichever is not selected is stopped so it
+# does not hold port 69
+TFTP_SERVERS="atftpd tftpd-hpa"
+# Largest block that fits a 1500 byte MTU without IP fragmentation, matches tftpblocksize
+# (tftpd-hpa only, atftpd takes the block size the client asks for)
+TFTP_BLOCKSIZE="${TFTP_BLOCKSIZE:-1468}"
+
 # Function for logging
 log() {
     echo "$(date '+%Y-%m-%d %H:%M:%S') - $1"
@@ -156,10 +166,12 @@ cleanup_services() {
     sudo systemctl stop nfs-kernel-server &>/dev/null || true
     sudo systemctl disable nfs-kernel-server &>/dev/null || true
     
-    # Stop and disable TFTP server
+    # Stop and disable TFTP servers, whichever was set up
     log "Stopping TFTP server..."
-    sudo systemctl stop tftpd-hpa &>/dev/null || true
-    sudo systemctl disable tftpd-hpa &>/dev/null || true
+    for server in $TFTP_SERVERS; do
+        sudo systemctl stop "$server" &>/dev/null || true
+        sudo systemctl disable "$server" &>/dev/null || true
+    done
     
     # Remove NFS exports
     log "Removing NFS exports..."
@@ -192,29 +204,55 @@ setup_tftp() {
     # Install TFTP server
     log "Installing TFTP server packages..."
     sudo DEBIAN_FRONTEND=noninteractive apt-get update -y >/dev/null 2>&1 || error_exit "Failed to update package lists"
-    sudo DEBIAN_FRONTEND=noninteractive apt-get install -y tftpd-hpa >/dev/null 2>&1 || error_exit "Failed to install tftpd-hpa"
+    sudo DEBIAN_FRONTEND=noninteractive apt-get install -y "$TFTP_SERVER" >/dev/null 2>&1 || error_exit "Failed to install $TFTP_SERVER"
     
     # Configure TFTP server
-    log "Configuring TFTP server..."
-    sudo bash -c "cat > /etc/default/tftpd-hpa" << EOF
+    case "$TFTP_SERVER" in
+        "atftpd")
+            # atftpd negotiates blksize and windowsize with the client, no option needed
+            log "Configuring TFTP server ($TFTP_SERVER)..."
+            sudo bash -c "cat > /etc/default/atftpd" << EOF
+USE_INETD=false
+OPTIONS="--tftpd-timeout 300 --retry-timeout 5 --maxthread 100 --bind-address $ip_address --port 69 /srv/tftp"
+EOF
+            tftp_owner="nobody:nogroup"
+            ;;
+        "tftpd-hpa")
+            log "Configuring TFTP server ($TFTP_SERVER, blksize $TFTP_BLOCKSIZE)..."
+            sudo bash -c "cat > /etc/default/tftpd-hpa" << EOF
 TFTP_USERNAME="tftp"
 TFTP_DIRECTORY="/srv/tftp"
 TFTP_ADDRESS="$ip_address:69"
-TFTP_OPTIONS="--secure"
+TFTP_OPTIONS="--secure --blocksize $TFTP_BLOCKSIZE"
 EOF
+            tftp_owner="tftp:tftp"
+            ;;
+        *)
+            error_exit "Unsupported TFTP server '$TFTP_SERVER' (use atftpd or tftpd-hpa)"
+            ;;
+    esac
+    
+    # Stop the other TFTP server, it would keep port 69 and answer instead
+    for server in $TFTP_SERVERS; do
+        if [ "$server" != "$TFTP_SERVER" ]; then
+            log "Stopping and disabling $server..."
+            sudo systemctl stop "$server" &>/dev/null || true
+            sudo systemctl disable "$server" &>/dev/null || true
+        fi
+    done
     
     # Create and set permissions for TFTP directory
     log "Creating TFTP directory and setting permissions..."
     sudo mkdir -p /srv/tftp
-    sudo chown -R tftp:tftp /srv/tftp
+    sudo chown -R "$tftp_owner" /srv/tftp
     sudo chmod -R 777 /srv/tftp
     
     # Restart TFTP service
     log "Restarting TFTP service..."
-    sudo systemctl restart tftpd-hpa || error_exit "Failed to restart tftpd-hpa service"
+    sudo systemctl restart "$TFTP_SERVER" || error_exit "Failed to restart $TFTP_SERVER service"
     
     # Check if TFTP service is running
-    if ! sudo systemctl is-active --quiet tftpd-hpa; then
+    if ! sudo systemctl is-active --quiet "$TFTP_SERVER"; then
         error_exit "TFTP service failed to start"
     fi
     
@@ -231,32 +269,41 @@ test_tftp() {
     log "Installing TFTP client..."
     sudo DEBIAN_FRONTEND=noninteractive apt-get install -y tftp >/dev/null 2>&1 || error_exit "Failed to install TFTP client"
     
-    # Create test file
+    # Create test file, about the size of a zImage so the transfer time means something
     log "Creating test file..."
-    echo "TFTP Test" | sudo tee /srv/tftp/test.txt > /dev/null
+    sudo dd if=/dev/urandom of=/srv/tftp/test.bin bs=1M count=4 status=none || error_exit "Failed to create TFTP test file"
     
     # Test TFTP connection
     log "Testing TFTP connection..."
     
     # Create a temporary file for tftp commands
     TFTP_COMMANDS=$(mktemp)
-    echo "get test.txt" > "$TFTP_COMMANDS"
+    echo "binary" > "$TFTP_COMMANDS"
+    echo "get test.bin" >> "$TFTP_COMMANDS"
     echo "quit" >> "$TFTP_COMMANDS"
     
-    # Run tftp with commands from the file
+    # Run tftp with commands from the file and time the transfer
+    local start_ns end_ns elapsed_ms
+    start_ns=$(date +%s%N)
     tftp "$ip_address" < "$TFTP_COMMANDS" || error_exit "TFTP test failed"
+    end_ns=$(date +%s%N)
+    elapsed_ms=$(( (end_ns - start_ns) / 1000000 ))
     
     # Check if the file was downloaded
-    if [ -f "test.txt" ]; then
-        log "TFTP test successful - file downloaded"
-        rm test.txt
+    if [ -f "test.bin" ] && cmp -s test.bin /srv/tftp/test.bin; then
+        log "TFTP test successful - 4 MiB downloaded in ${elapsed_ms} ms"
+        if [ "$elapsed_ms" -gt 0 ]; then
+            log "TFTP throughput: $(( 4 * 1024 * 1000 / elapsed_ms )) KiB/s (host client, 512 byte blocks)"
+        fi
+        rm test.bin
     else
+        rm -f test.bin
         error_exit "TFTP test failed - file not downloaded"
     fi
     
     # Clean up
     rm "$TFTP_COMMANDS"
-    sudo rm /srv/tftp/test.txt
+    sudo rm /srv/tftp/test.bin
     
     log "TFTP server testing completed successfully"
 }
@@ -375,8 +422,8 @@ check_status() {
     
     # Check TFTP status
     log "TFTP Server Status:"
-    if systemctl is-active --quiet tftpd-hpa; then
-        log "  - TFTP Server: RUNNING"
+    if systemctl is-active --quiet "$TFTP_SERVER"; then
+        log "  - TFTP Server: RUNNING ($TFTP_SERVER)"
         log "  - Port: 69 (UDP)"
         log "  - Directory: /srv/tftp"
         if [ -d "/srv/tftp" ]; then
@@ -421,6 +468,13 @@ Commands:
     status           Display current status of services
     -h, --help       Display this help message
 
+Environment:
+    TFTP_SERVER      TFTP server to install, atftpd (default) or tftpd-hpa.
+                     atftpd also negotiates the windowsize option U-Boot uses
+                     for faster transfers (tftpwindowsize)
+    TFTP_BLOCKSIZE   Largest TFTP block size tftpd-hpa allows (default 1468),
+                     atftpd takes the block size the client asks for
+
 Arguments:
     network_adapter  The network interface to configure (e.g., eth0, enp0s3)
                      OR MAC address with colon or dash delimiters 
@@ -438,6 +492,7 @@ Examples:
 Service Details:
     TFTP Server:
     - Default Port: 69 (UDP)
+    - Block Size: up to 1468 bytes, window size negotiated by U-Boot
     - Root Directory: /srv/tftp
     - Permissions: 777 (rwxrwxrwx)
 
@@ -520,6 +575,11 @@ main() {
             log ""
             log "TFTP Server Details:"
             log "  - Server IP: $static_ip:69 (UDP)"
+            if [ "$TFTP_SERVER" = "tftpd-hpa" ]; then
+                log "  - Server: $TFTP_SERVER (blksize $TFTP_BLOCKSIZE)"
+            else
+                log "  - Server: $TFTP_SERVER (blksize and windowsize negotiated)"
+            fi
             log "  - Root Directory: /srv/tftp"
             log ""
             log "NFS Server Details:"